@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+/* Whole processing module, to reach the static colour stages */
+#include "../../src/processing/raw_processing.c"
+
+/* Tolerance of the tiled colour stages against the old per pixel code (of 65535) */
+#define MAX_MEAN_DIFFERENCE 0.15
+#define MAX_DIFFERENCE      32
+
+/* Fixed random frame, 12 MP */
+#define FRAME_WIDTH  4000
+#define FRAME_HEIGHT 3000
+
+/* Old HueVs curves, per pixel through fromRGBtoHSV and back. Indices clamped like the new code,
+ * before they could read past the end of the curves */
+static void old_hue_vs_curves(processingObject_t * processing, uint16_t * img, int pixels)
+{
+    for (uint16_t * pix = img; pix < img + pixels * 3; pix += 3)
+    {
+        float hsl[3];
+        float rgb[3];
+        for( int i = 0; i < 3; i++ ) rgb[i] = pix[i] / 65535.0f;
+        fromRGBtoHSV( rgb, hsl );
+
+        double sat = 0;
+        if( !( pix[0] == 0 && pix[1] == 0 && pix[2] == 0 ) )
+        {
+            uint16_t biggest = 0;
+            uint16_t smallest = 65535;
+            for( int i = 0; i < 3; i++ )
+            {
+                if( pix[i] > biggest ) biggest = pix[i];
+                if( pix[i] < smallest ) smallest = pix[i];
+            }
+            sat = ((double)biggest - (double)smallest) / (double)biggest;
+        }
+        sat = 2.0 * sat / ( sat * sat + 1 );
+        if( sat > 1.0 ) sat = 1.0;
+
+        int hue = MIN((int)(hsl[0] * 100.0), 35999);
+
+        hsl[2] *= 1.0 + (processing->hue_vs_luma[hue] * sat * 2);
+        if( hsl[2] < 0.0 ) hsl[2] = 0.0;
+
+        hsl[1] *= 1.0 + (processing->hue_vs_saturation[hue] * 2);
+        if( hsl[1] < 0.0 ) hsl[1] = 0.0;
+
+        hsl[0] += 60 * processing->hue_vs_hue[hue];
+        if( hsl[0] < 0 ) hsl[0] += 360;
+        else if( hsl[0] >= 360 ) hsl[0] -= 360;
+
+        int luma = MIN((int)((hsl[2]) * 36000.0), 35999);
+        hsl[1] *= 1.0 + (processing->luma_vs_saturation[luma] * 2);
+        if( hsl[1] < 0.0 ) hsl[1] = 0.0;
+
+        fromHSVtoRGB( hsl, rgb );
+        for( int i = 0; i < 3; i++ ) pix[i] = LIMIT16( rgb[i] * 65535.0f + 0.5f );
+    }
+}
+
+/* Old vibrance and saturation, the tables written out: (value - Y) * factor, truncated */
+static void old_vibrance_saturation(processingObject_t * processing, uint16_t * img, int pixels)
+{
+    if( processing->vibrance > 1.01 || processing->vibrance < 0.99 )
+    {
+        for (uint16_t * pix = img; pix < img + pixels * 3; pix += 3)
+        {
+            int32_t Y1 = ((pix[0] << 2) + (pix[1] * 11) + pix[2]) >> 4;
+
+            int32_t pix0 = (int32_t)((pix[0] - Y1) * processing->vibrance) + Y1;
+            int32_t pix1 = (int32_t)((pix[1] - Y1) * processing->vibrance) + Y1;
+            int32_t pix2 = (int32_t)((pix[2] - Y1) * processing->vibrance) + Y1;
+
+            if( processing->vibrance > 1.0 )
+            {
+                double sat = 0;
+                if( !( pix[0] == 0 && pix[1] == 0 && pix[2] == 0 ) )
+                {
+                    uint16_t biggest = 0;
+                    uint16_t smallest = 65535;
+                    for( int i = 0; i < 3; i++ )
+                    {
+                        if( pix[i] > biggest ) biggest = pix[i];
+                        if( pix[i] < smallest ) smallest = pix[i];
+                    }
+                    sat = ((double)biggest - (double)smallest) / (double)biggest;
+                }
+                sat = 2.0 * sat / ( sat * sat + 1 );
+                if( sat > 1.0 ) sat = 1.0;
+                pix[0] = LIMIT16( pix[0] * sat + pix0 * ( 1.0 - sat ) );
+                pix[1] = LIMIT16( pix[1] * sat + pix1 * ( 1.0 - sat ) );
+                pix[2] = LIMIT16( pix[2] * sat + pix2 * ( 1.0 - sat ) );
+            }
+            else
+            {
+                pix[0] = LIMIT16(pix0);
+                pix[1] = LIMIT16(pix1);
+                pix[2] = LIMIT16(pix2);
+            }
+        }
+    }
+
+    if( processing->saturation > 1.01 || processing->saturation < 0.99 )
+    {
+        for (uint16_t * pix = img; pix < img + pixels * 3; pix += 3)
+        {
+            int32_t Y1 = ((pix[0] << 2) + (pix[1] * 11) + pix[2]) >> 4;
+
+            int32_t pix0 = (int32_t)((pix[0] - Y1) * processing->saturation) + Y1;
+            int32_t pix1 = (int32_t)((pix[1] - Y1) * processing->saturation) + Y1;
+            int32_t pix2 = (int32_t)((pix[2] - Y1) * processing->saturation) + Y1;
+
+            pix[0] = LIMIT16(pix0);
+            pix[1] = LIMIT16(pix1);
+            pix[2] = LIMIT16(pix2);
+        }
+    }
+}
+
+/* Runs old and new stages on the same frame, returns 1 if out of tolerance */
+static int compare(processingObject_t * processing, uint16_t * frame, int pixels, const char * name)
+{
+    uint16_t * old_frame = malloc( pixels * 3 * sizeof(uint16_t) );
+    uint16_t * new_frame = malloc( pixels * 3 * sizeof(uint16_t) );
+    memcpy(old_frame, frame, pixels * 3 * sizeof(uint16_t));
+    memcpy(new_frame, frame, pixels * 3 * sizeof(uint16_t));
+
+    old_hue_vs_curves(processing, old_frame, pixels);
+    old_vibrance_saturation(processing, old_frame, pixels);
+
+    apply_hue_vs_curves(processing, new_frame, pixels);
+    apply_vibrance_saturation(processing, new_frame, pixels);
+
+    double sum = 0.0;
+    int max = 0;
+    for (int i = 0; i < pixels * 3; ++i)
+    {
+        int difference = abs(old_frame[i] - new_frame[i]);
+        sum += difference;
+        if (difference > max) max = difference;
+    }
+    double mean = sum / (pixels * 3.0);
+
+    int failed = mean > MAX_MEAN_DIFFERENCE || max > MAX_DIFFERENCE;
+    printf("%-32s mean difference %.3f, max %d: %s\n", name, mean, max, failed ? "FAILED" : "ok");
+
+    free(old_frame);
+    free(new_frame);
+    return failed;
+}
+
+int main()
+{
+    int pixels = FRAME_WIDTH * FRAME_HEIGHT;
+    uint16_t * frame = malloc( pixels * 3 * sizeof(uint16_t) );
+
+    /* Same frame on every run */
+    uint32_t seed = 12345;
+    for (int i = 0; i < pixels * 3; ++i)
+    {
+        seed = seed * 1664525 + 1013904223;
+        frame[i] = seed >> 16;
+    }
+    /* Black, white and gray pixels */
+    for (int i = 0; i < 3; ++i)
+    {
+        frame[i] = 0;
+        frame[3+i] = 65535;
+        frame[6+i] = 32768;
+    }
+
+    processingObject_t * processing = initProcessingObject();
+
+    /* All curves active */
+    float curve_x[5] = { 0.0f, 0.2f, 0.45f, 0.7f, 1.0f };
+    float hue_vs_hue[5] = { 0.0f, 0.3f, -0.2f, 0.25f, 0.0f };
+    float hue_vs_saturation[5] = { 0.1f, 0.4f, -0.3f, 0.5f, 0.1f };
+    float hue_vs_luma[5] = { 0.0f, -0.4f, 0.3f, 0.2f, 0.0f };
+    float luma_vs_saturation[5] = { -0.2f, 0.3f, 0.1f, -0.3f, 0.2f };
+    processingSetHueVsCurves(processing, 5, curve_x, hue_vs_hue, 0);
+    processingSetHueVsCurves(processing, 5, curve_x, hue_vs_saturation, 1);
+    processingSetHueVsCurves(processing, 5, curve_x, hue_vs_luma, 2);
+    processingSetHueVsCurves(processing, 5, curve_x, luma_vs_saturation, 3);
+
+    int failed = 0;
+
+    processingSetVibrance(processing, 1.6);
+    processingSetSaturation(processing, 1.4);
+    failed |= compare(processing, frame, pixels, "curves, more vibrance/saturation");
+
+    processingSetVibrance(processing, 0.6);
+    processingSetSaturation(processing, 0.7);
+    failed |= compare(processing, frame, pixels, "curves, less vibrance/saturation");
+
+    freeProcessingObject(processing);
+    free(frame);
+
+    return failed;
+}
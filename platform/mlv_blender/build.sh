@@ -6,6 +6,7 @@ SourceFiles=(
     ../../src/debayer/basic.c
     ../../src/ca_correct/CA_correct_RT.c
     ../../src/matrix/matrix.c
+    ../../src/buffer_pool/buffer_pool.c
     ../../src/mlv/frame_caching.c
     ../../src/mlv/video_mlv.c
     ../../src/mlv/liblj92/lj92.c
@@ -41,10 +41,49 @@ AudioWave::~AudioWave()
 QImage AudioWave::getMonoWave(int16_t *pAudioTrack, uint64_t audioSize, uint16_t width, int pixelRatio)
 {
     if( width == 0 ) return *m_pAudioWave;
-    delete m_pAudioWave;
 
     width *= pixelRatio;
 
+    QVector<int16_t> peaks( width, 0 );
+
+    //If no data -> no wave
+    if( pAudioTrack != NULL )
+    {
+        uint64_t pointPackageSize = audioSize / (uint64_t)width / sizeof(int16_t);
+
+        //For each point in the graphic
+        for( uint64_t x = 0; x < (uint64_t)width; x++ )
+        {
+            int16_t y = 0;
+
+            //pack samples to
+            for( uint64_t i = 0; i < pointPackageSize; i++ )
+            {
+                //positive part
+                if( pAudioTrack[ ( ( pointPackageSize * x ) + i ) ] > y )
+                {
+                    y = pAudioTrack[ ( ( pointPackageSize * x ) + i ) ];
+                }
+                //negativ part (mirrored)
+                else if( -pAudioTrack[ ( ( pointPackageSize * x ) + i ) ] > y )
+                {
+                    y = -pAudioTrack[ ( ( pointPackageSize * x ) + i ) ] - 1;
+                }
+            }
+            peaks[x] = y;
+        }
+    }
+
+    return getMonoWave( peaks, pixelRatio );
+}
+
+//Make a image of the audio track from peak values, one per (device) pixel
+QImage AudioWave::getMonoWave( const QVector<int16_t> &peaks, int pixelRatio )
+{
+    int width = peaks.count();
+    if( width == 0 ) return *m_pAudioWave;
+    delete m_pAudioWave;
+
     m_pAudioWave = new QImage( width, 32 * pixelRatio, QImage::Format_RGB888 );
 
     //Background with gradient
@@ -54,31 +93,13 @@ QImage AudioWave::getMonoWave(int16_t *pAudioTrack, uint64_t audioSize, uint16_t
     gradient.setColorAt( 0, QColor( 99, 120, 106, 255 ) );
     gradient.setColorAt( 1, QColor( 43, 74, 53, 255 ) );
     painter.fillRect(rect, gradient);
-
-    //If no data -> no wave -> return
-    if( pAudioTrack == NULL ) return *m_pAudioWave;
-
-    uint64_t pointPackageSize = audioSize / (uint64_t)width / sizeof(int16_t);
+    painter.end();
 
     //For each point in the graphic
-    for( uint64_t x = 0; x < (uint64_t)width; x++ )
+    for( int x = 0; x < width; x++ )
     {
-        int16_t y = 0;
-
-        //pack samples to
-        for( uint64_t i = 0; i < pointPackageSize; i++ )
-        {
-            //positive part
-            if( pAudioTrack[ ( ( pointPackageSize * x ) + i ) ] > y )
-            {
-                y = pAudioTrack[ ( ( pointPackageSize * x ) + i ) ];
-            }
-            //negativ part (mirrored)
-            else if( -pAudioTrack[ ( ( pointPackageSize * x ) + i ) ] > y )
-            {
-                y = -pAudioTrack[ ( ( pointPackageSize * x ) + i ) ] - 1;
-            }
-        }
+        int16_t y = peaks.at( x );
+        if( y <= 0 ) continue;
 
         //Some funny math to make it nice at max height of 32 pixel
         y = ( 100.0 * log( y ) + y / 10.0 ) / 116 * pixelRatio;
@@ -95,4 +116,3 @@ QImage AudioWave::getMonoWave(int16_t *pAudioTrack, uint64_t audioSize, uint16_t
 
     return *m_pAudioWave;
 }
-
@@ -9,6 +9,7 @@
 #define AUDIOWAVE_H
 
 #include <QImage>
+#include <QVector>
 
 class AudioWave
 {
@@ -16,6 +17,7 @@ public:
     AudioWave();
     ~AudioWave();
     QImage getMonoWave(int16_t *pAudioTrack, uint64_t audioSize, uint16_t width, int pixelRatio );
+    QImage getMonoWave( const QVector<int16_t> &peaks, int pixelRatio );
 
 private:
     QImage *m_pAudioWave;
@@ -0,0 +1,33 @@
+/*!
+ * \file DarkFrameStacker.cpp
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Stacks multi frame dark MLVs to library masters in background
+ */
+
+#include "DarkFrameStacker.h"
+
+#include <QThread>
+#include "../../src/mlv_include.h"
+
+//Constructor
+DarkFrameStacker::DarkFrameStacker( const QString &mlvPath, const QString &libraryDir, QObject *pReceiver )
+    : m_mlvPath( mlvPath ), m_libraryDir( libraryDir ), m_pReceiver( pReceiver )
+{
+}
+
+//Stack the MLV and store the master to the library
+void DarkFrameStacker::run( void )
+{
+    char masterPath[DF_MAX_PATH] = { 0 };
+    char errorMessage[256] = { 0 };
+
+    int ret = llrpBuildDarkFrameMaster( m_mlvPath.toUtf8().data(), m_libraryDir.toUtf8().data(),
+                                        QThread::idealThreadCount(), masterPath, errorMessage );
+    if( ret && !errorMessage[0] ) strcpy( errorMessage, "Could not stack the dark frame MLV" );
+
+    QMetaObject::invokeMethod( m_pReceiver, "darkFrameMasterReady", Qt::QueuedConnection,
+                               Q_ARG( QString, m_mlvPath ),
+                               Q_ARG( QString, ret ? QString() : QString::fromUtf8( masterPath ) ),
+                               Q_ARG( QString, ret ? QString( errorMessage ) : QString() ) );
+}
@@ -0,0 +1,29 @@
+/*!
+ * \file DarkFrameStacker.h
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Stacks multi frame dark MLVs to library masters in background
+ */
+
+#ifndef DARKFRAMESTACKER_H
+#define DARKFRAMESTACKER_H
+
+#include <QRunnable>
+#include <QString>
+#include <QObject>
+
+//Stacks one dark MLV to a master in the dark frame library, the receiver gets
+//darkFrameMasterReady( mlvPath, masterPath, errorMessage ) queued when done
+class DarkFrameStacker : public QRunnable
+{
+public:
+    DarkFrameStacker( const QString &mlvPath, const QString &libraryDir, QObject *pReceiver );
+    void run( void );
+
+private:
+    QString m_mlvPath;
+    QString m_libraryDir;
+    QObject *m_pReceiver;
+};
+
+#endif // DARKFRAMESTACKER_H
@@ -162,11 +162,14 @@ SOURCES += \
     ../../src/debayer/debayer.c \
     ../../src/debayer/conv.c \
     ../../src/debayer/basic.c \
+    ../../src/debayer/rcd_realtime.c \
     ../../src/ca_correct/CA_correct_RT.c \
     ../../src/matrix/matrix.c \
+    ../../src/buffer_pool/buffer_pool.c \
     ../../src/mlv/frame_caching.c \
     ../../src/mlv/video_mlv.c \
     ../../src/mlv/video_mlv_misc.c \
+    ../../src/mlv/mlv_proxy.c \
     ../../src/mlv/liblj92/lj92.c \
     ../../src/mlv/llrawproc/llrawproc.c \
     ../../src/mlv/llrawproc/pixelproc.c \
@@ -243,6 +246,10 @@ SOURCES += \
     FocusPixelMapManager.cpp \
     DownloadManager.cpp \
     StatusFpmDialog.cpp \
+    ThumbnailCache.cpp \
+    DarkFrameStacker.cpp \
+    ProxyStream.cpp \
+    TimelineOverview.cpp \
     ../../src/librtprocess/src/demosaic/ahd.cc \
     ../../src/librtprocess/src/demosaic/amaze.cc \
     ../../src/librtprocess/src/demosaic/bayerfast.cc \
@@ -333,10 +340,12 @@ HEADERS += MainWindow.h \
     ../../src/debayer/basic.h \
     ../../src/ca_correct/CA_correct_RT.h \
     ../../src/matrix/matrix.h \
+    ../../src/buffer_pool/buffer_pool.h \
     ../../src/mlv/mlv.h \
     ../../src/mlv/mlv_object.h \
     ../../src/mlv/raw.h \
     ../../src/mlv/video_mlv.h \
+    ../../src/mlv/mlv_proxy.h \
     ../../src/mlv/mcraw/mcraw.h \
     ../../src/mlv/mcraw/cJSON.h \
     ../../src/mlv/liblj92/lj92.h \
@@ -362,6 +371,7 @@ HEADERS += MainWindow.h \
     ../../src/processing/filter/genann/genann.h \
     ../../src/processing/image_profile.h \
     ../../src/processing/cube_lut.h \
+    ../../src/processing/lut3d.h \
     ../../src/processing/denoiser/denoiser_2d_median.h \
     ClipInformation.h \
     InfoDialog.h \
@@ -433,6 +443,10 @@ HEADERS += MainWindow.h \
     DownloadManager.h \
     FocusPixelMapManager.h \
     StatusFpmDialog.h \
+    ThumbnailCache.h \
+    DarkFrameStacker.h \
+    ProxyStream.h \
+    TimelineOverview.h \
     ../../src/librtprocess/src/include/array2D.h \
     ../../src/librtprocess/src/include/bayerhelper.h \
     ../../src/librtprocess/src/include/boxblur.h \
@@ -94,6 +94,14 @@ extern const char* camidGetCameraName(uint32_t cameraModel, int camname_type);
 #define SET_ACTIVE_CLIP_IDX(index)   m_pModel->setActiveRow(index)
 #define SESSION_EMPTY                m_pModel->rowCount(QModelIndex())==0
 
+//Directory of the dark frame library, created if missing
+static QString darkFrameLibraryPath( void )
+{
+    QString darkFrameLibrary = QStandardPaths::writableLocation( QStandardPaths::AppDataLocation ).append( "/darkframes" );
+    QDir().mkpath( darkFrameLibrary );
+    return darkFrameLibrary;
+}
+
 //Constructor
 MainWindow::MainWindow(int &argc, char **argv, QWidget *parent) :
     QMainWindow(parent),
@@ -137,6 +145,26 @@ MainWindow::MainWindow(int &argc, char **argv, QWidget *parent) :
     connect( m_pRenderThread, SIGNAL(frameReady()), this, SLOT(drawFrameReady()) );
     while( !m_pRenderThread->isRunning() ) {}
 
+    //Disk cache for preview pictures
+    m_pThumbnailCache = new ThumbnailCache();
+
+    //Proxy streams for scrubbing long clips, generated in background
+    m_pProxyStream = new ProxyStream();
+    m_pProxyGenerator = new ProxyGenerator();
+    m_pTimelineOverview = new TimelineOverview();
+    connect( m_pProxyGenerator, SIGNAL(proxyReady(QString)), this, SLOT(proxyReady(QString)) );
+
+    //Filmstrip is painted in background, again when the settings rest for a moment
+    m_pFilmstripRenderer = new FilmstripRenderer();
+    connect( m_pFilmstripRenderer, SIGNAL(filmstripReady(QImage)), this, SLOT(filmstripReady(QImage)) );
+    m_pFilmstripTimer = new QTimer( this );
+    m_pFilmstripTimer->setSingleShot( true );
+    m_pFilmstripTimer->setInterval( 300 );
+    connect( m_pFilmstripTimer, SIGNAL(timeout()), this, SLOT(paintFilmstrip()) );
+
+    //Dark MLVs are stacked one after the other
+    m_darkFrameThreadPool.setMaxThreadCount( 1 );
+
     //Init scripting engine
     m_pScripting = new Scripting( this );
     m_pScripting->scanScripts();
@@ -228,6 +256,16 @@ MainWindow::~MainWindow()
     m_pRenderThread->stop();
     while( !m_pRenderThread->isFinished() ) {}
     delete m_pRenderThread;
+    delete m_pThumbnailCache;
+    m_darkFrameThreadPool.clear();
+    m_darkFrameThreadPool.waitForDone();
+    disconnect( m_pProxyGenerator, SIGNAL(proxyReady(QString)), this, SLOT(proxyReady(QString)) );
+    delete m_pProxyGenerator;
+    delete m_pProxyStream;
+    m_pFilmstripTimer->stop();
+    disconnect( m_pFilmstripRenderer, SIGNAL(filmstripReady(QImage)), this, SLOT(filmstripReady(QImage)) );
+    delete m_pFilmstripRenderer;
+    delete m_pTimelineOverview;
 
     //Save settings
     writeSettings();
@@ -599,11 +637,18 @@ void MainWindow::drawFrame( void )
     //enable low level raw fixes (if wanted)
     if( ui->checkBoxRawFixEnable->isChecked() ) m_pMlvObject->llrawproc->fix_raw = 1;
 
+    //Proxy and overview have to show the actual raw fixes
+    updateProxy();
+    //Filmstrip shows the actual settings, repainted when they rest
+    if( !ui->actionPlay->isChecked() && ui->actionShowFilmstrip->isChecked() ) m_pFilmstripTimer->start();
+
     //Get frame from library
     if( ui->actionPlay->isChecked() && ui->actionDropFrameMode->isChecked() )
     {
         //If we are in playback, dropmode, we calculated the exact frame to sync the timeline
-        m_pRenderThread->renderFrame( m_newPosDropMode );
+        //Wavelet compressed clips are decoded at half resolution while playing
+        if( isMlvJpeg2000( m_pMlvObject ) || isMlvCineform( m_pMlvObject ) ) m_pRenderThread->renderPreviewFrame( m_newPosDropMode );
+        else m_pRenderThread->renderFrame( m_newPosDropMode );
 
         //Draw TimeCode
         if( !m_tcModeDuration )
@@ -616,10 +661,32 @@ void MainWindow::drawFrame( void )
             m_pTcLabel->setPixmap( pic );
         }
     }
+    else if( ui->horizontalSliderPosition->isSliderDown() && m_pProxyStream->isOpen() )
+    {
+        //While scrubbing we render from the proxy, full decode follows when slider is released
+        m_pRenderThread->renderProxyFrame( ui->horizontalSliderPosition->value(), m_pProxyStream->data() );
+
+        //Draw TimeCode
+        if( !m_tcModeDuration )
+        {
+            QPixmap pic = QPixmap::fromImage( m_pTimeCodeImage->getTimeCodeLabel( ui->horizontalSliderPosition->value(), getFramerate() ).scaled( 200 * devicePixelRatio(),
+                                                                                              30 * devicePixelRatio(),
+                                                                                              Qt::IgnoreAspectRatio, Qt::SmoothTransformation) );
+            pic.setDevicePixelRatio( devicePixelRatio() );
+            m_pTcLabel->setPixmap( pic );
+        }
+    }
     else
     {
         //Else we render the frame which is selected by the slider
-        m_pRenderThread->renderFrame( ui->horizontalSliderPosition->value() );
+        if( ui->actionPlay->isChecked() && ( isMlvJpeg2000( m_pMlvObject ) || isMlvCineform( m_pMlvObject ) ) )
+        {
+            m_pRenderThread->renderPreviewFrame( ui->horizontalSliderPosition->value() );
+        }
+        else
+        {
+            m_pRenderThread->renderFrame( ui->horizontalSliderPosition->value() );
+        }
 
         //Draw TimeCode
         if( !m_tcModeDuration )
@@ -663,6 +730,9 @@ void MainWindow::importNewMlv(QString fileName)
             SESSION_LAST_CLIP->setStretchFactorY( -1 );
 
             previewPicture( SESSION_CLIP_COUNT - 1 );
+
+            //Long clips get a proxy for scrubbing
+            m_pProxyGenerator->addClip( fileName, m_pMlvObject );
         }
         else
         {
@@ -715,11 +785,18 @@ int MainWindow::openMlvForPreview(QString fileName)
     //Waiting for frame ready because it works with m_pMlvObject
     while( m_frameStillDrawing ) {qApp->processEvents();}
 
+    //Proxy and overview belong to the clip which is freed now
+    m_pProxyStream->close();
+    m_pTimelineOverview->clear();
+    m_fullOpenedClipPath.clear();
+
     //Reset audio playback engine
     //m_pAudioPlayback->resetAudioEngine();
 
     /* Destroy it just for simplicity... and make a new one */
     freeMlvObject( m_pMlvObject );
+    /* Scratch buffers of the old frame size are not needed anymore */
+    bufferPoolTrim();
     /* Set to NEW object with a NEW MLV clip! */
     m_pMlvObject = new_MlvObject;
 
@@ -735,6 +812,8 @@ int MainWindow::openMlvForPreview(QString fileName)
     setMlvRawCacheLimitMegaBytes( m_pMlvObject, m_cacheSizeMB );
     /* Tell it how many cores we have so it can be optimal */
     setMlvCpuCores( m_pMlvObject, QThread::idealThreadCount() );
+    /* Stacked dark frames are kept in the dark frame library */
+    llrpSetDarkFrameLibrary( m_pMlvObject, darkFrameLibraryPath().toUtf8().data() );
 
     int imageSize = getMlvWidth( m_pMlvObject ) * getMlvHeight( m_pMlvObject ) * 3;
     if( m_pRawImage ) free( m_pRawImage );
@@ -891,6 +970,8 @@ int MainWindow::openMlv( QString fileName )
 
     /* Destroy it just for simplicity... and make a new one */
     freeMlvObject( m_pMlvObject );
+    /* Scratch buffers of the old frame size are not needed anymore */
+    bufferPoolTrim();
     /* Set to NEW object with a NEW MLV clip! */
     m_pMlvObject = new_MlvObject;
 
@@ -906,6 +987,8 @@ int MainWindow::openMlv( QString fileName )
     setMlvRawCacheLimitMegaBytes( m_pMlvObject, m_cacheSizeMB );
     /* Tell it how many cores we have so it can be optimal */
     setMlvCpuCores( m_pMlvObject, QThread::idealThreadCount() );
+    /* Stacked dark frames are kept in the dark frame library */
+    llrpSetDarkFrameLibrary( m_pMlvObject, darkFrameLibraryPath().toUtf8().data() );
 
     //Adapt the RawImage to actual size
     int imageSize = getMlvWidth( m_pMlvObject ) * getMlvHeight( m_pMlvObject ) * 3;
@@ -915,6 +998,12 @@ int MainWindow::openMlv( QString fileName )
     //Init Render Thread
     m_pRenderThread->init( m_pMlvObject, m_pRawImage );
 
+    //Proxy for scrubbing and timeline overview are opened with the raw fixes of the receipt, on the first frame drawn
+    m_fullOpenedClipPath = fileName;
+    m_proxyRawFixesKey.clear();
+    m_pProxyStream->close();
+    m_pTimelineOverview->clear();
+
     //Calculate shutter flavors :)
     float shutterSpeed = 1000000.0f / (float)(getMlvShutter( m_pMlvObject ));
     float shutterAngle = getMlvFramerate( m_pMlvObject ) * 360.0f / shutterSpeed;
@@ -1003,6 +1092,10 @@ int MainWindow::openMlv( QString fileName )
     {
         setMlvUseSimpleDebayer( m_pMlvObject );
     }
+    else if( ui->actionUseRealtimeRcdDebayer->isChecked() )
+    {
+        setMlvUseRealtimeDebayer( m_pMlvObject );
+    }
     else if( ui->actionUseLmmseDebayer->isChecked() )
     {
         setMlvUseLmmseDebayer( m_pMlvObject );
@@ -1029,8 +1122,9 @@ int MainWindow::openMlv( QString fileName )
 
     m_fileLoaded = true;
 
-    //Audio Track
+    //Audio Track and filmstrip
     paintAudioTrack();
+    paintFilmstrip();
 
     //Frame label
     drawFrameNumberLabel();
@@ -1172,6 +1266,7 @@ void MainWindow::initGui( void )
     m_previewDebayerGroup->addAction( ui->actionUseNoneDebayer );
     m_previewDebayerGroup->addAction( ui->actionUseSimpleDebayer );
     m_previewDebayerGroup->addAction( ui->actionUseBilinear );
+    m_previewDebayerGroup->addAction( ui->actionUseRealtimeRcdDebayer );
     m_previewDebayerGroup->addAction( ui->actionUseLmmseDebayer );
     m_previewDebayerGroup->addAction( ui->actionUseIgvDebayer );
     m_previewDebayerGroup->addAction( ui->actionUseAhdDebayer );
@@ -1180,7 +1275,7 @@ void MainWindow::initGui( void )
     m_previewDebayerGroup->addAction( ui->actionAlwaysUseAMaZE );
     m_previewDebayerGroup->addAction( ui->actionCaching );
     m_previewDebayerGroup->addAction( ui->actionDontSwitchDebayerForPlayback );
-    ui->actionUseBilinear->setChecked( true );
+    ui->actionUseRealtimeRcdDebayer->setChecked( true );
     ui->actionCaching->setVisible( false );
 
     //Scope menu as group
@@ -1232,6 +1327,8 @@ void MainWindow::initGui( void )
     QPixmap pic = QPixmap::fromImage( m_pAudioWave->getMonoWave( NULL, 0, 100, devicePixelRatio() ) );
     pic.setDevicePixelRatio( devicePixelRatio() );
     ui->labelAudioTrack->setPixmap( pic );
+    //Filmstrip is shown when the overview of a clip is available
+    ui->labelFilmstrip->setVisible( false );
     //Fullscreen does not work well, so disable
     ui->actionFullscreen->setVisible( false );
     //Disable caching by default to avoid crashes
@@ -2981,12 +3078,18 @@ void MainWindow::startExportMlv(QString fileName)
 #else
     int ret = saveMlvHeaders( m_pMlvObject, mlvOut, exportAudio, m_codecOption, m_exportQueue.first()->cutIn(), m_exportQueue.first()->cutOut(), VERSION.toLatin1().data(), errorMessage );
 #endif
+    //Encoding codecs run on all cores, frames are written in order (NULL for other codecs)
+    mlvWriter_t * mlvWriter = NULL;
+    if( !ret ) mlvWriter = initMlvWriter( m_pMlvObject, mlvOut, exportAudio, m_codecOption, m_exportQueue.first()->cutIn(), m_exportQueue.first()->cutOut(), QThread::idealThreadCount() );
     //Output frames loop
     for( uint32_t frame = m_exportQueue.first()->cutIn() - 1; frame < m_exportQueue.first()->cutOut(); frame++ )
     {
         //Save audio and video frames
-        if( ret || saveMlvAVFrame( m_pMlvObject, mlvOut, exportAudio, m_codecOption, m_exportQueue.first()->cutIn(), m_exportQueue.first()->cutOut(), frame , averagedImage, errorMessage) )
+        if( ret
+         || ( mlvWriter && mlvWriterWriteFrame( mlvWriter, frame, errorMessage ) )
+         || ( !mlvWriter && saveMlvAVFrame( m_pMlvObject, mlvOut, exportAudio, m_codecOption, m_exportQueue.first()->cutIn(), m_exportQueue.first()->cutOut(), frame , averagedImage, errorMessage) ) )
         {
+            freeMlvWriter( mlvWriter ); mlvWriter = NULL;
             fclose(mlvOut); mlvOut = NULL;
             QFile( pathName ).remove();
 
@@ -3011,6 +3114,7 @@ void MainWindow::startExportMlv(QString fileName)
         if( m_exportAbortPressed || m_codecOption == CODEC_MLV_EXTRACT_DF) break;
     }
     //Clean up
+    freeMlvWriter( mlvWriter );
     if( averagedImage ) free( averagedImage );
     if( mlvOut ) fclose(mlvOut);
     //Enable GUI drawing
@@ -4283,6 +4387,15 @@ void MainWindow::readXmlElementsFromFile(QXmlStreamReader *Rxml, ReceiptSettings
 }
 
 //Write all receipt elements to xml
+//Receipt serialized like in a session file, used as cache key
+QByteArray MainWindow::receiptToByteArray( ReceiptSettings *receipt )
+{
+    QByteArray data;
+    QXmlStreamWriter xmlWriter( &data );
+    writeXmlElementsToFile( &xmlWriter, receipt );
+    return data;
+}
+
 void MainWindow::writeXmlElementsToFile(QXmlStreamWriter *xmlWriter, ReceiptSettings *receipt)
 {
     xmlWriter->writeTextElement( "exposure",                QString( "%1" ).arg( receipt->exposure() ) );
@@ -4407,6 +4520,7 @@ void MainWindow::deleteSession()
 
     //Fake no audio track
     paintAudioTrack();
+    paintFilmstrip();
 
     resetSliders();
 
@@ -4712,10 +4826,16 @@ void MainWindow::setSliders(ReceiptSettings *receipt, bool paste)
     //Auto setup at first full import, else get from receipt
     if( receipt->darkFrameEnabled() == -1 )
     {
+        char darkFrameMaster[DF_MAX_PATH] = { 0 };
         if( llrpGetDarkFrameIntStatus( m_pMlvObject ) )
         {
             setToolButtonDarkFrameSubtraction( 2 );
         }
+        else if( !llrpFindDarkFrameInLibrary( m_pMlvObject, darkFrameMaster ) )
+        {
+            //Matching master from the dark frame library, selects Ext mode
+            ui->lineEditDarkFrameFile->setText( QString::fromUtf8( darkFrameMaster ) );
+        }
         else
         {
             setToolButtonDarkFrameSubtraction( 0 );
@@ -5297,56 +5417,53 @@ void MainWindow::addClipToExportQueue(int row, QString fileName)
 //Handles preview pictures - make sure that right clip for row is loaded before!
 void MainWindow::previewPicture( int row )
 {
-    //disable low level raw fixes for preview
-    m_pMlvObject->llrawproc->fix_raw = 0;
-
-    // Get proper image size
-    int raw_w = m_pMlvObject->RAWI.xRes;
-    int raw_h = m_pMlvObject->RAWI.yRes;
-    int downscaled_factor = 1;
-
-    if (raw_w > 2000 && raw_h > 1500) downscaled_factor = 9;
-    else if (raw_w < 2000 && raw_h < 1500) downscaled_factor = 5;
-    else downscaled_factor = 7;
-
-    // For get_area_average_downscale_thumnail only: other factors for dualiso hiding the horizontal lines
-    if (m_pMlvObject->llrawproc->dual_iso > 0)
+    //Picture from disk cache, if clip and receipt did not change since it was rendered
+    QString thumbnailKey = ThumbnailCache::key( GET_CLIP( row )->getPath(), receiptToByteArray( GET_RECEIPT( row ) ) );
+    QImage thumbnail;
+    if( m_pThumbnailCache->load( thumbnailKey, &thumbnail ) )
     {
-        if (downscaled_factor > 5) downscaled_factor = 8;
-        else downscaled_factor = 4;
+        setPreviewIcon( row, thumbnail );
+    }
+    else
+    {
+        //Rendered in background with a copy of the settings, render thread must not use them meanwhile
+        m_pRenderThread->lock();
+        m_pThumbnailCache->render( thumbnailKey, GET_CLIP( row )->getPath(), m_pMlvObject, m_pProcessingObject,
+                                   getHorizontalStretchFactor(true), getVerticalStretchFactor(true), this );
+        m_pRenderThread->unlock();
     }
 
+    setPreviewMode();
+}
 
-    int width = raw_w / downscaled_factor;
-    int height = raw_h / downscaled_factor;
+//Preview picture rendered in background, shown if the clip and its receipt did not change meanwhile
+void MainWindow::thumbnailReady( QString clipPath, QString key, QImage thumbnail )
+{
+    for( int row = 0; row < SESSION_CLIP_COUNT; row++ )
+    {
+        if( GET_CLIP( row )->getPath() != clipPath ) continue;
+        if( ThumbnailCache::key( clipPath, receiptToByteArray( GET_RECEIPT( row ) ) ) != key ) continue;
+        setPreviewIcon( row, thumbnail );
+    }
+}
 
-    //Get frame from library, temp disable linear gradient and vignette, because not compatible with shrinked resolutions
-    auto vstr = m_pMlvObject->processing->vignette_strength;
-    auto gren = m_pMlvObject->processing->gradient_enable;
-    m_pMlvObject->processing->vignette_strength = 0;
-    m_pMlvObject->processing->gradient_enable = 0;
-    //create_thumbnail( m_pMlvObject, m_pRawImage, downscaled_factor, width, height, QThread::idealThreadCount() );
-    get_area_average_downscale_thumnail(m_pMlvObject, 0, downscaled_factor, QThread::idealThreadCount(), m_pRawImage);
-    m_pMlvObject->processing->vignette_strength = vstr;
-    m_pMlvObject->processing->gradient_enable = gren;
+//Dark MLV stacked in background, its master replaces it if it is still selected
+void MainWindow::darkFrameMasterReady( QString mlvPath, QString masterPath, QString errorMessage )
+{
+    m_darkFrameStacking.remove( mlvPath );
+    if( errorMessage.isEmpty() ) m_darkFrameMasters.insert( mlvPath, masterPath );
+    else m_darkFrameStackErrors.insert( mlvPath, errorMessage );
 
-    QImage img( m_pRawImage,
-                width,
-                height,
-                width * 3,
-                QImage::Format_RGB888 );
+    if( ui->lineEditDarkFrameFile->text() == mlvPath ) on_lineEditDarkFrameFile_textChanged( mlvPath );
+}
 
-    QPixmap pic = QPixmap::fromImage( img.scaled(
-                        width * getHorizontalStretchFactor(true),
-                        height * getVerticalStretchFactor(true),
-                        Qt::IgnoreAspectRatio,
-                        Qt::SmoothTransformation)
-                    );
+//Show preview picture in session list
+void MainWindow::setPreviewIcon( int row, const QImage &thumbnail )
+{
+    QPixmap pic = QPixmap::fromImage( thumbnail );
 
     pic.setDevicePixelRatio( devicePixelRatio() );
     m_pModel->setData( m_pModel->index( row, 0, QModelIndex() ), QIcon( pic ), Qt::DecorationRole );
-
-    setPreviewMode();
 }
 
 //Sets the preview mode
@@ -5437,6 +5554,13 @@ void MainWindow::paintAudioTrack( void )
         pic.setDevicePixelRatio( devicePixelRatio() );
         ui->labelAudioTrack->setPixmap( pic );
     }
+    //Paint from overview, without touching the audio data
+    else if( m_pTimelineOverview->hasAudio() )
+    {
+        pic = QPixmap::fromImage( m_pAudioWave->getMonoWave( m_pTimelineOverview->audioPeaks( ui->labelAudioTrack->width() * devicePixelRatio() ), devicePixelRatio() ) );
+        pic.setDevicePixelRatio( devicePixelRatio() );
+        ui->labelAudioTrack->setPixmap( pic );
+    }
     //Load audio data and paint
     else
     {
@@ -5455,6 +5579,36 @@ void MainWindow::paintAudioTrack( void )
     ui->labelAudioTrack->setMaximumHeight( 32 );
 }
 
+//Paint the filmstrip of the clip to GUI, hidden until the overview is generated
+void MainWindow::paintFilmstrip( void )
+{
+    bool visible = ui->actionShowFilmstrip->isChecked() && m_fileLoaded && m_pTimelineOverview->hasFilmstrip();
+    ui->labelFilmstrip->setVisible( visible );
+    if( !visible || ui->labelFilmstrip->width() <= 0 )
+    {
+        m_pFilmstripRenderer->abort();
+        return;
+    }
+
+    //Thumbnails are processed in background with a copy of the actual settings, render thread must not use the processing object meanwhile
+    m_pRenderThread->lock();
+    m_pFilmstripRenderer->render( *m_pTimelineOverview,
+                                  m_pProcessingObject,
+                                  ui->labelFilmstrip->width() * devicePixelRatio(),
+                                  32 * devicePixelRatio() );
+    m_pRenderThread->unlock();
+}
+
+//Filmstrip painted in background
+void MainWindow::filmstripReady( QImage filmstrip )
+{
+    if( !ui->labelFilmstrip->isVisible() ) return;
+    QPixmap pic = QPixmap::fromImage( filmstrip );
+    pic.setDevicePixelRatio( devicePixelRatio() );
+    ui->labelFilmstrip->setPixmap( pic );
+    ui->labelFilmstrip->setMinimumSize( 1, 1 ); //Otherwise window won't be smaller than picture
+}
+
 //Draw Zebras, return: 1=under, 2=over, 3=under+over, 0=okay
 uint8_t MainWindow::drawZebras()
 {
@@ -5973,6 +6127,12 @@ void MainWindow::on_horizontalSliderPosition_valueChanged(int position)
     m_frameChanged = true;
 }
 
+//Position Slider released: replace proxy frame by full frame
+void MainWindow::on_horizontalSliderPosition_sliderReleased()
+{
+    m_frameChanged = true;
+}
+
 //Show Info Dialog
 void MainWindow::on_actionClip_Information_triggered()
 {
@@ -7334,6 +7494,13 @@ void MainWindow::on_actionUseBilinear_triggered()
     return;
 }
 
+//Use reduced RCD, fast enough for playback
+void MainWindow::on_actionUseRealtimeRcdDebayer_triggered()
+{
+    selectDebayerAlgorithm();
+    return;
+}
+
 //Use LMMSE debayer
 void MainWindow::on_actionUseLmmseDebayer_triggered()
 {
@@ -7689,6 +7856,15 @@ void MainWindow::on_actionShowAudioTrack_toggled(bool checked)
     m_frameChanged = true;
 }
 
+//Set visibility of filmstrip
+void MainWindow::on_actionShowFilmstrip_toggled(bool checked)
+{
+    Q_UNUSED( checked );
+    paintFilmstrip();
+    qApp->processEvents();
+    m_frameChanged = true;
+}
+
 //Rightclick on SessionList
 void MainWindow::on_listViewSession_customContextMenuRequested(const QPoint &pos)
 {
@@ -8273,6 +8449,12 @@ void MainWindow::on_labelAudioTrack_sizeChanged()
     paintAudioTrack();
 }
 
+//Repaint filmstrip if its size changed
+void MainWindow::on_labelFilmstrip_sizeChanged()
+{
+    paintFilmstrip();
+}
+
 //DoubleClick on Lut Strength Label
 void MainWindow::on_label_LutStrengthVal_doubleClicked()
 {
@@ -8448,6 +8630,7 @@ void MainWindow::on_actionFullscreen_triggered( bool checked )
     static bool editWasActive;
     static bool sessionWasActive;
     static bool audioWasActive;
+    static bool filmstripWasActive;
 
     if( checked )
     {
@@ -8459,12 +8642,15 @@ void MainWindow::on_actionFullscreen_triggered( bool checked )
         editWasActive = ui->actionShowEditArea->isChecked();
         sessionWasActive = ui->actionShowSessionArea->isChecked();
         audioWasActive = ui->actionShowAudioTrack->isChecked();
+        filmstripWasActive = ui->actionShowFilmstrip->isChecked();
         ui->actionShowEditArea->setChecked( false );
         ui->actionShowSessionArea->setChecked( false );
         ui->actionShowAudioTrack->setChecked( false );
+        ui->actionShowFilmstrip->setChecked( false );
         ui->actionShowEditArea->setEnabled( false );
         ui->actionShowSessionArea->setEnabled( false );
         ui->actionShowAudioTrack->setEnabled( false );
+        ui->actionShowFilmstrip->setEnabled( false );
         this->showFullScreen();
     }
     else
@@ -8478,9 +8664,11 @@ void MainWindow::on_actionFullscreen_triggered( bool checked )
         if( !ui->actionShowEditArea->isChecked() && editWasActive ) ui->actionShowEditArea->setChecked( true );
         if( !ui->actionShowSessionArea->isChecked() && sessionWasActive ) ui->actionShowSessionArea->setChecked( true );
         if( !ui->actionShowAudioTrack->isChecked() && audioWasActive ) ui->actionShowAudioTrack->setChecked( true );
+        if( !ui->actionShowFilmstrip->isChecked() && filmstripWasActive ) ui->actionShowFilmstrip->setChecked( true );
         ui->actionShowEditArea->setEnabled( true );
         ui->actionShowSessionArea->setEnabled( true );
         ui->actionShowAudioTrack->setEnabled( true );
+        ui->actionShowFilmstrip->setEnabled( true );
     }
     qApp->processEvents();
     m_frameChanged = true;
@@ -8609,6 +8797,9 @@ void MainWindow::on_actionPlay_triggered(bool checked)
         on_actionGoto_First_Frame_triggered();
     }
 
+    //Playback of wavelet compressed clips was at half resolution, draw full frame when stopped
+    if( !checked && m_fileLoaded && ( isMlvJpeg2000( m_pMlvObject ) || isMlvCineform( m_pMlvObject ) ) ) m_frameChanged = true;
+
     //If no audio, we have nothing to do here
     if( !doesMlvHaveAudio( m_pMlvObject ) ) return;
 
@@ -9722,6 +9913,37 @@ void MainWindow::drawFrameReady()
     emit frameReady();
 }
 
+//Proxy generation finished, use it if this clip is shown
+void MainWindow::proxyReady( QString clipPath )
+{
+    if( !m_fileLoaded || m_fullOpenedClipPath != clipPath ) return;
+    m_pRenderThread->lock();
+    m_pProxyStream->open( clipPath, m_pMlvObject );
+    m_pRenderThread->unlock();
+    m_pTimelineOverview->load( clipPath, m_pMlvObject );
+    paintAudioTrack();
+    paintFilmstrip();
+}
+
+//Raw fixes changed: use proxy and overview made with them, or queue their generation
+void MainWindow::updateProxy( void )
+{
+    if( !m_fileLoaded || m_fullOpenedClipPath.isEmpty() ) return;
+    llrpSettings_t rawFixes;
+    llrpGetSettings( m_pMlvObject, &rawFixes );
+    QByteArray key = ProxyStream::rawFixesKey( rawFixes );
+    if( key == m_proxyRawFixesKey ) return;
+    m_proxyRawFixesKey = key;
+
+    m_pRenderThread->lock();
+    m_pProxyStream->open( m_fullOpenedClipPath, m_pMlvObject );
+    m_pRenderThread->unlock();
+    m_pTimelineOverview->load( m_fullOpenedClipPath, m_pMlvObject );
+    m_pProxyGenerator->addClip( m_fullOpenedClipPath, m_pMlvObject );
+    paintAudioTrack();
+    paintFilmstrip();
+}
+
 //Paintmode for gradient enabled/disabled
 void MainWindow::on_toolButtonGradientPaint_toggled(bool checked)
 {
@@ -10267,9 +10489,10 @@ void MainWindow::on_toolButtonDarkFrameSubtractionFile_clicked()
     //Open File Dialog
     QString fileName = QFileDialog::getOpenFileName( this, tr("Open one or more MLV..."),
                                                     path,
-                                                    tr("Magic Lantern Video (*.mlv *.MLV)") );
+                                                    tr("Dark frame (*.mlv *.MLV *.darkframe)") );
 
-    if( QFileInfo( fileName ).exists() && fileName.endsWith( ".MLV", Qt::CaseInsensitive ) )
+    if( QFileInfo( fileName ).exists()
+     && ( fileName.endsWith( ".MLV", Qt::CaseInsensitive ) || fileName.endsWith( ".darkframe", Qt::CaseInsensitive ) ) )
     {
         ui->lineEditDarkFrameFile->setText( fileName );
         m_lastDarkframeFileName = fileName;
@@ -10279,13 +10502,24 @@ void MainWindow::on_toolButtonDarkFrameSubtractionFile_clicked()
 //Darkframe Subtraction Filename changed
 void MainWindow::on_lineEditDarkFrameFile_textChanged(const QString &arg1)
 {
-    if( QFileInfo( arg1 ).exists() && arg1.endsWith( ".MLV", Qt::CaseInsensitive ) )
+    if( QFileInfo( arg1 ).exists()
+     && ( arg1.endsWith( ".MLV", Qt::CaseInsensitive ) || arg1.endsWith( ".darkframe", Qt::CaseInsensitive ) ) )
     {
-#ifdef Q_OS_UNIX
+        //Dark MLV was stacked already: use its master, or tell why that failed
+        if( m_darkFrameMasters.contains( arg1 ) && QFileInfo( m_darkFrameMasters.value( arg1 ) ).exists() )
+        {
+            ui->lineEditDarkFrameFile->setText( m_darkFrameMasters.value( arg1 ) );
+            return;
+        }
+        if( m_darkFrameStackErrors.contains( arg1 ) )
+        {
+            QMessageBox::critical( this, tr( "Error" ), tr( "%1" ).arg( m_darkFrameStackErrors.value( arg1 ) ), QMessageBox::Cancel, QMessageBox::Cancel );
+            ui->lineEditDarkFrameFile->setText( "No file selected" );
+            return;
+        }
+
+        //Same encoding as the library, masters found there are decoded from UTF-8
         QByteArray darkFrameFileName = arg1.toUtf8();
-#else
-        QByteArray darkFrameFileName = arg1.toLatin1();
-#endif
 
         char errorMessage[256] = { 0 };
         int ret = llrpValidateExtDarkFrame(m_pMlvObject, darkFrameFileName.data(), errorMessage);
@@ -10300,6 +10534,13 @@ void MainWindow::on_lineEditDarkFrameFile_textChanged(const QString &arg1)
             QMessageBox::warning( this, tr( "Warning" ), tr( "%1" ).arg( errorMessage ), QMessageBox::Ok , QMessageBox::Ok );
         }
 
+        //Multi frame or lossless dark MLV: stacked in background, subtracted when its master is ready
+        if( llrpDarkFrameNeedsStacking( darkFrameFileName.data() ) && !m_darkFrameStacking.contains( arg1 ) )
+        {
+            m_darkFrameStacking.insert( arg1 );
+            m_darkFrameThreadPool.start( new DarkFrameStacker( arg1, darkFrameLibraryPath(), this ) );
+        }
+
         llrpInitDarkFrameExtFileName(m_pMlvObject, darkFrameFileName.data());
         ui->toolButtonDarkFrameSubtractionExt->setEnabled( true );
         setToolButtonDarkFrameSubtraction( 1 );
@@ -10434,19 +10675,24 @@ void MainWindow::on_lineEditLutName_textChanged(const QString &arg1)
         QByteArray lutName = arg1.toLatin1();
 #endif
         char errorMessage[256] = { 0 };
+        //Tables are replaced, render thread must not apply the LUT meanwhile
+        m_pRenderThread->lock();
         int ret = load_lut( m_pProcessingObject->lut, lutName.data(), errorMessage );
+        if( ret < 0 ) unload_lut( m_pProcessingObject->lut );
+        m_pRenderThread->unlock();
         if( ret < 0 )
         {
             QMessageBox::critical( this, tr( "Error" ), tr( "%1" ).arg( errorMessage ), QMessageBox::Cancel, QMessageBox::Cancel );
             ui->lineEditLutName->setText( "" );
-            unload_lut( m_pProcessingObject->lut );
             return;
         }
         m_lastLutFileName = arg1;
     }
     else
     {
+        m_pRenderThread->lock();
         unload_lut( m_pProcessingObject->lut );
+        m_pRenderThread->unlock();
         ui->lineEditLutName->setText( "" );
     }
 
@@ -10690,6 +10936,12 @@ void MainWindow::selectDebayerAlgorithm()
             disableMlvCaching( m_pMlvObject );
             m_pChosenDebayer->setText( tr( "Bilinear" ) );
         }
+        else if( ui->actionUseRealtimeRcdDebayer->isChecked() )
+        {
+            setMlvUseRealtimeDebayer( m_pMlvObject );
+            disableMlvCaching( m_pMlvObject );
+            m_pChosenDebayer->setText( tr( "Realtime RCD" ) );
+        }
         else if( ui->actionUseLmmseDebayer->isChecked() )
         {
             setMlvUseLmmseDebayer( m_pMlvObject );
@@ -11065,6 +11317,8 @@ void MainWindow::checkDiskFull(QString path)
 //Changed the transfer function text
 void MainWindow::on_lineEditTransferFunction_textChanged(const QString &arg1)
 {
+    //Gamma table is built by the render thread with the compiled expression, don't free it meanwhile
+    m_pRenderThread->lock();
 #ifdef Q_OS_UNIX
     //qDebug() << "Set Transfer function!" <<
     processingSetTransferFunction( m_pProcessingObject, arg1.toUtf8().data() );
@@ -11072,6 +11326,7 @@ void MainWindow::on_lineEditTransferFunction_textChanged(const QString &arg1)
     //qDebug() << "Set Transfer function!" <<
     processingSetTransferFunction( m_pProcessingObject, arg1.toLatin1().data() );
 #endif
+    m_pRenderThread->unlock();
     m_frameChanged = true;
 }
 
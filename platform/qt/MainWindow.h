@@ -12,9 +12,12 @@
 #include <QFileDialog>
 #include <QDebug>
 #include <QTimerEvent>
+#include <QTimer>
 #include <QResizeEvent>
 #include <QFileOpenEvent>
 #include <QThreadPool>
+#include <QHash>
+#include <QSet>
 #include <QProcess>
 #include <QVector>
 #include <QGraphicsPixmapItem>
@@ -39,6 +42,10 @@
 #include "Scripting.h"
 #include "ReceiptCopyMaskDialog.h"
 #include "QRecentFilesMenu.h"
+#include "ThumbnailCache.h"
+#include "ProxyStream.h"
+#include "TimelineOverview.h"
+#include "DarkFrameStacker.h"
 
 namespace Ui {
 class MainWindow;
@@ -74,6 +81,7 @@ private slots:
     void on_actionAbout_triggered();
     void on_actionAboutQt_triggered();
     void on_horizontalSliderPosition_valueChanged(int position);
+    void on_horizontalSliderPosition_sliderReleased();
     void on_actionClip_Information_triggered();
     void on_horizontalSliderGamma_valueChanged(int position);
     void on_horizontalSliderExposure_valueChanged(int position);
@@ -194,6 +202,7 @@ private slots:
     void on_actionUseNoneDebayer_triggered();
     void on_actionUseSimpleDebayer_triggered();
     void on_actionUseBilinear_triggered();
+    void on_actionUseRealtimeRcdDebayer_triggered();
     void on_actionUseLmmseDebayer_triggered();
     void on_actionUseIgvDebayer_triggered();
     void on_actionUseAhdDebayer_triggered();
@@ -229,6 +238,7 @@ private slots:
     void on_dockWidgetSession_visibilityChanged(bool visible);
     void on_dockWidgetEdit_visibilityChanged(bool visible);
     void on_actionShowAudioTrack_toggled(bool checked);
+    void on_actionShowFilmstrip_toggled(bool checked);
     void on_listViewSession_customContextMenuRequested(const QPoint &pos);
     void on_tableViewSession_customContextMenuRequested(const QPoint &pos);
     void deleteFileFromSession( void );
@@ -267,6 +277,7 @@ private slots:
     void on_label_GrainStrength_doubleClicked( void );
     void on_label_GrainLumaWeight_doubleClicked( void );
     void on_labelAudioTrack_sizeChanged( void );
+    void on_labelFilmstrip_sizeChanged( void );
     void on_label_LutStrengthVal_doubleClicked( void );
     void on_label_FilterStrengthVal_doubleClicked( void );
     void on_label_VignetteStrengthVal_doubleClicked( void );
@@ -352,6 +363,11 @@ private slots:
     void on_groupBoxTransformation_toggled(bool arg1);
     void exportAbort( void );
     void drawFrameReady( void );
+    void proxyReady( QString clipPath );
+    void paintFilmstrip( void );
+    void filmstripReady( QImage filmstrip );
+    void thumbnailReady( QString clipPath, QString key, QImage thumbnail );
+    void darkFrameMasterReady( QString mlvPath, QString masterPath, QString errorMessage );
 
     void on_toolButtonGradientPaint_toggled(bool checked);
     void on_checkBoxGradientEnable_toggled(bool checked);
@@ -425,6 +441,19 @@ private:
     AudioWave *m_pAudioWave;
     AudioPlayback *m_pAudioPlayback;
     RenderFrameThread *m_pRenderThread;
+    ThumbnailCache *m_pThumbnailCache;
+    ProxyStream *m_pProxyStream;
+    ProxyGenerator *m_pProxyGenerator;
+    TimelineOverview *m_pTimelineOverview;
+    FilmstripRenderer *m_pFilmstripRenderer;
+    QTimer *m_pFilmstripTimer;
+    //Dark MLVs stacked to library masters in background: master, error or still stacking
+    QThreadPool m_darkFrameThreadPool;
+    QHash<QString, QString> m_darkFrameMasters;
+    QHash<QString, QString> m_darkFrameStackErrors;
+    QSet<QString> m_darkFrameStacking;
+    QString m_fullOpenedClipPath;
+    QByteArray m_proxyRawFixesKey;
     mlvObject_t *m_pMlvObject;
     processingObject_t *m_pProcessingObject;
     QGraphicsPixmapItem *m_pGraphicsItem;
@@ -513,6 +542,7 @@ private:
     void saveSession( QString fileName );
     void readXmlElementsFromFile(QXmlStreamReader *Rxml, ReceiptSettings *receipt , int version);
     void writeXmlElementsToFile( QXmlStreamWriter *xmlWriter, ReceiptSettings *receipt );
+    QByteArray receiptToByteArray( ReceiptSettings *receipt );
     void deleteSession( void );
     bool isFileInSession( QString fileName );
     void pasteReceiptFromClipboardTo( int row );
@@ -524,9 +554,11 @@ private:
     int showFileInEditor(int row);
     void addClipToExportQueue( int row, QString fileName );
     void previewPicture( int row );
+    void setPreviewIcon( int row, const QImage &thumbnail );
     void setPreviewMode( void );
     double getFramerate( void );
     void paintAudioTrack( void );
+    void updateProxy( void );
     uint8_t drawZebras( void );
     void drawFrameNumberLabel( void );
     void setToolButtonFocusPixels( int index );
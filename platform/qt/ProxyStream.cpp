@@ -0,0 +1,215 @@
+/*!
+ * \file ProxyStream.cpp
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Low resolution proxy streams for fast scrubbing
+ */
+
+#include "ProxyStream.h"
+#include "ThumbnailCache.h"
+#include "TimelineOverview.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <cstddef>
+
+//Max count of proxy and overview files kept on disk, oldest are deleted first
+#define PROXY_MAX_FILES 50
+#define OVERVIEW_MAX_FILES 1000
+
+//Folder for proxy files
+static QString proxyDir( void )
+{
+    return QStandardPaths::writableLocation( QStandardPaths::CacheLocation ).append( "/proxies" );
+}
+
+//Constructor
+ProxyStream::ProxyStream()
+{
+    m_pData = NULL;
+}
+
+//Destructor
+ProxyStream::~ProxyStream()
+{
+    close();
+}
+
+//Raw fixes the user chose, automatic dual iso corrections are found again for each object of the clip
+QByteArray ProxyStream::rawFixesKey( const llrpSettings_t &rawFixes )
+{
+    return QByteArray( (const char*)&rawFixes, offsetof( llrpSettings_t, diso_validity ) );
+}
+
+//Path of the proxy for a clip, changes if the clip file or the raw fixes change
+QString ProxyStream::fileName( const QString &clipPath, const llrpSettings_t &rawFixes )
+{
+    return QString( "%1/%2.proxy" ).arg( proxyDir() ).arg( ThumbnailCache::key( clipPath, rawFixesKey( rawFixes ) ) );
+}
+
+//Map the proxy of the clip made with the raw fixes of pMlvObject, returns false if there is no usable proxy
+bool ProxyStream::open( const QString &clipPath, mlvObject_t *pMlvObject )
+{
+    close();
+
+    llrpSettings_t rawFixes;
+    llrpGetSettings( pMlvObject, &rawFixes );
+    m_file.setFileName( fileName( clipPath, rawFixes ) );
+    if( !m_file.exists() || !m_file.open( QIODevice::ReadOnly ) ) return false;
+
+    uchar *pData = m_file.map( 0, m_file.size() );
+    if( !pData || mlv_proxy_check( pMlvObject, pData, m_file.size() ) )
+    {
+        if( pData ) m_file.unmap( pData );
+        m_file.close();
+        return false;
+    }
+
+    m_pData = pData;
+    return true;
+}
+
+//Unmap proxy
+void ProxyStream::close( void )
+{
+    if( m_pData ) m_file.unmap( m_pData );
+    m_pData = NULL;
+    if( m_file.isOpen() ) m_file.close();
+}
+
+//Constructor
+ProxyGenerator::ProxyGenerator()
+{
+    m_abort = 0;
+    m_busy = false;
+    QDir().mkpath( proxyDir() );
+    prune();
+}
+
+//Destructor
+ProxyGenerator::~ProxyGenerator()
+{
+    abort();
+    wait();
+}
+
+//Queue a clip for proxy and overview generation with the raw fixes of pMlvObject, the overview is always written last
+void ProxyGenerator::addClip( const QString &clipPath, mlvObject_t *pMlvObject )
+{
+    Job job;
+    job.clipPath = clipPath;
+    llrpGetSettings( pMlvObject, &job.rawFixes );
+    if( QFileInfo( TimelineOverview::fileName( clipPath, job.rawFixes ) ).exists() ) return;
+    m_mutex.lock();
+    //A clip still waiting gets the actual raw fixes
+    int i = 0;
+    while( i < m_queue.count() && m_queue.at( i ).clipPath != clipPath ) i++;
+    if( i < m_queue.count() ) m_queue[i] = job;
+    else m_queue.append( job );
+    bool idle = !m_busy;
+    m_busy = true;
+    m_mutex.unlock();
+    //Thread may still be leaving run(), wait before restarting it
+    if( idle )
+    {
+        wait();
+        start( QThread::LowPriority );
+    }
+}
+
+//Stop generating, running proxy is discarded
+void ProxyGenerator::abort( void )
+{
+    m_mutex.lock();
+    m_queue.clear();
+    m_abort = 1;
+    m_mutex.unlock();
+}
+
+//Work through the queue
+void ProxyGenerator::run( void )
+{
+    m_mutex.lock();
+    while( !m_queue.isEmpty() && !m_abort )
+    {
+        Job job = m_queue.takeFirst();
+        m_mutex.unlock();
+        createProxy( job );
+        m_mutex.lock();
+    }
+    m_busy = false;
+    m_mutex.unlock();
+}
+
+//Open the clip a second time, render its proxy (long clips only) and its timeline overview
+void ProxyGenerator::createProxy( const Job &job )
+{
+    const QString &clipPath = job.clipPath;
+    int mlvErr = MLV_ERR_NONE;
+    char mlvErrMsg[256] = { 0 };
+    mlvObject_t *pMlvObject;
+
+    if( clipPath.endsWith( ".mcraw", Qt::CaseInsensitive ) )
+    {
+#ifdef Q_OS_UNIX
+        pMlvObject = initMlvObjectWithMcrawClip( clipPath.toUtf8().data(), MLV_OPEN_FULL, &mlvErr, mlvErrMsg );
+#else
+        pMlvObject = initMlvObjectWithMcrawClip( clipPath.toLatin1().data(), MLV_OPEN_FULL, &mlvErr, mlvErrMsg );
+#endif
+    }
+    else
+    {
+#ifdef Q_OS_UNIX
+        pMlvObject = initMlvObjectWithClip( clipPath.toUtf8().data(), MLV_OPEN_FULL, &mlvErr, mlvErrMsg );
+#else
+        pMlvObject = initMlvObjectWithClip( clipPath.toLatin1().data(), MLV_OPEN_FULL, &mlvErr, mlvErrMsg );
+#endif
+    }
+
+    if( !mlvErr )
+    {
+        //Proxy is not processed, but raw fixes (dark frame, pixel fixes, dual iso) are, like in the clip
+        llrpSettings_t rawFixes = job.rawFixes;
+        llrpSetSettings( pMlvObject, &rawFixes );
+        setMlvCpuCores( pMlvObject, 1 );
+
+        int ret = MLV_PROXY_OK;
+        QString proxyFileName = ProxyStream::fileName( clipPath, job.rawFixes );
+        if( getMlvFrames( pMlvObject ) >= PROXY_MIN_FRAMES && !QFileInfo( proxyFileName ).exists() )
+        {
+#ifdef Q_OS_UNIX
+            ret = mlv_proxy_create( pMlvObject, proxyFileName.toUtf8().data(), &m_abort, NULL );
+#else
+            ret = mlv_proxy_create( pMlvObject, proxyFileName.toLatin1().data(), &m_abort, NULL );
+#endif
+        }
+        if( ret == MLV_PROXY_OK && TimelineOverview::build( pMlvObject, clipPath, job.rawFixes, &m_abort ) )
+        {
+            emit proxyReady( clipPath );
+        }
+    }
+
+    freeMlvObject( pMlvObject );
+}
+
+//Limit count of proxies and overviews, delete the oldest and unfinished ones
+void ProxyGenerator::prune( void )
+{
+    QDir dir( proxyDir() );
+    QFileInfoList files = dir.entryInfoList( QStringList() << "*.tmp", QDir::Files );
+    for( int i = 0; i < files.count(); i++ )
+    {
+        QFile::remove( files.at( i ).absoluteFilePath() );
+    }
+    files = dir.entryInfoList( QStringList() << "*.proxy", QDir::Files, QDir::Time );
+    for( int i = PROXY_MAX_FILES; i < files.count(); i++ )
+    {
+        QFile::remove( files.at( i ).absoluteFilePath() );
+    }
+    files = dir.entryInfoList( QStringList() << "*.overview", QDir::Files, QDir::Time );
+    for( int i = OVERVIEW_MAX_FILES; i < files.count(); i++ )
+    {
+        QFile::remove( files.at( i ).absoluteFilePath() );
+    }
+}
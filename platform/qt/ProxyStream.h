@@ -0,0 +1,72 @@
+/*!
+ * \file ProxyStream.h
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Low resolution proxy streams for fast scrubbing
+ */
+
+#ifndef PROXYSTREAM_H
+#define PROXYSTREAM_H
+
+#include <QThread>
+#include <QMutex>
+#include <QFile>
+#include <QString>
+#include <QList>
+#include <QByteArray>
+#include "../../src/mlv_include.h"
+
+//Proxies are only made for clips with at least this count of frames
+#define PROXY_MIN_FRAMES 250
+
+//Memory mapped proxy of the active clip
+class ProxyStream
+{
+public:
+    ProxyStream();
+    ~ProxyStream();
+    static QByteArray rawFixesKey( const llrpSettings_t &rawFixes );
+    static QString fileName( const QString &clipPath, const llrpSettings_t &rawFixes );
+    bool open( const QString &clipPath, mlvObject_t *pMlvObject );
+    void close( void );
+    bool isOpen( void ){ return m_pData != NULL; }
+    const uint8_t *data( void ){ return m_pData; }
+
+private:
+    QFile m_file;
+    uint8_t *m_pData;
+};
+
+//Creates proxies and timeline overviews in background, one clip after the other
+class ProxyGenerator : public QThread
+{
+    Q_OBJECT
+
+public:
+    ProxyGenerator();
+    ~ProxyGenerator();
+    void addClip( const QString &clipPath, mlvObject_t *pMlvObject );
+    void abort( void );
+
+signals:
+    void proxyReady( QString clipPath );
+
+private:
+    //Clip and the raw fixes it is shown with
+    struct Job
+    {
+        QString clipPath;
+        llrpSettings_t rawFixes;
+    };
+
+    QMutex m_mutex;
+    QList<Job> m_queue;
+    volatile int m_abort;
+    bool m_busy;
+
+    void run( void );
+    void createProxy( const Job &job );
+    static void prune( void );
+};
+
+#endif // PROXYSTREAM_H
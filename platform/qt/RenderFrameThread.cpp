@@ -15,6 +15,8 @@ RenderFrameThread::RenderFrameThread()
     m_initialized = false;
     m_renderFrame = false;
     m_frameReady = false;
+    m_pProxyData = NULL;
+    m_preview = false;
 }
 
 //Destructor
@@ -30,6 +32,8 @@ void RenderFrameThread::init(mlvObject_t *pMlvObject, uint8_t *pRawImage)
     m_frameReady = false;
     m_pMlvObject = pMlvObject;
     m_pRawImage = pRawImage;
+    m_pProxyData = NULL;
+    m_preview = false;
     m_mutex.unlock();
 }
 
@@ -38,6 +42,32 @@ void RenderFrameThread::renderFrame(uint32_t frameNumber)
 {
     m_mutex.lock();
     m_frameNumber = frameNumber;
+    m_pProxyData = NULL;
+    m_preview = false;
+    m_renderFrame = true;
+    m_frameReady = false;
+    m_mutex.unlock();
+}
+
+//Start rendering at half resolution (playback of compressed clips)
+void RenderFrameThread::renderPreviewFrame(uint32_t frameNumber)
+{
+    m_mutex.lock();
+    m_frameNumber = frameNumber;
+    m_pProxyData = NULL;
+    m_preview = true;
+    m_renderFrame = true;
+    m_frameReady = false;
+    m_mutex.unlock();
+}
+
+//Start rendering from proxy stream (fast scrubbing)
+void RenderFrameThread::renderProxyFrame(uint32_t frameNumber, const uint8_t *pProxyData)
+{
+    m_mutex.lock();
+    m_frameNumber = frameNumber;
+    m_pProxyData = pProxyData;
+    m_preview = false;
     m_renderFrame = true;
     m_frameReady = false;
     m_mutex.unlock();
@@ -93,7 +123,9 @@ void RenderFrameThread::run(void)
 //render the picture
 void RenderFrameThread::drawFrame()
 {
-    //Get frame from library
-    getMlvProcessedFrame8( m_pMlvObject, m_frameNumber, m_pRawImage, QThread::idealThreadCount() );
+    //Get frame from library, or from proxy stream
+    if( m_pProxyData ) mlv_proxy_get_processed_frame8( m_pMlvObject, m_pProxyData, m_frameNumber, m_pRawImage, QThread::idealThreadCount() );
+    else if( m_preview ) getMlvPreviewFrame8( m_pMlvObject, m_frameNumber, m_pRawImage, QThread::idealThreadCount() );
+    else getMlvProcessedFrame8( m_pMlvObject, m_frameNumber, m_pRawImage, QThread::idealThreadCount() );
     emit frameReady();
 }
@@ -22,6 +22,8 @@ public:
     void init( mlvObject_t *pMlvObject,
           uint8_t *pRawImage );
     void renderFrame( uint32_t frameNumber );
+    void renderPreviewFrame( uint32_t frameNumber );
+    void renderProxyFrame( uint32_t frameNumber, const uint8_t *pProxyData );
     bool isFrameReady( void );
     bool isIdle( void );
     void stop( void );
@@ -35,6 +37,8 @@ private:
     QMutex m_mutex;
     mlvObject_t *m_pMlvObject;
     uint8_t *m_pRawImage;
+    const uint8_t *m_pProxyData;
+    bool m_preview;
     bool m_initialized;
     bool m_stop;
     bool m_renderFrame;
@@ -0,0 +1,250 @@
+/*!
+ * \file ThumbnailCache.cpp
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Persistent disk cache for session preview pictures
+ */
+
+#include "ThumbnailCache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QStandardPaths>
+#include <QThread>
+
+//Max count of cached preview pictures, oldest are deleted first
+#define THUMBNAIL_CACHE_MAX_FILES 5000
+//Max count of preview pictures waiting for rendering, each holds a copy of the settings
+#define THUMBNAIL_MAX_RENDERS     8
+
+//Writes one preview picture to disk, in background
+class ThumbnailWriter : public QRunnable
+{
+public:
+    ThumbnailWriter( const QString &fileName, const QImage &image )
+        : m_fileName( fileName ), m_image( image ) {}
+
+    void run( void )
+    {
+        //Write to temp file first, so a half written picture is never read
+        QString tempFileName = m_fileName + QString( ".tmp" );
+        if( !m_image.save( tempFileName, "PNG" ) ) return;
+        QFile::remove( m_fileName );
+        QFile::rename( tempFileName, m_fileName );
+    }
+
+private:
+    QString m_fileName;
+    QImage m_image;
+};
+
+//Renders one preview picture with a second object of the clip, in background
+class ThumbnailRenderer : public QRunnable
+{
+public:
+    ThumbnailRenderer( ThumbnailCache *pCache, const QString &key, const QString &clipPath, processingObject_t *pProcessing,
+                       const llrpSettings_t &rawFixes, double stretchX, double stretchY, QObject *pReceiver )
+        : m_pCache( pCache ), m_key( key ), m_clipPath( clipPath ), m_pProcessing( pProcessing ),
+          m_rawFixes( rawFixes ), m_stretchX( stretchX ), m_stretchY( stretchY ), m_pReceiver( pReceiver ) {}
+
+    void run( void )
+    {
+        QImage thumbnail = renderThumbnail();
+        m_pCache->renderDone( m_pProcessing );
+        if( thumbnail.isNull() ) return;
+
+        m_pCache->store( m_key, thumbnail );
+        QMetaObject::invokeMethod( m_pReceiver, "thumbnailReady", Qt::QueuedConnection,
+                                   Q_ARG( QString, m_clipPath ), Q_ARG( QString, m_key ), Q_ARG( QImage, thumbnail ) );
+    }
+
+private:
+    ThumbnailCache *m_pCache;
+    QString m_key;
+    QString m_clipPath;
+    processingObject_t *m_pProcessing;
+    llrpSettings_t m_rawFixes;
+    double m_stretchX;
+    double m_stretchY;
+    QObject *m_pReceiver;
+
+    QImage renderThumbnail( void )
+    {
+        int mlvErr = MLV_ERR_NONE;
+        char mlvErrMsg[256] = { 0 };
+        mlvObject_t *pMlvObject;
+
+        if( m_clipPath.endsWith( ".mcraw", Qt::CaseInsensitive ) )
+        {
+#ifdef Q_OS_UNIX
+            pMlvObject = initMlvObjectWithMcrawClip( m_clipPath.toUtf8().data(), MLV_OPEN_PREVIEW, &mlvErr, mlvErrMsg );
+#else
+            pMlvObject = initMlvObjectWithMcrawClip( m_clipPath.toLatin1().data(), MLV_OPEN_PREVIEW, &mlvErr, mlvErrMsg );
+#endif
+        }
+        else
+        {
+#ifdef Q_OS_UNIX
+            pMlvObject = initMlvObjectWithClip( m_clipPath.toUtf8().data(), MLV_OPEN_PREVIEW, &mlvErr, mlvErrMsg );
+#else
+            pMlvObject = initMlvObjectWithClip( m_clipPath.toLatin1().data(), MLV_OPEN_PREVIEW, &mlvErr, mlvErrMsg );
+#endif
+        }
+        if( mlvErr )
+        {
+            freeMlvObject( pMlvObject );
+            return QImage();
+        }
+
+        //Settings are copied already, setMlvProcessing would reset the levels
+        pMlvObject->processing = m_pProcessing;
+        m_pProcessing->dual_iso = &pMlvObject->llrawproc->dual_iso;
+        llrpSetSettings( pMlvObject, &m_rawFixes );
+        //No low level raw fixes for preview
+        llrpSetFixRawMode( pMlvObject, 0 );
+
+        // Get proper image size
+        int raw_w = pMlvObject->RAWI.xRes;
+        int raw_h = pMlvObject->RAWI.yRes;
+        int downscaled_factor = 1;
+
+        if (raw_w > 2000 && raw_h > 1500) downscaled_factor = 9;
+        else if (raw_w < 2000 && raw_h < 1500) downscaled_factor = 5;
+        else downscaled_factor = 7;
+
+        // For get_area_average_downscale_thumnail only: other factors for dualiso hiding the horizontal lines
+        if (pMlvObject->llrawproc->dual_iso > 0)
+        {
+            if (downscaled_factor > 5) downscaled_factor = 8;
+            else downscaled_factor = 4;
+        }
+
+        int width = raw_w / downscaled_factor;
+        int height = raw_h / downscaled_factor;
+
+        QImage thumbnail;
+        uint8_t *pImage = (uint8_t*)malloc( width * height * 3 );
+        if( pImage && width > 0 && height > 0 )
+        {
+            //Shares the cores with the other pictures in the pool
+            get_area_average_downscale_thumnail( pMlvObject, 0, downscaled_factor, qMax( QThread::idealThreadCount() / 2, 1 ), pImage );
+
+            QImage img( pImage,
+                        width,
+                        height,
+                        width * 3,
+                        QImage::Format_RGB888 );
+
+            thumbnail = img.scaled( width * m_stretchX,
+                                    height * m_stretchY,
+                                    Qt::IgnoreAspectRatio,
+                                    Qt::SmoothTransformation );
+        }
+        free( pImage );
+
+        pMlvObject->processing = NULL;
+        m_pProcessing->dual_iso = NULL;
+        freeMlvObject( pMlvObject );
+        return thumbnail;
+    }
+};
+
+//Constructor
+ThumbnailCache::ThumbnailCache()
+    : m_renderSlots( THUMBNAIL_MAX_RENDERS )
+{
+    m_cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation ).append( "/thumbnails" );
+    QDir().mkpath( m_cacheDir );
+    m_threadPool.setMaxThreadCount( 2 );
+    prune();
+}
+
+//Destructor
+ThumbnailCache::~ThumbnailCache()
+{
+    waitForDone();
+    while( !m_freeProcessing.isEmpty() ) freeProcessingObject( m_freeProcessing.takeLast() );
+}
+
+//Content address of a preview picture: clip path, size, modification time and receipt
+QString ThumbnailCache::key( const QString &clipPath, const QByteArray &receipt )
+{
+    QFileInfo info( clipPath );
+    QCryptographicHash hash( QCryptographicHash::Sha1 );
+    hash.addData( info.absoluteFilePath().toUtf8() );
+    hash.addData( QByteArray::number( info.size() ) );
+    hash.addData( QByteArray::number( info.lastModified().toMSecsSinceEpoch() ) );
+    hash.addData( receipt );
+    return QString::fromLatin1( hash.result().toHex() );
+}
+
+//Get cached preview picture, returns false if not in cache
+bool ThumbnailCache::load( const QString &key, QImage *pImage )
+{
+    QString name = fileName( key );
+    if( !QFileInfo( name ).exists() ) return false;
+    return pImage->load( name, "PNG" );
+}
+
+//Put preview picture to the cache, file is written by the thread pool
+void ThumbnailCache::store( const QString &key, const QImage &image )
+{
+    if( image.isNull() ) return;
+    m_threadPool.start( new ThumbnailWriter( fileName( key ), image.copy() ) );
+}
+
+//Render a preview picture in background, with a copy of the settings of the clip. Render thread must not use
+//pProcessing meanwhile. Stored to the cache, then sent to thumbnailReady( QString clipPath, QString key, QImage ) of pReceiver
+void ThumbnailCache::render( const QString &key, const QString &clipPath, mlvObject_t *pMlvObject, processingObject_t *pProcessing,
+                             double stretchX, double stretchY, QObject *pReceiver )
+{
+    //Blocks if too many pictures are waiting
+    m_renderSlots.acquire();
+
+    m_processingMutex.lock();
+    processingObject_t *pCopy = m_freeProcessing.isEmpty() ? NULL : m_freeProcessing.takeLast();
+    m_processingMutex.unlock();
+    if( !pCopy ) pCopy = initProcessingObject();
+    processingCopySettings( pCopy, pProcessing );
+
+    llrpSettings_t rawFixes;
+    llrpGetSettings( pMlvObject, &rawFixes );
+
+    m_threadPool.start( new ThumbnailRenderer( this, key, clipPath, pCopy, rawFixes, stretchX, stretchY, pReceiver ) );
+}
+
+//Wait until all pictures are written
+void ThumbnailCache::waitForDone( void )
+{
+    m_threadPool.waitForDone();
+}
+
+//Path of cached picture
+QString ThumbnailCache::fileName( const QString &key )
+{
+    return QString( "%1/%2.png" ).arg( m_cacheDir ).arg( key );
+}
+
+//Background picture finished, settings copy can be reused
+void ThumbnailCache::renderDone( processingObject_t *pProcessing )
+{
+    m_processingMutex.lock();
+    m_freeProcessing.append( pProcessing );
+    m_processingMutex.unlock();
+    m_renderSlots.release();
+}
+
+//Limit cache size, delete the oldest pictures
+void ThumbnailCache::prune( void )
+{
+    QDir dir( m_cacheDir );
+    QFileInfoList files = dir.entryInfoList( QStringList() << "*.png" << "*.tmp", QDir::Files, QDir::Time );
+    for( int i = THUMBNAIL_CACHE_MAX_FILES; i < files.count(); i++ )
+    {
+        QFile::remove( files.at( i ).absoluteFilePath() );
+    }
+}
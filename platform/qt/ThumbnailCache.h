@@ -0,0 +1,46 @@
+/*!
+ * \file ThumbnailCache.h
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Persistent disk cache for session preview pictures
+ */
+
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QImage>
+#include <QThreadPool>
+#include <QMutex>
+#include <QSemaphore>
+#include <QList>
+#include "../../src/mlv_include.h"
+
+class ThumbnailCache
+{
+    friend class ThumbnailRenderer;
+public:
+    ThumbnailCache();
+    ~ThumbnailCache();
+    static QString key( const QString &clipPath, const QByteArray &receipt );
+    bool load( const QString &key, QImage *pImage );
+    void store( const QString &key, const QImage &image );
+    void render( const QString &key, const QString &clipPath, mlvObject_t *pMlvObject, processingObject_t *pProcessing,
+                 double stretchX, double stretchY, QObject *pReceiver );
+    void waitForDone( void );
+
+private:
+    QString m_cacheDir;
+    QThreadPool m_threadPool;
+    //Settings copies for pictures rendered in background, reused
+    QMutex m_processingMutex;
+    QList<processingObject_t*> m_freeProcessing;
+    QSemaphore m_renderSlots;
+
+    QString fileName( const QString &key );
+    void prune( void );
+    void renderDone( processingObject_t *pProcessing );
+};
+
+#endif // THUMBNAILCACHE_H
@@ -0,0 +1,380 @@
+/*!
+ * \file TimelineOverview.cpp
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Multi resolution audio peaks and filmstrip of a clip, for drawing the timeline
+ */
+
+#include "TimelineOverview.h"
+#include "ThumbnailCache.h"
+#include "ProxyStream.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QPainter>
+#include <QStandardPaths>
+#include <math.h>
+
+#define OVERVIEW_MAGIC         0x4D4C564F //"MLVO"
+#define OVERVIEW_VERSION       1
+//Samples per bucket in the finest audio level
+#define AUDIO_BUCKET           64
+//Coarsest audio level has at least this count of buckets
+#define AUDIO_MIN_BUCKETS      256
+//Filmstrip thumbnail height and max count per clip
+#define FILMSTRIP_THUMB_HEIGHT 36
+#define FILMSTRIP_MAX_THUMBS   256
+
+//Constructor
+TimelineOverview::TimelineOverview()
+{
+    clear();
+}
+
+//Destructor
+TimelineOverview::~TimelineOverview()
+{
+
+}
+
+//Path of the overview for a clip, stored with the proxies. The filmstrip depends on the raw fixes
+QString TimelineOverview::fileName( const QString &clipPath, const llrpSettings_t &rawFixes )
+{
+    return QString( "%1/proxies/%2.overview" )
+            .arg( QStandardPaths::writableLocation( QStandardPaths::CacheLocation ) )
+            .arg( ThumbnailCache::key( clipPath, ProxyStream::rawFixesKey( rawFixes ) ) );
+}
+
+//Scan audio and frames of the clip once and save the overview, runs in background
+bool TimelineOverview::build( mlvObject_t *pMlvObject, const QString &clipPath, const llrpSettings_t &rawFixes, volatile int *pAbort )
+{
+    TimelineOverview overview;
+    overview.m_frames = getMlvFrames( pMlvObject );
+
+    //Audio: min/max per bucket
+    if( doesMlvHaveAudio( pMlvObject ) && getMlvAudioData( pMlvObject ) )
+    {
+        int16_t *pAudio = (int16_t*)getMlvAudioData( pMlvObject );
+        overview.m_audioSamples = getMlvAudioSize( pMlvObject ) / sizeof( int16_t );
+        int buckets = ( overview.m_audioSamples + AUDIO_BUCKET - 1 ) / AUDIO_BUCKET;
+        QVector<int16_t> mins( buckets );
+        QVector<int16_t> maxs( buckets );
+        for( int b = 0; b < buckets; b++ )
+        {
+            quint64 end = qMin( (quint64)( b + 1 ) * AUDIO_BUCKET, overview.m_audioSamples );
+            int16_t min = 0;
+            int16_t max = 0;
+            for( quint64 i = (quint64)b * AUDIO_BUCKET; i < end; i++ )
+            {
+                if( pAudio[i] < min ) min = pAudio[i];
+                if( pAudio[i] > max ) max = pAudio[i];
+            }
+            mins[b] = min;
+            maxs[b] = max;
+        }
+        overview.m_audioMin.append( mins );
+        overview.m_audioMax.append( maxs );
+    }
+
+    //Filmstrip: area averaged thumbnails, unprocessed
+    int factor = getMlvHeight( pMlvObject ) / FILMSTRIP_THUMB_HEIGHT;
+    if( factor < 2 ) factor = 2;
+    if( factor & 1 ) factor++;
+    overview.m_thumbWidth = getMlvWidth( pMlvObject ) / factor;
+    overview.m_thumbHeight = getMlvHeight( pMlvObject ) / factor;
+    overview.m_thumbStep = ( overview.m_frames + FILMSTRIP_MAX_THUMBS - 1 ) / FILMSTRIP_MAX_THUMBS;
+    if( overview.m_thumbStep < 1 ) overview.m_thumbStep = 1;
+
+    int thumbSize = overview.m_thumbWidth * overview.m_thumbHeight * 3;
+    if( thumbSize > 0 )
+    {
+        QVector<uint16_t> linear( thumbSize );
+        for( quint32 frame = 0; frame < overview.m_frames; frame += overview.m_thumbStep )
+        {
+            if( pAbort && *pAbort ) return false;
+            if( get_area_average_downscale_raw( pMlvObject, frame, factor, linear.data() ) ) return false;
+            QByteArray thumb( thumbSize, 0 );
+            for( int i = 0; i < thumbSize; i++ )
+            {
+                thumb[i] = (char)(uint8_t)( sqrt( linear[i] / 65535.0 ) * 255.0 + 0.5 );
+            }
+            overview.m_thumbs.append( thumb );
+        }
+    }
+
+    //Write to temp file first, so a half written overview is never read
+    QString name = fileName( clipPath, rawFixes );
+    QFile file( name + QString( ".tmp" ) );
+    if( !file.open( QIODevice::WriteOnly ) ) return false;
+    QDataStream out( &file );
+    out << (quint32)OVERVIEW_MAGIC << (quint32)OVERVIEW_VERSION << overview.m_frames << overview.m_audioSamples;
+    out << ( overview.hasAudio() ? overview.m_audioMin.first() : QVector<int16_t>() );
+    out << ( overview.hasAudio() ? overview.m_audioMax.first() : QVector<int16_t>() );
+    out << (qint32)overview.m_thumbWidth << (qint32)overview.m_thumbHeight << (qint32)overview.m_thumbStep;
+    out << overview.m_thumbs;
+    file.close();
+    if( out.status() != QDataStream::Ok )
+    {
+        file.remove();
+        return false;
+    }
+    QFile::remove( name );
+    return file.rename( name );
+}
+
+//Load overview of the clip made with the raw fixes of pMlvObject, returns false if there is none
+bool TimelineOverview::load( const QString &clipPath, mlvObject_t *pMlvObject )
+{
+    clear();
+
+    llrpSettings_t rawFixes;
+    llrpGetSettings( pMlvObject, &rawFixes );
+    QFile file( fileName( clipPath, rawFixes ) );
+    if( !file.open( QIODevice::ReadOnly ) ) return false;
+    QDataStream in( &file );
+    quint32 magic, version;
+    in >> magic >> version;
+    if( magic != OVERVIEW_MAGIC || version != OVERVIEW_VERSION ) return false;
+
+    QVector<int16_t> mins, maxs;
+    qint32 thumbWidth, thumbHeight, thumbStep;
+    in >> m_frames >> m_audioSamples >> mins >> maxs >> thumbWidth >> thumbHeight >> thumbStep >> m_thumbs;
+    m_thumbWidth = thumbWidth;
+    m_thumbHeight = thumbHeight;
+    m_thumbStep = thumbStep;
+
+    if( in.status() != QDataStream::Ok
+     || m_frames != (quint32)getMlvFrames( pMlvObject )
+     || mins.count() != maxs.count()
+     || m_thumbStep < 1 )
+    {
+        clear();
+        return false;
+    }
+    for( int i = 0; i < m_thumbs.count(); i++ )
+    {
+        if( m_thumbs.at( i ).size() != m_thumbWidth * m_thumbHeight * 3 )
+        {
+            clear();
+            return false;
+        }
+    }
+
+    if( !mins.isEmpty() )
+    {
+        m_audioMin.append( mins );
+        m_audioMax.append( maxs );
+        buildAudioLevels();
+    }
+    return true;
+}
+
+//Reset to empty overview
+void TimelineOverview::clear( void )
+{
+    m_audioMin.clear();
+    m_audioMax.clear();
+    m_audioSamples = 0;
+    m_thumbs.clear();
+    m_thumbWidth = 0;
+    m_thumbHeight = 0;
+    m_thumbStep = 1;
+    m_frames = 0;
+}
+
+//Peak amplitude (negative part mirrored) for each pixel of the range from..to (0..1 of the clip)
+QVector<int16_t> TimelineOverview::audioPeaks( int width, double from, double to )
+{
+    QVector<int16_t> peaks( qMax( width, 0 ), 0 );
+    if( !hasAudio() || width <= 0 || to <= from ) return peaks;
+
+    double samplesPerPixel = ( to - from ) * m_audioSamples / width;
+    double firstSample = from * m_audioSamples;
+
+    //Coarsest level which still has at least one bucket per pixel
+    int level = 0;
+    while( level + 1 < m_audioMin.count() && (double)( AUDIO_BUCKET << ( level + 1 ) ) <= samplesPerPixel ) level++;
+    const QVector<int16_t> &mins = m_audioMin.at( level );
+    const QVector<int16_t> &maxs = m_audioMax.at( level );
+    double bucketSize = AUDIO_BUCKET << level;
+
+    for( int x = 0; x < width; x++ )
+    {
+        int first = ( firstSample + x * samplesPerPixel ) / bucketSize;
+        int last = ( firstSample + ( x + 1 ) * samplesPerPixel ) / bucketSize;
+        if( last <= first ) last = first + 1;
+        if( last > mins.count() ) last = mins.count();
+
+        int y = 0;
+        for( int b = first; b < last; b++ )
+        {
+            if( maxs.at( b ) > y ) y = maxs.at( b );
+            if( -mins.at( b ) - 1 > y ) y = -mins.at( b ) - 1;
+        }
+        peaks[x] = y;
+    }
+    return peaks;
+}
+
+//Paint the filmstrip for the range from..to (0..1 of the clip), thumbnails are processed with the actual settings
+QImage TimelineOverview::filmstrip( int width, int height, processingObject_t *pProcessing, double from, double to )
+{
+    QImage image( qMax( width, 1 ), qMax( height, 1 ), QImage::Format_RGB888 );
+    image.fill( Qt::black );
+    if( !hasFilmstrip() || width <= 0 || height <= 0 || to <= from ) return image;
+
+    int cellWidth = height * m_thumbWidth / m_thumbHeight;
+    if( cellWidth < 1 ) cellWidth = 1;
+
+    uint16_t decodeLut[256];
+    for( int i = 0; i < 256; i++ )
+    {
+        decodeLut[i] = (uint16_t)( ( i / 255.0 ) * ( i / 255.0 ) * 65535.0 + 0.5 );
+    }
+
+    int thumbSize = m_thumbWidth * m_thumbHeight * 3;
+    QVector<uint16_t> linear( thumbSize );
+    QVector<uint16_t> processed( thumbSize );
+    QImage thumbImage( m_thumbWidth, m_thumbHeight, QImage::Format_RGB888 );
+    QImage cell;
+    int lastThumb = -1;
+
+    QPainter painter( &image );
+    for( int x = 0; x < width; x += cellWidth )
+    {
+        double position = from + ( to - from ) * ( x + cellWidth / 2.0 ) / width;
+        int thumb = position * m_frames / m_thumbStep;
+        if( thumb >= m_thumbs.count() ) thumb = m_thumbs.count() - 1;
+        if( thumb < 0 ) thumb = 0;
+
+        //Neighbour cells often show the same thumbnail when zoomed in
+        if( thumb != lastThumb )
+        {
+            const uint8_t *pThumb = (const uint8_t*)m_thumbs.at( thumb ).constData();
+            for( int i = 0; i < thumbSize; i++ ) linear[i] = decodeLut[pThumb[i]];
+
+            //Vignette and gradient masks are made for full resolution
+            applyProcessingObjectWithoutMasks( pProcessing,
+                                               m_thumbWidth, m_thumbHeight,
+                                               linear.data(),
+                                               processed.data(),
+                                               1, 1, thumb * m_thumbStep );
+
+            for( int y = 0; y < m_thumbHeight; y++ )
+            {
+                uint8_t *pLine = thumbImage.scanLine( y );
+                const uint16_t *pProcessed = processed.constData() + y * m_thumbWidth * 3;
+                for( int i = 0; i < m_thumbWidth * 3; i++ ) pLine[i] = pProcessed[i] >> 8;
+            }
+            cell = thumbImage.scaled( cellWidth, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+            lastThumb = thumb;
+        }
+        painter.drawImage( x, 0, cell );
+    }
+    painter.end();
+
+    return image;
+}
+
+//Coarser audio levels, each bucket combines two of the level below
+void TimelineOverview::buildAudioLevels( void )
+{
+    while( m_audioMin.last().count() > AUDIO_MIN_BUCKETS )
+    {
+        const QVector<int16_t> mins = m_audioMin.last();
+        const QVector<int16_t> maxs = m_audioMax.last();
+        int buckets = ( mins.count() + 1 ) / 2;
+        QVector<int16_t> levelMin( buckets );
+        QVector<int16_t> levelMax( buckets );
+        for( int b = 0; b < buckets; b++ )
+        {
+            int second = qMin( 2 * b + 1, mins.count() - 1 );
+            levelMin[b] = qMin( mins.at( 2 * b ), mins.at( second ) );
+            levelMax[b] = qMax( maxs.at( 2 * b ), maxs.at( second ) );
+        }
+        m_audioMin.append( levelMin );
+        m_audioMax.append( levelMax );
+    }
+}
+
+//Constructor
+FilmstripRenderer::FilmstripRenderer()
+{
+    m_pPendingProcessing = initProcessingObject();
+    m_pProcessing = initProcessingObject();
+    m_dualIso[0] = 0;
+    m_dualIso[1] = 0;
+    //Each copy needs its own dual iso state, processingCopySettings keeps the pointer
+    m_pPendingProcessing->dual_iso = &m_dualIso[0];
+    m_pProcessing->dual_iso = &m_dualIso[1];
+    m_width = 0;
+    m_height = 0;
+    m_pending = false;
+    m_busy = false;
+    m_abort = 0;
+}
+
+//Destructor
+FilmstripRenderer::~FilmstripRenderer()
+{
+    abort();
+    wait();
+    freeProcessingObject( m_pPendingProcessing );
+    freeProcessingObject( m_pProcessing );
+}
+
+//Request a filmstrip with the actual settings, replaces a request not started yet.
+//Render thread must not use pProcessing meanwhile
+void FilmstripRenderer::render( const TimelineOverview &overview, processingObject_t *pProcessing, int width, int height )
+{
+    m_mutex.lock();
+    m_pendingOverview = overview;
+    processingCopySettings( m_pPendingProcessing, pProcessing );
+    *m_pPendingProcessing->dual_iso = pProcessing->dual_iso ? *pProcessing->dual_iso : 0;
+    m_width = width;
+    m_height = height;
+    m_pending = true;
+    m_abort = 0;
+    bool idle = !m_busy;
+    m_busy = true;
+    m_mutex.unlock();
+    //Thread may still be leaving run(), wait before restarting it
+    if( idle )
+    {
+        wait();
+        start( QThread::LowPriority );
+    }
+}
+
+//Drop the pending request, a running one is not shown
+void FilmstripRenderer::abort( void )
+{
+    m_mutex.lock();
+    m_pending = false;
+    m_abort = 1;
+    m_mutex.unlock();
+}
+
+//Paint until no request is pending, only the result of the latest one is shown
+void FilmstripRenderer::run( void )
+{
+    m_mutex.lock();
+    while( m_pending && !m_abort )
+    {
+        processingObject_t *pProcessing = m_pPendingProcessing;
+        m_pPendingProcessing = m_pProcessing;
+        m_pProcessing = pProcessing;
+        TimelineOverview overview = m_pendingOverview;
+        int width = m_width;
+        int height = m_height;
+        m_pending = false;
+        m_mutex.unlock();
+
+        QImage strip = overview.filmstrip( width, height, m_pProcessing );
+
+        m_mutex.lock();
+        if( !m_pending && !m_abort ) emit filmstripReady( strip );
+    }
+    m_busy = false;
+    m_mutex.unlock();
+}
@@ -0,0 +1,77 @@
+/*!
+ * \file TimelineOverview.h
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Multi resolution audio peaks and filmstrip of a clip, for drawing the timeline
+ */
+
+#ifndef TIMELINEOVERVIEW_H
+#define TIMELINEOVERVIEW_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QImage>
+#include "../../src/mlv_include.h"
+
+class TimelineOverview
+{
+public:
+    TimelineOverview();
+    ~TimelineOverview();
+    static QString fileName( const QString &clipPath, const llrpSettings_t &rawFixes );
+    static bool build( mlvObject_t *pMlvObject, const QString &clipPath, const llrpSettings_t &rawFixes, volatile int *pAbort );
+    bool load( const QString &clipPath, mlvObject_t *pMlvObject );
+    void clear( void );
+    bool hasAudio( void ){ return !m_audioMax.isEmpty(); }
+    bool hasFilmstrip( void ){ return !m_thumbs.isEmpty(); }
+    QVector<int16_t> audioPeaks( int width, double from = 0.0, double to = 1.0 );
+    QImage filmstrip( int width, int height, processingObject_t *pProcessing, double from = 0.0, double to = 1.0 );
+
+private:
+    //Audio: level 0 has the min/max of AUDIO_BUCKET samples, every next level halves the count
+    QVector< QVector<int16_t> > m_audioMin;
+    QVector< QVector<int16_t> > m_audioMax;
+    quint64 m_audioSamples;
+    //Filmstrip: one square root encoded RGB thumbnail each m_thumbStep frames
+    QVector<QByteArray> m_thumbs;
+    int m_thumbWidth;
+    int m_thumbHeight;
+    int m_thumbStep;
+    quint32 m_frames;
+
+    void buildAudioLevels( void );
+};
+
+//Paints the filmstrip in background, with its own copy of the processing settings
+class FilmstripRenderer : public QThread
+{
+    Q_OBJECT
+public:
+    FilmstripRenderer();
+    ~FilmstripRenderer();
+    void render( const TimelineOverview &overview, processingObject_t *pProcessing, int width, int height );
+    void abort( void );
+
+signals:
+    void filmstripReady( QImage filmstrip );
+
+private:
+    QMutex m_mutex;
+    //Only the latest request is painted, it waits in the pending members
+    TimelineOverview m_pendingOverview;
+    processingObject_t *m_pPendingProcessing;
+    processingObject_t *m_pProcessing;
+    int m_dualIso[2];
+    int m_width;
+    int m_height;
+    bool m_pending;
+    bool m_busy;
+    volatile int m_abort;
+
+    void run( void );
+};
+
+#endif // TIMELINEOVERVIEW_H
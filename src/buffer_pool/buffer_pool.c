@@ -0,0 +1,175 @@
+/*!
+ * \file buffer_pool.c
+ * \author masc4ii
+ * \copyright 2026
+ * \brief process wide pool for frame sized scratch buffers, so playback and export don't malloc every frame
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "buffer_pool.h"
+
+//Smallest size class, smaller requests are rounded up to it
+#define POOL_MIN_SHIFT 12
+//Size classes per power of two, so at most 1/8 is wasted
+#define POOL_STEPS 8
+#define POOL_CLASSES 256
+//Bytes in front of each buffer, keeps the alignment of malloc and 64 for cache lines
+#define POOL_HEADER 64
+#define POOL_MAGIC 0x504f4f4cu
+
+typedef struct pool_block_s {
+    struct pool_block_s * next; //Next idle buffer of the same class
+    size_t capacity;
+    int size_class;             //-1: too big for a class, always freed
+    uint32_t magic;
+} pool_block_t;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pool_block_t * pool_idle[POOL_CLASSES];
+static size_t pool_idle_limit = (size_t)2 << 30;
+static buffer_pool_stats_t pool_stats;
+
+//Size class and rounded capacity for a request
+static int pool_size_class( size_t size, size_t *capacity )
+{
+    if( size <= ( (size_t)1 << POOL_MIN_SHIFT ) )
+    {
+        *capacity = (size_t)1 << POOL_MIN_SHIFT;
+        return 0;
+    }
+
+    //2^p < size <= 2^(p+1), rounded up to a step of 2^p / POOL_STEPS
+    int p = 0;
+    while( ( (size - 1) >> (p + 1) ) != 0 ) p++;
+    size_t base = (size_t)1 << p;
+    size_t step = base / POOL_STEPS;
+    size_t k = ( size - base + step - 1 ) / step;
+    *capacity = base + k * step;
+
+    int size_class = ( p - POOL_MIN_SHIFT ) * POOL_STEPS + (int)k;
+    if( size_class >= POOL_CLASSES )
+    {
+        *capacity = size;
+        return -1;
+    }
+    return size_class;
+}
+
+static pool_block_t * pool_block( void * buffer )
+{
+    return (pool_block_t *)( (uint8_t *)buffer - POOL_HEADER );
+}
+
+//Remember the peak of bytes in use and idle, must hold the mutex
+static void pool_update_high_water_mark( void )
+{
+    size_t total = pool_stats.bytes_in_use + pool_stats.bytes_idle;
+    if( total > pool_stats.high_water_mark ) pool_stats.high_water_mark = total;
+}
+
+void * bufferPoolAlloc( size_t size )
+{
+    size_t capacity;
+    int size_class = pool_size_class( size, &capacity );
+    pool_block_t * block = NULL;
+
+    pthread_mutex_lock( &pool_mutex );
+    if( size_class >= 0 && pool_idle[size_class] )
+    {
+        //Last freed first, it may still be in cache
+        block = pool_idle[size_class];
+        pool_idle[size_class] = block->next;
+        pool_stats.bytes_idle -= block->capacity;
+        pool_stats.bytes_in_use += block->capacity;
+        pool_stats.reuses++;
+    }
+    pthread_mutex_unlock( &pool_mutex );
+
+    if( !block )
+    {
+        block = malloc( POOL_HEADER + capacity );
+        if( !block ) return NULL;
+        block->capacity = capacity;
+        block->size_class = size_class;
+        block->magic = POOL_MAGIC;
+
+        pthread_mutex_lock( &pool_mutex );
+        pool_stats.bytes_in_use += capacity;
+        pool_stats.allocations++;
+        pool_update_high_water_mark();
+        pthread_mutex_unlock( &pool_mutex );
+    }
+
+    block->next = NULL;
+    return (uint8_t *)block + POOL_HEADER;
+}
+
+void bufferPoolFree( void * buffer )
+{
+    if( !buffer ) return;
+    pool_block_t * block = pool_block( buffer );
+    if( block->magic != POOL_MAGIC )
+    {
+#ifndef STDOUT_SILENT
+        printf( "bufferPoolFree: buffer not from pool\n" );
+#endif
+        return;
+    }
+
+    pthread_mutex_lock( &pool_mutex );
+    pool_stats.bytes_in_use -= block->capacity;
+    int keep = block->size_class >= 0
+            && pool_stats.bytes_idle + block->capacity <= pool_idle_limit;
+    if( keep )
+    {
+        block->next = pool_idle[block->size_class];
+        pool_idle[block->size_class] = block;
+        pool_stats.bytes_idle += block->capacity;
+    }
+    pthread_mutex_unlock( &pool_mutex );
+
+    if( !keep ) free( block );
+}
+
+void bufferPoolTrim( void )
+{
+    pool_block_t * idle[POOL_CLASSES];
+
+    pthread_mutex_lock( &pool_mutex );
+    for( int i = 0; i < POOL_CLASSES; i++ )
+    {
+        idle[i] = pool_idle[i];
+        pool_idle[i] = NULL;
+    }
+    pool_stats.bytes_idle = 0;
+    pthread_mutex_unlock( &pool_mutex );
+
+    for( int i = 0; i < POOL_CLASSES; i++ )
+    {
+        while( idle[i] )
+        {
+            pool_block_t * next = idle[i]->next;
+            free( idle[i] );
+            idle[i] = next;
+        }
+    }
+}
+
+void bufferPoolSetIdleLimit( size_t bytes )
+{
+    pthread_mutex_lock( &pool_mutex );
+    pool_idle_limit = bytes;
+    int over = pool_stats.bytes_idle > pool_idle_limit;
+    pthread_mutex_unlock( &pool_mutex );
+
+    if( over ) bufferPoolTrim();
+}
+
+void bufferPoolGetStats( buffer_pool_stats_t * stats )
+{
+    pthread_mutex_lock( &pool_mutex );
+    *stats = pool_stats;
+    pthread_mutex_unlock( &pool_mutex );
+}
@@ -0,0 +1,33 @@
+/*!
+ * \file buffer_pool.h
+ * \author masc4ii
+ * \copyright 2026
+ * \brief process wide pool for frame sized scratch buffers, so playback and export don't malloc every frame
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    size_t   bytes_in_use;    /* Handed out right now */
+    size_t   bytes_idle;      /* Kept for the next request of the same size class */
+    size_t   high_water_mark; /* Most bytes in use + idle at the same time */
+    uint64_t allocations;     /* Requests which needed a new malloc */
+    uint64_t reuses;          /* Requests served by an idle buffer */
+} buffer_pool_stats_t;
+
+/* Like malloc, but reuses an idle buffer of the same size class (sizes are rounded up
+ * by at most 1/8). Contents are undefined. Can be used from any thread. */
+void * bufferPoolAlloc( size_t size );
+/* Gives the buffer back to the pool, NULL is ignored. Never use free() on pool buffers. */
+void bufferPoolFree( void * buffer );
+/* Frees all idle buffers, e.g. when a clip is closed */
+void bufferPoolTrim( void );
+/* Idle buffers above this many bytes are freed instead of kept (default 2 GiB) */
+void bufferPoolSetIdleLimit( size_t bytes );
+void bufferPoolGetStats( buffer_pool_stats_t * stats );
+
+#endif // BUFFER_POOL_H
@@ -1458,6 +1458,9 @@
                     for (row=rr+top, cc=16; cc < cc1-19; cc+=4) {
                         _mm_storeu_ps(&green[row][cc + left], LVF(rgbgreen[rr*TS+cc]) * c65535v);
                     }
+                    for (; cc < cc1-16; cc++) {
+                        green[row][cc + left] = 65535.0f*rgbgreen[rr*TS+cc];
+                    }
     #else
                     for (row=rr+top, cc=16; cc < cc1-16; cc++) {
                         col = cc + left;
@@ -5,7 +5,9 @@
 #include <pthread.h>
 
 #include "debayer.h"
+#include "wb_conversion.h"
 #include "librtprocesswrapper.h"
+#include "../buffer_pool/buffer_pool.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -16,119 +18,181 @@ void convert_to_log(void * data)
     // float
 }
 
-/* AmAZeMEmE debayer easier to use */
-void debayerAmaze(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, int blacklevel)
+/* Rows per band of the band debayers: bands are demosaiced into per thread scratch, so no
+ * frame sized float planes are needed. AMaZE crashes on windows of less than ~32 rows. */
+#define DEBAYER_BAND_ROWS_MAX 512
+#define DEBAYER_BAND_ROWS_MIN 64
+/* Rows demosaiced above and below each band and thrown away, covers the 16 pixel tile
+ * border of AMaZE, so bands don't show seams like the old per thread chunks did */
+#define DEBAYER_BAND_HALO 16
+/* Halo of the realtime RCD: reaches 7 rows, so bands are identical to a whole frame run */
+#define RCD_REALTIME_HALO 8
+
+/* Demosaics one window of rows, all row pointers are relative to the window */
+typedef void (*debayer_band_t)(float ** raw, float ** red, float ** green, float ** blue, int width, int rows, const void * arg);
+
+/* Height of one band, bands are spread evenly over the threads */
+static int debayer_band_rows(int height, int threads)
 {
-    int pixelsize = width * height;
-
-    /* AmAZeMEmE wants an image as floating points and 2d arrey as well */
-    float ** __restrict imagefloat2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) imagefloat2d[y] = (float *)(bayerdata+(y*width));
-
-    /* AmAZe also wants to return floats, so heres memeory 4 it */
-    float  * __restrict red1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict red2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) red2d[y] = (float *)(red1d+(y*width));
-    float  * __restrict green1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict green2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) green2d[y] = (float *)(green1d+(y*width));
-    float  * __restrict blue1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict blue2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) blue2d[y] = (float *)(blue1d+(y*width));
-
-    /* If threads is < 2 just do a normal amaze */
-    if (threads < 2)
-    {
-        /* run the Amaze */
-        demosaic( & (amazeinfo_t) {
-                  imagefloat2d,
-                  red2d,
-                  green2d,
-                  blue2d,
-                  0, 0, /* crop window for demosaicing */
-                  width, height,
-                  0,
-                  blacklevel} );
-    }
+    int bands = (height + DEBAYER_BAND_ROWS_MAX - 1) / DEBAYER_BAND_ROWS_MAX;
+    if (threads > 1) bands = (bands + threads - 1) / threads * threads;
 
-    /* Else do multithreading */
-    else
-    {
-        int startchunk_y[threads];
-        int endchunk_y[threads];
+    int rows = (height + bands - 1) / bands;
+    rows += rows % 2; /* Bands must start on a red row */
+    return MAX(rows, DEBAYER_BAND_ROWS_MIN);
+}
 
-        /* How big each thread's chunk is, multiple of 2 - or debayer
-         * would start on wrong pixel and magenta stripes appear */
-        int chunk_height = height / threads;
-        chunk_height -= chunk_height % 2;
+/* Number of bands, a too short last band is merged into the one before */
+static int debayer_band_count(int height, int rows)
+{
+    int bands = (height + rows - 1) / rows;
+    if (bands > 1 && height - (bands - 1) * rows < DEBAYER_BAND_ROWS_MIN / 2) bands--;
+    return bands;
+}
 
-        /* To small chunk heights bring AMaZE module to crash */
-        while( chunk_height <= 32 )
+/* Demosaiced planes to interleaved RGB, undoing the WB conversion if there is one */
+static inline void debayer_store_rgb(uint16_t * __restrict debayerto, const float * __restrict red, const float * __restrict green, const float * __restrict blue, int width, const wb_convert_info_t * wb)
+{
+    if (wb)
+    {
+        for (int x = 0; x < width; x++)
         {
-            if( threads <= 1 ) break;
-            threads--;
-            chunk_height = height / threads;
-            chunk_height -= chunk_height % 2;
+            debayerto[x*3  ] = wb_undo_pixel(wb, LIMIT16((uint32_t)red[x]), 0);
+            debayerto[x*3+1] = wb_undo_pixel(wb, LIMIT16((uint32_t)green[x]), 1);
+            debayerto[x*3+2] = wb_undo_pixel(wb, LIMIT16((uint32_t)blue[x]), 2);
         }
-
-        /* Calculate chunks of image for each thread */
-        for (int thread = 0; thread < threads; ++thread)
+    }
+    else
+    {
+        for (int x = 0; x < width; x++)
         {
-            startchunk_y[thread] = chunk_height * thread;
-            endchunk_y[thread] = chunk_height * (thread + 1);
+            debayerto[x*3  ] = LIMIT16((uint32_t)red[x]);
+            debayerto[x*3+1] = LIMIT16((uint32_t)green[x]);
+            debayerto[x*3+2] = LIMIT16((uint32_t)blue[x]);
         }
+    }
+}
 
-        /* Last chunk must reach end of frame */
-        endchunk_y[threads-1] = height;
-
-        pthread_t thread_id[threads];
-        amazeinfo_t amaze_arguments[threads];
-
-        /* Create amaze pthreads */
-        for (int thread = 0; thread < threads; ++thread)
+/* Runs a demosaicer over bands of rows on all threads. Each band is demosaiced together with
+ * halo rows above and below (thrown away after), so the seams at band borders are invisible.
+ * With wb the bayer data is WB converted band by band on the fly (unless wb->converted) and
+ * the conversion is undone on output, bayerdata itself is never written.
+ * If a thread gets no scratch memory, the frame is debayered basic, which needs none. */
+static void debayer_bands(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, const wb_convert_info_t * wb, int halo, debayer_band_t demosaic_band, const void * arg)
+{
+    int band_rows = debayer_band_rows(height, threads);
+    int bands = debayer_band_count(height, band_rows);
+    /* Biggest window: the last band can have up to DEBAYER_BAND_ROWS_MIN/2 extra rows */
+    int max_window = MIN(band_rows + DEBAYER_BAND_ROWS_MIN / 2 + 2 * halo, height);
+    int convert = (wb && !wb->converted);
+    int out_of_memory = 0;
+    if (threads < 1) threads = 1;
+
+    #pragma omp parallel num_threads(MIN(threads, bands))
+    {
+        /* Per thread scratch: converted input (only if needed), red, green and blue of one window */
+        size_t plane = (size_t)max_window * width;
+        float * scratch = (float *)bufferPoolAlloc(plane * (convert ? 4 : 3) * sizeof(float));
+        float ** rows2d = (float **)bufferPoolAlloc(max_window * 4 * sizeof(float *));
+        float ** raw2d = rows2d;
+        float ** red2d = rows2d + max_window;
+        float ** green2d = rows2d + max_window * 2;
+        float ** blue2d = rows2d + max_window * 3;
+
+        if (!scratch || !rows2d)
         {
-            /* Amaze arguments */
-            amaze_arguments[thread] = (amazeinfo_t) {
-                imagefloat2d,
-                red2d,
-                green2d,
-                blue2d,
-                /* Crop out a part for each thread */
-                0, startchunk_y[thread],    /* crop window for demosaicing */
-                width, (endchunk_y[thread] - startchunk_y[thread]),
-                0,
-                blacklevel };
-
-            /* Create pthread! */
-            pthread_create( &thread_id[thread], NULL, (void *)&demosaic, (void *)&amaze_arguments[thread] );
+            #pragma omp atomic write
+            out_of_memory = 1;
         }
+        #pragma omp barrier
 
-        /* let all threads finish */
-        for (int thread = 0; thread < threads; ++thread)
+        #pragma omp for schedule(dynamic)
+        for (int band = 0; band < bands; band++)
         {
-            pthread_join( thread_id[thread], NULL );
+            if (out_of_memory) continue;
+            int band_start = band * band_rows;
+            int band_end = (band == bands - 1) ? height : band_start + band_rows;
+            int window_start = MAX(band_start - halo, 0);
+            int window_end = MIN(band_end + halo, height);
+            int window_rows = window_end - window_start;
+
+            for (int y = 0; y < window_rows; y++)
+            {
+                red2d[y] = scratch + (size_t)y * width;
+                green2d[y] = red2d[y] + plane;
+                blue2d[y] = green2d[y] + plane;
+
+                float * raw = bayerdata + (size_t)(window_start + y) * width;
+                if (convert)
+                {
+                    /* Window starts on an even row, so y and window_start + y have the same colors */
+                    raw2d[y] = blue2d[y] + plane;
+                    int odd = y % 2; /* R G row or G B row */
+                    for (int x = 0; x < width; x += 2)
+                    {
+                        raw2d[y][x] = wb_convert_pixel(wb, raw[x], odd);
+                        if (x + 1 < width) raw2d[y][x+1] = wb_convert_pixel(wb, raw[x+1], odd + 1);
+                    }
+                }
+                else raw2d[y] = raw;
+            }
+
+            demosaic_band(raw2d, red2d, green2d, blue2d, width, window_rows, arg);
+
+            /* Giv back as RGB, not separate channels */
+            for (int y = band_start; y < band_end; y++)
+            {
+                int row = y - window_start;
+                debayer_store_rgb(debayerto + (size_t)y * width * 3, red2d[row], green2d[row], blue2d[row], width, wb);
+            }
         }
 
+        bufferPoolFree(rows2d);
+        bufferPoolFree(scratch);
     }
 
-    //int rgb_pixels = pixelsize * 3;
-
-    /* Giv back as RGB, not separate channels */
-    for (int i = 0; i < pixelsize; i++)
+    if (out_of_memory)
     {
-        int j = i * 3;
-        debayerto[ j ] = LIMIT16((uint32_t)red1d[i]);
-        debayerto[j+1] = LIMIT16((uint32_t)green1d[i]);
-        debayerto[j+2] = LIMIT16((uint32_t)blue1d[i]);
+#ifndef STDOUT_SILENT
+        printf("Debayer: out of memory for the band scratch, using basic debayer\n");
+#endif
+        debayerBasic(debayerto, bayerdata, width, height, threads);
     }
+}
+
+static void amaze_band(float ** raw, float ** red, float ** green, float ** blue, int width, int rows, const void * arg)
+{
+    (void)arg;
+    /* AMaZE only works inside its window */
+    demosaic( & (amazeinfo_t) {
+              raw,
+              red,
+              green,
+              blue,
+              0, 0, /* crop window for demosaicing */
+              width, rows,
+              0,
+              0 } );
+}
+
+/* AmAZeMEmE debayer easier to use, in bands of rows on all threads */
+void debayerAmaze(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, const wb_convert_info_t * wb)
+{
+    debayer_bands(debayerto, bayerdata, width, height, threads, wb, DEBAYER_BAND_HALO, amaze_band, NULL);
+}
 
-    free(red1d);
-    free(red2d);
-    free(green1d);
-    free(green2d);
-    free(blue1d);
-    free(blue2d);
-    free(imagefloat2d);
+
+
+static void rcd_realtime_band(float ** raw, float ** red, float ** green, float ** blue, int width, int rows, const void * arg)
+{
+    (void)arg;
+    rcdRealtimeDemosaic(raw, red, green, blue, width, rows);
+}
+
+/* Reduced RCD for playback, in bands of rows on all threads */
+void debayerRealtime(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, const wb_convert_info_t * wb)
+{
+    debayer_bands(debayerto, bayerdata, width, height, threads, wb, RCD_REALTIME_HALO, rcd_realtime_band, NULL);
 }
 
 
@@ -378,54 +442,49 @@ void debayerEasy(uint16_t * __restrict debayerto, float * __restrict bayerdata,
     }
 }
 
-void debayerLibRtProcess(uint16_t *debayerto, float *bayerdata, int width, int height, int algorithm, double camMatrix[9])
-{
-    int pixelsize = width * height;
-
-    /* lrtp wants an image as floating points and 2d arrey as well */
-    float ** __restrict imagefloat2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) imagefloat2d[y] = (float *)(bayerdata+(y*width));
-
-    /* lrtp also wants to return floats, so heres memeory 4 it */
-    float  * __restrict red1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict red2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) red2d[y] = (float *)(red1d+(y*width));
-    float  * __restrict green1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict green2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) green2d[y] = (float *)(green1d+(y*width));
-    float  * __restrict blue1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict blue2d = (float **)malloc(height * sizeof(float *));
-    for (int y = 0; y < height; ++y) blue2d[y] = (float *)(blue1d+(y*width));
-
-    if( algorithm == 4)
-        lrtpLmmseDemosaic( imagefloat2d, red2d, green2d, blue2d, width, height );
-    else if( algorithm == 5 )
-        lrtpIgvDemosaic( imagefloat2d, red2d, green2d, blue2d, width, height );
-    else if( algorithm == 6 )
-        lrtpAhdDemosaic( imagefloat2d, red2d, green2d, blue2d, width, height, camMatrix );
-    else if( algorithm == 7 )
-        lrtpRcdDemosaic( imagefloat2d, red2d, green2d, blue2d, width, height );
-    else if( algorithm == 8 )
-        lrtpDcbDemosaic( imagefloat2d, red2d, green2d, blue2d, width, height );
-    else //AMaZE
-        lrtpAmazeDemosaic( imagefloat2d, red2d, green2d, blue2d, width, height );
-
-    //int rgb_pixels = pixelsize * 3;
+typedef struct {
+    int algorithm;
+    double * camMatrix;
+} lrtp_band_args_t;
 
-    /* Giv back as RGB, not separate channels */
-    for (int i = 0; i < pixelsize; i++)
+/* Halo rows each librtprocess algorithm needs: with these LMMSE, IGV and AHD bands are identical
+ * to a whole frame run. RCD and DCB work in tiles internally and differ a bit at their own tile
+ * borders whatever the halo, just like a whole frame run has those differences at its tiles. */
+static int lrtp_band_halo(int algorithm)
+{
+    switch (algorithm)
     {
-        int j = i * 3;
-        debayerto[ j ] = LIMIT16((uint32_t)red1d[i]);
-        debayerto[j+1] = LIMIT16((uint32_t)green1d[i]);
-        debayerto[j+2] = LIMIT16((uint32_t)blue1d[i]);
+        case 4: return 16; //LMMSE
+        case 5: return 32; //IGV
+        case 6: return 8;  //AHD
+        case 7: return 16; //RCD
+        case 8: return 32; //DCB
+        default: return 32;
     }
+}
+
+static void lrtp_band(float ** raw, float ** red, float ** green, float ** blue, int width, int rows, const void * arg)
+{
+    const lrtp_band_args_t * lrtp = (const lrtp_band_args_t *)arg;
+
+    if( lrtp->algorithm == 4)
+        lrtpLmmseDemosaic( raw, red, green, blue, width, rows );
+    else if( lrtp->algorithm == 5 )
+        lrtpIgvDemosaic( raw, red, green, blue, width, rows );
+    else if( lrtp->algorithm == 6 )
+        lrtpAhdDemosaic( raw, red, green, blue, width, rows, lrtp->camMatrix );
+    else if( lrtp->algorithm == 7 )
+        lrtpRcdDemosaic( raw, red, green, blue, width, rows );
+    else if( lrtp->algorithm == 8 )
+        lrtpDcbDemosaic( raw, red, green, blue, width, rows );
+    else //AMaZE
+        lrtpAmazeDemosaic( raw, red, green, blue, width, rows );
+}
 
-    free(red1d);
-    free(red2d);
-    free(green1d);
-    free(green2d);
-    free(blue1d);
-    free(blue2d);
-    free(imagefloat2d);
+/* librtprocess demosaicers, in overlapping bands of rows on all threads like AMaZE. librtprocess'
+ * own OpenMP loops run single threaded inside the bands, as nested parallelism is off. */
+void debayerLibRtProcess(uint16_t *debayerto, float *bayerdata, int width, int height, int threads, int algorithm, double camMatrix[9], const wb_convert_info_t * wb)
+{
+    lrtp_band_args_t lrtp = { algorithm, camMatrix };
+    debayer_bands(debayerto, bayerdata, width, height, threads, wb, lrtp_band_halo(algorithm), lrtp_band, &lrtp);
 }
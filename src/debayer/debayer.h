@@ -2,15 +2,19 @@
 #define _debayer_
 
 #include <stdint.h>
+#include "wb_conversion.h"
 
 /* Easy debayer types */
 void debayerEasy(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, int type);
 /* Quite quick bilinear debayer, floating point sadly; threads argument is unused */
 void debayerBasic(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads);
-/* More useable amaze, threads number should be the number of cores(or threads if >= i7) your cpu has */
-void debayerAmaze(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, int blacklevel);
-/* via librtprocess */
-void debayerLibRtProcess(uint16_t *__restrict debayerto, float *__restrict bayerdata, int width, int height, int algorithm, double camMatrix[9]);
+/* More useable amaze, threads number should be the number of cores(or threads if >= i7) your cpu has.
+ * Works in bands of rows, writes RGB directly. wb: WB conversion done on the fly and undone on output, or NULL */
+void debayerAmaze(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, const wb_convert_info_t * wb);
+/* via librtprocess, in bands of rows like debayerAmaze */
+void debayerLibRtProcess(uint16_t *__restrict debayerto, float *__restrict bayerdata, int width, int height, int threads, int algorithm, double camMatrix[9], const wb_convert_info_t * wb);
+/* Reduced RCD for realtime playback, in bands of rows like debayerAmaze */
+void debayerRealtime(uint16_t * __restrict debayerto, float * __restrict bayerdata, int width, int height, int threads, const wb_convert_info_t * wb);
 /* AHD debayer */
 void debayerAhd(uint16_t *__restrict debayerto, float *__restrict bayerdata, int width, int height);
 
@@ -45,4 +49,7 @@ __attribute__ ((force_align_arg_pointer))
 /*AMaZE algo*/
 demosaic(amazeinfo_t * inputdata);
 
+/* Reduced RCD, whole window; row pointers like AMaZE */
+void rcdRealtimeDemosaic(float ** rawData, float ** red, float ** green, float ** blue, int width, int height);
+
 #endif
@@ -0,0 +1,261 @@
+/*!
+ * \file rcd_realtime.c
+ * \author masc4ii
+ * \copyright 2026
+ * \brief Reduced RCD demosaic for realtime playback
+ *
+ * Based on RATIO CORRECTED DEMOSAICING by Luis Sanz Rodriguez
+ * (https://github.com/LuisSR/RCD-Demosaicing, GPLv3), as found in librtprocess.
+ * Green is interpolated like RCD (vertical/horizontal discrimination plus ratio
+ * corrected estimations), red and blue are interpolated by colour differences:
+ * the P/Q diagonal discrimination and RCD's tiling are left out for speed.
+ * All passes work on whole rows so the compiler can vectorise them, the caller
+ * runs bands of rows on all threads (debayerRealtime).
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "debayer.h"
+#include "../buffer_pool/buffer_pool.h"
+
+/* Pixels at the window border which get the bilinear fallback, RCD reaches 4 pixels and the
+ * refined discrimination one more */
+#define RCD_BORDER 5
+/* Tolerances to avoid dividing by zero, raw values are 0..65535 here */
+#define RCD_EPS 1.0f
+#define RCD_EPSSQ 1.0f
+
+#define SQR(x) ((x)*(x))
+
+/* assume RGGB */
+static inline int FC(int row, int col)
+{
+    return (row & 1) + (col & 1);
+}
+
+/* Like fmaxf, but inlined and vectorised without -ffast-math */
+static inline float rcd_max(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+/* Square of the 1D colour difference high pass filter, stride 1 horizontally or width vertically */
+static inline float rcd_hpf(const float * c, ptrdiff_t s)
+{
+    return SQR( ( c[-3*s] - c[-s] - c[s] + c[3*s] ) - 3.0f * ( c[-2*s] + c[2*s] ) + 6.0f * c[0] );
+}
+
+/* Step 3 for one row: green estimation at cols start..end-1, c, l and vh point to the row in the
+ * cfa, low pass and discrimination planes of the window */
+static void rcd_green_row(float * __restrict g, const float * __restrict c, const float * __restrict l, const float * __restrict vh, ptrdiff_t w1, int start, int end)
+{
+    const float * u1 = c - w1, * u2 = c - 2*w1, * u3 = c - 3*w1, * u4 = c - 4*w1;
+    const float * d1 = c + w1, * d2 = c + 2*w1, * d3 = c + 3*w1, * d4 = c + 4*w1;
+    const float * lu = l - 2*w1, * ld = l + 2*w1;
+    const float * vhu = vh - w1, * vhd = vh + w1;
+
+    for (int col = start; col < end; col++)
+    {
+        float n_grad = RCD_EPS + fabsf(u1[col] - d1[col]) + fabsf(c[col] - u2[col]) + fabsf(u1[col] - u3[col]) + fabsf(u2[col] - u4[col]);
+        float s_grad = RCD_EPS + fabsf(u1[col] - d1[col]) + fabsf(c[col] - d2[col]) + fabsf(d1[col] - d3[col]) + fabsf(d2[col] - d4[col]);
+        float w_grad = RCD_EPS + fabsf(c[col - 1] - c[col + 1]) + fabsf(c[col] - c[col - 2]) + fabsf(c[col - 1] - c[col - 3]) + fabsf(c[col - 2] - c[col - 4]);
+        float e_grad = RCD_EPS + fabsf(c[col - 1] - c[col + 1]) + fabsf(c[col] - c[col + 2]) + fabsf(c[col + 1] - c[col + 3]) + fabsf(c[col + 2] - c[col + 4]);
+
+        /* Ratio corrected estimations n = u1 * 2 * lpf / (lpf + lpf_n) etc., each pair weighted by the
+         * opposite gradients. Put over one denominator, one division per direction instead of three */
+        float lpfi = 2.0f * l[col];
+        float n_den = RCD_EPS + l[col] + lu[col];
+        float s_den = RCD_EPS + l[col] + ld[col];
+        float w_den = RCD_EPS + l[col] + l[col - 2];
+        float e_den = RCD_EPS + l[col] + l[col + 2];
+
+        float v_est = lpfi * (s_grad * u1[col] * s_den + n_grad * d1[col] * n_den) / ((n_grad + s_grad) * n_den * s_den);
+        float h_est = lpfi * (e_grad * c[col - 1] * e_den + w_grad * c[col + 1] * w_den) / ((w_grad + e_grad) * w_den * e_den);
+
+        /* Refined discrimination: take the diagonal neighbourhood if it's more decided */
+        float vh_central = vh[col];
+        float vh_neighbourhood = 0.25f * ( vhu[col - 1] + vhu[col + 1] + vhd[col - 1] + vhd[col + 1] );
+        float vh_disc = fabsf(0.5f - vh_central) < fabsf(0.5f - vh_neighbourhood) ? vh_neighbourhood : vh_central;
+
+        g[col] = vh_disc * (h_est - v_est) + v_est;
+    }
+}
+
+/* Step 4.1 for one row: the other of red/blue from the mean colour difference of the diagonals,
+ * cu and cd are the cfa rows above and below */
+static void rcd_diagonal_row(float * __restrict o, const float * __restrict gu, const float * __restrict g, const float * __restrict gd,
+                             const float * __restrict cu, const float * __restrict cd, int start, int end)
+{
+    for (int col = start; col < end; col++)
+    {
+        o[col] = rcd_max(g[col] + 0.25f * ( (cu[col - 1] - gu[col - 1]) + (cu[col + 1] - gu[col + 1])
+                                       + (cd[col - 1] - gd[col - 1]) + (cd[col + 1] - gd[col + 1]) ), 0.0f);
+    }
+}
+
+/* Mean of the same colour samples around a pixel, for the window border */
+static void rcd_border_pixel(float ** raw, float ** rgb[3], int width, int height, int row, int col)
+{
+    float sum[3] = { 0, 0, 0 };
+    int count[3] = { 0, 0, 0 };
+
+    for (int y = row - 1; y <= row + 1; y++)
+    {
+        if (y < 0 || y >= height) continue;
+        for (int x = col - 1; x <= col + 1; x++)
+        {
+            if (x < 0 || x >= width) continue;
+            int c = FC(y, x);
+            sum[c] += raw[y][x];
+            count[c]++;
+        }
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+        rgb[c][row][col] = count[c] ? rcd_max(sum[c] / count[c], 0.0f) : 0.0f;
+    }
+    rgb[FC(row, col)][row][col] = rcd_max(raw[row][col], 0.0f);
+}
+
+void rcdRealtimeDemosaic(float ** rawData, float ** red, float ** green, float ** blue, int width, int height)
+{
+    float ** rgb[3] = { red, green, blue };
+    const ptrdiff_t w1 = width;
+
+    /* Too small for RCD, all border */
+    if (width < 2 * RCD_BORDER + 2 || height < 2 * RCD_BORDER + 2)
+    {
+        for (int row = 0; row < height; row++)
+            for (int col = 0; col < width; col++)
+                rcd_border_pixel(rawData, rgb, width, height, row, col);
+        return;
+    }
+
+    /* The window as one contiguous block, the row pointers may point anywhere */
+    size_t size = (size_t)width * height;
+    float * cfa = (float *)bufferPoolAlloc(size * sizeof(float) * 3);
+    float * vh_dir = cfa + size;       /* Vertical/horizontal discrimination, weight of the horizontal estimation */
+    float * lpf = vh_dir + size;       /* Low pass of all colours */
+    float * hpf_v = (float *)bufferPoolAlloc((size_t)width * 4 * sizeof(float));
+    float * hpf_h = hpf_v + width * 3;
+
+    for (int row = 0; row < height; row++)
+    {
+        float * c = cfa + row * w1;
+        for (int col = 0; col < width; col++) c[col] = rcd_max(rawData[row][col], 0.0f);
+    }
+
+    /* Window border first, the steps below read the border as neighbours */
+    for (int row = 0; row < height; row++)
+    {
+        if (row < RCD_BORDER || row >= height - RCD_BORDER)
+        {
+            for (int col = 0; col < width; col++) rcd_border_pixel(rawData, rgb, width, height, row, col);
+        }
+        else
+        {
+            for (int col = 0; col < RCD_BORDER; col++) rcd_border_pixel(rawData, rgb, width, height, row, col);
+            for (int col = width - RCD_BORDER; col < width; col++) rcd_border_pixel(rawData, rgb, width, height, row, col);
+        }
+    }
+
+    /* Step 1: vertical and horizontal discrimination strength, from the sums of the squared high
+     * pass over three rows (vertical) and three columns (horizontal). hpf_v holds rows row-1..row+1 */
+    for (int row = 3; row < 5; row++)
+    {
+        const float * c = cfa + row * w1;
+        float * v = hpf_v + (row - 3) * width;
+        for (int col = 0; col < width; col++) v[col] = rcd_hpf(c + col, w1);
+    }
+    for (int row = 4; row < height - 4; row++)
+    {
+        const float * c = cfa + row * w1;
+        float * v0 = hpf_v + ((row - 4) % 3) * width;
+        float * v1 = hpf_v + ((row - 3) % 3) * width;
+        float * v2 = hpf_v + ((row - 2) % 3) * width;
+        float * vh = vh_dir + row * w1;
+
+        for (int col = 0; col < width; col++) v2[col] = rcd_hpf(c + w1 + col, w1);
+        for (int col = 3; col < width - 3; col++) hpf_h[col] = rcd_hpf(c + col, 1);
+
+        for (int col = 4; col < width - 4; col++)
+        {
+            float v_stat = rcd_max(RCD_EPSSQ, v0[col] + v1[col] + v2[col]);
+            float h_stat = rcd_max(RCD_EPSSQ, hpf_h[col - 1] + hpf_h[col] + hpf_h[col + 1]);
+            vh[col] = v_stat / (v_stat + h_stat);
+        }
+    }
+
+    /* Step 2: low pass filter of the local red, green and blue samples, only used at red and blue */
+    for (int row = 2; row < height - 2; row++)
+    {
+        const float * c = cfa + row * w1;
+        float * l = lpf + row * w1;
+        for (int col = 2; col < width - 2; col++)
+        {
+            l[col] = c[col]
+                   + 0.5f * ( c[col - w1] + c[col + w1] + c[col - 1] + c[col + 1] )
+                   + 0.25f * ( c[col - w1 - 1] + c[col - w1 + 1] + c[col + w1 - 1] + c[col + w1 + 1] );
+        }
+    }
+
+    /* Step 3: green at red and blue, ratio corrected cardinal estimations weighted by gradients.
+     * Estimated on whole rows so the loop vectorises, green samples are put back after */
+    for (int row = RCD_BORDER; row < height - RCD_BORDER; row++)
+    {
+        rcd_green_row(green[row], cfa + row * w1, lpf + row * w1, vh_dir + row * w1, w1, RCD_BORDER, width - RCD_BORDER);
+    }
+    for (int row = 0; row < height; row++)
+    {
+        const float * c = cfa + row * w1;
+        float * g = green[row];
+        for (int col = (row & 1) ^ 1; col < width; col += 2) g[col] = c[col];
+    }
+
+    /* Step 4.1: red at blue and blue at red, from the mean colour difference of the diagonals.
+     * Also whole rows, the values at green are overwritten by step 4.2 */
+    for (int row = RCD_BORDER; row < height - RCD_BORDER; row++)
+    {
+        rcd_diagonal_row(rgb[(row & 1) ? 0 : 2][row], green[row - 1], green[row], green[row + 1],
+                         cfa + (row - 1) * w1, cfa + (row + 1) * w1, RCD_BORDER, width - RCD_BORDER);
+    }
+    for (int row = 0; row < height; row++)
+    {
+        const float * c = cfa + row * w1;
+        float * own = rgb[row & 1 ? 2 : 0][row];
+        for (int col = row & 1; col < width; col += 2) own[col] = c[col];
+    }
+
+    /* Step 4.2: red and blue at green, vertical and horizontal colour differences blended like green */
+    for (int row = RCD_BORDER; row < height - RCD_BORDER; row++)
+    {
+        const float * g = green[row];
+        const float * gu = green[row - 1];
+        const float * gd = green[row + 1];
+        const float * vh = vh_dir + row * w1;
+
+        for (int c = 0; c <= 2; c += 2)
+        {
+            float * o = rgb[c][row];
+            const float * ou = rgb[c][row - 1];
+            const float * od = rgb[c][row + 1];
+
+            for (int col = RCD_BORDER + ((row ^ RCD_BORDER ^ 1) & 1); col < width - RCD_BORDER; col += 2)
+            {
+                float vh_central = vh[col];
+                float vh_neighbourhood = 0.25f * ( vh[col - w1 - 1] + vh[col - w1 + 1] + vh[col + w1 - 1] + vh[col + w1 + 1] );
+                float vh_disc = fabsf(0.5f - vh_central) < fabsf(0.5f - vh_neighbourhood) ? vh_neighbourhood : vh_central;
+
+                float v_est = 0.5f * ( (ou[col] - gu[col]) + (od[col] - gd[col]) );
+                float h_est = 0.5f * ( (o[col - 1] - g[col - 1]) + (o[col + 1] - g[col + 1]) );
+
+                o[col] = rcd_max(g[col] + vh_disc * (h_est - v_est) + v_est, 0.0f);
+            }
+        }
+    }
+
+    bufferPoolFree(hpf_v);
+    bufferPoolFree(cfa);
+}
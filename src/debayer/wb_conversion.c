@@ -57,6 +57,28 @@ static long double std_dev(float * a, int n, int stride)
 // #define USE_BLACKLEVEL
 #define USE_STANDARD_DEVIATION
 
+void wb_convert_init(wb_convert_info_t * wb_info, int blacklevel)
+{
+    if(blacklevel < 1000) blacklevel = -1000; //TO BE REMOVED! But this fixes blue dots for clips with blacklevel=0
+
+    /* WB adaption, needed for correct operation */
+    get_kelvin_multipliers_rgb(6500, wb_info->multiplier);
+    double max_wb = MAX( wb_info->multiplier[0], MAX( wb_info->multiplier[1], wb_info->multiplier[2] ) );
+    for( int i = 0; i < 3; i++ ) wb_info->multiplier[i] /= max_wb;
+    wb_info->blacklevel = blacklevel;
+    wb_info->converted = 0;
+}
+
+void wb_convert_frame(wb_convert_info_t * wb_info, float * rawData, int width, int height)
+{
+#pragma omp parallel for
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            rawData[y*width+x] = wb_convert_pixel( wb_info, rawData[y*width+x], FC(y,x) );
+
+    wb_info->converted = 1;
+}
+
 void wb_convert(wb_convert_info_t * wb_info, float * rawData, int width, int height, int blacklevel)
 {
 //     /* Subtract black */
@@ -223,38 +245,11 @@ void wb_convert(wb_convert_info_t * wb_info, float * rawData, int width, int hei
 
 //     return;
 
-    if(blacklevel < 1000) blacklevel = -1000; //TO BE REMOVED! But this fixes blue dots for clips with blacklevel=0
-
-    /* WB adaption, needed for correct operation */
-    double wb_multipliers[3];
-    get_kelvin_multipliers_rgb(6500, wb_multipliers);
-    double max_wb = MAX( wb_multipliers[0], MAX( wb_multipliers[1], wb_multipliers[2] ) );
-    for( int i = 0; i < 3; i++ ) wb_multipliers[i] /= max_wb;
-    {
-#pragma omp parallel for collapse(2)
-        for (int y = 0; y < height; ++y)
-            for (int x = 0; x < width; ++x)
-            {
-                switch (FC(y,x))
-                {
-                    case 0:
-                        rawData[y*width+x] = /* LIMIT16 */( ( rawData[y*width+x] - blacklevel ) * wb_multipliers[0] );
-                        break;
-                    case 1:
-                        rawData[y*width+x] = /* LIMIT16 */( ( rawData[y*width+x] - blacklevel ) * wb_multipliers[1] );
-                        break;
-                    case 2:
-                        rawData[y*width+x] = /* LIMIT16 */( ( rawData[y*width+x] - blacklevel ) * wb_multipliers[2] );
-                        break;
-                    default:
-                        break;
-                }
-            }
-
-    }
+    wb_convert_init(wb_info, blacklevel);
+    wb_convert_frame(wb_info, rawData, width, height);
 }
 
-void wb_undo(const wb_convert_info_t * wb_info, uint16_t * debayeredFrame, int width, int height, int blacklevel)
+void wb_undo(const wb_convert_info_t * wb_info, uint16_t * debayeredFrame, int width, int height)
 {
 //     /* Unstretch channels */
 //     int framesize = width*height*3;
@@ -310,21 +305,15 @@ void wb_undo(const wb_convert_info_t * wb_info, uint16_t * debayeredFrame, int w
 //     //     debayeredFrame[i+2] = LIMIT16(b);
 //     // }
 
-    if(blacklevel < 1000) blacklevel = -1000; //TO BE REMOVED! But this fixes blue dots for clips with blacklevel=0
-
-    double wb_multipliers[3];
-    get_kelvin_multipliers_rgb(6500, wb_multipliers);
-    double max_wb = MAX( wb_multipliers[0], MAX( wb_multipliers[1], wb_multipliers[2] ) );
-    for( int i = 0; i < 3; i++ ) wb_multipliers[i] /= max_wb;
     {
 #pragma omp parallel for collapse(2)
         for (int y = 0; y < height; ++y)
             for (int x = 0; x < width; ++x)
             {
                 int idx = (y*width+x)*3;
-                debayeredFrame[idx  ] = LIMIT16( ( debayeredFrame[idx  ] / wb_multipliers[0] ) + blacklevel );
-                debayeredFrame[idx+1] = LIMIT16( ( debayeredFrame[idx+1] / wb_multipliers[1] ) + blacklevel );
-                debayeredFrame[idx+2] = LIMIT16( ( debayeredFrame[idx+2] / wb_multipliers[2] ) + blacklevel );
+                debayeredFrame[idx  ] = wb_undo_pixel( wb_info, debayeredFrame[idx  ], 0 );
+                debayeredFrame[idx+1] = wb_undo_pixel( wb_info, debayeredFrame[idx+1], 1 );
+                debayeredFrame[idx+2] = wb_undo_pixel( wb_info, debayeredFrame[idx+2], 2 );
             }
     }
 }
@@ -12,7 +12,9 @@
 #include "stdint.h"
 
 typedef struct {
-    float r, g, b;
+    double multiplier[3]; /* R, G, B */
+    int blacklevel;       /* Subtracted before scaling, added back by the undo */
+    int converted;        /* 1 when the bayer frame itself was converted by wb_convert_frame */
 } wb_convert_info_t;
 // typedef struct {
 //     float min_r, max_r;
@@ -20,7 +22,26 @@ typedef struct {
 //     float min_b, max_b;
 // } wb_convert_info_t;
 
+/* Only calculates the conversion, for debayers which convert on the fly */
+void wb_convert_init(wb_convert_info_t * wb_info, int blacklevel);
+/* Converts the whole bayer frame in place */
+void wb_convert_frame(wb_convert_info_t * wb_info, float *rawData, int width, int height);
+/* wb_convert_init + wb_convert_frame */
 void wb_convert(wb_convert_info_t * wb_info, float *rawData, int width, int height, int blacklevel);
-void wb_undo(const wb_convert_info_t * wb_info, uint16_t *debayeredFrame, int width, int height, int blacklevel);
+void wb_undo(const wb_convert_info_t * wb_info, uint16_t *debayeredFrame, int width, int height);
+
+/* Single pixel versions, color 0=red 1=green 2=blue */
+static inline float wb_convert_pixel(const wb_convert_info_t * wb_info, float pixel, int color)
+{
+    return ( pixel - wb_info->blacklevel ) * wb_info->multiplier[color];
+}
+
+static inline uint16_t wb_undo_pixel(const wb_convert_info_t * wb_info, uint16_t pixel, int color)
+{
+    double undone = ( pixel / wb_info->multiplier[color] ) + wb_info->blacklevel;
+    if( undone > 65535 ) return 65535;
+    if( undone < 0 ) return 0;
+    return (uint16_t)undone;
+}
 
 #endif // WB_CONVERSION_H
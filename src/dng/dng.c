@@ -25,6 +25,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 #include "dng.h"
 #include "dng_tag_codes.h"
@@ -764,6 +767,132 @@ static void dng_fill_header(mlvObject_t * mlv_data, dngObject_t * dng_data, uint
     }
 }
 
+/* Packed raw data is a stream of little endian 16 bit words, the pixel bits are stored MSB first.
+   So 8 pixels of an even bit depth always take bpp bytes and start on a word boundary.
+   The group functions below are inlined with a constant bpp, which turns all shifts into constants */
+static inline void unpack_group8(const uint16_t * packed, uint16_t * unpacked, const uint32_t bpp)
+{
+    uint32_t acc = 0;
+    uint32_t bits = 0;
+    #pragma GCC unroll 8
+    for (int p = 0; p < 8; p++)
+    {
+        if (bits < bpp)
+        {
+            acc = (acc << 16) | *packed++;
+            bits += 16;
+        }
+        bits -= bpp;
+        unpacked[p] = (uint16_t)((acc >> bits) & ((1u << bpp) - 1));
+    }
+}
+
+static inline void pack_group8(const uint16_t * unpacked, uint16_t * packed, const uint32_t bpp, int big_endian)
+{
+    uint32_t acc = 0;
+    uint32_t bits = 0;
+    #pragma GCC unroll 8
+    for (int p = 0; p < 8; p++)
+    {
+        acc = (acc << bpp) | (unpacked[p] & ((1u << bpp) - 1));
+        bits += bpp;
+        if (bits >= 16)
+        {
+            bits -= 16;
+            uint16_t word = (uint16_t)(acc >> bits);
+            *packed++ = big_endian ? ROL16(word, 8) : word;
+        }
+    }
+}
+
+/* pixels which are left over after the last group of 8 */
+static void unpack_tail(const uint16_t * packed, uint16_t * unpacked, uint32_t count, uint32_t bpp)
+{
+    uint32_t acc = 0;
+    uint32_t bits = 0;
+    for (uint32_t p = 0; p < count; p++)
+    {
+        if (bits < bpp)
+        {
+            acc = (acc << 16) | *packed++;
+            bits += 16;
+        }
+        bits -= bpp;
+        unpacked[p] = (uint16_t)((acc >> bits) & ((1u << bpp) - 1));
+    }
+}
+
+static void pack_tail(const uint16_t * unpacked, uint16_t * packed, uint32_t count, uint32_t bpp, int big_endian)
+{
+    uint32_t acc = 0;
+    uint32_t bits = 0;
+    for (uint32_t p = 0; p < count; p++)
+    {
+        acc = (acc << bpp) | (unpacked[p] & ((1u << bpp) - 1));
+        bits += bpp;
+        if (bits >= 16)
+        {
+            bits -= 16;
+            uint16_t word = (uint16_t)(acc >> bits);
+            *packed++ = big_endian ? ROL16(word, 8) : word;
+        }
+    }
+    if (bits > 0)
+    {
+        uint16_t word = (uint16_t)(acc << (16 - bits));
+        *packed = big_endian ? ROL16(word, 8) : word;
+    }
+}
+
+#ifdef __SSSE3__
+/* 8 pixels per shuffle: each 16 bit lane gets the word its pixel starts in (hi) and the next one (lo),
+   hi * 2^shift | lo * 2^shift / 2^16 puts the pixel to the top of the lane, then it is shifted down.
+   A 16 byte load covers the bpp bytes of the group plus the word after it */
+static void unpack_groups_ssse3(const uint8_t * packed, uint16_t * unpacked, int32_t groups, uint32_t bpp)
+{
+    uint8_t hi_index[16], lo_index[16];
+    uint16_t multiplier[8];
+    for (int p = 0; p < 8; p++)
+    {
+        uint32_t word = p * bpp / 16;
+        uint32_t shift = p * bpp % 16;
+        hi_index[2*p] = 2*word; hi_index[2*p+1] = 2*word + 1;
+        /* without shift nothing of the next word is needed, 0x80 gives a zero byte */
+        lo_index[2*p] = shift ? 2*word + 2 : 0x80; lo_index[2*p+1] = shift ? 2*word + 3 : 0x80;
+        multiplier[p] = 1 << shift;
+    }
+    __m128i hi_shuffle = _mm_loadu_si128((__m128i *)hi_index);
+    __m128i lo_shuffle = _mm_loadu_si128((__m128i *)lo_index);
+    __m128i mul = _mm_loadu_si128((__m128i *)multiplier);
+    __m128i down = _mm_cvtsi32_si128(16 - bpp);
+
+    #pragma omp parallel for
+    for (int32_t group = 0; group < groups; group++)
+    {
+        __m128i data = _mm_loadu_si128((__m128i *)(packed + (size_t)group * bpp));
+        __m128i hi = _mm_shuffle_epi8(data, hi_shuffle);
+        __m128i lo = _mm_shuffle_epi8(data, lo_shuffle);
+        __m128i top = _mm_or_si128(_mm_mullo_epi16(hi, mul), _mm_mulhi_epu16(lo, mul));
+        _mm_storeu_si128((__m128i *)(unpacked + (size_t)group * 8), _mm_srl_epi16(top, down));
+    }
+}
+#endif
+
+/* unpack bit depths with a group function, groups run in parallel */
+#define UNPACK_GROUPS(BPP) \
+    _Pragma("omp parallel for") \
+    for (int32_t group = first_group; group < groups; group++) \
+    { \
+        unpack_group8(packed_bits + (size_t)group * (BPP) / 2, unpacked_bits + (size_t)group * 8, BPP); \
+    }
+
+#define PACK_GROUPS(BPP) \
+    _Pragma("omp parallel for") \
+    for (int32_t group = 0; group < groups; group++) \
+    { \
+        pack_group8(unpacked_bits + (size_t)group * 8, packed_bits + (size_t)group * (BPP) / 2, BPP, big_endian); \
+    }
+
 /* unpack bits to 16 bit little endian and converts to real 14bit if less then 14bit depth detected
    output_buffer - the buffer where the result will be written
    input_buffer - a buffer containing the packed imaged data
@@ -778,6 +907,35 @@ void dng_unpack_image_bits(uint16_t * output_buffer, uint16_t * input_buffer, in
     uint16_t *packed_bits = input_buffer;
     uint16_t *unpacked_bits = output_buffer;
 
+    /* common bit depths are unpacked 8 pixels at a time */
+    if (bpp == 10 || bpp == 12 || bpp == 14)
+    {
+        int32_t groups = pixel_count / 8;
+        int32_t first_group = 0;
+#ifdef __SSSE3__
+        /* the 16 byte load of a group must stay inside of the packed frame */
+        size_t packed_size = (size_t)pixel_count * bpp / 8;
+        if (packed_size >= 16)
+        {
+            first_group = MIN(groups, (int32_t)((packed_size - 16) / bpp + 1));
+            unpack_groups_ssse3((uint8_t *)packed_bits, unpacked_bits, first_group, bpp);
+        }
+#endif
+        switch (bpp)
+        {
+            case 10: UNPACK_GROUPS(10) break;
+            case 12: UNPACK_GROUPS(12) break;
+            case 14: UNPACK_GROUPS(14) break;
+        }
+        unpack_tail(packed_bits + (size_t)groups * bpp / 2, unpacked_bits + (size_t)groups * 8, pixel_count % 8, bpp);
+        return;
+    }
+    if (bpp == 16)
+    {
+        memcpy(unpacked_bits, packed_bits, (size_t)pixel_count * 2);
+        return;
+    }
+
     #pragma omp parallel for
     for (uint32_t pixel_index = 0; pixel_index < pixel_count; pixel_index++)
     {
@@ -810,6 +968,21 @@ void dng_pack_image_bits(uint16_t * output_buffer, uint16_t * input_buffer, int
     uint16_t *unpacked_bits = input_buffer;
     uint16_t *packed_bits = output_buffer;
 
+    /* common bit depths are packed 8 pixels at a time */
+    if (bpp == 10 || bpp == 12 || bpp == 14 || bpp == 16)
+    {
+        int32_t groups = pixel_count / 8;
+        switch (bpp)
+        {
+            case 10: PACK_GROUPS(10) break;
+            case 12: PACK_GROUPS(12) break;
+            case 14: PACK_GROUPS(14) break;
+            case 16: PACK_GROUPS(16) break;
+        }
+        pack_tail(unpacked_bits + (size_t)groups * 8, packed_bits + (size_t)groups * bpp / 2, pixel_count % 8, bpp, big_endian);
+        return;
+    }
+
     packed_bits[0] = unpacked_bits[0] << bits_free;
     for (uint32_t pixel_index = 1; pixel_index < pixel_count; pixel_index++)
     {
@@ -861,14 +1034,14 @@ int dng_decompress_image(uint16_t * output_buffer, uint16_t * input_buffer, size
     return ret;
 }
 
-/* compress input_buffer to LJ92 image */
-int dng_compress_image(uint16_t * output_buffer, uint16_t * input_buffer, size_t * output_buffer_size, int width, int height, uint32_t bpp)
+/* compress input_buffer to LJ92 image, slices of the image are encoded on up to threads cores (0: all) */
+int dng_compress_image(uint16_t * output_buffer, uint16_t * input_buffer, size_t * output_buffer_size, int width, int height, uint32_t bpp, int threads)
 {
     uint8_t * compressed = NULL;
     int new_width = width * 2;
     int new_height = height / 2;
 
-    int ret = lj92_encode(input_buffer, new_width, new_height, (int)bpp, new_width * new_height, 0, NULL, 0, &compressed, (int*)output_buffer_size);
+    int ret = lj92_encode_threads(input_buffer, new_width, new_height, (int)bpp, new_width * new_height, 0, NULL, 0, &compressed, (int*)output_buffer_size, threads);
     if(ret == LJ92_ERROR_NONE)
     {
         memcpy(output_buffer, compressed, *output_buffer_size);
@@ -967,7 +1140,8 @@ static int dng_get_frame(mlvObject_t * mlv_data, dngObject_t * dng_data, uint32_
                                      &dng_data->image_size,
                                      mlv_data->RAWI.xRes,
                                      mlv_data->RAWI.yRes,
-                                     mlv_data->RAWI.raw_info.bits_per_pixel);
+                                     mlv_data->RAWI.raw_info.bits_per_pixel,
+                                     0);
         }
         else   // uncompressed and fast pass
         {
@@ -1017,7 +1191,8 @@ static int dng_get_frame(mlvObject_t * mlv_data, dngObject_t * dng_data, uint32_
                                              &dng_data->image_size,
                                              mlv_data->RAWI.xRes,
                                              mlv_data->RAWI.yRes,
-                                             (llrpHQDualIso(mlv_data)) ? 16 : mlv_data->RAWI.raw_info.bits_per_pixel);
+                                             (llrpHQDualIso(mlv_data)) ? 16 : mlv_data->RAWI.raw_info.bits_per_pixel,
+                                             0);
                 }
                 else
                 {
@@ -1071,7 +1246,8 @@ static int dng_get_frame(mlvObject_t * mlv_data, dngObject_t * dng_data, uint32_
                                              &dng_data->image_size,
                                              mlv_data->RAWI.xRes,
                                              mlv_data->RAWI.yRes,
-                                             (llrpHQDualIso(mlv_data)) ? 16 : mlv_data->RAWI.raw_info.bits_per_pixel);
+                                             (llrpHQDualIso(mlv_data)) ? 16 : mlv_data->RAWI.raw_info.bits_per_pixel,
+                                             0);
                 }
                 else
                 {
@@ -74,6 +74,16 @@ struct Encoder {
 
 struct Decoder {
     ojph::codestream cs;
+    uint32_t skip_levels = 0;
+
+    // Skip the finest wavelet levels for reading and reconstruction,
+    // every level halves width and height. Must run after read_headers.
+    void restrict_resolution() {
+        uint32_t levels = skip_levels;
+        uint32_t decompositions = cs.access_cod().get_num_decompositions();
+        if (levels > decompositions) levels = decompositions;
+        cs.restrict_input_resolution(levels, levels);
+    }
 };
 
 extern "C" {
@@ -134,33 +144,13 @@ void* ojph_decoder_new() {
     return new (std::nothrow) Decoder();
 }
 
-int ojph_decoder_probe(void* d, const uint8_t* data, size_t size,
-                       uint32_t* w, uint32_t* h,
-                       uint32_t* num_comps, uint32_t* bit_depth,
-                       int* is_signed) {
-    auto* dec = static_cast<Decoder*>(d);
-    dec->cs.restart();
-
-    ojph::mem_infile infile;
-    infile.open(data, size);
-    dec->cs.enable_resilience();
-    dec->cs.read_headers(&infile);
-
-    ojph::param_siz siz = dec->cs.access_siz();
-    *w = siz.get_recon_width(0);
-    *h = siz.get_recon_height(0);
-    *num_comps = siz.get_num_components();
-    *bit_depth = siz.get_bit_depth(0);
-    *is_signed = siz.is_signed(0) ? 1 : 0;
-
-    infile.close();
-    return 0;
+void ojph_decoder_set_skip_levels(void* d, uint32_t levels) {
+    static_cast<Decoder*>(d)->skip_levels = levels;
 }
 
-size_t ojph_decoder_decode_into(void* d, const uint8_t* data, size_t size,
-                                int32_t* out_pixels, size_t out_pixels_cap,
-                                uint32_t* out_w, uint32_t* out_h,
-                                uint32_t* out_num_comps) {
+size_t ojph_decoder_decode_u16(void* d, const uint8_t* data, size_t size,
+                               uint16_t* out, size_t pixel_step, size_t line_stride,
+                               uint32_t expected_w, uint32_t expected_h) {
     auto* dec = static_cast<Decoder*>(d);
     dec->cs.restart();
 
@@ -169,35 +159,35 @@ size_t ojph_decoder_decode_into(void* d, const uint8_t* data, size_t size,
 
     dec->cs.enable_resilience();
     dec->cs.read_headers(&infile);
-    dec->cs.set_planar(false);
-    dec->cs.create();
+    dec->restrict_resolution();
 
+    // Check the size before anything is decoded, headers are parsed only once
     ojph::param_siz siz = dec->cs.access_siz();
     uint32_t w = siz.get_recon_width(0);
     uint32_t h = siz.get_recon_height(0);
-    uint32_t nc = siz.get_num_components();
-    size_t needed = (size_t)w * h * nc;
-
-    if (needed > out_pixels_cap) {
+    if (siz.get_num_components() != 1 || w != expected_w || h != expected_h) {
         infile.close();
         return 0;
     }
 
+    dec->cs.set_planar(false);
+    dec->cs.create();
+
     for (uint32_t y = 0; y < h; ++y) {
-        for (uint32_t c = 0; c < nc; ++c) {
-            ojph::ui32 comp_num;
-            ojph::line_buf* line = dec->cs.pull(comp_num);
-            const ojph::si32* sp = line->i32;
-            for (uint32_t x = 0; x < w; ++x)
-                out_pixels[(y * w + x) * nc + c] = sp[x];
+        ojph::ui32 comp_num;
+        ojph::line_buf* line = dec->cs.pull(comp_num);
+        const ojph::si32* sp = line->i32;
+        uint16_t* dp = out + y * line_stride;
+        for (uint32_t x = 0; x < w; ++x) {
+            ojph::si32 val = sp[x];
+            if (val < 0) val = 0;
+            if (val > 65535) val = 65535;
+            dp[x * pixel_step] = (uint16_t)val;
         }
     }
 
-    *out_w = w;
-    *out_h = h;
-    *out_num_comps = nc;
     infile.close();
-    return needed;
+    return (size_t)w * h;
 }
 
 void ojph_decoder_free(void* d) { delete static_cast<Decoder*>(d); }
@@ -19,14 +19,15 @@ size_t ojph_encoder_encode_into(void* e, const int32_t* pixels,
 void  ojph_encoder_free(void* e);
 
 void* ojph_decoder_new();
-int   ojph_decoder_probe(void* d, const uint8_t* data, size_t size,
-                         uint32_t* w, uint32_t* h,
-                         uint32_t* num_comps, uint32_t* bit_depth,
-                         int* is_signed);
-size_t ojph_decoder_decode_into(void* d, const uint8_t* data, size_t size,
-                                int32_t* out_pixels, size_t out_pixels_cap,
-                                uint32_t* out_w, uint32_t* out_h,
-                                uint32_t* out_num_comps);
+/* Skip the finest wavelet levels (0 = full resolution, 1 = half, 2 = quarter...),
+ * clamped to the levels in the codestream. */
+void  ojph_decoder_set_skip_levels(void* d, uint32_t levels);
+/* Decodes a single component image of exactly expected_w x expected_h straight into 16 bit
+ * (clamped): pixel x of line y goes to out[y * line_stride + x * pixel_step]. Returns the
+ * pixel count, or 0 if the image has another size or more components. */
+size_t ojph_decoder_decode_u16(void* d, const uint8_t* data, size_t size,
+                               uint16_t* out, size_t pixel_step, size_t line_stride,
+                               uint32_t expected_w, uint32_t expected_h);
 void  ojph_decoder_free(void* d);
 
 #ifdef __cplusplus
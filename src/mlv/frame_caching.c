@@ -9,6 +9,7 @@
 #include "../debayer/debayer.h"
 #include "../ca_correct/CA_correct_RT.h"
 #include "../debayer/wb_conversion.h"
+#include "../buffer_pool/buffer_pool.h"
 
 #include "librtprocesswrapper.h"
 
@@ -212,33 +213,8 @@ void an_mlv_cache_thread(mlvObject_t * video)
     uint32_t width = getMlvWidth(video);
     uint32_t pixelsize = width * height;
 
-    /* 2d array uglyness */
-    float  * __restrict imagefloat1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict imagefloat2d = (float **)malloc(height * sizeof(float *));
-    for (volatile uint32_t y = 0; y < height; ++y) imagefloat2d[y] = (float *)(imagefloat1d+(y*width));
-    float  * __restrict red1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict red2d = (float **)malloc(height * sizeof(float *));
-    for (volatile uint32_t y = 0; y < height; ++y) red2d[y] = (float *)(red1d+(y*width));
-    float  * __restrict green1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict green2d = (float **)malloc(height * sizeof(float *));
-    for (volatile uint32_t y = 0; y < height; ++y) green2d[y] = (float *)(green1d+(y*width));
-    float  * __restrict blue1d = (float *)malloc(pixelsize * sizeof(float));
-    float ** __restrict blue2d = (float **)malloc(height * sizeof(float *));
-    for (volatile uint32_t y = 0; y < height; ++y) blue2d[y] = (float *)(blue1d+(y*width));
-
-    pthread_mutex_lock( &video->g_mutexCount );
-    amazeinfo_t amaze_params = {
-        .rawData =  imagefloat2d,
-        .red     =  red2d,
-        .green   =  green2d,
-        .blue    =  blue2d,
-        .winx    =  0,
-        .winy    =  0,
-        .winw    =  getMlvWidth(video),
-        .winh    =  getMlvHeight(video),
-        .cfa     =  0
-    };
-    pthread_mutex_unlock( &video->g_mutexCount );
+    /* Bayer frame, AMaZE demosaics it in bands straight into the cache */
+    float * __restrict imagefloat1d = (float *)bufferPoolAlloc(pixelsize * sizeof(float));
 
     while (1 < 2)
     {
@@ -258,17 +234,7 @@ void an_mlv_cache_thread(mlvObject_t * video)
         pthread_mutex_unlock( &video->cache_mutex );
 
         /* Single thread AMaZE */
-        demosaic(&amaze_params);
-
-        /* To 16-bit */
-        uint16_t * out = video->rgb_raw_frames[cache_frame];
-        for (uint32_t i = 0; i < pixelsize-10; i++)
-        {
-            uint16_t * pix = out + (i*3);
-            pix[0] = (uint16_t)MIN(red1d[i], 65535);
-            pix[1] = (uint16_t)MIN(green1d[i], 65535);
-            pix[2] = (uint16_t)MIN(blue1d[i], 65535);
-        }
+        debayerAmaze(video->rgb_raw_frames[cache_frame], imagefloat1d, width, height, 1, NULL);
 
         pthread_mutex_lock( &video->g_mutexFind );
         video->cached_frames[cache_frame] = MLV_FRAME_IS_CACHED;
@@ -277,14 +243,7 @@ void an_mlv_cache_thread(mlvObject_t * video)
         DEBUG( printf("Debayered frame %llu/%llu has been cached.\n", cache_frame+1, video->cache_limit_frames); )
     }
 
-    free(red1d);
-    free(red2d);
-    free(green1d);
-    free(green2d);
-    free(blue1d);
-    free(blue2d);
-    free(imagefloat2d);
-    free(imagefloat1d);
+    bufferPoolFree(imagefloat1d);
 
     pthread_mutex_lock( &video->g_mutexCount );
     video->cache_thread_count--;
@@ -305,18 +264,23 @@ void get_mlv_raw_frame_debayered( mlvObject_t * video,
     getMlvRawFrameFloat(video, frame_index, temp_memory);
 
     wb_convert_info_t wb_info;
+    wb_convert_info_t * wb = NULL;
 
-    /* WB conversion for ideal debayer result, not for bilinear, easy and non debayer */
+    /* WB conversion for ideal debayer result, not for bilinear, easy and non debayer.
+     * AMaZE, librtprocess and realtime RCD convert band by band on the fly, so the frame is only converted if needed */
     if( !( debayer_type == 0 || debayer_type == 2 || debayer_type == 3 ) )
     {
-        wb_convert(&wb_info, temp_memory, width, height, getMlvBlackLevel(video));
+        wb_convert_init(&wb_info, getMlvBlackLevel(video));
+        wb = &wb_info;
 
         /* CA correction, multithreaded, not for bilinear, easy and non debayer because not visible and slow */
         if( video->ca_red <= -0.1 || video->ca_red >= 0.1
          || video->ca_blue <= -0.1 || video->ca_blue >= 0.1 )
         {
+            wb_convert_frame(&wb_info, temp_memory, width, height);
+
             /* 2d array for CA correction */
-            float ** __restrict imagefloat2d = (float **)malloc(height * sizeof(float *));
+            float ** __restrict imagefloat2d = (float **)bufferPoolAlloc(height * sizeof(float *));
             for (int y = 0; y < height; ++y) imagefloat2d[y] = (float *)(temp_memory+(y*width));
 
             /* the magic CA correction function */
@@ -326,6 +290,8 @@ void get_mlv_raw_frame_debayered( mlvObject_t * video,
 
             lrtpCaCorrect( imagefloat2d, 0, 0, width, height,
                            0, 0, video->ca_red, video->ca_blue, 0 );
+
+            bufferPoolFree(imagefloat2d);
         }
     }
 
@@ -333,28 +299,31 @@ void get_mlv_raw_frame_debayered( mlvObject_t * video,
     if (/*debayer_type == 1 ||*/ debayer_type == 4 || debayer_type == 5 || /*debayer_type == 6 ||*/ debayer_type == 7 || debayer_type == 8)
     {
         //AMaZE and AHD disabled from librtprocess because of bad artifacts
-        debayerLibRtProcess(output_frame, temp_memory, width, height, debayer_type, video->processing->cam_matrix);
+        debayerLibRtProcess(output_frame, temp_memory, width, height, getMlvCpuCores(video), debayer_type, video->processing->cam_matrix, wb);
     }
     else if (debayer_type == 1 )
     {
-        debayerAmaze(output_frame, temp_memory, width, height, getMlvCpuCores(video), getMlvBlackLevel(video));
+        debayerAmaze(output_frame, temp_memory, width, height, getMlvCpuCores(video), wb);
     }
     else if(debayer_type == 2 || debayer_type == 3)
     {
         /* threaded easy types */
         debayerEasy(output_frame, temp_memory, width, height, getMlvCpuCores(video), debayer_type);
     }
+    else if (debayer_type == 9 )
+    {
+        /* Reduced RCD, fast enough for playback */
+        debayerRealtime(output_frame, temp_memory, width, height, getMlvCpuCores(video), wb);
+    }
     else if (debayer_type == 6 )
     {
+        if( !wb_info.converted ) wb_convert_frame(&wb_info, temp_memory, width, height);
         debayerAhd(output_frame, temp_memory, width, height);
+        wb_undo(&wb_info, output_frame, width, height);
     }
     else
     {
         /* Debayer quickly (bilinearly) */
         debayerBasic(output_frame, temp_memory, width, height, 1);
     }
-
-    /* WB conversion undo for ideal debayer result */
-    if( !( debayer_type == 0 || debayer_type == 2 || debayer_type == 3 ) )
-        wb_undo(&wb_info, output_frame, width, height, getMlvBlackLevel(video));
 }
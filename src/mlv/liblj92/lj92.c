@@ -25,6 +25,9 @@ SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "lj92.h"
 
@@ -733,75 +736,87 @@ typedef struct _lje {
     u16 huffenc[18];
     u16 huffbits[18];
     int huffsym[18];
+    int threads;
 } lje;
 
-int frequencyScan(lje* self) {
-    // Scan through the tile using the standard type 6 prediction
-    // Need to cache the previous 2 row in target coordinates because of tiling
-    uint16_t* pixel = self->image;
-    int pixcount = self->width*self->height;
-    int scan = self->readLength;
+/* Encoder slices: the tile is cut into horizontal bands of rows which are scanned
+ * and encoded in parallel. All slices share one Huffman table and their bits are
+ * joined to one continuous scan, so the stream is the same as a serial encode */
+typedef struct _ljeslice {
+    int row;            // First row of the slice
+    int rows;
+    int hist[18];       // SSSS frequency histogram of this slice
+    uint8_t* bits;      // Unstuffed body bits, MSB first
+    int bitsLength;     // Allocated bytes
+    uint64_t bitcount;  // Written bits
+    int error;
+} ljeslice;
+
+// Rows below this are not worth a slice of their own
+#define LJE_MIN_SLICE_ROWS 16
+
+// Pixel at index of the tile in the image, *scan is set to the pixels left in its read run
+static uint16_t* tilePixel(lje* self, int index, int* scan) {
+    *scan = self->readLength - index % self->readLength;
+    return self->image + index + (size_t)(index / self->readLength) * self->skipLength;
+}
+
+// Reads one row of the tile to dst, returns the first pixel of the next row
+static uint16_t* readRow(lje* self, uint16_t* pixel, int* scan, uint16_t* dst, int delinearize) {
+    for (int col=0;col<self->width;col++) {
+        uint16_t p = *pixel++;
+        dst[col] = delinearize ? self->delinearize[p] : p;
+        if (--(*scan)==0) { pixel += self->skipLength; *scan = self->readLength; }
+    }
+    return pixel;
+}
+
+// Standard type 6 prediction, row 0 and col 0 fall back to neighbours
+static inline int32_t predictDiff(lje* self, uint16_t* prev, uint16_t* cur, int row, int col) {
+    int Px;
+    if ((row == 0)&&(col == 0))
+        Px = 1 << (self->bitdepth-1);
+    else if (row == 0)
+        Px = cur[col-1];
+    else if (col == 0)
+        Px = prev[col];
+    else
+        Px = prev[col] + ((cur[col-1] - prev[col-1])>>1);
+    return (int16_t)(cur[col] - Px);
+}
+
+static inline int diffSsss(int32_t diff) {
+    return diff ? 32 - __builtin_clz(abs(diff)) : 0;
+}
+
+// Loads the row above the slice, returns the first pixel of the slice
+static uint16_t* sliceStart(lje* self, ljeslice* slice, int* scan, uint16_t* prev, int delinearize) {
+    if (slice->row == 0) return tilePixel(self, 0, scan);
+    uint16_t* pixel = tilePixel(self, (slice->row-1)*self->width, scan);
+    return readRow(self, pixel, scan, prev, delinearize);
+}
+
+static void frequencyScan(lje* self, ljeslice* slice) {
+    // Scan through the slice using the standard type 6 prediction
+    // Need to cache the previous row in target coordinates because of tiling
     uint16_t* rowcache = (uint16_t*)calloc(1,self->width*4);
+    if (rowcache==NULL) { slice->error = LJ92_ERROR_NO_MEMORY; return; }
     uint16_t* rows[2];
     rows[0] = rowcache;
     rows[1] = &rowcache[self->width];
 
-    int col = 0;
-    int row = 0;
-    int Px = 0;
-    int32_t diff = 0;
-    //int maxval = (1 << self->bitdepth);
-    while (pixcount--) {
-        uint16_t p = *pixel;
-        /* if (self->delinearize) {
-            if (p>=self->delinearizeLength) {
-                free(rowcache);
-                return LJ92_ERROR_TOO_WIDE;
-            }
-            p = self->delinearize[p];
-        }
-        if (p>=maxval) {
-            free(rowcache);
-            return LJ92_ERROR_TOO_WIDE;
-        } */
-        rows[1][col] = p;
-
-        if ((row == 0)&&(col == 0))
-            Px = 1 << (self->bitdepth-1);
-        else if (row == 0)
-            Px = rows[1][col-1];
-        else if (col == 0)
-            Px = rows[0][col];
-        else
-            Px = rows[0][col] + ((rows[1][col-1] - rows[0][col-1])>>1);
-        diff = rows[1][col] - Px;
-        diff = diff%65536;
-        diff = (int16_t)diff;
-        int ssss = 32 - __builtin_clz(abs(diff));
-        if (diff==0) ssss=0;
-        self->hist[ssss]++;
-        //printf("%d %d %d %d %d %d\n",col,row,p,Px,diff,ssss);
-        pixel++;
-        scan--;
-        col++;
-        if (scan==0) { pixel += self->skipLength; scan = self->readLength; }
-        if (col==self->width) {
-            uint16_t* tmprow = rows[1];
-            rows[1] = rows[0];
-            rows[0] = tmprow;
-            col=0;
-            row++;
+    int scan;
+    uint16_t* pixel = sliceStart(self, slice, &scan, rows[0], 0);
+    for (int row=slice->row;row<slice->row+slice->rows;row++) {
+        pixel = readRow(self, pixel, &scan, rows[1], 0);
+        for (int col=0;col<self->width;col++) {
+            slice->hist[diffSsss(predictDiff(self, rows[0], rows[1], row, col))]++;
         }
+        uint16_t* tmprow = rows[1];
+        rows[1] = rows[0];
+        rows[0] = tmprow;
     }
-#ifdef DEBUG
-    int sort[17];
-    for (int h=0;h<17;h++) {
-        sort[h] = h;
-        printf("%d:%d\n",h,self->hist[h]);
-    }
-#endif
     free(rowcache);
-    return LJ92_ERROR_NONE;
 }
 
 void createEncodeTable(lje* self) {
@@ -1032,135 +1047,146 @@ void writePost(lje* self) {
     self->encodedWritten = w;
 }
 
-int writeBody(lje* self) {
-    // Scan through the tile using the standard type 6 prediction
-    // Need to cache the previous 2 row in target coordinates because of tiling
-    uint16_t* pixel = self->image;
-    int pixcount = self->width*self->height;
-    int scan = self->readLength;
+// 64 bit accumulator, whole 32 bit words are written out MSB first
+typedef struct _ljebits {
+    uint8_t* out;
+    uint64_t acc;
+    int accbits;
+} ljebits;
+
+static inline void putBits(ljebits* b, uint32_t code, int len) {
+    // len is at most 31 and accbits below 32, so nothing falls off the top
+    b->acc = (b->acc << len) | code;
+    b->accbits += len;
+    if (b->accbits >= 32) {
+        b->accbits -= 32;
+        uint32_t v = (uint32_t)(b->acc >> b->accbits);
+        b->out[0] = v >> 24; b->out[1] = v >> 16; b->out[2] = v >> 8; b->out[3] = v;
+        b->out += 4;
+    }
+}
+
+static void writeBody(lje* self, ljeslice* slice) {
     uint16_t* rowcache = (uint16_t*)calloc(1,self->width*4);
+    // Compressed data is well below 16 bits per pixel, grown per row if not
+    slice->bitsLength = slice->rows*self->width*2 + 16;
+    slice->bits = (uint8_t*)malloc(slice->bitsLength);
+    if (rowcache==NULL || slice->bits==NULL) {
+        free(rowcache);
+        slice->error = LJ92_ERROR_NO_MEMORY;
+        return;
+    }
     uint16_t* rows[2];
     rows[0] = rowcache;
     rows[1] = &rowcache[self->width];
 
-    int col = 0;
-    int row = 0;
-    int Px = 0;
-    int32_t diff = 0;
-    //int bitcount = 0;
-    uint8_t* out = self->encoded;
-    int w = self->encodedWritten;
-    uint8_t next = 0;
-    uint8_t nextbits = 8;
-    while (pixcount--) {
-        uint16_t p = *pixel;
-        if (self->delinearize) p = self->delinearize[p];
-        rows[1][col] = p;
-
-        if ((row == 0)&&(col == 0))
-            Px = 1 << (self->bitdepth-1);
-        else if (row == 0)
-            Px = rows[1][col-1];
-        else if (col == 0)
-            Px = rows[0][col];
-        else
-            Px = rows[0][col] + ((rows[1][col-1] - rows[0][col-1])>>1);
-        diff = rows[1][col] - Px;
-        diff = diff%65536;
-        diff = (int16_t)diff;
-        int ssss = 32 - __builtin_clz(abs(diff));
-        if (diff==0) ssss=0;
-        //printf("%d %d %d %d %d\n",col,row,Px,diff,ssss);
-
-        // Write the huffman code for the ssss value
+    // Huffman code and its length for each ssss
+    uint32_t code[17];
+    int codebits[17];
+    for (int ssss=0;ssss<17;ssss++) {
         int huffcode = self->huffsym[ssss];
-        int huffenc = self->huffenc[huffcode];
-        int huffbits = self->huffbits[huffcode];
+        code[ssss] = self->huffenc[huffcode];
+        codebits[ssss] = self->huffbits[huffcode];
+    }
 
-        int vt = ssss>0?(1<<(ssss-1)):0;
-        //printf("%d %d %d %d\n",rows[1][col],Px,diff,Px+diff);
-#ifdef DEBUG
-#endif
-        if (diff < vt)
-            diff += (1 << (ssss))-1;
-
-        // Write the ssss
-        while (huffbits>0) {
-            int usebits = huffbits>nextbits?nextbits:huffbits;
-            // Add top usebits from huffval to next usebits of nextbits
-            int tophuff = huffenc >> (huffbits - usebits);
-            next |= (tophuff << (nextbits-usebits));
-            nextbits -= usebits;
-            huffbits -= usebits;
-            huffenc &= (1<<huffbits)-1;
-            if (nextbits==0) {
-                if(w >= self->encodedLength - 1)
-                {
-                    free(rowcache);
-                    return LJ92_ERROR_ENCODER;
-                }
-                out[w++] = next;
-                if (next==0xff) out[w++] = 0x0;
-                next = 0;
-                nextbits = 8;
+    ljebits b = { slice->bits, 0, 0 };
+    int scan;
+    uint16_t* pixel = sliceStart(self, slice, &scan, rows[0], self->delinearize != NULL);
+    for (int row=slice->row;row<slice->row+slice->rows;row++) {
+        // Worst case is 31 bits per pixel
+        size_t written = b.out - slice->bits;
+        if (written + (size_t)self->width*4 + 16 > (size_t)slice->bitsLength) {
+            int length = slice->bitsLength*2 + self->width*4;
+            uint8_t* bits = (uint8_t*)realloc(slice->bits, length);
+            if (bits==NULL) {
+                free(rowcache);
+                slice->error = LJ92_ERROR_NO_MEMORY;
+                return;
             }
+            slice->bits = bits;
+            slice->bitsLength = length;
+            b.out = bits + written;
         }
-        // Write the rest of the bits for the value
-        if (ssss == 16) {
-            // Diff values (always 32678) for SSSS=16 are encoded with 0 bits
-            ssss = 0;
-        }
-        while (ssss>0) {
-            int usebits = ssss>nextbits?nextbits:ssss;
-            // Add top usebits from huffval to next usebits of nextbits
-            int tophuff = diff >> (ssss - usebits);
-            next |= (tophuff << (nextbits-usebits));
-            nextbits -= usebits;
-            ssss -= usebits;
-            diff &= (1<<ssss)-1;
-            if (nextbits==0) {
-                if(w >= self->encodedLength - 1)
-                {
-                    free(rowcache);
-                    return LJ92_ERROR_ENCODER;
-                }
-                out[w++] = next;
-                if (next==0xff) out[w++] = 0x0;
-                next = 0;
-                nextbits = 8;
+        pixel = readRow(self, pixel, &scan, rows[1], self->delinearize != NULL);
+        for (int col=0;col<self->width;col++) {
+            int32_t diff = predictDiff(self, rows[0], rows[1], row, col);
+            int ssss = diffSsss(diff);
+            // The ssss huffman code is followed by the low ssss bits of the value,
+            // negative values minus one. Diff values (always 32678) for SSSS=16 are encoded with 0 bits
+            if (ssss == 0 || ssss == 16) {
+                putBits(&b, code[ssss], codebits[ssss]);
+            } else {
+                if (diff < 0) diff += (1 << ssss)-1;
+                putBits(&b, (code[ssss] << ssss) | (uint32_t)diff, codebits[ssss] + ssss);
             }
         }
+        uint16_t* tmprow = rows[1];
+        rows[1] = rows[0];
+        rows[0] = tmprow;
+    }
+    // Flush the final bits, the last byte is padded with zeros
+    slice->bitcount = (uint64_t)(b.out - slice->bits)*8 + b.accbits;
+    while (b.accbits > 0) {
+        int shift = b.accbits - 8;
+        *b.out++ = shift >= 0 ? (uint8_t)(b.acc >> shift) : (uint8_t)(b.acc << -shift);
+        b.accbits -= 8;
+    }
+    free(rowcache);
+}
 
-        //printf("%d %d\n",diff,ssss);
-        pixel++;
-        scan--;
-        col++;
-        if (scan==0) { pixel += self->skipLength; scan = self->readLength; }
-        if (col==self->width) {
-            uint16_t* tmprow = rows[1];
-            rows[1] = rows[0];
-            rows[0] = tmprow;
-            col=0;
-            row++;
-        }
+// Shifts the slice bits right by shift (1..7) bits in place, the new top bits are zero
+static void shiftSlice(ljeslice* slice, int shift) {
+    size_t bytes = (size_t)((slice->bitcount + shift + 7) >> 3);
+    uint8_t* d = slice->bits;
+    size_t oldbytes = (size_t)((slice->bitcount + 7) >> 3);
+    for (size_t i=bytes;i-->0;) {
+        uint8_t hi = (i > 0) ? d[i-1] : 0;
+        uint8_t lo = (i < oldbytes) ? d[i] : 0;
+        d[i] = (uint8_t)((hi << (8-shift)) | (lo >> shift));
     }
-    // Flush the final bits
-    if (nextbits<8) {
-        out[w++] = next;
-        if (next==0xff) out[w++] = 0x0;
+}
+
+// Appends bytes to the encoded stream with a 0 after each 0xff
+static void writeStuffed(lje* self, const uint8_t* data, size_t length) {
+    uint8_t* out = self->encoded + self->encodedWritten;
+    const uint8_t* end = data + length;
+    while (data < end) {
+        const uint8_t* ff = (const uint8_t*)memchr(data, 0xff, end - data);
+        size_t run = (ff ? ff + 1 : end) - data;
+        memcpy(out, data, run);
+        out += run;
+        data += run;
+        if (ff) *out++ = 0x0;
     }
-#ifdef DEBUG
-    int sort[18];
-    for (int h=0;h<18;h++) {
-        sort[h] = h;
-        printf("%d:%d\n",h,self->hist[h]);
+    self->encodedWritten = out - self->encoded;
+}
+
+// Joins the slice bits to one scan, slices after the first are shifted in place to the
+// bit position they continue at
+static void joinSlices(lje* self, ljeslice* slices, int count) {
+    int shift[count];
+    uint64_t bitpos = 0;
+    for (int i=0;i<count;i++) {
+        shift[i] = bitpos & 7;
+        bitpos += slices[i].bitcount;
     }
-    printf("Total bytes: %d\n",bitcount>>3);
-#endif
-    free(rowcache);
-    self->encodedWritten = w;
-    return LJ92_ERROR_NONE;
+    #pragma omp parallel for num_threads(self->threads)
+    for (int i=0;i<count;i++) {
+        if (shift[i]) shiftSlice(&slices[i], shift[i]);
+    }
+    uint8_t carry = 0; // Partial last byte of the previous slices
+    for (int i=0;i<count;i++) {
+        uint64_t bits = slices[i].bitcount + shift[i];
+        size_t full = (size_t)(bits >> 3);
+        uint8_t* d = slices[i].bits;
+        if (shift[i]) d[0] |= carry;
+        writeStuffed(self, d, full);
+        if (bits & 7) carry = d[full];
+        else carry = 0;
+    }
+    if (bitpos & 7) writeStuffed(self, &carry, 1);
 }
+
 /* Encoder
  * Read tile from an image and encode in one shot
  * Return the encoded data
@@ -1169,10 +1195,30 @@ int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
                 int readLength, int skipLength,
                 uint16_t* delinearize,int delinearizeLength,
                 uint8_t** encoded, int* encodedLength) {
+    return lj92_encode_threads(image, width, height, bitdepth, readLength, skipLength,
+                               delinearize, delinearizeLength, encoded, encodedLength, 1);
+}
+
+int lj92_encode_threads(uint16_t* image, int width, int height, int bitdepth,
+                        int readLength, int skipLength,
+                        uint16_t* delinearize,int delinearizeLength,
+                        uint8_t** encoded, int* encodedLength, int threads) {
     int ret = LJ92_ERROR_NONE;
 
+    if (threads <= 0) {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+    }
+    int count = height / LJE_MIN_SLICE_ROWS;
+    if (count > threads) count = threads;
+    if (count < 1) count = 1;
+
     lje* self = (lje*)calloc(sizeof(lje),1);
-    if (self==NULL) return LJ92_ERROR_NO_MEMORY;
+    ljeslice* slices = (ljeslice*)calloc(sizeof(ljeslice),count);
+    if (self==NULL || slices==NULL) { free(self); free(slices); return LJ92_ERROR_NO_MEMORY; }
     self->image = image;
     self->width = width;
     self->height = height;
@@ -1181,39 +1227,65 @@ int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
     self->skipLength = skipLength;
     self->delinearize = delinearize;
     self->delinearizeLength = delinearizeLength;
-    self->encodedLength = width*height*3+200;
-    self->encoded = malloc(self->encodedLength);
-    if (self->encoded==NULL) { free(self); return LJ92_ERROR_NO_MEMORY; }
+    self->threads = threads;
+    for (int i=0;i<count;i++) {
+        slices[i].row = (int)((int64_t)height * i / count);
+        slices[i].rows = (int)((int64_t)height * (i+1) / count) - slices[i].row;
+    }
+
     // Scan through data to gather frequencies of ssss prefixes
-    ret = frequencyScan(self);
-    if (ret != LJ92_ERROR_NONE) {
-        free(self->encoded);
-        free(self);
-        return ret;
+    #pragma omp parallel for num_threads(threads)
+    for (int i=0;i<count;i++) {
+        frequencyScan(self, &slices[i]);
     }
-    // Create encoded table based on frequencies
-    createEncodeTable(self);
-    // Write JPEG head and scan header
-    writeHeader(self);
-    // Scan through and do the compression
-    ret = writeBody(self);
-    if (ret != LJ92_ERROR_NONE) {
-        free(self->encoded);
-        free(self);
-        return ret;
+    for (int i=0;i<count;i++) {
+        if (slices[i].error) ret = slices[i].error;
+        for (int h=0;h<18;h++) self->hist[h] += slices[i].hist[h];
     }
-    // Finish
-    writePost(self);
 #ifdef DEBUG
-    printf("written:%d\n",self->encodedWritten);
+    for (int h=0;h<17;h++) {
+        printf("%d:%d\n",h,self->hist[h]);
+    }
 #endif
-    self->encoded = realloc(self->encoded,self->encodedWritten);
-    self->encodedLength = self->encodedWritten;
-    *encoded = self->encoded;
-    *encodedLength = self->encodedLength;
+    if (ret == LJ92_ERROR_NONE) {
+        // Create encoded table based on frequencies
+        createEncodeTable(self);
+        // Scan through and do the compression
+        #pragma omp parallel for num_threads(threads)
+        for (int i=0;i<count;i++) {
+            writeBody(self, &slices[i]);
+        }
+        uint64_t bitcount = 0;
+        for (int i=0;i<count;i++) {
+            if (slices[i].error) ret = slices[i].error;
+            bitcount += slices[i].bitcount;
+        }
+        if (ret == LJ92_ERROR_NONE) {
+            // Room for the headers and every byte being stuffed
+            self->encodedLength = (int)(((bitcount + 7) >> 3) * 2 + 200);
+            self->encoded = malloc(self->encodedLength);
+            if (self->encoded==NULL) ret = LJ92_ERROR_NO_MEMORY;
+        }
+    }
+    if (ret == LJ92_ERROR_NONE) {
+        // Write JPEG head and scan header, the slices and finish
+        writeHeader(self);
+        joinSlices(self, slices, count);
+        writePost(self);
+#ifdef DEBUG
+        printf("written:%d\n",self->encodedWritten);
+#endif
+        self->encoded = realloc(self->encoded,self->encodedWritten);
+        self->encodedLength = self->encodedWritten;
+        *encoded = self->encoded;
+        *encodedLength = self->encodedLength;
+    }
 
+    for (int i=0;i<count;i++) {
+        free(slices[i].bits);
+    }
+    free(slices);
     free(self);
 
     return ret;
 }
-
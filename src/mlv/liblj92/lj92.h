@@ -68,4 +68,13 @@ int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
                 int readLength, int skipLength,
                 uint16_t* delinearize,int delinearizeLength,
                 uint8_t** encoded, int* encodedLength);
+
+/*
+ * Same as lj92_encode, but scans and encodes horizontal slices of the tile on up to
+ * threads cores (0: all). The stream is identical to lj92_encode.
+ */
+int lj92_encode_threads(uint16_t* image, int width, int height, int bitdepth,
+                        int readLength, int skipLength,
+                        uint16_t* delinearize,int delinearizeLength,
+                        uint8_t** encoded, int* encodedLength, int threads);
 #endif
@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "darkframe.h"
 
@@ -29,6 +30,11 @@
 #define MAX(a,b) (((a)>(b))?(a):(b))
 #define COERCE(x,lo,hi) MAX(MIN((x),(hi)),(lo))
 
+/* dark frame library index file name */
+#define DF_LIBRARY_INDEX "darkframes.idx"
+/* max number of partial averages kept in memory for the median stack */
+#define DF_STACK_GROUPS 15
+
 static uint64_t file_set_pos(FILE *stream, uint64_t offset, int whence)
 {
 #if defined(__WIN32)
@@ -80,36 +86,409 @@ static void df_unload( mlvObject_t* df_mlv )
     pthread_mutex_destroy(&df_mlv->cache_mutex);
 }
 
-/* load dark frame from external averaged MLV file */
-static int df_load_ext(mlvObject_t * video, char * error_message)
+/* fill dark frame block header from the dark frame MLV */
+static void df_fill_hdr(mlvObject_t * df_mlv, mlv_dark_hdr_t * hdr, uint32_t frame_size, uint32_t samples)
+{
+    memcpy(&hdr->blockType, "DARK", 4);
+    hdr->blockSize = sizeof(mlv_dark_hdr_t) + frame_size;
+    hdr->timestamp = 0xFFFFFFFFFFFFFFFF;
+    hdr->samplesAveraged = samples;
+    hdr->cameraModel = df_mlv->IDNT.cameraModel;
+    hdr->xRes = df_mlv->RAWI.xRes;
+    hdr->yRes = df_mlv->RAWI.yRes;
+    hdr->rawWidth = df_mlv->RAWI.raw_info.width;
+    hdr->rawHeight = df_mlv->RAWI.raw_info.height;
+    hdr->bits_per_pixel = df_mlv->RAWI.raw_info.bits_per_pixel;
+    hdr->black_level = df_mlv->RAWI.raw_info.black_level;
+    hdr->white_level = df_mlv->RAWI.raw_info.white_level;
+    hdr->sourceFpsNom = df_mlv->MLVI.sourceFpsNom;
+    hdr->sourceFpsDenom = df_mlv->MLVI.sourceFpsDenom;
+    hdr->isoMode = df_mlv->EXPO.isoMode;
+    hdr->isoValue = df_mlv->EXPO.isoValue;
+    hdr->isoAnalog = df_mlv->EXPO.isoAnalog;
+    hdr->digitalGain = df_mlv->EXPO.digitalGain;
+    hdr->shutterValue = df_mlv->EXPO.shutterValue;
+    hdr->binning_x = df_mlv->RAWC.binning_x;
+    hdr->skipping_x = df_mlv->RAWC.skipping_x;
+    hdr->binning_y = df_mlv->RAWC.binning_y;
+    hdr->skipping_y = df_mlv->RAWC.skipping_y;
+}
+
+/* replace the dark frame by data (NULL to free it). Takes the write lock, so it waits until
+   no frame is subtracting the old dark frame any more, which is freed after the swap */
+static void df_set_data(mlvObject_t * video, mlv_dark_hdr_t * hdr, uint16_t * data, uint32_t size)
+{
+    pthread_rwlock_wrlock(&video->llrawproc->dark_frame_lock);
+    uint16_t * old_data = video->llrawproc->dark_frame_data;
+    video->llrawproc->dark_frame_data = data;
+    video->llrawproc->dark_frame_size = data ? size : 0;
+    if(data) memcpy(&video->llrawproc->dark_frame_hdr, hdr, sizeof(mlv_dark_hdr_t));
+    else memset(&video->llrawproc->dark_frame_hdr, 0, sizeof(mlv_dark_hdr_t));
+    if(!data) video->llrawproc->dark_frame_source = DF_OFF;
+    pthread_rwlock_unlock(&video->llrawproc->dark_frame_lock);
+
+    if(old_data)
+    {
+#ifndef STDOUT_SILENT
+        printf("DF: all data freed\n");
+#endif
+        free(old_data);
+    }
+}
+
+/* check if the file is a dark frame master (DARK header followed by 16bit frame data) */
+static int df_is_master(char * filename)
+{
+    uint8_t magic[4] = { 0 };
+    FILE * file = fopen(filename, "rb");
+    if(!file) return 0;
+    int ret = (fread(magic, 4, 1, file) == 1) && !memcmp(magic, "DARK", 4);
+    fclose(file);
+    return ret;
+}
+
+/* compressed or multi frame dark MLVs are not used directly, they are stacked to a master */
+static int df_mlv_needs_stacking(mlvObject_t * df_mlv)
+{
+    return (df_mlv->MLVI.videoClass & (MLV_VIDEO_CLASS_FLAG_LJ92 | MLV_VIDEO_CLASS_FLAG_CINEFORM | MLV_VIDEO_CLASS_FLAG_JPEG2K))
+           || (df_mlv->MLVI.videoFrameCount > 1);
+}
+
+/* load dark frame master, see df_save_master() */
+static int df_load_master(mlvObject_t * video, char * filename, int validate_only, char * error_message)
 {
-    /* If file name is not set return error */
-    if(!video->llrawproc->dark_frame_filename) return 1;
-    /* Parse dark frame MLV */
-    mlvObject_t df_mlv = { 0 };
     char err_msg[256] = { 0 };
-    int ret = openMlvClip(&df_mlv, video->llrawproc->dark_frame_filename, 2, err_msg);
-    if(ret != 0)
+    mlv_dark_hdr_t hdr;
+    FILE * file = fopen(filename, "rb");
+    if(!file || fread(&hdr, sizeof(mlv_dark_hdr_t), 1, file) != 1)
+    {
+        sprintf(err_msg, "Could not read dark frame master:\n\n%s", filename);
+        goto error;
+    }
+    /* if resolution mismatch detected */
+    if( (hdr.xRes != video->RAWI.xRes) || (hdr.yRes != video->RAWI.yRes) )
+    {
+        sprintf(err_msg, "Video clip and dark frame resolutions have not matched:\n\n%s", filename);
+        goto error;
+    }
+    if(validate_only)
+    {
+        fclose(file);
+        return 0;
+    }
+
+    uint32_t size = hdr.xRes * hdr.yRes * 2;
+    uint16_t * data = calloc(size + 4, 1);
+    if(!data || fread(data, size, 1, file) != 1)
+    {
+        free(data);
+        sprintf(err_msg, "Could not read dark frame from the file:\n\n%s", filename);
+        goto error;
+    }
+    fclose(file);
+    df_set_data(video, &hdr, data, size);
+#ifndef STDOUT_SILENT
+    printf("DF: initialized Ext mode from master (%u frames averaged)\n", hdr.samplesAveraged);
+#endif
+    return 0;
+
+error:
+#ifndef STDOUT_SILENT
+    printf("DF: %s\n", err_msg);
+#endif
+    if(error_message != NULL) strcpy(error_message, err_msg);
+    if(file) fclose(file);
+    return 1;
+}
+
+/* add a partial sum of samples frames to the sum of a group and clear it */
+static void df_stack_add(uint32_t * sum, uint32_t * partial, size_t pixel_count, uint32_t * group_samples, uint32_t samples)
+{
+    #pragma omp critical (df_stack)
     {
+        for(size_t i = 0; i < pixel_count; i++) sum[i] += partial[i];
+        *group_samples += samples;
+    }
+    memset(partial, 0, pixel_count * sizeof(uint32_t));
+}
+
+/* Median stack all frames of a raw or lossless dark MLV to one frame.
+ * Frames are decoded in parallel and summed up right away, so memory use does not
+ * depend on the clip length. The frames are summed into at most DF_STACK_GROUPS
+ * partial averages and the median of those is taken */
+int df_stack_mlv(char * df_filename, int threads, mlv_dark_hdr_t * hdr, uint16_t ** data, char * error_message)
+{
+    char err_msg[256] = { 0 };
+    mlvObject_t * df_mlv = initMlvObject();
+    /* no cache threads needed for the dark frame clip */
+    df_mlv->stop_caching = 1;
+    int ret = openMlvClip(df_mlv, df_filename, 0, err_msg);
+    if(ret != 0 || !df_mlv->frames)
+    {
+        if(!err_msg[0]) sprintf(err_msg, "Dark frame MLV does not contain any frames:\n\n%s", df_filename);
 #ifndef STDOUT_SILENT
         printf("DF: %s\n", err_msg);
 #endif
         if(error_message != NULL) strcpy(error_message, err_msg);
-        return ret;
+        freeMlvObject(df_mlv);
+        return 1;
     }
 
-    /* if lossless MLV return error */
-    if(df_mlv.MLVI.videoClass & MLV_VIDEO_CLASS_FLAG_LJ92)
+    uint32_t frames = df_mlv->frames;
+    size_t pixel_count = (size_t)df_mlv->RAWI.xRes * df_mlv->RAWI.yRes;
+    int groups = MIN(frames, DF_STACK_GROUPS);
+    uint32_t * sums = calloc(groups * pixel_count, sizeof(uint32_t));
+    uint32_t group_samples[DF_STACK_GROUPS] = { 0 };
+    uint16_t * stacked = calloc(pixel_count * 2 + 4, 1);
+    if(!sums || !stacked)
     {
-        sprintf(err_msg, "Can not use lossless MLV as a dark frame:\n\n%s", video->llrawproc->dark_frame_filename);
+        sprintf(err_msg, "Dark frame stack allocation error");
 #ifndef STDOUT_SILENT
         printf("DF: %s\n", err_msg);
 #endif
         if(error_message != NULL) strcpy(error_message, err_msg);
-        /* Close darkframe MLV */
-        df_unload( &df_mlv );
+        free(sums);
+        free(stacked);
+        freeMlvObject(df_mlv);
+        return 1;
+    }
+
+#ifndef STDOUT_SILENT
+    printf("DF: stacking %u frames, %d group(s)\n", frames, groups);
+#endif
+
+    /* every thread sums its frames into a partial sum and adds that to the group sum only when
+       it moves on to the next group. Static schedule: each thread gets a consecutive range of
+       frames, so that happens about groups + threads times instead of once per frame */
+    #pragma omp parallel num_threads(MAX(threads, 1))
+    {
+        uint16_t * frame = malloc(pixel_count * sizeof(uint16_t));
+        uint32_t * partial = calloc(pixel_count, sizeof(uint32_t));
+        int partial_group = -1;
+        uint32_t partial_samples = 0;
+
+        #pragma omp for schedule(static)
+        for(uint32_t f = 0; f < frames; f++)
+        {
+            int group = (uint64_t)f * groups / frames;
+            if(group != partial_group && partial_samples)
+            {
+                df_stack_add(sums + partial_group * pixel_count, partial, pixel_count, &group_samples[partial_group], partial_samples);
+                partial_samples = 0;
+            }
+            partial_group = group;
+
+            if(!frame || !partial || getMlvRawFrameUint16(df_mlv, f, frame)) continue;
+            for(size_t i = 0; i < pixel_count; i++) partial[i] += frame[i];
+            partial_samples++;
+        }
+        if(partial_samples)
+        {
+            df_stack_add(sums + partial_group * pixel_count, partial, pixel_count, &group_samples[partial_group], partial_samples);
+        }
+
+        free(partial);
+        free(frame);
+    }
+
+    uint32_t samples = 0;
+    for(int g = 0; g < groups; g++) samples += group_samples[g];
+    if(!samples)
+    {
+        sprintf(err_msg, "Could not read dark frame from the file:\n\n%s", df_filename);
+#ifndef STDOUT_SILENT
+        printf("DF: %s\n", err_msg);
+#endif
+        if(error_message != NULL) strcpy(error_message, err_msg);
+        free(sums);
+        free(stacked);
+        freeMlvObject(df_mlv);
         return 1;
     }
+
+    #pragma omp parallel for
+    for(size_t i = 0; i < pixel_count; i++)
+    {
+        uint32_t values[DF_STACK_GROUPS];
+        int n = 0;
+        for(int g = 0; g < groups; g++)
+        {
+            if(!group_samples[g]) continue;
+            uint32_t value = (sums[g * pixel_count + i] + group_samples[g] / 2) / group_samples[g];
+            /* insertion sort, there are only a few groups */
+            int k = n++;
+            while(k > 0 && values[k - 1] > value)
+            {
+                values[k] = values[k - 1];
+                k--;
+            }
+            values[k] = value;
+        }
+        stacked[i] = (n & 1) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2] + 1) / 2;
+    }
+
+    df_fill_hdr(df_mlv, hdr, pixel_count * 2, samples);
+    *data = stacked;
+
+    free(sums);
+    freeMlvObject(df_mlv);
+    return 0;
+}
+
+/* save dark frame master: DARK block header followed by unpacked 16bit frame data */
+int df_save_master(char * filename, mlv_dark_hdr_t * hdr, uint16_t * data)
+{
+    FILE * file = fopen(filename, "wb");
+    if(!file) return 1;
+    mlv_dark_hdr_t master_hdr = *hdr;
+    size_t data_size = (size_t)hdr->xRes * hdr->yRes * 2;
+    master_hdr.blockSize = sizeof(mlv_dark_hdr_t) + data_size;
+    int ret = (fwrite(&master_hdr, sizeof(mlv_dark_hdr_t), 1, file) != 1) || (fwrite(data, data_size, 1, file) != 1);
+    fclose(file);
+    if(ret) remove(filename);
+    return ret;
+}
+
+/* store dark frame master to the library and update the library index,
+   the library holds one master per camera/resolution/ISO/exposure */
+int df_library_add(char * library_dir, mlv_dark_hdr_t * hdr, uint16_t * data, char * master_path)
+{
+    char master_name[256];
+    char index_path[DF_MAX_PATH];
+    char path[DF_MAX_PATH];
+    snprintf(master_name, sizeof(master_name), "DF_%08X_%ux%u_ISO%u_%lluus.darkframe",
+             hdr->cameraModel, hdr->xRes, hdr->yRes, hdr->isoValue, (unsigned long long)hdr->shutterValue);
+    snprintf(path, DF_MAX_PATH, "%s/%s", library_dir, master_name);
+    snprintf(index_path, DF_MAX_PATH, "%s/%s", library_dir, DF_LIBRARY_INDEX);
+
+    if(df_save_master(path, hdr, data))
+    {
+#ifndef STDOUT_SILENT
+        printf("DF: could not write dark frame master: %s\n", path);
+#endif
+        return 1;
+    }
+
+    /* rewrite the index with the new entry replacing an older one with the same key */
+    char * index = NULL;
+    size_t index_size = 0;
+    FILE * file = fopen(index_path, "rb");
+    if(file)
+    {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        index = calloc(size + 1, 1);
+        if(index && size > 0) index_size = fread(index, 1, size, file);
+        fclose(file);
+    }
+
+    file = fopen(index_path, "wb");
+    if(!file)
+    {
+        free(index);
+        return 1;
+    }
+    char * line = index_size ? strtok(index, "\n") : NULL;
+    while(line)
+    {
+        if(!strstr(line, master_name)) fprintf(file, "%s\n", line);
+        line = strtok(NULL, "\n");
+    }
+    fprintf(file, "%08X %u %u %u %llu %u %s\n", hdr->cameraModel, hdr->xRes, hdr->yRes, hdr->isoValue,
+            (unsigned long long)hdr->shutterValue, hdr->samplesAveraged, master_name);
+    fclose(file);
+    free(index);
+
+    if(master_path) snprintf(master_path, DF_MAX_PATH, "%s", path);
+#ifndef STDOUT_SILENT
+    printf("DF: stored master in library: %s\n", path);
+#endif
+    return 0;
+}
+
+/* find the library master matching camera, resolution and ISO of the clip, with the closest exposure time */
+int df_library_find(mlvObject_t * video, char * library_dir, char * master_path)
+{
+    char index_path[DF_MAX_PATH];
+    snprintf(index_path, DF_MAX_PATH, "%s/%s", library_dir, DF_LIBRARY_INDEX);
+    FILE * file = fopen(index_path, "r");
+    if(!file) return 1;
+
+    char line[512];
+    char best_name[256] = { 0 };
+    uint64_t best_diff = UINT64_MAX;
+    while(fgets(line, sizeof(line), file))
+    {
+        unsigned int camera, xres, yres, iso, samples;
+        unsigned long long shutter;
+        char name[256];
+        if(sscanf(line, "%X %u %u %u %llu %u %255s", &camera, &xres, &yres, &iso, &shutter, &samples, name) != 7) continue;
+        if(camera != video->IDNT.cameraModel || xres != video->RAWI.xRes || yres != video->RAWI.yRes || iso != video->EXPO.isoValue) continue;
+
+        uint64_t diff = (shutter > video->EXPO.shutterValue) ? shutter - video->EXPO.shutterValue : video->EXPO.shutterValue - shutter;
+        if(diff < best_diff)
+        {
+            best_diff = diff;
+            strcpy(best_name, name);
+        }
+    }
+    fclose(file);
+
+    if(!best_name[0]) return 1;
+    snprintf(master_path, DF_MAX_PATH, "%s/%s", library_dir, best_name);
+    return !df_is_master(master_path);
+}
+
+/* check if the dark frame file is a MLV which has to be stacked to a master before it can be used */
+int df_needs_stacking(char * df_filename)
+{
+    if(df_is_master(df_filename)) return 0;
+    mlvObject_t df_mlv = { 0 };
+    char err_msg[256] = { 0 };
+    if(openMlvClip(&df_mlv, df_filename, 2, err_msg) != 0) return 0;
+    int ret = df_mlv_needs_stacking(&df_mlv);
+    df_unload( &df_mlv );
+    return ret;
+}
+
+/* stack a lossless or multi frame dark MLV and store it as single frame master to the library,
+   slow: not to be called on the render path. master_path gets the path of the new master */
+int df_build_master(char * df_filename, char * library_dir, int threads, char * master_path, char * error_message)
+{
+    mlv_dark_hdr_t hdr;
+    uint16_t * data = NULL;
+    if(df_stack_mlv(df_filename, threads, &hdr, &data, error_message)) return 1;
+
+    int ret = df_library_add(library_dir, &hdr, data, master_path);
+    if(ret && error_message != NULL) sprintf(error_message, "Could not write dark frame master to the library:\n\n%s", library_dir);
+    free(data);
+    return ret;
+}
+
+/* load dark frame from external MLV file or dark frame master */
+static int df_load_ext(mlvObject_t * video, int validate_only, char * error_message)
+{
+    /* If file name is not set return error */
+    if(!video->llrawproc->dark_frame_filename) return 1;
+    /* Averaged dark frame from the library */
+    if(df_is_master(video->llrawproc->dark_frame_filename))
+    {
+        return df_load_master(video, video->llrawproc->dark_frame_filename, validate_only, error_message);
+    }
+    /* Parse dark frame MLV */
+    mlvObject_t df_mlv = { 0 };
+    char err_msg[256] = { 0 };
+    int ret = openMlvClip(&df_mlv, video->llrawproc->dark_frame_filename, 2, err_msg);
+    if(ret != 0)
+    {
+#ifndef STDOUT_SILENT
+        printf("DF: %s\n", err_msg);
+#endif
+        if(error_message != NULL) strcpy(error_message, err_msg);
+        return ret;
+    }
+
     /* if resolution mismatch detected */
     if( (df_mlv.RAWI.xRes != video->RAWI.xRes) || (df_mlv.RAWI.yRes != video->RAWI.yRes) )
     {
@@ -122,14 +501,20 @@ static int df_load_ext(mlvObject_t * video, char * error_message)
         df_unload( &df_mlv );
         return 1;
     }
-    /* if MLV has more than one frame just show the warning */
-    if( df_mlv.MLVI.videoFrameCount > 1 )
+
+    /* compressed or not yet averaged MLV has to be stacked to a master first, see df_build_master() */
+    int needs_stacking = df_mlv_needs_stacking(&df_mlv);
+    if(needs_stacking || validate_only)
     {
-        sprintf(err_msg, "For proper use as a dark frame all frames of this MLV have to be averaged first:\n\n%s", video->llrawproc->dark_frame_filename);
+        /* Close darkframe MLV */
+        df_unload( &df_mlv );
+        if(validate_only) return 0;
+        sprintf(err_msg, "Dark frame MLV has to be stacked to a master first:\n\n%s", video->llrawproc->dark_frame_filename);
 #ifndef STDOUT_SILENT
         printf("DF: %s\n", err_msg);
 #endif
         if(error_message != NULL) strcpy(error_message, err_msg);
+        return 1;
     }
 
     /* Allocate dark frame data buffer */
@@ -159,36 +544,14 @@ static int df_load_ext(mlvObject_t * video, char * error_message)
         df_unload( &df_mlv );
         return 1;
     }
-    /* Free all data related to the dark frame if needed */
-    df_free(video);
     /* Fill DARK block header */
-    memcpy(&video->llrawproc->dark_frame_hdr.blockType, "DARK", 4);
-    video->llrawproc->dark_frame_hdr.blockSize = sizeof(mlv_dark_hdr_t) + df_mlv.video_index[0].frame_size;
-    video->llrawproc->dark_frame_hdr.timestamp = 0xFFFFFFFFFFFFFFFF;
-    video->llrawproc->dark_frame_hdr.samplesAveraged = MAX(df_mlv.VIDF.frameNumber + 1, df_mlv.MLVI.videoFrameCount);
-    video->llrawproc->dark_frame_hdr.cameraModel = df_mlv.IDNT.cameraModel;
-    video->llrawproc->dark_frame_hdr.xRes = df_mlv.RAWI.xRes;
-    video->llrawproc->dark_frame_hdr.yRes = df_mlv.RAWI.yRes;
-    video->llrawproc->dark_frame_hdr.rawWidth = df_mlv.RAWI.raw_info.width;
-    video->llrawproc->dark_frame_hdr.rawHeight = df_mlv.RAWI.raw_info.height;
-    video->llrawproc->dark_frame_hdr.bits_per_pixel = df_mlv.RAWI.raw_info.bits_per_pixel;
-    video->llrawproc->dark_frame_hdr.black_level = df_mlv.RAWI.raw_info.black_level;
-    video->llrawproc->dark_frame_hdr.white_level = df_mlv.RAWI.raw_info.white_level;
-    video->llrawproc->dark_frame_hdr.sourceFpsNom = df_mlv.MLVI.sourceFpsNom;
-    video->llrawproc->dark_frame_hdr.sourceFpsDenom = df_mlv.MLVI.sourceFpsDenom;
-    video->llrawproc->dark_frame_hdr.isoMode = df_mlv.EXPO.isoMode;
-    video->llrawproc->dark_frame_hdr.isoValue = df_mlv.EXPO.isoValue;
-    video->llrawproc->dark_frame_hdr.isoAnalog = df_mlv.EXPO.isoAnalog;
-    video->llrawproc->dark_frame_hdr.digitalGain = df_mlv.EXPO.digitalGain;
-    video->llrawproc->dark_frame_hdr.shutterValue = df_mlv.EXPO.shutterValue;
-    video->llrawproc->dark_frame_hdr.binning_x = df_mlv.RAWC.binning_x;
-    video->llrawproc->dark_frame_hdr.skipping_x = df_mlv.RAWC.skipping_x;
-    video->llrawproc->dark_frame_hdr.binning_y = df_mlv.RAWC.binning_y;
-    video->llrawproc->dark_frame_hdr.skipping_y = df_mlv.RAWC.skipping_y;
+    mlv_dark_hdr_t hdr;
+    df_fill_hdr(&df_mlv, &hdr, df_mlv.video_index[0].frame_size, MAX(df_mlv.VIDF.frameNumber + 1, df_mlv.MLVI.videoFrameCount));
     /* Allocate the dark frame 16bit buffer */
-    video->llrawproc->dark_frame_size = df_mlv.RAWI.xRes * df_mlv.RAWI.yRes * 2;
-    video->llrawproc->dark_frame_data = calloc(video->llrawproc->dark_frame_size + 4, 1);
-    dng_unpack_image_bits(video->llrawproc->dark_frame_data, (uint16_t*)df_packed_buf, df_mlv.RAWI.xRes, df_mlv.RAWI.yRes, df_mlv.RAWI.raw_info.bits_per_pixel);
+    uint32_t size = df_mlv.RAWI.xRes * df_mlv.RAWI.yRes * 2;
+    uint16_t * data = calloc(size + 4, 1);
+    dng_unpack_image_bits(data, (uint16_t*)df_packed_buf, df_mlv.RAWI.xRes, df_mlv.RAWI.yRes, df_mlv.RAWI.raw_info.bits_per_pixel);
+    df_set_data(video, &hdr, data, size);
 #ifndef STDOUT_SILENT
     printf("DF: initialized Ext mode\n");
 #endif
@@ -225,14 +588,11 @@ static int df_load_int(mlvObject_t * video)
         free(df_packed_buf);
         return 1;
     }
-    /* Free all data related to the dark frame if needed */
-    df_free(video);
-    /* Copy DARK block header */
-    memcpy(&video->llrawproc->dark_frame_hdr, &video->DARK, sizeof(mlv_dark_hdr_t));
     /* Allocate the dark frame 16bit buffer */
-    video->llrawproc->dark_frame_size = video->DARK.xRes * video->DARK.yRes * 2;
-    video->llrawproc->dark_frame_data = calloc(video->llrawproc->dark_frame_size + 4, 1);
-    dng_unpack_image_bits(video->llrawproc->dark_frame_data, (uint16_t*)df_packed_buf, video->DARK.xRes, video->DARK.yRes, video->DARK.bits_per_pixel);
+    uint32_t size = video->DARK.xRes * video->DARK.yRes * 2;
+    uint16_t * data = calloc(size + 4, 1);
+    dng_unpack_image_bits(data, (uint16_t*)df_packed_buf, video->DARK.xRes, video->DARK.yRes, video->DARK.bits_per_pixel);
+    df_set_data(video, &video->DARK, data, size);
 #ifndef STDOUT_SILENT
     printf("DF: initialized Int mode\n");
 #endif
@@ -240,86 +600,113 @@ static int df_load_int(mlvObject_t * video)
     return 0;
 }
 
+/* filename changes, the caller holds dark_frame_mutex so df_init can't load from it meanwhile */
+static void df_set_filename(mlvObject_t * video, char * df_filename)
+{
+    /* dark frame loaded from the previous file is not valid anymore */
+    if(video->llrawproc->dark_frame_source == DF_EXT) df_free(video);
+    if(video->llrawproc->dark_frame_filename) free(video->llrawproc->dark_frame_filename);
+    video->llrawproc->dark_frame_filename = df_filename ? strdup(df_filename) : NULL;
+    video->llrawproc->dark_frame_failed = DF_OFF;
+}
+
 /* copy filename of external dark frame MLV to llrawproc structure */
 void df_init_filename(mlvObject_t * video, char * df_filename)
 {
-    size_t df_filename_size = strlen(df_filename);
-    video->llrawproc->dark_frame_filename = calloc(df_filename_size + 1, 1);
-    memcpy(video->llrawproc->dark_frame_filename, df_filename, df_filename_size);
+    pthread_mutex_lock(&video->llrawproc->dark_frame_mutex);
+    df_set_filename(video, df_filename);
+    pthread_mutex_unlock(&video->llrawproc->dark_frame_mutex);
 }
 
 /* delete filename of external dark frame MLV from llrawproc structure */
 void df_free_filename(mlvObject_t * video)
 {
-    if(video->llrawproc->dark_frame_filename) free(video->llrawproc->dark_frame_filename);
-    video->llrawproc->dark_frame_filename = NULL;
+    pthread_mutex_lock(&video->llrawproc->dark_frame_mutex);
+    df_set_filename(video, NULL);
+    pthread_mutex_unlock(&video->llrawproc->dark_frame_mutex);
 }
 
-/* subtract dark frame from the current frame */
-void df_subtract(mlvObject_t * video, uint16_t * raw_image_buff, size_t raw_image_size)
+/* subtract dark frame from pixel_count pixels of the current frame, starting at first_pixel,
+   the caller holds the dark frame read lock (df_lock) and has checked the frame size */
+void df_subtract(mlvObject_t * video, uint16_t * raw_image_buff, size_t first_pixel, size_t pixel_count)
 {
-    if( !video->llrawproc->dark_frame_data || (raw_image_size != video->llrawproc->dark_frame_size) )
-    {
-#ifndef STDOUT_SILENT
-    printf("DF: subtracting is impossible, invalid dark frame'\n\n");
-#endif
-        return;
-    }
-#ifndef STDOUT_SILENT
-    printf("Subtracting dark frame...'\n\n");
-#endif
-    uint16_t * dark_frame_data = video->llrawproc->dark_frame_data;
+    uint16_t * dark_frame_data = video->llrawproc->dark_frame_data + first_pixel;
+    uint16_t * raw_pixels = raw_image_buff + first_pixel;
     uint32_t black_level = video->llrawproc->dark_frame_hdr.black_level;
     uint16_t white_level = (1 << video->RAWI.raw_info.bits_per_pixel) - 1;
 
-    uint32_t pixel_count = raw_image_size / 2;
-#pragma omp parallel for
-    for(uint32_t i = 0; i < pixel_count; i++)
+    for(size_t i = 0; i < pixel_count; i++)
     {
-        int32_t orig_val = raw_image_buff[i];
+        int32_t orig_val = raw_pixels[i];
         int32_t dark_val = dark_frame_data[i];
 
-        raw_image_buff[i] = COERCE( orig_val - dark_val + black_level, 0, white_level );
+        raw_pixels[i] = COERCE( orig_val - dark_val + black_level, 0, white_level );
     }
 }
 
 /* validate external dark frame file */
 int df_validate(mlvObject_t * video, char * df_filename, char * error_message)
 {
-    df_init_filename(video, df_filename);
-    int ret = df_load_ext(video, error_message);
-    df_free_filename(video);
-    df_free(video);
+    pthread_mutex_lock(&video->llrawproc->dark_frame_mutex);
+    df_set_filename(video, df_filename);
+    int ret = df_load_ext(video, 1, error_message);
+    df_set_filename(video, NULL);
+    pthread_mutex_unlock(&video->llrawproc->dark_frame_mutex);
 
     return ret;
 }
 
-/* process DF modes: Off, Ext or Int, if Off just free all DF data */
+/* process DF modes: Off, Ext or Int, if Off just free all DF data
+   the dark frame is loaded once and kept until mode or file name changes */
 int df_init(mlvObject_t * video)
 {
-    switch(video->llrawproc->dark_frame)
+    int ret = 1;
+    pthread_mutex_lock(&video->llrawproc->dark_frame_mutex);
+    /* data is only replaced with dark_frame_mutex held, no need for the read lock */
+    if(video->llrawproc->dark_frame_data && video->llrawproc->dark_frame_source == video->llrawproc->dark_frame)
+    {
+        ret = 0;
+    }
+    /* loading failed already for this mode and file, don't retry on every frame */
+    else if(video->llrawproc->dark_frame != DF_OFF && video->llrawproc->dark_frame_failed == video->llrawproc->dark_frame)
+    {
+        ret = 1;
+    }
+    else switch(video->llrawproc->dark_frame)
     {
         case DF_EXT:
-            return df_load_ext(video, NULL);
+            ret = df_load_ext(video, 0, NULL);
+            break;
         case DF_INT:
-            return df_load_int(video);
+            ret = df_load_int(video);
+            break;
         default:
             df_free(video);
-            return 1; // DF mode = Off
+            ret = 1; // DF mode = Off
     }
+    if(!ret) video->llrawproc->dark_frame_source = video->llrawproc->dark_frame;
+    else video->llrawproc->dark_frame_failed = video->llrawproc->dark_frame;
+    pthread_mutex_unlock(&video->llrawproc->dark_frame_mutex);
+    return ret;
 }
 
 /* free all DF data */
 void df_free(mlvObject_t * video)
 {
-    if(video->llrawproc->dark_frame_data)
-    {
-#ifndef STDOUT_SILENT
-        printf("DF: all data freed\n");
-#endif
-        free(video->llrawproc->dark_frame_data);
-        video->llrawproc->dark_frame_data = NULL;
-        video->llrawproc->dark_frame_size = 0;
-        memset(&video->llrawproc->dark_frame_hdr, 0, sizeof(mlv_dark_hdr_t));
-    }
+    df_set_data(video, NULL, NULL, 0);
+}
+
+/* read lock the dark frame for subtracting it from a frame of raw_image_size bytes,
+   returns 0 (and keeps the lock until df_unlock) if it is loaded and matches the frame */
+int df_lock(mlvObject_t * video, size_t raw_image_size)
+{
+    pthread_rwlock_rdlock(&video->llrawproc->dark_frame_lock);
+    if(video->llrawproc->dark_frame_data && raw_image_size == video->llrawproc->dark_frame_size) return 0;
+    pthread_rwlock_unlock(&video->llrawproc->dark_frame_lock);
+    return 1;
+}
+
+void df_unlock(mlvObject_t * video)
+{
+    pthread_rwlock_unlock(&video->llrawproc->dark_frame_lock);
 }
@@ -25,6 +25,9 @@
 
 /* from video_mlv.c */
 extern int openMlvClip(mlvObject_t * video, char * mlvPath, int open_mode, char * error_message);
+extern mlvObject_t * initMlvObject();
+extern void freeMlvObject(mlvObject_t * video);
+extern int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame);
 /* from dng.c */
 extern void dng_unpack_image_bits(uint16_t * input_buffer, uint16_t * output_buffer, int width, int height, uint32_t bpp);
 
@@ -36,6 +39,17 @@ int df_validate(mlvObject_t * video, char * df_filename, char * error_message);
 int df_init(mlvObject_t * video);
 void df_free(mlvObject_t * video);
 
-void df_subtract(mlvObject_t * video, uint16_t * raw_image_buff, size_t raw_image_size);
+/* df_subtract only between df_lock (returns 0 if the dark frame matches the frame) and df_unlock */
+int df_lock(mlvObject_t * video, size_t raw_image_size);
+void df_unlock(mlvObject_t * video);
+void df_subtract(mlvObject_t * video, uint16_t * raw_image_buff, size_t first_pixel, size_t pixel_count);
+
+/* dark frame masters and library */
+int df_needs_stacking(char * df_filename);
+int df_build_master(char * df_filename, char * library_dir, int threads, char * master_path, char * error_message);
+int df_stack_mlv(char * df_filename, int threads, mlv_dark_hdr_t * hdr, uint16_t ** data, char * error_message);
+int df_save_master(char * filename, mlv_dark_hdr_t * hdr, uint16_t * data);
+int df_library_add(char * library_dir, mlv_dark_hdr_t * hdr, uint16_t * data, char * master_path);
+int df_library_find(mlvObject_t * video, char * library_dir, char * master_path);
 
 #endif
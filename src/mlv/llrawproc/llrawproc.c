@@ -38,6 +38,9 @@
 #define COERCE(x,lo,hi) MAX(MIN((x),(hi)),(lo))
 #define ABS(a) ((a) > 0 ? (a) : -(a))
 
+/* pixels per band in applyLLRawProcObject */
+#define LLRP_BAND_PIXELS ((size_t)1 << 16)
+
 /* this is DNG feature only */
 static void deflicker(mlvObject_t * video, uint16_t * raw_image_buff, size_t raw_image_size)
 {
@@ -52,35 +55,27 @@ static void deflicker(mlvObject_t * video, uint16_t * raw_image_buff, size_t raw
     video->RAWI.raw_info.exposure_bias[1] = 10000;
 }
 
-/* convert uncompressed 10/12bit raw data to 14bit for subsequent processing */
-static void make_14bit(uint16_t * raw_image_buff, size_t raw_image_size, struct raw_info * raw_info)
+/* convert uncompressed 10/12bit raw data to 14bit for subsequent processing, returns the brightest pixel */
+static uint16_t make_14bit(uint16_t * raw_pixels, size_t pixel_count, int bits_shift)
 {
-    uint32_t pixel_count = raw_image_size / 2;
-    int bits_shift = 14 - raw_info->bits_per_pixel;
-    raw_info->black_level <<= bits_shift;
-    raw_info->white_level <<= bits_shift;
-    raw_info->bits_per_pixel = 14;
-    raw_info->frame_size = raw_info->width * raw_info->height * 14 / 8;
-
-    #pragma omp parallel for
-    for(uint32_t i = 0; i < pixel_count; ++i)
+    uint16_t max_level = 0;
+    for(size_t i = 0; i < pixel_count; ++i)
     {
-        raw_image_buff[i] <<= bits_shift;
+        raw_pixels[i] <<= bits_shift;
+        max_level = MAX(max_level, raw_pixels[i]);
     }
+    return max_level;
 }
 
 /* undo 14bit conversion to initial bit depth with rounding error minimizing */
-static void undo_14bit(uint16_t * raw_image_buff, size_t raw_image_size, uint32_t bpp)
+static void undo_14bit(uint16_t * raw_pixels, size_t pixel_count, int bits_shift)
 {
-    uint32_t pixel_count = raw_image_size / 2;
-    int bits_shift = 14 - bpp;
     /* calculate rounding number to be added to the raw value before shifting right to minimize rounding error */
     uint32_t rounding_number = (uint32_t)pow(2, bits_shift - 1);
 
-    #pragma omp parallel for
-    for(uint32_t i = 0; i < pixel_count; ++i)
+    for(size_t i = 0; i < pixel_count; ++i)
     {
-        raw_image_buff[i] = (raw_image_buff[i] + rounding_number) >> bits_shift;
+        raw_pixels[i] = (raw_pixels[i] + rounding_number) >> bits_shift;
     }
 }
 
@@ -173,6 +168,11 @@ llrawprocObject_t * initLLRawProcObject()
     llrawproc->dark_frame_filename = NULL;
     llrawproc->dark_frame_data = NULL;
     llrawproc->dark_frame_size = 0;
+    llrawproc->dark_frame_source = DF_OFF;
+    llrawproc->dark_frame_failed = DF_OFF;
+    llrawproc->dark_frame_library = NULL;
+    pthread_mutex_init(&llrawproc->dark_frame_mutex, NULL);
+    pthread_rwlock_init(&llrawproc->dark_frame_lock, NULL);
 
     llrawproc->raw2ev = NULL;
     llrawproc->ev2raw = NULL;
@@ -184,6 +184,8 @@ llrawprocObject_t * initLLRawProcObject()
     llrawproc->bad_pixel_map.type = PIX_BAD;
     llrawproc->bad_pixel_map.pixels = NULL;
 
+    init_pattern_noise_buffers(&llrawproc->pattern_noise_buffers);
+
     return llrawproc;
 }
 
@@ -191,37 +193,153 @@ void freeLLRawProcObject(mlvObject_t * video)
 {
     df_free_filename(video);
     df_free(video);
+    free(video->llrawproc->dark_frame_library);
+    pthread_mutex_destroy(&video->llrawproc->dark_frame_mutex);
+    pthread_rwlock_destroy(&video->llrawproc->dark_frame_lock);
     free_luts(video->llrawproc->raw2ev, video->llrawproc->ev2raw);
     free_pixel_maps(&(video->llrawproc->focus_pixel_map), &(video->llrawproc->bad_pixel_map));
+    free_pattern_noise_buffers(&(video->llrawproc->pattern_noise_buffers));
     free(video->llrawproc);
 }
 
 /* all low level raw processing takes place here */
 void applyLLRawProcObject(mlvObject_t * video, uint16_t * raw_image_buff, size_t raw_image_size)
 {
+    llrpFrame_t frame;
+    size_t pixel_count = raw_image_size / 2;
+    int bands = (int)((pixel_count + LLRP_BAND_PIXELS - 1) / LLRP_BAND_PIXELS);
+
+    llrpBeginFrame(video, &frame, raw_image_size);
+
+    #pragma omp parallel for
+    for(int band = 0; band < bands; band++)
+    {
+        size_t first = (size_t)band * LLRP_BAND_PIXELS;
+        llrpProcessPixels(video, &frame, raw_image_buff, first, MIN(LLRP_BAND_PIXELS, pixel_count - first));
+    }
+
+    llrpProcessFrame(video, &frame, raw_image_buff);
+
+    #pragma omp parallel for
+    for(int band = 0; band < bands; band++)
+    {
+        size_t first = (size_t)band * LLRP_BAND_PIXELS;
+        llrpFinishPixels(&frame, raw_image_buff, first, MIN(LLRP_BAND_PIXELS, pixel_count - first));
+    }
+}
+
+void llrpBeginFrame(mlvObject_t * video, llrpFrame_t * frame, size_t raw_image_size)
+{
+    memset(frame, 0, sizeof(llrpFrame_t));
+
     /* if 'fix_raw == false' skip raw processing alltogether */
-    if(!video->llrawproc->fix_raw) return;
+    frame->active = video->llrawproc->fix_raw;
+    if(!frame->active) return;
 
     /* subtract dark frame if Ext or Int mode specified and df_init is successful */
     if (!df_init(video))
     {
+        /* the dark frame stays read locked until llrpProcessFrame, so it can't be freed meanwhile */
+        if(!df_lock(video, raw_image_size))
+        {
 #ifndef STDOUT_SILENT
-        printf("Subtracting Dark Frame... ");
+            printf("Subtracting Dark Frame...\n\n");
 #endif
-        df_subtract(video, raw_image_buff, raw_image_size);
+            frame->dark_frame = 1;
+        }
+        else
+        {
 #ifndef STDOUT_SILENT
-        printf("Done\n\n");
+            printf("DF: subtracting is impossible, invalid dark frame'\n\n");
 #endif
+        }
     }
 
     /* make copy of 'RAWI.raw_info' struct for subsequent modification */
-    struct raw_info raw_info = video->RAWI.raw_info;
+    frame->raw_info = video->RAWI.raw_info;
 
     /* convert uncompressed 10/12bit raw data to 14bits for correct processing */
     if(video->RAWI.raw_info.bits_per_pixel < 14)
     {
-        make_14bit(raw_image_buff, raw_image_size, &raw_info);
+        struct raw_info * raw_info = &frame->raw_info;
+        frame->bits_shift = 14 - raw_info->bits_per_pixel;
+        raw_info->black_level <<= frame->bits_shift;
+        raw_info->white_level <<= frame->bits_shift;
+        raw_info->bits_per_pixel = 14;
+        raw_info->frame_size = raw_info->width * raw_info->height * 14 / 8;
+
+        /* undo 14bit conversion at the end, except when 20bit dual iso processing is active */
+        if(video->llrawproc->dual_iso != 1) frame->undo_shift = frame->bits_shift;
+    }
+
+    /* the stripes correction needs the brightest pixel of the frame before correcting */
+    frame->stripes_max = video->llrawproc->vertical_stripes != 0;
+}
+
+void llrpProcessPixels(mlvObject_t * video, llrpFrame_t * frame, uint16_t * raw_image_buff, size_t first_pixel, size_t pixel_count)
+{
+    if(!frame->active) return;
+
+    if(frame->dark_frame)
+    {
+        df_subtract(video, raw_image_buff, first_pixel, pixel_count);
+    }
+
+    if(frame->bits_shift || frame->stripes_max)
+    {
+        uint16_t max_level = make_14bit(raw_image_buff + first_pixel, pixel_count, frame->bits_shift);
+        if(frame->stripes_max)
+        {
+            #pragma omp critical (llrp_max_level)
+            frame->max_level = MAX(frame->max_level, max_level);
+        }
+    }
+}
+
+void llrpFinishPixels(llrpFrame_t * frame, uint16_t * raw_image_buff, size_t first_pixel, size_t pixel_count)
+{
+    if(frame->active && frame->undo_shift)
+    {
+        undo_14bit(raw_image_buff + first_pixel, pixel_count, frame->undo_shift);
+    }
+}
+
+void llrpFinishPixelsFloat(llrpFrame_t * frame, uint16_t * raw_image_buff, float * output, size_t first_pixel, size_t pixel_count, int shift)
+{
+    uint16_t * raw_pixels = raw_image_buff + first_pixel;
+    float * output_pixels = output + first_pixel;
+
+    if(frame->active && frame->undo_shift)
+    {
+        int bits_shift = frame->undo_shift;
+        uint32_t rounding_number = (uint32_t)pow(2, bits_shift - 1);
+        for(size_t i = 0; i < pixel_count; ++i)
+        {
+            output_pixels[i] = (float)((uint16_t)((raw_pixels[i] + rounding_number) >> bits_shift) << shift);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < pixel_count; ++i)
+        {
+            output_pixels[i] = (float)(raw_pixels[i] << shift);
+        }
     }
+}
+
+void llrpCancelFrame(mlvObject_t * video, llrpFrame_t * frame)
+{
+    if(frame->dark_frame) df_unlock(video);
+    frame->dark_frame = 0;
+}
+
+void llrpProcessFrame(mlvObject_t * video, llrpFrame_t * frame, uint16_t * raw_image_buff)
+{
+    /* all llrpProcessPixels are done, release the dark frame */
+    llrpCancelFrame(video, frame);
+    if(!frame->active) return;
+
+    struct raw_info raw_info = frame->raw_info;
 
     /* initialize dual iso black and white levels */
     llrpResetDngBWLevels(video);
@@ -243,6 +361,7 @@ void applyLLRawProcObject(mlvObject_t * video, uint16_t * raw_image_buff, size_t
                              raw_image_buff,
                              raw_info.black_level,
                              raw_info.white_level,
+                             frame->max_level,
                              raw_info.frame_size,
                              video->RAWI.xRes,
                              video->RAWI.yRes,
@@ -303,7 +422,7 @@ void applyLLRawProcObject(mlvObject_t * video, uint16_t * raw_image_buff, size_t
 #ifndef STDOUT_SILENT
         printf("Fixing pattern noise... ");
 #endif
-        fix_pattern_noise((int16_t *)raw_image_buff, video->RAWI.xRes, video->RAWI.yRes, raw_info.white_level, 0);
+        fix_pattern_noise(&video->llrawproc->pattern_noise_buffers, (int16_t *)raw_image_buff, video->RAWI.xRes, video->RAWI.yRes, raw_info.white_level, 0);
 #ifndef STDOUT_SILENT
         printf("Done\n\n");
 #endif
@@ -455,12 +574,6 @@ void applyLLRawProcObject(mlvObject_t * video, uint16_t * raw_image_buff, size_t
                       video->llrawproc->ev2raw);
     }
 
-    /* undo 14bit conversion of uncompressed 10/12bit raw data, except when 20bit dual iso processing is active */
-    if(video->RAWI.raw_info.bits_per_pixel < 14 && video->llrawproc->dual_iso != 1)
-    {
-        undo_14bit(raw_image_buff, raw_image_size, video->RAWI.raw_info.bits_per_pixel);
-    }
-
     /* deflicker RAW data by changing 'tcBaselineExposure' tag in the exported DNG */
     /*
     if (video->llrawproc->deflicker_target)
@@ -468,7 +581,7 @@ void applyLLRawProcObject(mlvObject_t * video, uint16_t * raw_image_buff, size_t
 #ifndef STDOUT_SILENT
         printf("Per-frame exposure compensation: 'ON'\nDeflicker target: '%d'\n\n", video->llrawproc->deflicker_target);
 #endif
-        deflicker(video, raw_image_buff, raw_image_size);
+        deflicker(video, raw_image_buff, video->RAWI.xRes * video->RAWI.yRes * sizeof(uint16_t));
     }
     */
 
@@ -515,6 +628,14 @@ void llrpSetFixRawMode(mlvObject_t * video, int value)
     video->llrawproc->fix_raw = value;
 }
 
+int llrpRawFixesActive(mlvObject_t * video)
+{
+    llrawprocObject_t * llrawproc = video->llrawproc;
+    return llrawproc->fix_raw && (llrawproc->dark_frame || llrawproc->focus_pixels || llrawproc->bad_pixels
+                                  || llrawproc->vertical_stripes || llrawproc->chroma_smooth
+                                  || llrawproc->pattern_noise || llrawproc->dual_iso);
+}
+
 int llrpGetVerticalStripeMode(mlvObject_t * video)
 {
     return video->llrawproc->vertical_stripes;
@@ -764,3 +885,92 @@ int llrpValidateExtDarkFrame(mlvObject_t * video, char * df_filename, char * err
 {
     return df_validate(video, df_filename, error_message);
 }
+
+void llrpSetDarkFrameLibrary(mlvObject_t * video, char * library_dir)
+{
+    free(video->llrawproc->dark_frame_library);
+    video->llrawproc->dark_frame_library = NULL;
+    if(library_dir) video->llrawproc->dark_frame_library = strdup(library_dir);
+}
+
+void llrpGetSettings(mlvObject_t * video, llrpSettings_t * settings)
+{
+    llrawprocObject_t * llrawproc = video->llrawproc;
+
+    /* zeroed, so the settings can be compared and hashed as bytes */
+    memset(settings, 0, sizeof(llrpSettings_t));
+    settings->fix_raw = llrawproc->fix_raw;
+    settings->vertical_stripes = llrawproc->vertical_stripes;
+    settings->focus_pixels = llrawproc->focus_pixels;
+    settings->fpi_method = llrawproc->fpi_method;
+    settings->bad_pixels = llrawproc->bad_pixels;
+    settings->bps_method = llrawproc->bps_method;
+    settings->bpi_method = llrawproc->bpi_method;
+    settings->chroma_smooth = llrawproc->chroma_smooth;
+    settings->pattern_noise = llrawproc->pattern_noise;
+    settings->dual_iso = llrawproc->dual_iso;
+    settings->diso_averaging = llrawproc->diso_averaging;
+    settings->diso_alias_map = llrawproc->diso_alias_map;
+    settings->diso_frblending = llrawproc->diso_frblending;
+    settings->dark_frame = llrawproc->dark_frame;
+    pthread_mutex_lock(&llrawproc->dark_frame_mutex);
+    if(llrawproc->dark_frame_filename) strncpy(settings->dark_frame_filename, llrawproc->dark_frame_filename, DF_MAX_PATH - 1);
+    pthread_mutex_unlock(&llrawproc->dark_frame_mutex);
+
+    settings->diso_validity = llrawproc->diso_validity;
+    settings->diso_pattern = llrawproc->diso_pattern;
+    settings->diso_auto_correction = llrawproc->diso_auto_correction;
+    settings->diso_ev_correction = llrawproc->diso_ev_correction;
+    settings->diso_black_delta = llrawproc->diso_black_delta;
+    if(llrawproc->dark_frame_library) strncpy(settings->dark_frame_library, llrawproc->dark_frame_library, DF_MAX_PATH - 1);
+}
+
+void llrpSetSettings(mlvObject_t * video, llrpSettings_t * settings)
+{
+    llrawprocObject_t * llrawproc = video->llrawproc;
+
+    llrawproc->fix_raw = settings->fix_raw;
+    llrawproc->vertical_stripes = settings->vertical_stripes;
+    llrawproc->compute_stripes = (settings->vertical_stripes != 0);
+    llrawproc->focus_pixels = settings->focus_pixels;
+    llrawproc->fpi_method = settings->fpi_method;
+    llrawproc->bad_pixels = settings->bad_pixels;
+    llrawproc->bps_method = settings->bps_method;
+    llrawproc->bpi_method = settings->bpi_method;
+    llrawproc->chroma_smooth = settings->chroma_smooth;
+    llrawproc->pattern_noise = settings->pattern_noise;
+    llrawproc->dual_iso = settings->dual_iso;
+    llrawproc->diso_averaging = settings->diso_averaging;
+    llrawproc->diso_alias_map = settings->diso_alias_map;
+    llrawproc->diso_frblending = settings->diso_frblending;
+    llrawproc->dark_frame = settings->dark_frame;
+    if(settings->dark_frame_filename[0]) llrpInitDarkFrameExtFileName(video, settings->dark_frame_filename);
+    else llrpFreeDarkFrameExtFileName(video);
+
+    /* old dual iso clips without DISO block have to be forced, real ones are found when opening */
+    if(settings->diso_validity == DISO_FORCED) llrpSetDualIsoValidity(video, 1);
+    llrawproc->diso_pattern = settings->diso_pattern;
+    llrawproc->diso_auto_correction = settings->diso_auto_correction;
+    llrawproc->diso_ev_correction = settings->diso_ev_correction;
+    llrawproc->diso_black_delta = settings->diso_black_delta;
+    llrpSetDarkFrameLibrary(video, settings->dark_frame_library[0] ? settings->dark_frame_library : NULL);
+
+    llrpResetFpmStatus(video);
+    llrpResetBpmStatus(video);
+}
+
+int llrpFindDarkFrameInLibrary(mlvObject_t * video, char * master_path)
+{
+    if(!video->llrawproc->dark_frame_library) return 1;
+    return df_library_find(video, video->llrawproc->dark_frame_library, master_path);
+}
+
+int llrpDarkFrameNeedsStacking(char * df_filename)
+{
+    return df_needs_stacking(df_filename);
+}
+
+int llrpBuildDarkFrameMaster(char * df_filename, char * library_dir, int threads, char * master_path, char * error_message)
+{
+    return df_build_master(df_filename, library_dir, threads, master_path, error_message);
+}
@@ -30,6 +30,31 @@ void freeLLRawProcObject(mlvObject_t * video);
 /* all low level raw processing takes place here */
 void applyLLRawProcObject(mlvObject_t * video, uint16_t * raw_image_buff, size_t raw_image_size);
 
+/* applyLLRawProcObject in steps, so the pixel wise parts can run on bands of the frame while
+   it is still in cache from unpacking or until it is converted to float:
+   llrpBeginFrame once, llrpProcessPixels on all bands, llrpProcessFrame once (stripes,
+   pixel fixes, pattern noise, dual iso, chroma smoothing) and llrpFinishPixels(Float) on all bands.
+   Bands can be processed in parallel. llrpBeginFrame may lock the dark frame until llrpProcessFrame,
+   call llrpCancelFrame instead if the frame is given up before (same thread as llrpBeginFrame) */
+typedef struct
+{
+    int active;                 // fix_raw was on
+    int dark_frame;             // subtract the dark frame
+    int bits_shift;             // 10/12bit raw data is shifted to 14bit
+    int undo_shift;             // and shifted back at the end
+    int stripes_max;            // collect the brightest pixel for the stripes correction
+    int32_t max_level;
+    struct raw_info raw_info;   // copy of 'RAWI.raw_info' with the levels used for processing
+} llrpFrame_t;
+
+void llrpBeginFrame(mlvObject_t * video, llrpFrame_t * frame, size_t raw_image_size);
+void llrpProcessPixels(mlvObject_t * video, llrpFrame_t * frame, uint16_t * raw_image_buff, size_t first_pixel, size_t pixel_count);
+void llrpProcessFrame(mlvObject_t * video, llrpFrame_t * frame, uint16_t * raw_image_buff);
+void llrpCancelFrame(mlvObject_t * video, llrpFrame_t * frame);
+void llrpFinishPixels(llrpFrame_t * frame, uint16_t * raw_image_buff, size_t first_pixel, size_t pixel_count);
+/* llrpFinishPixels, writing the result shifted left by shift as float to output */
+void llrpFinishPixelsFloat(llrpFrame_t * frame, uint16_t * raw_image_buff, float * output, size_t first_pixel, size_t pixel_count, int shift);
+
 /* Detect focus dot fix mode according to RAWC block info (binning + skipping) and camera ID
    Return value 0 = off, 1 = On, 2 = CropRec */
 int llrpDetectFocusDotFixMode(mlvObject_t * video);
@@ -38,6 +63,8 @@ int llrpDetectFocusDotFixMode(mlvObject_t * video);
 enum { FR_OFF, FR_ON };
 int llrpGetFixRawMode(mlvObject_t * video);
 void llrpSetFixRawMode(mlvObject_t * video, int value);
+/* returns 1 if fix_raw is on and any raw fix changes the frame */
+int llrpRawFixesActive(mlvObject_t * video);
 
 enum { VS_OFF, VS_ON, VS_FORCE };
 int llrpGetVerticalStripeMode(mlvObject_t * video);
@@ -114,4 +141,44 @@ int llrpGetDarkFrameIntStatus(mlvObject_t * video);
 
 int llrpValidateExtDarkFrame(mlvObject_t * video, char * df_filename, char * error_message);
 
+/* raw fix settings of a clip, to process it with a second mlvObject (e.g. proxy generation in background).
+   Members up to diso_validity are the user's choices, the rest is found per clip or only needed for loading */
+typedef struct
+{
+    int fix_raw;
+    int vertical_stripes;
+    int focus_pixels;
+    int fpi_method;
+    int bad_pixels;
+    int bps_method;
+    int bpi_method;
+    int chroma_smooth;
+    int pattern_noise;
+    int dual_iso;
+    int diso_averaging;
+    int diso_alias_map;
+    int diso_frblending;
+    int dark_frame;
+    char dark_frame_filename[DF_MAX_PATH];
+
+    int diso_validity;
+    int diso_pattern;
+    int diso_auto_correction;
+    double diso_ev_correction;
+    int diso_black_delta;
+    char dark_frame_library[DF_MAX_PATH];
+} llrpSettings_t;
+
+void llrpGetSettings(mlvObject_t * video, llrpSettings_t * settings);
+void llrpSetSettings(mlvObject_t * video, llrpSettings_t * settings);
+
+/* dark frame library: directory of stacked masters with an index by camera/resolution/ISO/exposure */
+void llrpSetDarkFrameLibrary(mlvObject_t * video, char * library_dir);
+/* finds the master matching the clip, master_path needs DF_MAX_PATH bytes, returns 0 on success */
+int llrpFindDarkFrameInLibrary(mlvObject_t * video, char * master_path);
+/* multi frame or lossless dark MLVs are not subtracted directly, they are median stacked to a master
+   in the library first. llrpBuildDarkFrameMaster is slow, call it in background, returns 0 on success */
+int llrpDarkFrameNeedsStacking(char * df_filename);
+int llrpBuildDarkFrameMaster(char * df_filename, char * library_dir, int threads, char * master_path, char * error_message);
+
 #endif
@@ -23,10 +23,15 @@
 #define _llrawproc_object_h
 
 #include <sys/types.h>
+#include <pthread.h>
 #include "pixelproc.h"
 #include "stripes.h"
+#include "patternnoise.h"
 #include "../mlv.h"
 
+/* max path length of dark frame library files */
+#define DF_MAX_PATH 4096
+
 /* Low level raw processing object */
 typedef struct
 {
@@ -79,6 +84,16 @@ typedef struct
     /* external dark frame buffer pointer and its size */
     uint16_t * dark_frame_data;
     uint32_t dark_frame_size;
+    /* dark frame mode the loaded data belongs to, 0 = nothing loaded */
+    int dark_frame_source;
+    /* dark frame mode which failed to load with the current file name, 0 = none */
+    int dark_frame_failed;
+    /* dark frame library directory, stacked masters are stored there */
+    char * dark_frame_library;
+    /* held while the dark frame is loaded or the file name changes */
+    pthread_mutex_t dark_frame_mutex;
+    /* read locked by frames subtracting the dark frame, write locked to replace or free it */
+    pthread_rwlock_t dark_frame_lock;
 
     /* LUTs */
     int * raw2ev;
@@ -94,6 +109,9 @@ typedef struct
     /* stripe corrections */
     stripes_correction stripe_corrections;
 
+    /* pattern noise buffers */
+    pattern_noise_buffers pattern_noise_buffers;
+
 } llrawprocObject_t;
 
 #endif
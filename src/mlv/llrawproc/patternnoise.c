@@ -24,6 +24,7 @@
 #include "string.h"
 #include "wirth.h"
 #include "math.h"
+#include "pthread.h"
 #include "patternnoise.h"
 
 static int g_debug_flags;
@@ -45,60 +46,83 @@ _a > _b ? _a : _b; })
 #define COERCE(x,lo,hi) MAX(MIN((x),(hi)),(lo))
 #define COUNT(x)        ((int)(sizeof(x)/sizeof((x)[0])))
 
-/* out = a - b */
-static void subtract(int16_t * a, int16_t * b, int16_t * out, int w, int h)
-{
-    #pragma omp parallel for
-    for (int i = 0; i < w*h; i++)
-    {
-        out[i] = a[i] - b[i];
-    }
-}
+/* half-res planes kept in pattern_noise_buffers */
+enum { PN_R, PN_G1, PN_G2, PN_B, PN_RS, PN_G1S, PN_G2S, PN_BS, PN_TMP0, PN_TMP1, PN_TMP2, PN_PLANES };
 
-/* out = (a + b) / 2 */
-static void average(int16_t * a, int16_t * b, int16_t * out, int w, int h)
-{
-    #pragma omp parallel for
-    for (int i = 0; i < w*h; i++)
-    {
-        out[i] = ((int)a[i] + (int)b[i]) / 2;
-    }
-}
+#define PN_TILE 32 /* size of the square tiles (in Bayer quads) used for copying channels in transposed order */
+#define PN_COLS 16 /* number of columns gathered at once when taking the column medians */
 
-/* w and h are the size of input buffer; the output buffer will have the dimensions swapped */
-static void transpose(int16_t * in, int16_t * out, int w, int h)
+/* split a Bayer image into its 4 half-res color channels, in a single pass */
+/* w and h are the size of the input buffer; output channels will be half-res */
+/* if transposed is set, the output channels have their dimensions swapped (h/2 x w/2), */
+/* so rows of the image become columns and the row noise can be fixed like the column noise */
+static void extract_channels(int16_t * in, int16_t ** out, int w, int h, int transposed)
 {
+    int cw = w/2;
+    int ch = h/2;
+
+    /* walk the image in square tiles, so the transposed writes stay in cache */
     #pragma omp parallel for collapse(2)
-    for (int y = 0; y < h; y++)
+    for (int ty = 0; ty < ch; ty += PN_TILE)
     {
-        for (int x = 0; x < w; x++)
+        for (int tx = 0; tx < cw; tx += PN_TILE)
         {
-            out[y + x*h] = in[x + y*w];
+            int ey = MIN(ty + PN_TILE, ch);
+            int ex = MIN(tx + PN_TILE, cw);
+            for (int y = ty; y < ey; y++)
+            {
+                for (int x = tx; x < ex; x++)
+                {
+                    int16_t * p = &in[2*x + 2*y*w];
+                    int o = transposed ? (y + x*ch) : (x + y*cw);
+                    out[0][o] = p[0];
+                    out[1][o] = p[1];
+                    out[2][o] = p[w];
+                    out[3][o] = p[w+1];
+                }
+            }
         }
     }
 }
 
-static void horizontal_gradient(int16_t * in, int16_t * out, int w, int h)
+/* merge 4 half-res color channels back into a Bayer image (inverse of extract_channels) */
+/* w and h are the size of the output buffer (full-size image) */
+static void set_channels(int16_t * out, int16_t ** in, int w, int h, int transposed)
 {
-    #pragma omp parallel for
-    for (int i = 2; i < w*h-2; i++)
+    int cw = w/2;
+    int ch = h/2;
+
+    #pragma omp parallel for collapse(2)
+    for (int ty = 0; ty < ch; ty += PN_TILE)
     {
-        out[i] = in[i-2] - in[i+2];
+        for (int tx = 0; tx < cw; tx += PN_TILE)
+        {
+            int ey = MIN(ty + PN_TILE, ch);
+            int ex = MIN(tx + PN_TILE, cw);
+            for (int y = ty; y < ey; y++)
+            {
+                for (int x = tx; x < ex; x++)
+                {
+                    int16_t * p = &out[2*x + 2*y*w];
+                    int i = transposed ? (y + x*ch) : (x + y*cw);
+                    p[0]   = in[0][i];
+                    p[1]   = in[1][i];
+                    p[w]   = in[2][i];
+                    p[w+1] = in[3][i];
+                }
+            }
+        }
     }
-    
-    out[0] = out[1] = out[w*h-1] = out[w*h-2] = 0;
 }
 
+/* avg_g, dif_rg and dif_bg are w x h scratch buffers */
 static void horizontal_edge_aware_blur_rggb(
                                             int16_t * in_r,  int16_t * in_g1,  int16_t * in_g2,  int16_t * in_b,
                                             int16_t * out_r, int16_t * out_g1, int16_t * out_g2, int16_t * out_b,
+                                            int16_t * avg_g, int16_t * dif_rg, int16_t * dif_bg,
                                             int w, int h, int strength, int thr)
 {
     #define NMAX 128
-    int16_t g1[NMAX];
-    int16_t g2[NMAX];
-    int16_t rg[NMAX];
-    int16_t bg[NMAX];
     if (strength > NMAX)
     {
 #ifndef STDOUT_SILENT
@@ -110,15 +134,23 @@ static void horizontal_edge_aware_blur_rggb(
     strength /= 2;
     
     /* precompute average green, red-green and blue-green */
-    int16_t * avg_g  = malloc(w * h * sizeof(avg_g[0]));
-    int16_t * dif_rg = malloc(w * h * sizeof(dif_rg[0]));
-    int16_t * dif_bg = malloc(w * h * sizeof(dif_bg[0]));
-    average(in_g1, in_g2, avg_g, w, h);
-    subtract(in_r, avg_g, dif_rg, w, h);
-    subtract(in_b, avg_g, dif_bg, w, h);
+    #pragma omp parallel for
+    for (int i = 0; i < w*h; i++)
+    {
+        int g = ((int)in_g1[i] + (int)in_g2[i]) / 2;
+        avg_g[i]  = g;
+        dif_rg[i] = in_r[i] - g;
+        dif_bg[i] = in_b[i] - g;
+    }
 
+    /* rows are independent of each other */
+    #pragma omp parallel for schedule(dynamic, 16)
     for (int y = 0; y < h; y++)
     {
+        int16_t g1[NMAX];
+        int16_t g2[NMAX];
+        int16_t rg[NMAX];
+        int16_t bg[NMAX];
         int prev_xl = -1;
         int prev_xr = -1;
         for (int x = 0; x < w; x++)
@@ -179,44 +211,26 @@ static void horizontal_edge_aware_blur_rggb(
             prev_xr = xr;
         }
     }
-    
-    free(avg_g);
-    free(dif_rg);
-    free(dif_bg);
 }
 
 /* Find and apply a scalar offset to each column, to reduce pattern noise */
 /* original: input and output */
 /* denoised: input only */
-static void fix_column_noise(int16_t * original, int16_t * denoised, int w, int h, int white)
+/* noise and mask: w x h scratch buffers */
+static void fix_column_noise(int16_t * original, int16_t * denoised, int16_t * noise, int16_t * mask, int w, int h, int white)
 {
     /* let's say the difference between original and denoised is mostly noise */
-    int16_t * noise = malloc(w * h * sizeof(noise[0]));
-    subtract(original, denoised, noise, w, h);
-    
-    /* from this noise, keep the FPN part (constant offset for each line/column) */
-    int* col_offsets = malloc(w * sizeof(col_offsets[0]));
-    int* noise_row = malloc(MAX(w,h) * sizeof(noise_row[0]));
-    int  noise_row_num = 0;
-    
     /* certain areas will give false readings, mask them out */
-    int16_t * mask  = malloc(w * h * sizeof(mask[0]));
-    int16_t * hgrad = malloc(w * h * sizeof(mask[0]));
-    
-    horizontal_gradient(original, hgrad, w, h);
-
-    #pragma omp parallel for collapse(2)
-    for (int y = 0; y < h; y++)
+    #pragma omp parallel for
+    for (int i = 0; i < w*h; i++)
     {
-        for (int x = 0; x < w; x++)
-        {
-            int pixel = original[x + y*w];
-            int hgradient = abs(hgrad[x + y*w]);
-            
-            mask[x + y*w] =
-            (hgradient > 500) ||   /* mask out pixels on a strong edge, that is clearly not pattern noise */
-            (pixel >= white);      /* mask out bright pixels (caveat: you really need to set the correct white level for this to work) */
-        }
+        int pixel = original[i];
+        int hgradient = (i >= 2 && i < w*h-2) ? abs(original[i-2] - original[i+2]) : 0;
+
+        noise[i] = pixel - denoised[i];
+        mask[i] =
+        (hgradient > 500) ||   /* mask out pixels on a strong edge, that is clearly not pattern noise */
+        (pixel >= white);      /* mask out bright pixels (caveat: you really need to set the correct white level for this to work) */
     }
     
     if (g_debug_flags & FIXPN_DBG_DENOISED)
@@ -224,7 +238,7 @@ static void fix_column_noise(int16_t * original, int16_t * denoised, int w, int
         /* debug: show denoised image */
         for (int i = 0; i < w*h; i++)
             original[i] = denoised[i];
-        goto end;
+        return;
     }
     else if (g_debug_flags & FIXPN_DBG_NOISE)
     {
@@ -234,156 +248,173 @@ static void fix_column_noise(int16_t * original, int16_t * denoised, int w, int
             if (mask[i]) noise[i] = -100;
             original[i] = noise[i] + 100;
         }
-        goto end;
+        return;
     }
     else if (g_debug_flags & FIXPN_DBG_MASK)
     {
         /* debug: show the mask */
         for (int i = 0; i < w*h; i++)
             original[i] = mask[i] * 1000;
-        goto end;
+        return;
     }
     
+    /* from this noise, keep the FPN part (constant offset for each line/column) */
+    int * col_offsets = malloc(w * sizeof(col_offsets[0]));
+    int * col_offsets_sorted = malloc(w * sizeof(col_offsets[0]));
+
     /* take the median value for each column, in the noise image */
-    for (int x = 0; x < w; x++)
+    /* columns are gathered in small blocks, so the noise image is still read row by row */
+    #pragma omp parallel
     {
-        noise_row_num = 0;
-        for (int y = 0; y < h; y++)
+        int * noise_rows = malloc(PN_COLS * h * sizeof(noise_rows[0]));
+
+        #pragma omp for schedule(dynamic)
+        for (int x0 = 0; x0 < w; x0 += PN_COLS)
         {
-            if (mask[x + y*w] == 0)
+            int cols = MIN(PN_COLS, w - x0);
+            int noise_row_num[PN_COLS] = { 0 };
+
+            for (int y = 0; y < h; y++)
             {
-                noise_row[noise_row_num++] = noise[x + y*w];
+                for (int c = 0; c < cols; c++)
+                {
+                    if (mask[x0 + c + y*w] == 0)
+                    {
+                        noise_rows[c*h + noise_row_num[c]++] = noise[x0 + c + y*w];
+                    }
+                }
+            }
+
+            for (int c = 0; c < cols; c++)
+            {
+                col_offsets[x0 + c] = (noise_row_num[c] < 10) ? 0 : -median_int_wirth(&noise_rows[c*h], noise_row_num[c]);
             }
         }
-        
-        int offset = (noise_row_num < 10) ? 0 : -median_int_wirth(noise_row, noise_row_num);
-        
-        col_offsets[x] = offset;
+
+        free(noise_rows);
     }
     
+    /* remove median from offsets, to prevent color cast */
+    /* note: median modifies the array, so we take it from a copy */
+    memcpy(col_offsets_sorted, col_offsets, w * sizeof(col_offsets[0]));
+    int mc = median_int_wirth(col_offsets_sorted, w);
+
     /* almost done, now apply the offsets */
-    #pragma omp parallel for collapse(2)
+    #pragma omp parallel for
     for (int y = 0; y < h; y++)
     {
         for (int x = 0; x < w; x++)
         {
-            original[x + y*w] = COERCE((int)original[x + y*w] + col_offsets[x], -32767, 32767);
+            int pixel = COERCE((int)original[x + y*w] + col_offsets[x], -32767, 32767);
+            /* FIXME: clamping to 32766 causes overflow */
+            original[x + y*w] = COERCE(pixel - mc, 0, 32760);
         }
     }
     
-    /* remove median from offsets, to prevent color cast */
-    /* note: median modifies the array, so we do this after applying the offsets to the image */
-    int mc = median_int_wirth(col_offsets, w);
-
-    #pragma omp parallel for
-    for (int i = 0; i < w*h; i++)
-    {
-        /* FIXME: clamping to 32766 causes overflow */
-        original[i] = COERCE((int)original[i] - mc, 0, 32760);
-    }
-    
-end:
-    free(noise);
     free(col_offsets);
-    free(noise_row);
-    free(mask);
-    free(hgrad);
+    free(col_offsets_sorted);
 }
 
-/* extract a color channel from a Bayer image */
-/* w and h are the size of the input buffer; output will be half-res */
-/* dx and dy can be 0 or 1 */
-static void extract_channel(int16_t * in, int16_t * out, int w, int h, int dx, int dy)
+/* if transposed is set, fixes the row noise instead of the column noise */
+static void fix_column_noise_rggb(int16_t * raw, int16_t ** planes, int w, int h, int white, int transposed)
 {
-    #pragma omp parallel for collapse(2)
-    for (int y = dy; y < h; y += 2)
-    {
-        for (int x = dx; x < w; x += 2)
-        {
-            out[(x/2) + (y/2)*(w/2)] = in[x + y*w];
-        }
-    }
-}
+    /* size of the half-res channels, as they are processed */
+    int cw = transposed ? h/2 : w/2;
+    int ch = transposed ? w/2 : h/2;
 
-/* set a color channel into a Bayer image */
-/* w and h are the size of the output buffer (full-size image); input will be half-res */
-/* dx and dy can be 0 or 1 */
-static void set_channel(int16_t * out, int16_t * in, int w, int h, int dx, int dy)
-{
-    #pragma omp parallel for collapse(2)
-    for (int y = dy; y < h; y += 2)
-    {
-        for (int x = dx; x < w; x += 2)
-        {
-            out[x + y*w] = in[(x/2) + (y/2)*(w/2)];
-        }
-    }
-}
-
-static void fix_column_noise_rggb(int16_t * raw, int w, int h, int white)
-{
     /* assume Bayer order [RGGB] */
-    int16_t * r        = malloc(w/2 * h/2 * sizeof(r[0]));   /* red channel (bottom left) */
-    int16_t * g1       = malloc(w/2 * h/2 * sizeof(r[0]));   /* top-left green */
-    int16_t * g2       = malloc(w/2 * h/2 * sizeof(r[0]));   /* bottom-right green */
-    int16_t * b        = malloc(w/2 * h/2 * sizeof(r[0]));   /* blue channel (top right) */
-    int16_t * rs       = malloc(w/2 * h/2 * sizeof(r[0]));   /* r  after smoothing */
-    int16_t * g1s      = malloc(w/2 * h/2 * sizeof(r[0]));   /* g1 after smoothing */
-    int16_t * g2s      = malloc(w/2 * h/2 * sizeof(r[0]));   /* g2 after smoothing */
-    int16_t * bs       = malloc(w/2 * h/2 * sizeof(r[0]));   /* b  after smoothing */
+    /* (transposed only changes the layout of the planes, each one holds the same Bayer position either way) */
+    int16_t * r   = planes[PN_R];    /* red channel (bottom left) */
+    int16_t * g1  = planes[PN_G1];   /* top-left green */
+    int16_t * g2  = planes[PN_G2];   /* bottom-right green */
+    int16_t * b   = planes[PN_B];    /* blue channel (top right) */
+    int16_t * rs  = planes[PN_RS];   /* r  after smoothing */
+    int16_t * g1s = planes[PN_G1S];  /* g1 after smoothing */
+    int16_t * g2s = planes[PN_G2S];  /* g2 after smoothing */
+    int16_t * bs  = planes[PN_BS];   /* b  after smoothing */
     
     /* extract half-res color channels from Bayer data */
-    extract_channel(raw, r,  w, h, 0, 0);
-    extract_channel(raw, g1, w, h, 1, 0);
-    extract_channel(raw, g2, w, h, 0, 1);
-    extract_channel(raw, b,  w, h, 1, 1);
+    extract_channels(raw, planes, w, h, transposed);
     
     /* strong horizontal denoising (1-D median blur on G, R-G and B-G, stop on edge */
     /* (this step takes a lot of time) */
-    horizontal_edge_aware_blur_rggb(r, g1, g2, b, rs, g1s, g2s, bs, w/2, h/2, 50, 500);
+    horizontal_edge_aware_blur_rggb(r, g1, g2, b, rs, g1s, g2s, bs,
+                                    planes[PN_TMP0], planes[PN_TMP1], planes[PN_TMP2],
+                                    cw, ch, 50, 500);
     
     /* after blurring horizontally, the difference reveals vertical FPN */
-    fix_column_noise(r,  rs,  w/2, h/2, white);
-    fix_column_noise(g1, g1s, w/2, h/2, white);
-    fix_column_noise(g2, g2s, w/2, h/2, white);
-    fix_column_noise(b,  bs,  w/2, h/2, white);
+    fix_column_noise(r,  rs,  planes[PN_TMP0], planes[PN_TMP1], cw, ch, white);
+    fix_column_noise(g1, g1s, planes[PN_TMP0], planes[PN_TMP1], cw, ch, white);
+    fix_column_noise(g2, g2s, planes[PN_TMP0], planes[PN_TMP1], cw, ch, white);
+    fix_column_noise(b,  bs,  planes[PN_TMP0], planes[PN_TMP1], cw, ch, white);
     
     /* commit changes */
-    set_channel(raw, r,  w, h, 0, 0);
-    set_channel(raw, g1, w, h, 1, 0);
-    set_channel(raw, g2, w, h, 0, 1);
-    set_channel(raw, b,  w, h, 1, 1);
-    
-    /* cleanup */
-    free(r);
-    free(g1);
-    free(g2);
-    free(b);
-    free(rs);
-    free(g1s);
-    free(g2s);
-    free(bs);
+    set_channels(raw, planes, w, h, transposed);
+}
+
+void init_pattern_noise_buffers(pattern_noise_buffers * buffers)
+{
+    pthread_mutex_init(&buffers->mutex, NULL);
+    buffers->planes = NULL;
+    buffers->plane_size = 0;
 }
 
-void fix_pattern_noise(int16_t * raw, int w, int h, int white, int debug_flags)
+void free_pattern_noise_buffers(pattern_noise_buffers * buffers)
+{
+    pthread_mutex_destroy(&buffers->mutex);
+    free(buffers->planes);
+    buffers->planes = NULL;
+    buffers->plane_size = 0;
+}
+
+void fix_pattern_noise(pattern_noise_buffers * buffers, int16_t * raw, int w, int h, int white, int debug_flags)
 {
     g_debug_flags = debug_flags;
+
+    /* use the persistent buffers, unless another thread is busy with them */
+    size_t plane_size = (size_t)(w/2) * (h/2);
+    int16_t * memory = NULL;
+    int own_buffers = buffers && !pthread_mutex_trylock(&buffers->mutex);
+    if (own_buffers)
+    {
+        if (buffers->plane_size < plane_size)
+        {
+            free(buffers->planes);
+            buffers->planes = malloc(PN_PLANES * plane_size * sizeof(int16_t));
+            buffers->plane_size = plane_size;
+        }
+        memory = buffers->planes;
+    }
+    else
+    {
+        memory = malloc(PN_PLANES * plane_size * sizeof(int16_t));
+    }
+
+    int16_t * planes[PN_PLANES];
+    for (int i = 0; i < PN_PLANES; i++)
+    {
+        planes[i] = memory + i * plane_size;
+    }
     
-    /* fix vertical noise, then transpose and repeat for the horizontal one */
-    /* not very efficient, but at least avoids duplicate code */
+    /* fix vertical noise, then repeat for the horizontal one on transposed channels */
+    /* the transposition is done while extracting the channels, so no full frame copy is needed */
     /* note: when debugging, we process only one direction */
     if (!g_debug_flags || !(g_debug_flags & FIXPN_DBG_ROWNOISE))
     {
-        fix_column_noise_rggb(raw, w, h, white);
+        fix_column_noise_rggb(raw, planes, w, h, white, 0);
     }
     
     if (!g_debug_flags || (g_debug_flags & FIXPN_DBG_ROWNOISE))
     {
-        /* transpose, process just like before, then transpose back */
-        int16_t * raw_t = malloc(w * h * sizeof(raw[0]));
-        transpose(raw, raw_t, w, h);
-        fix_column_noise_rggb(raw_t, h, w, white);
-        transpose(raw_t, raw, h, w);
-        free(raw_t);
+        fix_column_noise_rggb(raw, planes, w, h, white, 1);
+    }
+
+    if (own_buffers)
+    {
+        pthread_mutex_unlock(&buffers->mutex);
+    }
+    else
+    {
+        free(memory);
     }
 }
@@ -11,9 +11,25 @@
  * in the image (where this kind of noise is obvious).
  */
 
+#ifndef _patternnoise_h
+#define _patternnoise_h
+
 #include "stdint.h"
+#include "stddef.h"
+#include "pthread.h"
+
+/* half-res channel buffers, kept between frames to avoid reallocating them */
+typedef struct {
+    pthread_mutex_t mutex;
+    size_t plane_size;
+    int16_t * planes;
+} pattern_noise_buffers;
 
-void fix_pattern_noise(int16_t * raw, int w, int h, int white, int debug_flags);
+void init_pattern_noise_buffers(pattern_noise_buffers * buffers);
+void free_pattern_noise_buffers(pattern_noise_buffers * buffers);
+
+/* buffers may be NULL, then temporary ones are allocated */
+void fix_pattern_noise(pattern_noise_buffers * buffers, int16_t * raw, int w, int h, int white, int debug_flags);
 
 /* debug flags */
 #define FIXPN_DBG_COLNOISE  0
@@ -21,4 +37,6 @@ void fix_pattern_noise(int16_t * raw, int w, int h, int white, int debug_flags);
 
 #define FIXPN_DBG_DENOISED  2
 #define FIXPN_DBG_NOISE     4
-#define FIXPN_DBG_MASK      8
\ No newline at end of file
+#define FIXPN_DBG_MASK      8
+
+#endif
@@ -277,6 +277,7 @@ static void apply_vertical_stripes_correction(stripes_correction * correction,
                                               uint16_t * image_data,
                                               int32_t black_level,
                                               int32_t white_level,
+                                              int32_t max_level,
                                               uint16_t width,
                                               uint16_t height)
 {
@@ -290,31 +291,18 @@ static void apply_vertical_stripes_correction(stripes_correction * correction,
      *   - if there are no pixels above the true white level, it shouldn't hurt;
      *     worst case, the brightest pixel(s) will be underexposed by 0.1 EV or so
      *   - if there are, we will choose the true white level
+     *
+     * max(all pixels) is collected by the caller while the frame is unpacked
      */
      
-    int white = white_level * 2 / 3;
+    int white = MAX(white_level * 2 / 3, max_level);
     int pitch = width * 2;
 
-    struct raw_8pixels * row;
-    for (row = (void*)image_data; (void*)row < (void*)image_data + pitch * height; row += pitch / sizeof(struct raw_8pixels))
-    {
-        struct raw_8pixels * p;
-        for (p = row; (void*)p < (void*)row + pitch; p++)
-        {
-            white = MAX(white, PA);
-            white = MAX(white, PB);
-            white = MAX(white, PC);
-            white = MAX(white, PD);
-            white = MAX(white, PE);
-            white = MAX(white, PF);
-            white = MAX(white, PG);
-            white = MAX(white, PH);
-        }
-    }
-    
     int black = black_level;
-    for (row = (void*)image_data; (void*)row < (void*)image_data + pitch * height; row += pitch / sizeof(struct raw_8pixels))
+    #pragma omp parallel for
+    for (int y = 0; y < height; y++)
     {
+        struct raw_8pixels * row = (void*)image_data + (size_t)pitch * y;
         struct raw_8pixels * p;
         for (p = row; (void*)p < (void*)row + pitch; p++)
         {
@@ -350,6 +338,7 @@ void fix_vertical_stripes(stripes_correction * correction,
                           uint16_t * image_data,
                           int32_t black_level,
                           int32_t white_level,
+                          int32_t max_level,
                           int32_t raw_info_frame_size,
                           uint16_t width,
                           uint16_t height,
@@ -388,5 +377,10 @@ void fix_vertical_stripes(stripes_correction * correction,
         *compute_stripes = 0;
     }
 
-    apply_vertical_stripes_correction(correction, image_data, black_level, white_level, width, height);
+    /* nothing to do as long as no coefficients were computed */
+    int j;
+    for (j = 0; j < 8 && !correction->coeffficients[j]; j++);
+    if (j == 8) return;
+
+    apply_vertical_stripes_correction(correction, image_data, black_level, white_level, max_level, width, height);
 }
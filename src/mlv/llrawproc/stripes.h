@@ -36,6 +36,7 @@ void fix_vertical_stripes(stripes_correction * correction,
                           uint16_t * image_data,
                           int32_t black_level,
                           int32_t white_level,
+                          int32_t max_level,
                           int32_t raw_info_frame_size,
                           uint16_t width,
                           uint16_t height,
@@ -105,6 +105,8 @@
 #define setMlvUseRcdDebayer(video) (video)->use_amaze = 7; (video)->current_cached_frame_active = 0
 /* Use the DCB debayer */
 #define setMlvUseDcbDebayer(video) (video)->use_amaze = 8; (video)->current_cached_frame_active = 0
+/* Use the reduced RCD debayer, fast enough for playback */
+#define setMlvUseRealtimeDebayer(video) (video)->use_amaze = 9; (video)->current_cached_frame_active = 0
 
 /* Set CA correction parameters */
 #define setMlvCaCorrectionRed(video, value) (video)->ca_red = (value)
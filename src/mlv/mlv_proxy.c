@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2026 masc4ii
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mlv_proxy.h"
+#include "video_mlv.h"
+#include "llrawproc/llrawproc.h"
+#include "../buffer_pool/buffer_pool.h"
+#include "../processing/raw_processing.h"
+
+int mlv_proxy_downscale_factor(mlvObject_t * video)
+{
+    /* even factor keeps dual iso line pairs together */
+    int factor = (getMlvWidth(video) + MLV_PROXY_MAX_WIDTH - 1) / MLV_PROXY_MAX_WIDTH;
+    if (factor < 2) factor = 2;
+    if (factor & 1) factor++;
+    return factor;
+}
+
+int mlv_proxy_create(mlvObject_t * video, char * proxy_file, volatile int * abort_flag, volatile int * progress)
+{
+    int factor = mlv_proxy_downscale_factor(video);
+
+    mlv_proxy_hdr_t hdr;
+    memcpy(hdr.magic, MLV_PROXY_MAGIC, 4);
+    hdr.version = MLV_PROXY_VERSION;
+    hdr.width = getMlvWidth(video) / factor;
+    hdr.height = getMlvHeight(video) / factor;
+    hdr.frames = getMlvFrames(video);
+    hdr.downscale = factor;
+    hdr.raw_width = getMlvWidth(video);
+    hdr.raw_height = getMlvHeight(video);
+
+    if (!hdr.width || !hdr.height || !hdr.frames) return MLV_PROXY_ERROR;
+
+    size_t frame_pixels = (size_t)hdr.width * hdr.height * 3;
+    uint16_t * linear_frame = bufferPoolAlloc(frame_pixels * sizeof(uint16_t));
+    uint8_t * proxy_frame = bufferPoolAlloc(frame_pixels);
+    /* square root encoding keeps the precision in the shadows */
+    uint8_t * encode_lut = malloc(65536);
+    if (!linear_frame || !proxy_frame || !encode_lut)
+    {
+        bufferPoolFree(linear_frame);
+        bufferPoolFree(proxy_frame);
+        free(encode_lut);
+        return MLV_PROXY_ERROR;
+    }
+    for (int i = 0; i < 65536; i++)
+    {
+        encode_lut[i] = (uint8_t)(sqrtf(i / 65535.0f) * 255.0f + 0.5f);
+    }
+
+    char temp_file[4096];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", proxy_file);
+    FILE * file = fopen(temp_file, "wb");
+    if (!file)
+    {
+        bufferPoolFree(linear_frame);
+        bufferPoolFree(proxy_frame);
+        free(encode_lut);
+        return MLV_PROXY_ERROR;
+    }
+
+    int ret = MLV_PROXY_OK;
+    if (fwrite(&hdr, sizeof(mlv_proxy_hdr_t), 1, file) != 1) ret = MLV_PROXY_ERROR;
+
+    for (uint32_t frame = 0; frame < hdr.frames && ret == MLV_PROXY_OK; frame++)
+    {
+        if (abort_flag && *abort_flag)
+        {
+            ret = MLV_PROXY_ABORTED;
+            break;
+        }
+
+        if (get_area_average_downscale_raw(video, frame, factor, linear_frame))
+        {
+            ret = MLV_PROXY_ERROR;
+            break;
+        }
+
+        for (size_t i = 0; i < frame_pixels; i++)
+        {
+            proxy_frame[i] = encode_lut[linear_frame[i]];
+        }
+
+        if (fwrite(proxy_frame, frame_pixels, 1, file) != 1)
+        {
+            ret = MLV_PROXY_ERROR;
+            break;
+        }
+
+        if (progress) *progress = frame + 1;
+    }
+
+    fclose(file);
+    bufferPoolFree(linear_frame);
+    bufferPoolFree(proxy_frame);
+    free(encode_lut);
+
+    if (ret == MLV_PROXY_OK)
+    {
+        remove(proxy_file);
+        if (rename(temp_file, proxy_file)) ret = MLV_PROXY_ERROR;
+    }
+    if (ret != MLV_PROXY_OK) remove(temp_file);
+
+#ifndef STDOUT_SILENT
+    printf("Proxy: %ux%u, %u frames, %s\n", hdr.width, hdr.height, hdr.frames, (ret == MLV_PROXY_OK) ? "done" : "failed");
+#endif
+
+    return ret;
+}
+
+int mlv_proxy_check(mlvObject_t * video, const uint8_t * proxy_data, uint64_t proxy_size)
+{
+    if (!proxy_data || proxy_size < sizeof(mlv_proxy_hdr_t)) return 1;
+
+    const mlv_proxy_hdr_t * hdr = (const mlv_proxy_hdr_t *)proxy_data;
+    if (memcmp(hdr->magic, MLV_PROXY_MAGIC, 4) || hdr->version != MLV_PROXY_VERSION) return 1;
+    if (hdr->raw_width != (uint32_t)getMlvWidth(video) || hdr->raw_height != (uint32_t)getMlvHeight(video)) return 1;
+    if (hdr->frames != (uint32_t)getMlvFrames(video) || !hdr->downscale) return 1;
+    if (hdr->width != hdr->raw_width / hdr->downscale || hdr->height != hdr->raw_height / hdr->downscale) return 1;
+
+    uint64_t frame_size = (uint64_t)hdr->width * hdr->height * 3;
+    if (proxy_size < sizeof(mlv_proxy_hdr_t) + frame_size * hdr->frames) return 1;
+
+    return 0;
+}
+
+void mlv_proxy_get_frame(const uint8_t * proxy_data, uint32_t frame_index, uint16_t * output_frame)
+{
+    const mlv_proxy_hdr_t * hdr = (const mlv_proxy_hdr_t *)proxy_data;
+    size_t frame_pixels = (size_t)hdr->width * hdr->height * 3;
+    if (frame_index >= hdr->frames) frame_index = hdr->frames - 1;
+    const uint8_t * frame = proxy_data + sizeof(mlv_proxy_hdr_t) + frame_pixels * frame_index;
+
+    uint16_t decode_lut[256];
+    for (int i = 0; i < 256; i++)
+    {
+        float value = i / 255.0f;
+        decode_lut[i] = (uint16_t)(value * value * 65535.0f + 0.5f);
+    }
+
+    for (size_t i = 0; i < frame_pixels; i++)
+    {
+        output_frame[i] = decode_lut[frame[i]];
+    }
+}
+
+void mlv_proxy_get_processed_frame8(mlvObject_t * video, const uint8_t * proxy_data, uint32_t frame_index, uint8_t * output_frame, int threads)
+{
+    const mlv_proxy_hdr_t * hdr = (const mlv_proxy_hdr_t *)proxy_data;
+    int width = hdr->width;
+    int height = hdr->height;
+    int factor = hdr->downscale;
+    size_t frame_pixels = (size_t)width * height * 3;
+
+    uint16_t * unprocessed_frame = bufferPoolAlloc(frame_pixels * sizeof(uint16_t));
+    uint16_t * processed_frame = bufferPoolAlloc(frame_pixels * sizeof(uint16_t));
+    if (!unprocessed_frame || !processed_frame)
+    {
+        bufferPoolFree(unprocessed_frame);
+        bufferPoolFree(processed_frame);
+        return;
+    }
+
+    mlv_proxy_get_frame(proxy_data, frame_index, unprocessed_frame);
+
+    /* vignette and gradient masks are made for full resolution */
+    applyProcessingObjectWithoutMasks(video->processing,
+                                      width, height,
+                                      unprocessed_frame,
+                                      processed_frame,
+                                      threads, 1, frame_index);
+
+    /* nearest neighbour upscale to raw resolution (8 bit) */
+    int raw_w = getMlvWidth(video);
+    int raw_h = getMlvHeight(video);
+    #pragma omp parallel for
+    for (int y = 0; y < raw_h; y++)
+    {
+        int proxy_y = y / factor;
+        if (proxy_y >= height) proxy_y = height - 1;
+        const uint16_t * src_row = processed_frame + (size_t)proxy_y * width * 3;
+        uint8_t * dst_row = output_frame + (size_t)y * raw_w * 3;
+        for (int x = 0; x < raw_w; x++)
+        {
+            int proxy_x = x / factor;
+            if (proxy_x >= width) proxy_x = width - 1;
+            dst_row[x * 3 + 0] = src_row[proxy_x * 3 + 0] >> 8;
+            dst_row[x * 3 + 1] = src_row[proxy_x * 3 + 1] >> 8;
+            dst_row[x * 3 + 2] = src_row[proxy_x * 3 + 2] >> 8;
+        }
+    }
+
+    bufferPoolFree(unprocessed_frame);
+    bufferPoolFree(processed_frame);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026 masc4ii
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* Low resolution proxy stream for scrubbing.
+ * File layout: mlv_proxy_hdr_t, followed by all frames back to back.
+ * Each frame is width * height * 3 bytes of unprocessed, debayered RGB,
+ * square root encoded to 8 bit, so the image processing can still be
+ * applied when the proxy is shown. */
+
+#ifndef _mlv_proxy_h
+#define _mlv_proxy_h
+
+#include <stdint.h>
+
+#include "mlv_object.h"
+
+#define MLV_PROXY_MAGIC "MLVP"
+#define MLV_PROXY_VERSION 1
+/* Proxy width is kept at or below this */
+#define MLV_PROXY_MAX_WIDTH 640
+
+typedef struct {
+    char     magic[4];   /* MLV_PROXY_MAGIC */
+    uint32_t version;    /* MLV_PROXY_VERSION */
+    uint32_t width;      /* proxy width */
+    uint32_t height;     /* proxy height */
+    uint32_t frames;     /* frame count */
+    uint32_t downscale;  /* downscale factor from raw resolution */
+    uint32_t raw_width;  /* raw resolution of the clip */
+    uint32_t raw_height;
+} mlv_proxy_hdr_t;
+
+enum { MLV_PROXY_OK, MLV_PROXY_ERROR, MLV_PROXY_ABORTED };
+
+/* Downscale factor used for the proxy of this clip */
+int mlv_proxy_downscale_factor(mlvObject_t * video);
+
+/* Renders all frames of the clip to a proxy file. abort_flag is polled between frames,
+ * progress receives the count of finished frames (both may be NULL).
+ * The file is written to a temporary name and renamed when complete. */
+int mlv_proxy_create(mlvObject_t * video, char * proxy_file, volatile int * abort_flag, volatile int * progress);
+
+/* Checks a proxy in memory (e.g. mapped file) against the clip, returns 0 if usable */
+int mlv_proxy_check(mlvObject_t * video, const uint8_t * proxy_data, uint64_t proxy_size);
+
+/* Decodes one proxy frame to linear 16 bit RGB (width * height * 3) */
+void mlv_proxy_get_frame(const uint8_t * proxy_data, uint32_t frame_index, uint16_t * output_frame);
+
+/* Processes one proxy frame with the clips processing object and scales it up to the raw
+ * resolution, output sized like getMlvProcessedFrame8 */
+void mlv_proxy_get_processed_frame8(mlvObject_t * video, const uint8_t * proxy_data, uint32_t frame_index, uint8_t * output_frame, int threads);
+
+#endif
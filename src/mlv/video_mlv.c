@@ -13,6 +13,8 @@
 #include <unistd.h>
 #if defined(__linux)
 #include <alloca.h>
+#include <errno.h>
+#include <sys/syscall.h>
 #endif
 
 #include "video_mlv.h"
@@ -27,6 +29,8 @@
 #include "../debayer/debayer.h"
 /* Processing module */
 #include "../processing/raw_processing.h"
+/* Frame sized scratch buffers */
+#include "../buffer_pool/buffer_pool.h"
 
 /* Lossless decompression */
 #include "liblj92/lj92.h"
@@ -47,7 +51,6 @@
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
-#define ROR32(v,a) ((v) >> (a) | (v) << (32-(a)))
 
 static uint64_t file_set_pos(FILE *stream, uint64_t offset, int whence)
 {
@@ -203,13 +206,127 @@ static void frame_index_sort(frame_index_t *frame_index, uint32_t entries)
     } while (n > 1);
 }
 
+/* Shrinks a bayer frame by 2^levels, each output pixel is the average of the same colour
+ * pixels of its block, so the CFA pattern stays the same. Width and height are updated. */
+static void bin_bayer_frame(uint16_t * frame, int * width, int * height, int levels)
+{
+    int factor = 1 << levels;
+    int in_width = *width;
+    int out_width = (in_width / (2 * factor)) * 2;
+    int out_height = (*height / (2 * factor)) * 2;
+    int shift = 2 * levels;
+
+    uint16_t * binned = (uint16_t *)bufferPoolAlloc(out_width * out_height * sizeof(uint16_t));
+    if (!binned) return;
+
+    #pragma omp parallel for
+    for (int y = 0; y < out_height; ++y)
+    {
+        int in_y = (y & ~1) * factor + (y & 1);
+        for (int x = 0; x < out_width; ++x)
+        {
+            int in_x = (x & ~1) * factor + (x & 1);
+            uint32_t sum = 0;
+            for (int j = 0; j < factor; ++j)
+            {
+                uint16_t * row = frame + (in_y + j * 2) * in_width + in_x;
+                for (int i = 0; i < factor; ++i) sum += row[i * 2];
+            }
+            binned[y * out_width + x] = sum >> shift;
+        }
+    }
+
+    memcpy(frame, binned, out_width * out_height * sizeof(uint16_t));
+    bufferPoolFree(binned);
+    *width = out_width;
+    *height = out_height;
+}
+
+#ifdef ENABLE_JPEG2K
+/* Decodes the 4 JPEG2K bayer planes of a frame straight into their bayer positions, with
+ * levels finest wavelet levels skipped (planes rounded up). Returns 0 on success */
+static int decode_jpeg2k_bayer(uint8_t * frame_data, int width, int height, int levels, uint16_t * unpackedFrame)
+{
+    /* Parse bayer JPEG2K header: version + 8 u32s (offset/size for 4 channels) */
+    uint32_t *hdr = (uint32_t *)frame_data;
+    if(hdr[0] != 1)
+    {
+        DEBUG( printf("JPEG2K decoder: unsupported version of JPEG2K MLV layout.\n"); )
+        return 1;
+    }
+    uint32_t sizes[4]  = { hdr[2], hdr[4], hdr[6], hdr[8] };
+    uint32_t offsets[4] = { hdr[1], hdr[3], hdr[5], hdr[7] };
+
+    uint32_t hw = (((uint32_t)width / 2 - 1) >> levels) + 1;
+    uint32_t hh = (((uint32_t)height / 2 - 1) >> levels) + 1;
+    size_t out_width = hw * 2;
+
+    /* Decode 4 channels in parallel, each line goes to every 2nd pixel of every 2nd row
+     * Channel order: 0=x0y0, 1=x1y0, 2=x0y1, 3=x1y1 */
+    int decode_errors[4] = { 0, 0, 0, 0 };
+    #pragma omp parallel for num_threads(4)
+    for(int c = 0; c < 4; c++)
+    {
+        uint8_t *encoded = frame_data + offsets[c];
+        uint32_t x_off = (c == 1 || c == 3) ? 1 : 0;
+        uint32_t y_off = (c == 2 || c == 3) ? 1 : 0;
+
+        void *decoder = ojph_decoder_new();
+        if(!decoder)
+        {
+            DEBUG( printf("JPEG2K decoder: failed to create decoder\n"); )
+            decode_errors[c] = 1;
+            continue;
+        }
+
+        ojph_decoder_set_skip_levels(decoder, levels);
+        size_t decoded = ojph_decoder_decode_u16(decoder, encoded, sizes[c],
+                                                 unpackedFrame + y_off * out_width + x_off,
+                                                 2, out_width * 2, hw, hh);
+        if(decoded == 0)
+        {
+            DEBUG( printf("JPEG2K decoder: decode failed channel %d\n", c); )
+            decode_errors[c] = 1;
+        }
+
+        ojph_decoder_free(decoder);
+    }
+
+    return decode_errors[0] | decode_errors[1] | decode_errors[2] | decode_errors[3];
+}
+#endif
+
+/* Rows per band of the pass which unpacks, linearises and does the pixel wise low level raw processing */
+#define RAW_BAND_ROWS 16
+
+static int get_raw_frame_uint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame, int reduction, int * outWidth, int * outHeight, llrpFrame_t * llrp);
+
 /* Unpack or decompress original raw data */
 int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame)
+{
+    return get_raw_frame_uint16(video, frameIndex, unpackedFrame, 0, NULL, NULL, NULL);
+}
+
+/* Unpack or decompress original raw data at 1/2^reduction of the size. JPEG2000 and CineForm skip
+ * their finest wavelet levels, everything else (and what a codec can't skip) is binned afterwards */
+int getMlvRawFrameUint16Reduced(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame, int reduction, int * outWidth, int * outHeight)
+{
+    return get_raw_frame_uint16(video, frameIndex, unpackedFrame, reduction, outWidth, outHeight, NULL);
+}
+
+/* If llrp is given, llrpProcessPixels runs on every band of the frame right after it was unpacked */
+static int get_raw_frame_uint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame, int reduction, int * outWidth, int * outHeight, llrpFrame_t * llrp)
 {
     int bitdepth = video->RAWI.raw_info.bits_per_pixel;
     int width = video->RAWI.xRes;
     int height = video->RAWI.yRes;
-    int pixels_count = width * height;
+
+    /* Size of the frame in unpackedFrame and wavelet levels the decoder has skipped already */
+    int out_width = width;
+    int out_height = height;
+    int reduced = 0;
+    /* Uncompressed raw_frame is unpacked band by band below */
+    int packed = 0;
 
     int chunk = video->video_index[frameIndex].chunk_num;
     uint32_t frame_size = video->video_index[frameIndex].frame_size;
@@ -219,7 +336,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
     /* How many bytes is RAW frame */
     int raw_frame_size = (width * height * bitdepth) / 8;
     /* Memory buffer for original RAW data */
-    uint8_t * raw_frame = (uint8_t *)malloc(raw_frame_size + 4); // additional 4 bytes for safety
+    uint8_t * raw_frame = (uint8_t *)bufferPoolAlloc(raw_frame_size + 4); // additional 4 bytes for safety
 
     FILE * file = video->file[chunk];
 
@@ -235,7 +352,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
         if (fread(&item, sizeof(mr_item_t), 1, file) != 1)
         {
             DEBUG( printf("Frame header read error\n"); )
-            free(raw_frame);
+            bufferPoolFree(raw_frame);
             pthread_mutex_unlock(video->main_file_mutex + chunk);
             return 1;
         }
@@ -245,7 +362,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
         if (fread(raw_frame, frame_size, 1, file) != 1)
         {
             DEBUG( printf("Frame data read error\n"); )
-            free(raw_frame);
+            bufferPoolFree(raw_frame);
             pthread_mutex_unlock(video->main_file_mutex + chunk);
             return 1;
         }
@@ -257,7 +374,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
         if (ret <= 0)
         {
             DEBUG( printf("mcraw decoder: Failed with error code (%d)\n", ret); )
-            free(raw_frame);
+            bufferPoolFree(raw_frame);
             return 1;
         }
 
@@ -315,7 +432,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
         if (fread(&video->VIDF, sizeof(mlv_vidf_hdr_t), 1, file) != 1)
         {
             DEBUG( printf("Frame header read error\n"); )
-            free(raw_frame);
+            bufferPoolFree(raw_frame);
             pthread_mutex_unlock(video->main_file_mutex + chunk);
             return 1;
         }
@@ -327,7 +444,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             if(fread(raw_frame, frame_size, 1, file) != 1)
             {
                 DEBUG( printf("Frame data read error lj92\n"); )
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 pthread_mutex_unlock(video->main_file_mutex + chunk);
                 return 1;
             }
@@ -340,7 +457,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             if(ret != LJ92_ERROR_NONE)
             {
                 DEBUG( printf("LJ92 decoder: Failed with error code (%d)\n", ret); )
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 return 1;
             }
             else
@@ -349,7 +466,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
                 if(ret != LJ92_ERROR_NONE)
                 {
                     DEBUG( printf("LJ92 decoder: Failed with error code (%d)\n", ret); )
-                    free(raw_frame);
+                    bufferPoolFree(raw_frame);
                     return 1;
                 }
             }
@@ -361,7 +478,7 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             if(fread(raw_frame, frame_size, 1, file) != 1)
             {
                 DEBUG( printf("Frame data read error cineform\n"); )
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 pthread_mutex_unlock(video->main_file_mutex + chunk);
                 return 1;
             }
@@ -373,16 +490,17 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             if(err != CFHD_ERROR_OKAY)
             {
                 DEBUG( printf("Cineform decoder: Failed to open decoder (error %d)\n", err); )
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 return 1;
             }
 
             int actual_width = 0;
             int actual_height = 0;
             CFHD_PixelFormat actual_format = CFHD_PIXEL_FORMAT_BYR4;
+            /* Half resolution of a bayer sample is a half size BYR4 mosaic, quarter is not supported */
             err = CFHD_PrepareToDecode(decoder, width, height,
                                        CFHD_PIXEL_FORMAT_BYR4,
-                                       CFHD_DECODED_RESOLUTION_FULL,
+                                       (reduction > 0) ? CFHD_DECODED_RESOLUTION_HALF : CFHD_DECODED_RESOLUTION_FULL,
                                        CFHD_DECODING_FLAGS_NONE,
                                        raw_frame, frame_size,
                                        &actual_width, &actual_height, &actual_format);
@@ -390,24 +508,31 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             {
                 DEBUG( printf("Cineform decoder: PrepareToDecode failed (error %d)\n", err); )
                 CFHD_CloseDecoder(decoder);
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 return 1;
             }
 
+            if(reduction > 0 && actual_width * 2 == width && actual_height * 2 == height)
+            {
+                out_width = actual_width;
+                out_height = actual_height;
+                reduced = 1;
+            }
+
             err = CFHD_DecodeSample(decoder, raw_frame, frame_size,
-                                    unpackedFrame, width * 2);
+                                    unpackedFrame, out_width * 2);
             if(err != CFHD_ERROR_OKAY)
             {
                 DEBUG( printf("Cineform decoder: DecodeSample failed (error %d)\n", err); )
                 CFHD_CloseDecoder(decoder);
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 return 1;
             }
 
             CFHD_CloseDecoder(decoder);
 #else
             DEBUG( printf("Cineform codec is not enabled at build\n", err); )
-            free(raw_frame);
+            bufferPoolFree(raw_frame);
             pthread_mutex_unlock(video->main_file_mutex + chunk);
             return 1;
 #endif
@@ -418,125 +543,28 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             if(fread(raw_frame, frame_size, 1, file) != 1)
             {
                 DEBUG( printf("Frame data read error jpeg2k\n"); )
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 pthread_mutex_unlock(video->main_file_mutex + chunk);
                 return 1;
             }
 
             pthread_mutex_unlock(video->main_file_mutex + chunk);
 
-            /* Parse bayer JPEG2K header: version + 8 u32s (offset/size for 4 channels) */
-            uint32_t *hdr = (uint32_t *)raw_frame;
-            if(hdr[0] != 1)
-            {
-                DEBUG( printf("JPEG2K decoder: unsupported version of JPEG2K MLV layout.\n"); )
-                free(raw_frame);
-                return 1;
-            }
-            uint32_t sizes[4]  = { hdr[2], hdr[4], hdr[6], hdr[8] };
-            uint32_t offsets[4] = { hdr[1], hdr[3], hdr[5], hdr[7] };
-
-            uint32_t hw = width / 2;
-            uint32_t hh = height / 2;
-            size_t quarter_pixels = (size_t)hw * hh;
-
-            /* Allocate 4 separate quarter buffers */
-            int32_t *quarter_bufs[4] = { NULL, NULL, NULL, NULL };
-            int alloc_ok = 1;
-            for(int c = 0; c < 4; c++)
+            /* Skipped levels may be more than the codestream has, then decode full size and bin */
+            if(reduction > 0 && !decode_jpeg2k_bayer(raw_frame, width, height, reduction, unpackedFrame))
             {
-                quarter_bufs[c] = (int32_t *)malloc(quarter_pixels * sizeof(int32_t));
-                if(!quarter_bufs[c])
-                {
-                    DEBUG( printf("JPEG2K decoder: memory allocation failed\n"); )
-                    alloc_ok = 0;
-                    break;
-                }
+                reduced = reduction;
+                out_width = ((width / 2 - 1) >> reduction) * 2 + 2;
+                out_height = ((height / 2 - 1) >> reduction) * 2 + 2;
             }
-            if(!alloc_ok)
+            else if(decode_jpeg2k_bayer(raw_frame, width, height, 0, unpackedFrame))
             {
-                for(int c = 0; c < 4; c++) free(quarter_bufs[c]);
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 return 1;
             }
-
-            /* Decode 4 channels in parallel into separate buffers */
-            int decode_errors[4] = { 0, 0, 0, 0 };
-            #pragma omp parallel for num_threads(4)
-            for(int c = 0; c < 4; c++)
-            {
-                uint8_t *encoded = ((uint8_t *)raw_frame) + offsets[c];
-                uint32_t enc_size = sizes[c];
-
-                void *decoder = ojph_decoder_new();
-                if(!decoder)
-                {
-                    DEBUG( printf("JPEG2K decoder: failed to create decoder\n"); )
-                    decode_errors[c] = 1;
-                    continue;
-                }
-
-                uint32_t dw = 0, dh = 0, nc = 0, bd = 0;
-                int is_signed = 0;
-                int ret = ojph_decoder_probe(decoder, encoded, enc_size,
-                                             &dw, &dh, &nc, &bd, &is_signed);
-                if(ret != 0)
-                {
-                    DEBUG( printf("JPEG2K decoder: probe failed channel %d (error %d)\n", c, ret); )
-                    ojph_decoder_free(decoder);
-                    decode_errors[c] = 1;
-                    continue;
-                }
-
-                size_t pix_count = (size_t)dw * dh;
-                size_t decoded = ojph_decoder_decode_into(decoder, encoded, enc_size,
-                                                           quarter_bufs[c], pix_count,
-                                                           &dw, &dh, &nc);
-                if(decoded == 0 || decoded != pix_count)
-                {
-                    DEBUG( printf("JPEG2K decoder: decode failed channel %d\n", c); )
-                    ojph_decoder_free(decoder);
-                    decode_errors[c] = 1;
-                    continue;
-                }
-
-                ojph_decoder_free(decoder);
-            }
-
-            /* Check for decode errors */
-            for(int c = 0; c < 4; c++)
-            {
-                if(decode_errors[c])
-                {
-                    for(int c2 = 0; c2 < 4; c2++) free(quarter_bufs[c2]);
-                    free(raw_frame);
-                    return 1;
-                }
-            }
-
-            /* Scatter 4 quarter buffers into full bayer frame
-             * Channel order: 0=x0y0, 1=x1y0, 2=x0y1, 3=x1y1 */
-            for(int c = 0; c < 4; c++)
-            {
-                uint32_t x_off = (c == 1 || c == 3) ? 1 : 0;
-                uint32_t y_off = (c == 2 || c == 3) ? 1 : 0;
-
-                for(uint32_t y = 0; y < hh; y++)
-                {
-                    for(uint32_t x = 0; x < hw; x++)
-                    {
-                        int32_t val = quarter_bufs[c][y * hw + x];
-                        if(val < 0) val = 0;
-                        if(val > 65535) val = 65535;
-                        unpackedFrame[((y * 2 + y_off) * width) + (x * 2 + x_off)] = (uint16_t)val;
-                    }
-                }
-            }
-
-            for(int c = 0; c < 4; c++) free(quarter_bufs[c]);
 #else
             DEBUG( printf("JPEG2K codec is not enabled at build\n"); )
-            free(raw_frame);
+            bufferPoolFree(raw_frame);
             pthread_mutex_unlock(video->main_file_mutex + chunk);
             return 1;
 #endif
@@ -546,38 +574,61 @@ int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * un
             if(fread(raw_frame, raw_frame_size, 1, file) != 1)
             {
                 DEBUG( printf("Frame data read error none\n"); )
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 pthread_mutex_unlock(video->main_file_mutex + chunk);
                 return 1;
             }
 
             pthread_mutex_unlock(video->main_file_mutex + chunk);
+            packed = 1;
+        }
+    }
+
+    /* Unpack, linearise and pixel wise low level raw processing in one pass over row bands,
+     * so each band is still in cache for the next step */
+    if (packed || video->linearise_lut || llrp)
+    {
+        /* A band must start on a 16 bit word of the packed data */
+        int band_rows = (packed && (width * bitdepth) % 16) ? out_height : RAW_BAND_ROWS;
+        int bands = (out_height + band_rows - 1) / band_rows;
+
+        /* With a single band the unpacker runs parallel by itself */
+        #pragma omp parallel for if(bands > 1)
+        for (int band = 0; band < bands; band++)
+        {
+            int first_row = band * band_rows;
+            int rows = MIN(band_rows, out_height - first_row);
+            size_t first_pixel = (size_t)first_row * out_width;
+            size_t band_pixels = (size_t)rows * out_width;
+            uint16_t * band_frame = unpackedFrame + first_pixel;
+
+            if (packed)
+            {
+                /* Same unpacker as DNG and MLV export, specialised for 10/12/14 bit */
+                dng_unpack_image_bits(band_frame, (uint16_t *)(raw_frame + first_pixel * bitdepth / 8), width, rows, bitdepth);
+            }
 
-            uint32_t mask = (1 << bitdepth) - 1;
-            #pragma omp parallel for
-            for (int i = 0; i < pixels_count; ++i)
+            if (video->linearise_lut)
             {
-                uint32_t bits_offset = i * bitdepth;
-                uint32_t bits_address = bits_offset / 16;
-                uint32_t bits_shift = bits_offset % 16;
-                uint32_t rotate_value = 16 + ((32 - bitdepth) - bits_shift);
-                uint32_t uncorrected_data = *((uint32_t *)&((uint16_t *)raw_frame)[bits_address]);
-                uint32_t data = ROR32(uncorrected_data, rotate_value);
-                unpackedFrame[i] = ((uint16_t)(data & mask));
+                for (size_t i = 0; i < band_pixels; ++i)
+                {
+                    band_frame[i] = video->linearise_lut[band_frame[i]];
+                }
             }
+
+            if (llrp) llrpProcessPixels(video, llrp, unpackedFrame, first_pixel, band_pixels);
         }
     }
 
-    if (video->linearise_lut)
+    if (reduced < reduction)
     {
-        #pragma omp parallel for
-        for (int i = 0; i < pixels_count; ++i)
-        {
-            unpackedFrame[i] = video->linearise_lut[unpackedFrame[i]];
-        }
+        bin_bayer_frame(unpackedFrame, &out_width, &out_height, reduction - reduced);
     }
 
-    free(raw_frame);
+    if (outWidth) *outWidth = out_width;
+    if (outHeight) *outHeight = out_height;
+
+    bufferPoolFree(raw_frame);
     return 0;
 }
 
@@ -590,29 +641,39 @@ void getMlvRawFrameFloat(mlvObject_t * video, uint64_t frameIndex, float * outpu
 
     /* Memory buffer for decompressed or bit unpacked RAW data */
     size_t unpacked_frame_size = pixels_count * 2;
-    uint16_t * unpacked_frame = (uint16_t *)malloc( unpacked_frame_size );
+    uint16_t * unpacked_frame = (uint16_t *)bufferPoolAlloc( unpacked_frame_size );
 
-    if(getMlvRawFrameUint16(video, frameIndex, unpacked_frame))
+    /* apply low level raw processing to the unpacked_frame, the pixel wise parts of it
+     * together with unpacking and converting to float */
+    llrpFrame_t llrp;
+    llrpBeginFrame(video, &llrp, unpacked_frame_size);
+
+    if(get_raw_frame_uint16(video, frameIndex, unpacked_frame, 0, NULL, NULL, &llrp))
     {
+        llrpCancelFrame(video, &llrp);
         memset(outputFrame, 0, pixels_count * sizeof(float));
-        free(unpacked_frame);
+        bufferPoolFree(unpacked_frame);
         return;
     }
 
-    /* apply low level raw processing to the unpacked_frame */
-    applyLLRawProcObject(video, unpacked_frame, unpacked_frame_size);
+    llrpProcessFrame(video, &llrp, unpacked_frame);
 
     /* high quality dualiso buffer consists of real 16 bit values, no converting needed */
     int shift_val = (llrpHQDualIso(video)) ? 0 : (16 - video->RAWI.raw_info.bits_per_pixel);
 
     /* convert uint16_t raw data -> float raw_data for processing with amaze or bilinear debayer, both need data input as float */
+    int width = video->RAWI.xRes;
+    int height = video->RAWI.yRes;
+    int bands = (height + RAW_BAND_ROWS - 1) / RAW_BAND_ROWS;
     #pragma omp parallel for
-    for (volatile int i = 0; i < pixels_count; ++i)
+    for (int band = 0; band < bands; band++)
     {
-        outputFrame[i] = (float)(unpacked_frame[i] << shift_val);
+        int first_row = band * RAW_BAND_ROWS;
+        int rows = MIN(RAW_BAND_ROWS, height - first_row);
+        llrpFinishPixelsFloat(&llrp, unpacked_frame, outputFrame, (size_t)first_row * width, (size_t)rows * width, shift_val);
     }
 
-    free(unpacked_frame);
+    bufferPoolFree(unpacked_frame);
 }
 
 void setMlvProcessing(mlvObject_t * video, processingObject_t * processing)
@@ -730,9 +791,9 @@ void getMlvRawFrameDebayered(mlvObject_t * video, uint64_t frameIndex, uint16_t
             }
             else
             {
-                float * raw_frame = malloc(width * height * sizeof(float));
+                float * raw_frame = bufferPoolAlloc(width * height * sizeof(float));
                 get_mlv_raw_frame_debayered(video, frameIndex, raw_frame, video->rgb_raw_current_frame, doesMlvAlwaysUseAmaze(video));
-                free(raw_frame);
+                bufferPoolFree(raw_frame);
                 memcpy(outputFrame, video->rgb_raw_current_frame, frame_size);
                 video->current_cached_frame_active = 1;
                 video->current_cached_frame = frameIndex;
@@ -754,7 +815,7 @@ void getMlvProcessedFrame16(mlvObject_t * video, uint64_t frameIndex, uint16_t *
     int rgb_frame_size = height * width * 3;
 
     /* Unprocessed debayered frame (RGB) */
-    uint16_t * unprocessed_frame = malloc( rgb_frame_size * sizeof(uint16_t) );
+    uint16_t * unprocessed_frame = bufferPoolAlloc( rgb_frame_size * sizeof(uint16_t) );
 
     /* Get the raw data in B&W */
     getMlvRawFrameDebayered(video, frameIndex, unprocessed_frame);
@@ -766,7 +827,7 @@ void getMlvProcessedFrame16(mlvObject_t * video, uint64_t frameIndex, uint16_t *
                            outputFrame,
                            threads, 1, frameIndex );
 
-    free(unprocessed_frame);
+    bufferPoolFree(unprocessed_frame);
 }
 
 /* Get a processed frame in 8 bit */
@@ -776,7 +837,7 @@ void getMlvProcessedFrame8(mlvObject_t * video, uint64_t frameIndex, uint8_t * o
     int rgb_frame_size = getMlvWidth(video) * getMlvHeight(video) * 3;
 
     /* Processed frame (RGB) */
-    uint16_t * processed_frame = malloc( rgb_frame_size * sizeof(uint16_t) );
+    uint16_t * processed_frame = bufferPoolAlloc( rgb_frame_size * sizeof(uint16_t) );
 
     getMlvProcessedFrame16(video, frameIndex, processed_frame, threads);
 
@@ -787,7 +848,77 @@ void getMlvProcessedFrame8(mlvObject_t * video, uint64_t frameIndex, uint8_t * o
         outputFrame[i] = processed_frame[i] >> 8;
     }
 
-    free(processed_frame);
+    bufferPoolFree(processed_frame);
+}
+
+/* Get a processed frame in 8 bit for playback: raw data is decoded at half resolution
+ * (skipping wavelet levels of JPEG2000 and CineForm), debayered basic and processed at
+ * that size, then scaled up to the size of getMlvProcessedFrame8.
+ * Falls back to getMlvProcessedFrame8 if a raw fix or a slower debayer is selected */
+void getMlvPreviewFrame8(mlvObject_t * video, uint64_t frameIndex, uint8_t * outputFrame, int threads)
+{
+    /* Cached frames are debayered already. Raw fixes (dark frame, pixel maps, dual iso...) are
+     * made for full resolution raw data. Basic debayer only replaces the fast playback debayers */
+    int fast_debayer = (doesMlvAlwaysUseAmaze(video) == 0 || doesMlvAlwaysUseAmaze(video) == 3 || doesMlvAlwaysUseAmaze(video) == 9);
+    if (video->cached_frames[frameIndex] == MLV_FRAME_IS_CACHED || llrpRawFixesActive(video) || !fast_debayer)
+    {
+        getMlvProcessedFrame8(video, frameIndex, outputFrame, threads);
+        return;
+    }
+
+    int raw_w = getMlvWidth(video);
+    int raw_h = getMlvHeight(video);
+    int width = 0;
+    int height = 0;
+
+    uint16_t * raw_frame = bufferPoolAlloc( raw_w * raw_h * sizeof(uint16_t) );
+    if (getMlvRawFrameUint16Reduced(video, frameIndex, raw_frame, 1, &width, &height))
+    {
+        bufferPoolFree(raw_frame);
+        memset(outputFrame, 0, raw_w * raw_h * 3);
+        return;
+    }
+
+    int pixels_count = width * height;
+    int shift_val = 16 - video->RAWI.raw_info.bits_per_pixel;
+    float * float_frame = bufferPoolAlloc( pixels_count * sizeof(float) );
+    #pragma omp parallel for
+    for (int i = 0; i < pixels_count; ++i)
+    {
+        float_frame[i] = (float)(raw_frame[i] << shift_val);
+    }
+    bufferPoolFree(raw_frame);
+
+    uint16_t * unprocessed_frame = bufferPoolAlloc( pixels_count * 3 * sizeof(uint16_t) );
+    uint16_t * processed_frame = bufferPoolAlloc( pixels_count * 3 * sizeof(uint16_t) );
+    debayerBasic(unprocessed_frame, float_frame, width, height, threads);
+    bufferPoolFree(float_frame);
+
+    /* vignette and gradient masks are made for full resolution */
+    applyProcessingObjectWithoutMasks( video->processing,
+                                       width, height,
+                                       unprocessed_frame,
+                                       processed_frame,
+                                       threads, 1, frameIndex );
+    bufferPoolFree(unprocessed_frame);
+
+    /* nearest neighbour upscale to raw resolution (8 bit) */
+    #pragma omp parallel for
+    for (int y = 0; y < raw_h; y++)
+    {
+        int preview_y = y * height / raw_h;
+        const uint16_t * src_row = processed_frame + (size_t)preview_y * width * 3;
+        uint8_t * dst_row = outputFrame + (size_t)y * raw_w * 3;
+        for (int x = 0; x < raw_w; x++)
+        {
+            int preview_x = x * width / raw_w;
+            dst_row[x * 3 + 0] = src_row[preview_x * 3 + 0] >> 8;
+            dst_row[x * 3 + 1] = src_row[preview_x * 3 + 1] >> 8;
+            dst_row[x * 3 + 2] = src_row[preview_x * 3 + 2] >> 8;
+        }
+    }
+
+    bufferPoolFree(processed_frame);
 }
 
 /* To initialise mlv object with a clip
@@ -905,6 +1036,16 @@ void freeMlvObject(mlvObject_t * video)
     if(video->linearise_lut) free(video->linearise_lut);
     freeLLRawProcObject(video);
 
+    /* The pool is process wide, other clips may still use its idle buffers.
+     * The application trims it when the main clip is closed */
+    DEBUG(
+        buffer_pool_stats_t pool_stats;
+        bufferPoolGetStats(&pool_stats);
+        printf("Buffer pool: %zu MiB high water mark, %llu allocations, %llu reuses\n",
+               pool_stats.high_water_mark >> 20,
+               (unsigned long long)pool_stats.allocations, (unsigned long long)pool_stats.reuses);
+    )
+
     /* Mutex things here... */
     for (int i = 0; i < video->filenum; ++i)
         if(video->main_file_mutex) pthread_mutex_destroy(video->main_file_mutex + i);
@@ -1268,90 +1409,531 @@ uint16_t log_decode_int(uint16_t x, uint16_t bl, uint16_t max, uint16_t max_valu
     return (uint16_t)result;
 }
 
-/* Save MLV headers */
-int saveMlvHeaders(mlvObject_t * video, FILE * output_mlv, int export_audio, int export_mode, uint32_t frame_start, uint32_t frame_end, const char * version, char * error_message)
+/* Export modes which decode the frame and encode it again */
+static int is_encoded_export(mlvObject_t * video, int export_mode)
 {
-    int is_cineform = export_mode == MLV_CINEFORM;
-    int is_jp2k = export_mode == MLV_JP2K_LOW
-        || export_mode == MLV_JP2K_MED
-        || export_mode == MLV_JP2K_HIGH
-        || export_mode == MLV_JP2K_VERYHIGH
-        || export_mode == MLV_JP2K_VISULOSSLESS;
-    int is_lossy = is_cineform || is_jp2k;
+    switch (export_mode)
+    {
+        case MLV_CINEFORM:
+        case MLV_JP2K_LOW:
+        case MLV_JP2K_MED:
+        case MLV_JP2K_HIGH:
+        case MLV_JP2K_VERYHIGH:
+        case MLV_JP2K_VISULOSSLESS:
+            return 1;
+        case MLV_LJ92:
+            return !isMlvLj92(video);
+        default:
+            return 0;
+    }
+}
 
-    if(export_mode == MLV_DF_INT && !video->DARK.blockType[0])
+/* Encoder state and buffers, kept over all frames one thread encodes */
+typedef struct {
+    int export_mode;
+    int frame_threads;          /* threads working on one frame (LJ92 slices, JPEG2K planes) */
+    uint32_t width, height;
+    uint16_t * frame;           /* decoded frame */
+    uint16_t * compressed;      /* LJ92 output */
+    uint16_t encode_lut[16384]; /* log curve for CineForm and JPEG2K */
+#ifdef ENABLE_CINEFORM
+    CFHD_EncoderRef cineform;
+#endif
+#ifdef ENABLE_JPEG2K
+    void * jp2k[4];
+    int32_t * quarter_bufs[4];
+    uint8_t * encoded_bufs[4];
+    size_t max_enc_size;
+#endif
+} frame_encoder_t;
+
+static void free_frame_encoder(frame_encoder_t * encoder)
+{
+    if (!encoder) return;
+#ifdef ENABLE_CINEFORM
+    if (encoder->cineform) CFHD_CloseEncoder(encoder->cineform);
+#endif
+#ifdef ENABLE_JPEG2K
+    for (int c = 0; c < 4; c++)
     {
-        sprintf(error_message, "There is no internal darkframe in:  %s", video->path);
-        DEBUG( printf("\n%s\n", error_message); )
-        return 1;
+        if (encoder->jp2k[c]) ojph_encoder_free(encoder->jp2k[c]);
+        bufferPoolFree(encoder->quarter_bufs[c]);
+        bufferPoolFree(encoder->encoded_bufs[c]);
     }
-    else if((export_mode == MLV_LJ92) && isMlvCompressed(video))
+#endif
+    bufferPoolFree(encoder->frame);
+    bufferPoolFree(encoder->compressed);
+    free(encoder);
+}
+
+/* Opens and prepares the encoder for export_mode once, returns NULL on error */
+static frame_encoder_t * init_frame_encoder(mlvObject_t * video, int export_mode, int frame_threads, char * error_message)
+{
+    frame_encoder_t * encoder = calloc(1, sizeof(frame_encoder_t));
+    if (!encoder)
     {
-        sprintf(error_message, "MLV already compressed:  %s\nUse 'Fast Pass' instead", video->path);
-        DEBUG( printf("\n%s\n", error_message); )
-        return 1;
+        sprintf(error_message, "Could not allocate memory for the frame encoder");
+        return NULL;
     }
-    else if((export_mode == MLV_DECOMPRESS) && (!isMlvCompressed(video)))
+    encoder->export_mode = export_mode;
+    encoder->frame_threads = frame_threads;
+    encoder->width = video->RAWI.xRes;
+    encoder->height = video->RAWI.yRes;
+    size_t pixel_count = (size_t)encoder->width * encoder->height;
+
+    encoder->frame = bufferPoolAlloc(pixel_count * sizeof(uint16_t));
+    if (!encoder->frame)
     {
-        sprintf(error_message, "MLV already uncompressed:  %s\nUse 'Fast Pass' instead", video->path);
-        DEBUG( printf("\n%s\n", error_message); )
-        return 1;
+        sprintf(error_message, "Could not allocate memory for the frame encoder");
+        free_frame_encoder(encoder);
+        return NULL;
     }
 
-    /* construct version info */
-    char version_info[1024] = { 0 };
-    char tms[64] = { 0 };
-    char export_mode_str[32] = { 0 };
-    char export_audio_str[8] = { 0 };
-    time_t rawtm = time(NULL);
-    struct tm *tm = localtime(&rawtm);
-    strftime(tms, sizeof(tms), "%H:%M:%S %b %e %Y", tm);
+    if (export_mode == MLV_LJ92)
+    {
+        encoder->compressed = bufferPoolAlloc(pixel_count * sizeof(uint16_t));
+        if (!encoder->compressed)
+        {
+            sprintf(error_message, "Could not allocate memory for frame compressing");
+            free_frame_encoder(encoder);
+            return NULL;
+        }
+        return encoder;
+    }
 
-    char * export_mode_strings[] = {
-        "MLV_FAST_PASS",
-        "MLV_LJ92",
-        "MLV_DECOMPRESS",
-        "MLV_AVERAGED_FRAME",
-        "MLV_DF_INT",
-        "MLV_CINEFORM",
-        "MLV_JP2K_LOW",
-        "MLV_JP2K_MED",
-        "MLV_JP2K_HIGH",
-        "MLV_JP2K_VERYHIGH",
-        "MLV_JP2K_VISULOSSLESS"
-    };
+    uint16_t bl = getMlvBlackLevel(video);
+    uint16_t max_value = 1 << getMlvBitdepth(video);
+    for (int i = 0; i < 16384; i++) {
+        encoder->encode_lut[i] = log_encode_int(i, bl, max_value, 4095);
+    }
 
-    strcat(export_mode_str, export_mode_strings[export_mode]);
+    if (export_mode == MLV_CINEFORM)
+    {
+#ifdef ENABLE_CINEFORM
+        if (CFHD_OpenEncoder(&encoder->cineform, NULL) != CFHD_ERROR_OKAY
+            || CFHD_PrepareToEncode(encoder->cineform,
+                                    encoder->width,
+                                    encoder->height,
+                                    CFHD_PIXEL_FORMAT_BYR4,
+                                    CFHD_ENCODED_FORMAT_BAYER,
+                                    CFHD_ENCODING_FLAGS_NONE,
+                                    CFHD_ENCODING_QUALITY_FILMSCAN3) != CFHD_ERROR_OKAY)
+        {
+            sprintf(error_message, "Could not open Cineform encoder");
+            free_frame_encoder(encoder);
+            return NULL;
+        }
+#else
+        sprintf(error_message, "Cineform export is not enabled in this build (ENABLE_CINEFORM)");
+        free_frame_encoder(encoder);
+        return NULL;
+#endif
+    }
+    else
+    {
+#ifdef ENABLE_JPEG2K
+        uint32_t hw = encoder->width / 2;
+        uint32_t hh = encoder->height / 2;
+        size_t quarter_pixels = (size_t)hw * hh;
+        encoder->max_enc_size = quarter_pixels * 2;
+
+        float jp2k_threshold = 0.0;
+        if (export_mode == MLV_JP2K_LOW) {
+            jp2k_threshold = 0.010;
+        } else if (export_mode == MLV_JP2K_MED) {
+            jp2k_threshold = 0.0065;
+        } else if (export_mode == MLV_JP2K_HIGH) {
+            jp2k_threshold = 0.0045;
+        } else if (export_mode == MLV_JP2K_VERYHIGH) {
+            jp2k_threshold = 0.0032;
+        } else if (export_mode == MLV_JP2K_VISULOSSLESS) {
+            jp2k_threshold = 0.0015;
+        }
 
-    if(video->WAVI.blockType[0] && export_audio && (export_mode < MLV_AVERAGED_FRAME)) strcat(export_audio_str, "ON");
-    else strcat(export_audio_str, "OFF");
+        for (int c = 0; c < 4; c++)
+        {
+            encoder->jp2k[c] = ojph_encoder_new();
+            encoder->quarter_bufs[c] = (int32_t *)bufferPoolAlloc(quarter_pixels * sizeof(int32_t));
+            encoder->encoded_bufs[c] = (uint8_t *)bufferPoolAlloc(encoder->max_enc_size);
+            if (!encoder->jp2k[c] || !encoder->quarter_bufs[c] || !encoder->encoded_bufs[c])
+            {
+                sprintf(error_message, "Could not open JPEG2000 encoder");
+                free_frame_encoder(encoder);
+                return NULL;
+            }
+            ojph_encoder_set_image(encoder->jp2k[c], hw, hh, 1, 12, 0);
+            ojph_encoder_set_decompositions(encoder->jp2k[c], 5);
+            ojph_encoder_set_lossless(encoder->jp2k[c], 0);
+            ojph_encoder_set_quantization(encoder->jp2k[c], jp2k_threshold);
+        }
+#else
+        sprintf(error_message, "JPEG2000 export is not enabled in this build (ENABLE_JPEG2K)");
+        free_frame_encoder(encoder);
+        return NULL;
+#endif
+    }
 
-    sprintf(version_info, "exported by MLV App version %s on %s; export mode: %s (audio: %s) ", version, tms, export_mode_str, export_audio_str);
-    size_t vers_info_size = strlen(version_info) + 1;
-    size_t vers_block_size = sizeof(mlv_vers_hdr_t) + vers_info_size;
-    mlv_vers_hdr_t VERS_HEADER = { "VERS", vers_block_size, 0xFFFFFFFFFFFFFFFF, vers_info_size };
+    return encoder;
+}
 
-    /* calculate space needed for original VERS blocks */
-    size_t orig_vers_blocks_size = 0;
-    for (uint32_t i = 0; i < video->vers_blocks; ++i)
-        orig_vers_blocks_size += sizeof(mlv_vers_hdr_t) + video->vers_index[i].frame_size;
+/* Reads the VIDF block header of a frame, can be called from any thread */
+static int read_vidf_header(mlvObject_t * video, uint32_t frame_index, mlv_vidf_hdr_t * vidf_hdr)
+{
+    int chunk = video->video_index[frame_index].chunk_num;
+    pthread_mutex_lock(video->main_file_mutex + chunk);
+    file_set_pos(video->file[chunk], video->video_index[frame_index].block_offset, SEEK_SET);
+    int ret = fread(vidf_hdr, sizeof(mlv_vidf_hdr_t), 1, video->file[chunk]) != 1;
+    pthread_mutex_unlock(video->main_file_mutex + chunk);
+    return ret;
+}
 
-    size_t mlv_headers_size = video->MLVI.blockSize + video->RAWI.blockSize + video->IDNT.blockSize +
-                              video->EXPO.blockSize + video->LENS.blockSize + video->WBAL.blockSize +
-                              video->RTCI.blockSize + vers_block_size + orig_vers_blocks_size;
+/* Encodes one frame to a complete VIDF block (malloc, blockSize set in vidf_hdr), returns NULL on error.
+ * If LJ92 compression fails the original frame is stored and *uncompressed is set. Can be called from
+ * any thread, each thread needs its own encoder */
+static uint8_t * encode_vidf_block(mlvObject_t * video, frame_encoder_t * encoder, uint32_t frame_index, mlv_vidf_hdr_t * vidf_hdr, int * uncompressed, char * error_message)
+{
+    uint8_t * block_buf = NULL;
+    uint32_t pixel_count = encoder->width * encoder->height;
+    uint16_t * frame = encoder->frame;
+    *uncompressed = 0;
 
-    if(video->ELNS.blockType[0]) mlv_headers_size += video->ELNS.blockSize;
-    if(video->RAWC.blockType[0]) mlv_headers_size += video->RAWC.blockSize;
-    if(video->STYL.blockType[0]) mlv_headers_size += video->STYL.blockSize;
-    if(video->DISO.blockType[0]) mlv_headers_size += video->DISO.blockSize;
-    if(video->WAVI.blockType[0] && export_audio && !(export_mode == MLV_AVERAGED_FRAME || export_mode == MLV_DF_INT)) mlv_headers_size += video->WAVI.blockSize;
-    if(video->INFO.blockType[0] && video->INFO_STRING[0]) mlv_headers_size += video->INFO.blockSize;
-    if(video->llrawproc->dark_frame && export_mode < MLV_AVERAGED_FRAME) // if normal MLV export specified and dark frame exists
+    if (getMlvRawFrameUint16(video, frame_index, frame))
     {
-        df_init(video);
-        DEBUG( printf("Block Size = %u, DF Size = %u, Export Mode = %u, Filename = %s\n", video->llrawproc->dark_frame_hdr.blockSize, video->llrawproc->dark_frame_size, export_mode, video->llrawproc->dark_frame_filename); )
-        DEBUG( printf("Headers Size += %u\n", video->llrawproc->dark_frame_hdr.blockSize); )
-        mlv_headers_size += video->llrawproc->dark_frame_hdr.blockSize;
+        sprintf(error_message, "Could not decode video frame #%u", frame_index);
+        return NULL;
+    }
+
+    vidf_hdr->frameSpace = 0;
+
+    if (encoder->export_mode == MLV_LJ92)
+    {
+        size_t frame_size_compressed = 0;
+        int ret = dng_compress_image(encoder->compressed, frame, &frame_size_compressed, encoder->width, encoder->height, video->RAWI.raw_info.bits_per_pixel, encoder->frame_threads);
+        if (ret == LJ92_ERROR_NONE)
+        {
+            vidf_hdr->blockSize = sizeof(mlv_vidf_hdr_t) + frame_size_compressed;
+            block_buf = malloc(vidf_hdr->blockSize);
+            if (block_buf)
+            {
+                memcpy(block_buf, vidf_hdr, sizeof(mlv_vidf_hdr_t));
+                memcpy(block_buf + sizeof(mlv_vidf_hdr_t), encoder->compressed, frame_size_compressed);
+            }
+        }
+        else // if compression error then save original uncompressed raw
+        {
+            int chunk = video->video_index[frame_index].chunk_num;
+            uint32_t frame_size = video->video_index[frame_index].frame_size;
+            vidf_hdr->blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
+            block_buf = malloc(vidf_hdr->blockSize);
+            if (block_buf)
+            {
+                memcpy(block_buf, vidf_hdr, sizeof(mlv_vidf_hdr_t));
+                pthread_mutex_lock(video->main_file_mutex + chunk);
+                file_set_pos(video->file[chunk], video->video_index[frame_index].frame_offset, SEEK_SET);
+                int read_ok = fread(block_buf + sizeof(mlv_vidf_hdr_t), frame_size, 1, video->file[chunk]) == 1;
+                pthread_mutex_unlock(video->main_file_mutex + chunk);
+                if (!read_ok)
+                {
+                    sprintf(error_message, "Could not read VIDF image data from:  %s", video->path);
+                    free(block_buf);
+                    return NULL;
+                }
+                *uncompressed = 1;
+            }
+        }
+        if (!block_buf) sprintf(error_message, "Could not allocate memory for VIDF block");
+        return block_buf;
+    }
+
+    for (uint32_t p = 0; p < pixel_count; p++) {
+        frame[p] = encoder->encode_lut[frame[p]];
+    }
+
+    if (encoder->export_mode == MLV_CINEFORM)
+    {
+#ifdef ENABLE_CINEFORM
+        void *sample_data = NULL;
+        size_t sample_size = 0;
+        if (CFHD_EncodeSample(encoder->cineform, frame, encoder->width * 2) == CFHD_ERROR_OKAY
+            && CFHD_GetSampleData(encoder->cineform, &sample_data, &sample_size) == CFHD_ERROR_OKAY
+            && sample_data && sample_size > 0)
+        {
+            vidf_hdr->blockSize = sizeof(mlv_vidf_hdr_t) + sample_size;
+            block_buf = malloc(vidf_hdr->blockSize);
+            if (block_buf)
+            {
+                memcpy(block_buf, vidf_hdr, sizeof(mlv_vidf_hdr_t));
+                memcpy(block_buf + sizeof(mlv_vidf_hdr_t), sample_data, sample_size);
+            }
+        }
+        if (!block_buf) sprintf(error_message, "Cineform encoding failed");
+#endif
+    }
+    else
+    {
+#ifdef ENABLE_JPEG2K
+        uint32_t hw = encoder->width / 2;
+        uint32_t hh = encoder->height / 2;
+        size_t enc_sizes[4] = {0, 0, 0, 0};
+
+        /* Planes are independent, but the export writer already runs one encoder per core */
+        #pragma omp parallel for num_threads(encoder->frame_threads)
+        for (int c = 0; c < 4; c++)
+        {
+            uint32_t x_off = (c & 1) ? 1 : 0;
+            uint32_t y_off = (c & 2) ? 1 : 0;
+            int32_t * quarter_buf = encoder->quarter_bufs[c];
+            for (uint32_t y = 0; y < hh; y++)
+            {
+                uint32_t in_row = (y * 2 + y_off) * encoder->width;
+                uint32_t out_row = y * hw;
+                for (uint32_t x = 0; x < hw; x++)
+                {
+                    quarter_buf[out_row + x] = (int32_t)frame[in_row + x * 2 + x_off];
+                }
+            }
+            enc_sizes[c] = ojph_encoder_encode_into(encoder->jp2k[c], quarter_buf,
+                                                    encoder->encoded_bufs[c], encoder->max_enc_size);
+        }
+
+        if (enc_sizes[0] > 0 && enc_sizes[1] > 0 && enc_sizes[2] > 0 && enc_sizes[3] > 0)
+        {
+            uint32_t offsets[4];
+            offsets[0] = 36;
+            offsets[1] = offsets[0] + (uint32_t)enc_sizes[0];
+            offsets[2] = offsets[1] + (uint32_t)enc_sizes[1];
+            offsets[3] = offsets[2] + (uint32_t)enc_sizes[2];
+            size_t total_size = (size_t)offsets[3] + enc_sizes[3];
+
+            vidf_hdr->blockSize = sizeof(mlv_vidf_hdr_t) + total_size;
+
+            block_buf = malloc(vidf_hdr->blockSize);
+            if (block_buf)
+            {
+                uint8_t *ptr = block_buf + sizeof(mlv_vidf_hdr_t);
+                memcpy(block_buf, vidf_hdr, sizeof(mlv_vidf_hdr_t));
+
+                uint32_t version = 1;
+                memcpy(ptr, &version, 4); ptr += 4;
+                for (int c = 0; c < 4; c++)
+                {
+                    uint32_t size = (uint32_t)enc_sizes[c];
+                    memcpy(ptr, &offsets[c], 4); ptr += 4;
+                    memcpy(ptr, &size, 4); ptr += 4;
+                }
+                for (int c = 0; c < 4; c++)
+                {
+                    memcpy(ptr, encoder->encoded_bufs[c], enc_sizes[c]); ptr += enc_sizes[c];
+                }
+            }
+        }
+        if (!block_buf) sprintf(error_message, "JPEG2000 encoding failed");
+#endif
+    }
+
+    return block_buf;
+}
+
+/* Copies count bytes from in_offset of a clip file to the current position of output_mlv.
+ * On Linux the kernel moves the data (copy_file_range, on reflink filesystems it only shares
+ * the extents), elsewhere or if that's not possible it goes through a buffer. Returns 0 on success */
+static int copy_clip_data(mlvObject_t * video, int chunk, uint64_t in_offset, FILE * output_mlv, uint64_t count)
+{
+    FILE * input = video->file[chunk];
+
+#if defined(__linux) && defined(__NR_copy_file_range)
+    /* Explicit offsets, the file positions of the input are not used */
+    fflush(output_mlv);
+    int64_t in_pos = in_offset;
+    int64_t out_pos = file_get_pos(output_mlv);
+
+    /* Blocks are only shared if a call covers whole 4k blocks, so the unaligned head and tail
+     * are copied by their own calls (the output is padded to the same offset in a block) */
+    uint64_t pieces[3];
+    pieces[0] = MIN(count, (4096 - (in_offset & 4095)) & 4095);
+    pieces[1] = (count - pieces[0]) & ~(uint64_t)4095;
+    pieces[2] = count - pieces[0] - pieces[1];
+    for (int p = 0; p < 3; ++p)
+    {
+        uint64_t piece = pieces[p];
+        while (piece > 0)
+        {
+            long copied = syscall(__NR_copy_file_range, fileno(input), &in_pos, fileno(output_mlv), &out_pos, (size_t)MIN(piece, (uint64_t)1 << 30), 0);
+            if (copied <= 0) break; // Old kernel, other filesystem..., copy the rest below
+            piece -= copied;
+            count -= copied;
+        }
+        if (piece > 0) break;
+    }
+    file_set_pos(output_mlv, out_pos, SEEK_SET);
+    in_offset = in_pos;
+    if (count == 0) return 0;
+    DEBUG( printf("copy_file_range not possible (%s), copying through buffer\n", strerror(errno)); )
+#endif
+
+    size_t buffer_size = 8 << 20;
+    uint8_t * buffer = bufferPoolAlloc(buffer_size);
+    if (!buffer) return 1;
+
+    int ret = 0;
+    while (count > 0 && !ret)
+    {
+        size_t size = MIN(count, buffer_size);
+        pthread_mutex_lock(video->main_file_mutex + chunk);
+        file_set_pos(input, in_offset, SEEK_SET);
+        ret = fread(buffer, size, 1, input) != 1;
+        pthread_mutex_unlock(video->main_file_mutex + chunk);
+        if (!ret) ret = fwrite(buffer, size, 1, output_mlv) != 1;
+        in_offset += size;
+        count -= size;
+    }
+
+    bufferPoolFree(buffer);
+    return ret;
+}
+
+/* Patches videoClass in the MLVI header of the output file */
+static void patch_output_video_class(FILE * output_mlv, uint16_t videoClass)
+{
+    uint64_t current_pos = file_get_pos(output_mlv);
+    file_set_pos(output_mlv, 32, SEEK_SET);
+    if(fwrite(&videoClass, sizeof(uint16_t), 1, output_mlv) != 1)
+    {
+        DEBUG( printf("\nCould not patch videoClass in MLV header\n"); )
+    }
+    file_set_pos(output_mlv, current_pos, SEEK_SET);
+}
+
+/* Writes the cut audio as one AUDF block, goes in front of the first video frame */
+static int write_audf_block(mlvObject_t * video, FILE * output_mlv, uint32_t frame_start, uint32_t frame_end, uint64_t timestamp, char * error_message)
+{
+    /* initialize AUDF header */
+    mlv_audf_hdr_t audf_hdr = { { 'A','U','D','F' }, 0, 0, 0, 0 };
+
+    /* Calculate the sum of audio sample sizes for all audio channels */
+    uint64_t audio_sample_size = getMlvAudioChannels(video) * (getMlvAudioBitsPerSample(video) / 8);
+    /* Calculate the audio alignement block size in bytes */
+    uint16_t block_align = audio_sample_size * 1024;
+    /* Calculate audio starting offset */
+    uint64_t audio_start_offset = ( (uint64_t)( (double)(getMlvSampleRate(video) * audio_sample_size * (frame_start - 1)) / (double)getMlvFramerate(video) ) );
+    /* Make sure start offset value is multiple of sum of all channel sample sizes */
+    uint64_t audio_start_offset_aligned = audio_start_offset - (audio_start_offset % audio_sample_size);
+    /* Calculate cut audio size */
+    uint64_t cut_audio_size = (uint64_t)( (double)(getMlvSampleRate(video) * audio_sample_size * (frame_end - frame_start + 1)) / (double)getMlvFramerate(video) );
+    /* check if cut_audio_size is multiple of 'block_align' bytes and not more than original audio data size */
+    uint64_t cut_audio_size_aligned = MIN( (cut_audio_size - (cut_audio_size % block_align) + block_align), video->audio_size );
+    /* make max audio size (uint32_t max value - 1) multiple of 'block_align' bytes */
+    uint32_t max_audio_size = 0xFFFFFFFF - (0xFFFFFFFF % block_align);
+    /* Not likely that audio size exeeds the 4.3gb but anyway check if cut_audio_size is more than uint32_t max value to not overflow blockSize variable */
+    if(cut_audio_size_aligned > max_audio_size) cut_audio_size_aligned = max_audio_size;
+
+    /* fill AUDF block header */
+    audf_hdr.blockSize = sizeof(mlv_audf_hdr_t) + cut_audio_size_aligned;
+    audf_hdr.timestamp = timestamp;
+
+    /* write AUDF block header */
+    if(fwrite(&audf_hdr, sizeof(mlv_audf_hdr_t), 1, output_mlv) != 1)
+    {
+        sprintf(error_message, "Could not write AUDF block header");
+        DEBUG( printf("\n%s\n", error_message); )
+        return 1;
+    }
+
+    /* write audio data */
+    if(fwrite(video->audio_data + audio_start_offset_aligned, cut_audio_size_aligned, 1, output_mlv) != 1)
+    {
+        sprintf(error_message, "Could not write AUDF block audio data");
+        DEBUG( printf("\n%s\n", error_message); )
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Save MLV headers */
+int saveMlvHeaders(mlvObject_t * video, FILE * output_mlv, int export_audio, int export_mode, uint32_t frame_start, uint32_t frame_end, const char * version, char * error_message)
+{
+    int is_cineform = export_mode == MLV_CINEFORM;
+    int is_jp2k = export_mode == MLV_JP2K_LOW
+        || export_mode == MLV_JP2K_MED
+        || export_mode == MLV_JP2K_HIGH
+        || export_mode == MLV_JP2K_VERYHIGH
+        || export_mode == MLV_JP2K_VISULOSSLESS;
+    int is_lossy = is_cineform || is_jp2k;
+
+    if(export_mode == MLV_DF_INT && !video->DARK.blockType[0])
+    {
+        sprintf(error_message, "There is no internal darkframe in:  %s", video->path);
+        DEBUG( printf("\n%s\n", error_message); )
+        return 1;
+    }
+    else if((export_mode == MLV_LJ92) && isMlvCompressed(video))
+    {
+        sprintf(error_message, "MLV already compressed:  %s\nUse 'Fast Pass' instead", video->path);
+        DEBUG( printf("\n%s\n", error_message); )
+        return 1;
+    }
+    else if((export_mode == MLV_DECOMPRESS) && (!isMlvCompressed(video)))
+    {
+        sprintf(error_message, "MLV already uncompressed:  %s\nUse 'Fast Pass' instead", video->path);
+        DEBUG( printf("\n%s\n", error_message); )
+        return 1;
+    }
+
+    /* construct version info */
+    char version_info[1024] = { 0 };
+    char tms[64] = { 0 };
+    char export_mode_str[32] = { 0 };
+    char export_audio_str[8] = { 0 };
+    time_t rawtm = time(NULL);
+    struct tm *tm = localtime(&rawtm);
+    strftime(tms, sizeof(tms), "%H:%M:%S %b %e %Y", tm);
+
+    char * export_mode_strings[] = {
+        "MLV_FAST_PASS",
+        "MLV_LJ92",
+        "MLV_DECOMPRESS",
+        "MLV_AVERAGED_FRAME",
+        "MLV_DF_INT",
+        "MLV_CINEFORM",
+        "MLV_JP2K_LOW",
+        "MLV_JP2K_MED",
+        "MLV_JP2K_HIGH",
+        "MLV_JP2K_VERYHIGH",
+        "MLV_JP2K_VISULOSSLESS"
+    };
+
+    strcat(export_mode_str, export_mode_strings[export_mode]);
+
+    if(video->WAVI.blockType[0] && export_audio && (export_mode < MLV_AVERAGED_FRAME)) strcat(export_audio_str, "ON");
+    else strcat(export_audio_str, "OFF");
+
+    sprintf(version_info, "exported by MLV App version %s on %s; export mode: %s (audio: %s) ", version, tms, export_mode_str, export_audio_str);
+    size_t vers_info_size = strlen(version_info) + 1;
+    size_t vers_block_size = sizeof(mlv_vers_hdr_t) + vers_info_size;
+    mlv_vers_hdr_t VERS_HEADER = { "VERS", vers_block_size, 0xFFFFFFFFFFFFFFFF, vers_info_size };
+
+    /* calculate space needed for original VERS blocks */
+    size_t orig_vers_blocks_size = 0;
+    for (uint32_t i = 0; i < video->vers_blocks; ++i)
+        orig_vers_blocks_size += sizeof(mlv_vers_hdr_t) + video->vers_index[i].frame_size;
+
+    size_t mlv_headers_size = video->MLVI.blockSize + video->RAWI.blockSize + video->IDNT.blockSize +
+                              video->EXPO.blockSize + video->LENS.blockSize + video->WBAL.blockSize +
+                              video->RTCI.blockSize + vers_block_size + orig_vers_blocks_size;
+
+    if(video->ELNS.blockType[0]) mlv_headers_size += video->ELNS.blockSize;
+    if(video->RAWC.blockType[0]) mlv_headers_size += video->RAWC.blockSize;
+    if(video->STYL.blockType[0]) mlv_headers_size += video->STYL.blockSize;
+    if(video->DISO.blockType[0]) mlv_headers_size += video->DISO.blockSize;
+    if(video->WAVI.blockType[0] && export_audio && !(export_mode == MLV_AVERAGED_FRAME || export_mode == MLV_DF_INT)) mlv_headers_size += video->WAVI.blockSize;
+    if(video->INFO.blockType[0] && video->INFO_STRING[0]) mlv_headers_size += video->INFO.blockSize;
+    if(video->llrawproc->dark_frame && export_mode < MLV_AVERAGED_FRAME) // if normal MLV export specified and dark frame exists
+    {
+        df_init(video);
+        DEBUG( printf("Block Size = %u, DF Size = %u, Export Mode = %u, Filename = %s\n", video->llrawproc->dark_frame_hdr.blockSize, video->llrawproc->dark_frame_size, export_mode, video->llrawproc->dark_frame_filename); )
+        DEBUG( printf("Headers Size += %u\n", video->llrawproc->dark_frame_hdr.blockSize); )
+        mlv_headers_size += video->llrawproc->dark_frame_hdr.blockSize;
     }
     if (is_lossy)
     {
@@ -1577,14 +2159,18 @@ int saveMlvAVFrame(mlvObject_t * video, FILE * output_mlv, int export_audio, int
     int chunk = video->video_index[frame_index].chunk_num;
     uint32_t frame_size = video->video_index[frame_index].frame_size;
     uint64_t frame_offset = video->video_index[frame_index].frame_offset;
-    uint64_t block_offset = video->video_index[frame_index].block_offset;
 
     uint8_t * block_buf = NULL;
     uint8_t * frame_buf = NULL;
 
+    /* The original raw frame is written unchanged */
+    int pass_through = !is_encoded_export(video, export_mode)
+                    && export_mode != MLV_DF_INT
+                    && export_mode != MLV_AVERAGED_FRAME
+                    && !((export_mode == MLV_DECOMPRESS) && isMlvCompressed(video));
+
     /* read VIDF block header */
-    file_set_pos(video->file[chunk], block_offset, SEEK_SET);
-    if(fread(&vidf_hdr, sizeof(mlv_vidf_hdr_t), 1, video->file[chunk]) != 1)
+    if(read_vidf_header(video, frame_index, &vidf_hdr))
     {
         sprintf(error_message, "Could not read VIDF block header from:  %s", video->path);
         DEBUG( printf("\n%s\n", error_message); )
@@ -1592,449 +2178,208 @@ int saveMlvAVFrame(mlvObject_t * video, FILE * output_mlv, int export_audio, int
     }
 
     /* ilia3101: Implementing compressed export - for compressed modes I have added a simpler
-     * code path using this switch statement - read the frame using the simple frame reader utility,
-     * and then encode. I have kept bouncyball's original efficient logic for uncompressed/lossless modes. */
-    switch (export_mode)
-    {
-        case MLV_CINEFORM:
-        case MLV_JP2K_LOW:
-        case MLV_JP2K_MED:
-        case MLV_JP2K_HIGH:
-        case MLV_JP2K_VERYHIGH:
-        case MLV_JP2K_VISULOSSLESS:
+     * code path - read the frame using the simple frame reader utility, and then encode.
+     * I have kept bouncyball's original efficient logic for uncompressed/lossless modes.
+     * For exporting many frames mlvWriter_t does the same on all cores. */
+    if (is_encoded_export(video, export_mode))
+    {
+        int uncompressed = 0;
+        frame_encoder_t * encoder = init_frame_encoder(video, export_mode, 4, error_message);
+        if (!encoder)
         {
-            /* TODO ilia3101: maybe add some error handling to getMlvRawFrameUint16 */
-            uint16_t * frame = malloc(pixel_count * sizeof(uint16_t));
-            getMlvRawFrameUint16(video, frame_index, frame);
-
-            uint16_t encode_lut[16384];
-            uint16_t bl = getMlvBlackLevel(video);
-            uint16_t max_value = 1 << getMlvBitdepth(video);
-            for (int i = 0; i < 16384; i++) {
-                encode_lut[i] = log_encode_int(i, bl, max_value, 4095);
-            }
-
-            for (uint32_t p = 0; p < pixel_count; p++) {
-                frame[p] = encode_lut[frame[p]];
-            }
-
-            if (export_mode == MLV_CINEFORM) {
-                #ifdef ENABLE_CINEFORM
-                CFHD_EncoderRef encoder = NULL;
-                if (CFHD_OpenEncoder(&encoder, NULL) == CFHD_ERROR_OKAY)
-                {
-                    if (CFHD_PrepareToEncode(encoder,
-                                              video->RAWI.xRes,
-                                              video->RAWI.yRes,
-                                              CFHD_PIXEL_FORMAT_BYR4,
-                                              CFHD_ENCODED_FORMAT_BAYER,
-                                              CFHD_ENCODING_FLAGS_NONE,
-                                              CFHD_ENCODING_QUALITY_FILMSCAN3) == CFHD_ERROR_OKAY)
-                    {
-                        if (CFHD_EncodeSample(encoder, frame, video->RAWI.xRes * 2) == CFHD_ERROR_OKAY)
-                        {
-                            void *sample_data = NULL;
-                            size_t sample_size = 0;
-                            if (CFHD_GetSampleData(encoder, &sample_data, &sample_size) == CFHD_ERROR_OKAY
-                                && sample_data && sample_size > 0)
-                            {
-                                vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + sample_size;
-                                vidf_hdr.frameSpace = 0;
-                                block_buf = malloc(vidf_hdr.blockSize);
-                                if (block_buf)
-                                {
-                                    memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                                    memcpy(block_buf + sizeof(mlv_vidf_hdr_t), sample_data, sample_size);
-                                }
-                            }
-                        }
-                    }
-                    CFHD_CloseEncoder(encoder);
-                }
-                #else
-                sprintf(error_message, "Cineform export is not enabled in this build (ENABLE_CINEFORM)");
-                free(frame);
-                return 1;
-                #endif
-            }
-            else if (
-                export_mode == MLV_JP2K_LOW
-                ||export_mode == MLV_JP2K_MED
-                ||export_mode == MLV_JP2K_HIGH
-                ||export_mode == MLV_JP2K_VERYHIGH
-                ||export_mode == MLV_JP2K_VISULOSSLESS
-            ) {
-                #ifdef ENABLE_JPEG2K
-                void *encoders[4] = {NULL, NULL, NULL, NULL};
-                int32_t *quarter_bufs[4] = {NULL, NULL, NULL, NULL};
-                uint8_t *encoded_bufs[4] = {NULL, NULL, NULL, NULL};
-                size_t enc_sizes[4] = {0, 0, 0, 0};
-                int enc_ok = 1;
-                uint32_t hw = video->RAWI.xRes / 2;
-                uint32_t hh = video->RAWI.yRes / 2;
-                size_t quarter_pixels = (size_t)((uint32_t)hw * (uint32_t)hh);
-                size_t max_enc_size = quarter_pixels * 2;
-
-                float jp2k_threshold = 0.0;
-                if (export_mode == MLV_JP2K_LOW) {
-                    jp2k_threshold = 0.010;
-                } else if (export_mode == MLV_JP2K_MED) {
-                    jp2k_threshold = 0.0065;
-                } else if (export_mode == MLV_JP2K_HIGH) {
-                    jp2k_threshold = 0.0045;
-                } else if (export_mode == MLV_JP2K_VERYHIGH) {
-                    jp2k_threshold = 0.0032;
-                } else if (export_mode == MLV_JP2K_VISULOSSLESS) {
-                    jp2k_threshold = 0.0015;
-                }
-
-                for (int c = 0; c < 4 && enc_ok; c++)
-                {
-                    encoders[c] = ojph_encoder_new();
-                    if (!encoders[c]) { enc_ok = 0; break; }
-                    ojph_encoder_set_image(encoders[c], hw, hh, 1, 12, 0);
-                    ojph_encoder_set_decompositions(encoders[c], 5);
-                    ojph_encoder_set_lossless(encoders[c], 0);
-                    ojph_encoder_set_quantization(encoders[c], jp2k_threshold);
-
-                    quarter_bufs[c] = (int32_t *)malloc(quarter_pixels * sizeof(int32_t));
-                    encoded_bufs[c] = (uint8_t *)malloc(max_enc_size);
-                    if (!quarter_bufs[c] || !encoded_bufs[c]) { enc_ok = 0; break; }
-                }
-
-                if (enc_ok)
-                {
-                    //TODO: does this parallelisation actually work?
-                    #pragma omp parallel for num_threads(4)
-                    for (int c = 0; c < 4; c++)
-                    {
-                        uint32_t x_off = (c & 1) ? 1 : 0;
-                        uint32_t y_off = (c & 2) ? 1 : 0;
-                        for (uint32_t y = 0; y < hh; y++)
-                        {
-                            uint32_t in_row = (y * 2 + y_off) * video->RAWI.xRes;
-                            uint32_t out_row = y * hw;
-                            for (uint32_t x = 0; x < hw; x++)
-                            {
-                                quarter_bufs[c][out_row + x] = (int32_t)frame[in_row + x * 2 + x_off];
-                            }
-                        }
-                        enc_sizes[c] = ojph_encoder_encode_into(encoders[c], quarter_bufs[c],
-                                                                  encoded_bufs[c], max_enc_size);
-                    }
-                }
-
-                for (int c = 0; c < 4; c++) {
-                    if (encoders[c]) ojph_encoder_free(encoders[c]);
-                }
+            DEBUG( printf("\n%s\n", error_message); )
+            return 1;
+        }
+        block_buf = encode_vidf_block(video, encoder, frame_index, &vidf_hdr, &uncompressed, error_message);
+        free_frame_encoder(encoder);
+        if (!block_buf)
+        {
+            DEBUG( printf("\n%s\n", error_message); )
+            return 1;
+        }
 
-                if (enc_ok && enc_sizes[0] > 0 && enc_sizes[1] > 0 && enc_sizes[2] > 0 && enc_sizes[3] > 0)
-                {
-                    uint32_t offsets[4];
-                    offsets[0] = 36;
-                    offsets[1] = offsets[0] + (uint32_t)enc_sizes[0];
-                    offsets[2] = offsets[1] + (uint32_t)enc_sizes[1];
-                    offsets[3] = offsets[2] + (uint32_t)enc_sizes[2];
-                    size_t total_size = (size_t)offsets[3] + enc_sizes[3];
-
-                    vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + total_size;
-                    vidf_hdr.frameSpace = 0;
-
-                    block_buf = malloc(vidf_hdr.blockSize);
-                    if (block_buf)
-                    {
-                        uint8_t *ptr = block_buf + sizeof(mlv_vidf_hdr_t);
-                        memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-
-                        uint32_t version = 1;
-                        memcpy(ptr, &version, 4); ptr += 4;
-                        memcpy(ptr, &offsets[0], 4); ptr += 4;
-                        memcpy(ptr, &enc_sizes[0], 4); ptr += 4;
-                        memcpy(ptr, &offsets[1], 4); ptr += 4;
-                        memcpy(ptr, &enc_sizes[1], 4); ptr += 4;
-                        memcpy(ptr, &offsets[2], 4); ptr += 4;
-                        memcpy(ptr, &enc_sizes[2], 4); ptr += 4;
-                        memcpy(ptr, &offsets[3], 4); ptr += 4;
-                        memcpy(ptr, &enc_sizes[3], 4); ptr += 4;
-                        memcpy(ptr, encoded_bufs[0], enc_sizes[0]); ptr += enc_sizes[0];
-                        memcpy(ptr, encoded_bufs[1], enc_sizes[1]); ptr += enc_sizes[1];
-                        memcpy(ptr, encoded_bufs[2], enc_sizes[2]); ptr += enc_sizes[2];
-                        memcpy(ptr, encoded_bufs[3], enc_sizes[3]); ptr += enc_sizes[3];
-                    }
-                }
-                else
-                {
-                    sprintf(error_message, "JPEG2000 encoding failed");
-                    for (int c = 0; c < 4; c++)
-                    {
-                        if (quarter_bufs[c]) free(quarter_bufs[c]);
-                        if (encoded_bufs[c]) free(encoded_bufs[c]);
-                    }
-                    free(frame);
-                    return 1;
-                }
+        /* patch MLVI header and set back videoClass to 1 (uncompressed) */
+        if (uncompressed) patch_output_video_class(output_mlv, 0x1);
+    }
+    else if (pass_through)
+    {
+        /* Only the header goes through memory, the frame data is copied file to file when writing */
+        vidf_hdr.blockSize -= vidf_hdr.frameSpace;
+        vidf_hdr.frameSpace = 0;
+    }
+    else
+    {
+        /* ilia3101: bouncyball's original code: */
 
-                for (int c = 0; c < 4; c++)
-                {
-                    if (quarter_bufs[c]) free(quarter_bufs[c]);
-                    if (encoded_bufs[c]) free(encoded_bufs[c]);
-                }
-                #else
-                sprintf(error_message, "JPEG2000 export is not enabled in this build (ENABLE_JPEG2K)");
-                free(frame);
-                return 1;
-                #endif
-            }
+        vidf_hdr.blockSize -= vidf_hdr.frameSpace;
+        vidf_hdr.frameSpace = 0;
+        /* for safety allocate max possible size buffer for VIDF block, calculated for 16bits per pixel */
+        block_buf = calloc(sizeof(mlv_vidf_hdr_t) + frame_size_unpacked, 1);
+        if(!block_buf)
+        {
+            sprintf(error_message, "Could not allocate memory for VIDF block");
+            DEBUG( printf("\n%s\n", error_message); )
+            return 1;
+        }
+        /* for safety allocate max possible size buffer for image data, calculated for 16bits per pixel */
+        frame_buf = calloc(frame_size_unpacked, 1);
+        if(!frame_buf)
+        {
+            sprintf(error_message, "Could not allocate memory for VIDF frame");
+            DEBUG( printf("\n%s\n", error_message); )
+            free(block_buf);
+            return 1;
+        }
 
-            free(frame);
-            break;
+        /* read frame buffer */
+        file_set_pos(video->file[chunk], frame_offset, SEEK_SET);
+        if(fread(frame_buf, frame_size, 1, video->file[chunk]) != 1)
+        {
+            sprintf(error_message, "Could not read VIDF image data from:  %s", video->path);
+            DEBUG( printf("\n%s\n", error_message); )
+            free(frame_buf);
+            free(block_buf);
+            return 1;
         }
-        default: {
-            /* ilia3101: bouncyball's original code: */
 
-            vidf_hdr.blockSize -= vidf_hdr.frameSpace;
-            vidf_hdr.frameSpace = 0;
-            /* for safety allocate max possible size buffer for VIDF block, calculated for 16bits per pixel */
-            block_buf = calloc(sizeof(mlv_vidf_hdr_t) + frame_size_unpacked, 1);
-            if(!block_buf)
-            {
-                sprintf(error_message, "Could not allocate memory for VIDF block");
-                DEBUG( printf("\n%s\n", error_message); )
-                return 1;
-            }
-            /* for safety allocate max possible size buffer for image data, calculated for 16bits per pixel */
-            frame_buf = calloc(frame_size_unpacked, 1);
-            if(!frame_buf)
+        if(export_mode == MLV_DF_INT) // export internal dark frame as separate MLV
+        {
+            size_t df_packed_size = video->DARK.blockSize - sizeof(mlv_dark_hdr_t);
+            /* read dark frame */
+            file_set_pos(video->file[0], video->dark_frame_offset, SEEK_SET);
+            if(fread(frame_buf, df_packed_size, 1, video->file[0]) != 1)
             {
-                sprintf(error_message, "Could not allocate memory for VIDF frame");
+                sprintf(error_message, "Could not read DARK block image data from:  %s", video->path);
                 DEBUG( printf("\n%s\n", error_message); )
+                free(frame_buf);
                 free(block_buf);
                 return 1;
             }
-
-            /* read frame buffer */
-            file_set_pos(video->file[chunk], frame_offset, SEEK_SET);
-            if(fread(frame_buf, frame_size, 1, video->file[chunk]) != 1)
+            /* set blocksize and samplesAveraged to frameNumber */
+            vidf_hdr.blockSize = video->DARK.blockSize;
+            vidf_hdr.frameNumber = video->DARK.samplesAveraged;
+            memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
+            memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, df_packed_size);
+        }
+        else if(export_mode == MLV_AVERAGED_FRAME) // average all frames to one dark frame
+        {
+            uint16_t * frame_buf_unpacked = calloc(frame_size_unpacked, 1);
+            if(!frame_buf_unpacked)
             {
-                sprintf(error_message, "Could not read VIDF image data from:  %s", video->path);
+                sprintf(error_message, "Averaging: could not allocate memory for unpacked frame");
                 DEBUG( printf("\n%s\n", error_message); )
                 free(frame_buf);
                 free(block_buf);
                 return 1;
             }
-
-            if(export_mode == MLV_DF_INT) // export internal dark frame as separate MLV
+            if(isMlvCompressed(video))
             {
-                size_t df_packed_size = video->DARK.blockSize - sizeof(mlv_dark_hdr_t);
-                /* read dark frame */
-                file_set_pos(video->file[0], video->dark_frame_offset, SEEK_SET);
-                if(fread(frame_buf, df_packed_size, 1, video->file[0]) != 1)
+                int ret = dng_decompress_image(frame_buf_unpacked, (uint16_t*)frame_buf, frame_size, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel);
+                if(ret != LJ92_ERROR_NONE)
                 {
-                    sprintf(error_message, "Could not read DARK block image data from:  %s", video->path);
+                    sprintf(error_message, "Averaging: could not decompress frame:  LJ92_ERROR %u", ret);
                     DEBUG( printf("\n%s\n", error_message); )
+                    free(frame_buf_unpacked);
                     free(frame_buf);
                     free(block_buf);
-                    return 1;
+                    return ret;
                 }
-                /* set blocksize and samplesAveraged to frameNumber */
-                vidf_hdr.blockSize = video->DARK.blockSize;
-                vidf_hdr.frameNumber = video->DARK.samplesAveraged;
-                memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, df_packed_size);
             }
-            else if(export_mode == MLV_AVERAGED_FRAME) // average all frames to one dark frame
+            else
             {
-                uint16_t * frame_buf_unpacked = calloc(frame_size_unpacked, 1);
-                if(!frame_buf_unpacked)
-                {
-                    sprintf(error_message, "Averaging: could not allocate memory for unpacked frame");
-                    DEBUG( printf("\n%s\n", error_message); )
-                    free(frame_buf);
-                    free(block_buf);
-                    return 1;
-                }
-                if(isMlvCompressed(video))
-                {
-                    int ret = dng_decompress_image(frame_buf_unpacked, (uint16_t*)frame_buf, frame_size, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel);
-                    if(ret != LJ92_ERROR_NONE)
-                    {
-                        sprintf(error_message, "Averaging: could not decompress frame:  LJ92_ERROR %u", ret);
-                        DEBUG( printf("\n%s\n", error_message); )
-                        free(frame_buf_unpacked);
-                        free(frame_buf);
-                        free(block_buf);
-                        return ret;
-                    }
-                }
-                else
-                {
-                    dng_unpack_image_bits(frame_buf_unpacked, (uint16_t*)frame_buf, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel);
-                }
-                for(uint32_t i = 0; i < pixel_count; i++)
-                {
-                    avg_buf[i] += frame_buf_unpacked[i];
-                }
-
-                if(frame_index == frame_end - 1)
-                {
-                    for(uint32_t i = 0; i < pixel_count; i++)
-                    {
-                        frame_buf_unpacked[i] = (avg_buf[i] + max_frame_number / 2) / max_frame_number;
-                    }
-                    dng_pack_image_bits((uint16_t *)frame_buf, frame_buf_unpacked, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel, 0);
-
-                    vidf_hdr.frameNumber = max_frame_number;
-                    vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size_packed;
-                    memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                    memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size_packed);
-                    write_ok = 1;
-                }
-
-                free(frame_buf_unpacked);
+                dng_unpack_image_bits(frame_buf_unpacked, (uint16_t*)frame_buf, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel);
             }
-            else if((export_mode == MLV_LJ92) && (!isMlvLj92(video))) // compress MLV frame with LJ92 if specified
+            for(uint32_t i = 0; i < pixel_count; i++)
             {
-                int ret = 0;
-                size_t frame_size_compressed = 0;
+                avg_buf[i] += frame_buf_unpacked[i];
+            }
 
-                uint16_t * frame_buf_unpacked = calloc(frame_size_unpacked, 1);
-                uint16_t * frame_buf_compressed = calloc(frame_size_unpacked, 1);
-                if(!frame_buf_unpacked || !frame_buf_compressed)
+            if(frame_index == frame_end - 1)
+            {
+                for(uint32_t i = 0; i < pixel_count; i++)
                 {
-                    DEBUG( printf("\nCould not allocate memory for frame compressing\n"); )
-                    ret = 1;
+                    frame_buf_unpacked[i] = (avg_buf[i] + max_frame_number / 2) / max_frame_number;
                 }
+                dng_pack_image_bits((uint16_t *)frame_buf, frame_buf_unpacked, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel, 0);
 
-                if(!ret)
-                {
-                    // ilia3101: by calling mlv video reader (to support all types of compression) work is being
-                    // duplicated, so the earlier read becomes redundant. TODO: refactor this whole function!
-                    getMlvRawFrameUint16(video, frame_index, frame_buf_unpacked);
-                    ret = dng_compress_image(frame_buf_compressed, frame_buf_unpacked, &frame_size_compressed, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel);
-                    if(ret == LJ92_ERROR_NONE)
-                    {
-                        vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size_compressed;
-                        memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                        memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), (uint8_t*)frame_buf_compressed, frame_size_compressed);
-                    }
-                    else // if compression error then save original uncompressed raw
-                    {
-                        memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                        memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size);
-
-                        /* patch MLVI header and set back videoClass to 1 (uncompressed) */
-                        uint64_t current_pos = file_get_pos(output_mlv);
-                        file_set_pos(output_mlv, 32, SEEK_SET);
-                        uint16_t videoClass = 0x1;
-                        if(fwrite(&videoClass, sizeof(uint16_t), 1, output_mlv) != 1)
-                        {
-                            DEBUG( printf("\nCould not patch videoClass in MLV header\n"); )
-                        }
-                        file_set_pos(output_mlv, current_pos, SEEK_SET);
-                    }
-                }
-
-                if(frame_buf_unpacked) free(frame_buf_unpacked);
-                if(frame_buf_compressed) free(frame_buf_compressed);
+                vidf_hdr.frameNumber = max_frame_number;
+                vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size_packed;
+                memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
+                memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size_packed);
+                write_ok = 1;
             }
-            else if((export_mode == MLV_DECOMPRESS) && isMlvCompressed(video)) // decompress MLV frame with LJ92 if specified
+
+            free(frame_buf_unpacked);
+        }
+        else if((export_mode == MLV_DECOMPRESS) && isMlvCompressed(video)) // decompress MLV frame with LJ92 if specified
+        {
+            int ret = 0;
+
+            uint16_t * frame_buf_unpacked = calloc(frame_size_unpacked, 1);
+            if(!frame_buf_unpacked)
             {
-                int ret = 0;
+                DEBUG( printf("\nCould not allocate memory for frame decompressing\n"); )
+                ret = 1;
+            }
 
-                uint16_t * frame_buf_unpacked = calloc(frame_size_unpacked, 1);
-                if(!frame_buf_unpacked)
+            if(!ret)
+            {
+                int ret = getMlvRawFrameUint16(video, frame_index, frame_buf_unpacked);
+                if (ret == 0)
                 {
-                    DEBUG( printf("\nCould not allocate memory for frame decompressing\n"); )
-                    ret = 1;
+                    dng_pack_image_bits((uint16_t*)frame_buf, frame_buf_unpacked, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel, 0);
+                    vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size_packed;
+                    memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
+                    memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size_packed);
                 }
-
-                if(!ret)
+                else // if decompression error then save original compressed raw
                 {
-                    int ret = getMlvRawFrameUint16(video, frame_index, frame_buf_unpacked);
-                    if (ret == 0)
-                    {
-                        dng_pack_image_bits((uint16_t*)frame_buf, frame_buf_unpacked, video->RAWI.xRes, video->RAWI.yRes, video->RAWI.raw_info.bits_per_pixel, 0);
-                        vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size_packed;
-                        memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                        memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size_packed);
-                    }
-                    else // if decompression error then save original compressed raw
-                    {
-                        memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                        memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size);
-
-                        /* patch MLVI header and set back videoClass to original compressed videoclass */
-                        uint64_t current_pos = file_get_pos(output_mlv);
-                        file_set_pos(output_mlv, 32, SEEK_SET);
-                        uint16_t videoClass = video->MLVI.videoClass;
-                        if(fwrite(&videoClass, sizeof(uint16_t), 1, output_mlv) != 1)
-                        {
-                            DEBUG( printf("\nCould not patch videoClass in MLV header\n"); )
-                        }
-                        file_set_pos(output_mlv, current_pos, SEEK_SET);
-                    }
-                }
+                    memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
+                    memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size);
 
-                if(frame_buf_unpacked) free(frame_buf_unpacked);
-            }
-            else // pass through the original raw frame. TODO: verify this logic is still correct (ilia3101)
-            {
-                memcpy(block_buf, &vidf_hdr, sizeof(mlv_vidf_hdr_t));
-                memcpy((block_buf + sizeof(mlv_vidf_hdr_t)), frame_buf, frame_size);
+                    /* patch MLVI header and set back videoClass to original compressed videoclass */
+                    patch_output_video_class(output_mlv, video->MLVI.videoClass);
+                }
             }
+
+            if(frame_buf_unpacked) free(frame_buf_unpacked);
         }
     }
 
     /* if audio export is enabled */
     if(!(frame_start - frame_index - 1) && export_audio && !(export_mode == MLV_AVERAGED_FRAME || export_mode == MLV_DF_INT))
     {
-        /* initialize AUDF header */
-        mlv_audf_hdr_t audf_hdr = { { 'A','U','D','F' }, 0, 0, 0, 0 };
-
-        /* Calculate the sum of audio sample sizes for all audio channels */
-        uint64_t audio_sample_size = getMlvAudioChannels(video) * (getMlvAudioBitsPerSample(video) / 8);
-        /* Calculate the audio alignement block size in bytes */
-        uint16_t block_align = audio_sample_size * 1024;
-        /* Calculate audio starting offset */
-        uint64_t audio_start_offset = ( (uint64_t)( (double)(getMlvSampleRate(video) * audio_sample_size * (frame_start - 1)) / (double)getMlvFramerate(video) ) );
-        /* Make sure start offset value is multiple of sum of all channel sample sizes */
-        uint64_t audio_start_offset_aligned = audio_start_offset - (audio_start_offset % audio_sample_size);
-        /* Calculate cut audio size */
-        uint64_t cut_audio_size = (uint64_t)( (double)(getMlvSampleRate(video) * audio_sample_size * (frame_end - frame_start + 1)) / (double)getMlvFramerate(video) );
-        /* check if cut_audio_size is multiple of 'block_align' bytes and not more than original audio data size */
-        uint64_t cut_audio_size_aligned = MIN( (cut_audio_size - (cut_audio_size % block_align) + block_align), video->audio_size );
-        /* make max audio size (uint32_t max value - 1) multiple of 'block_align' bytes */
-        uint32_t max_audio_size = 0xFFFFFFFF - (0xFFFFFFFF % block_align);
-        /* Not likely that audio size exeeds the 4.3gb but anyway check if cut_audio_size is more than uint32_t max value to not overflow blockSize variable */
-        if(cut_audio_size_aligned > max_audio_size) cut_audio_size_aligned = max_audio_size;
-
-        /* fill AUDF block header */
-        audf_hdr.blockSize = sizeof(mlv_audf_hdr_t) + cut_audio_size_aligned;
-        audf_hdr.timestamp = vidf_hdr.timestamp;
-
-        /* write AUDF block header */
-        if(fwrite(&audf_hdr, sizeof(mlv_audf_hdr_t), 1, output_mlv) != 1)
-        {
-            sprintf(error_message, "Could not write AUDF block header");
-            DEBUG( printf("\n%s\n", error_message); )
+        if(write_audf_block(video, output_mlv, frame_start, frame_end, vidf_hdr.timestamp, error_message))
+        {
             if (frame_buf != NULL) free(frame_buf);
             if (block_buf != NULL) free(block_buf);
             return 1;
         }
+    }
 
-        /* write audio data */
-        if(fwrite(video->audio_data + audio_start_offset_aligned, cut_audio_size_aligned, 1, output_mlv) != 1)
+    /* write mlvFrame */
+    if(write_ok && pass_through)
+    {
+#if defined(__linux)
+        /* Pad so the frame data has the same offset in a 4k block as in the source, then
+         * reflink filesystems can share whole blocks */
+        static const uint8_t padding[4096] = { 0 };
+        uint64_t data_pos = file_get_pos(output_mlv) + sizeof(mlv_vidf_hdr_t);
+        vidf_hdr.frameSpace = (uint32_t)((frame_offset - data_pos) & 4095);
+        vidf_hdr.blockSize += vidf_hdr.frameSpace;
+#endif
+        if(fwrite(&vidf_hdr, sizeof(mlv_vidf_hdr_t), 1, output_mlv) != 1
+#if defined(__linux)
+           || (vidf_hdr.frameSpace && fwrite(padding, vidf_hdr.frameSpace, 1, output_mlv) != 1)
+#endif
+           || copy_clip_data(video, chunk, frame_offset, output_mlv, frame_size))
         {
-            sprintf(error_message, "Could not write AUDF block audio data");
+            sprintf(error_message, "Could not write video frame #%u", frame_index);
             DEBUG( printf("\n%s\n", error_message); )
-            if (frame_buf != NULL) free(frame_buf);
-            if (block_buf != NULL) free(block_buf);
             return 1;
         }
     }
-
-    /* write mlvFrame */
-    if(write_ok)
+    else if(write_ok)
     {
         if(fwrite(block_buf, vidf_hdr.blockSize, 1, output_mlv) != 1)
         {
@@ -2052,6 +2397,226 @@ int saveMlvAVFrame(mlvObject_t * video, FILE * output_mlv, int export_audio, int
     return 0;
 }
 
+/* Parallel MLV export: worker threads encode frames ahead with their own encoders,
+ * mlvWriterWriteFrame() writes them to the output in frame order */
+
+enum { WRITER_SLOT_FREE, WRITER_SLOT_ENCODING, WRITER_SLOT_READY, WRITER_SLOT_FAILED };
+
+typedef struct {
+    int state;
+    uint32_t frame_index;
+    uint8_t * block;        /* complete VIDF block */
+    uint32_t block_size;
+    uint64_t timestamp;
+    int uncompressed;       /* LJ92 failed, original frame stored */
+    char error_message[256];
+} mlv_writer_slot_t;
+
+struct mlvWriter_s {
+    mlvObject_t * video;
+    FILE * output_mlv;
+    int export_audio;
+    int export_mode;
+    uint32_t frame_start;
+    uint32_t frame_end;
+
+    pthread_t * threads;
+    int thread_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+
+    /* Frame i is encoded into slot i % slot_count, workers stay at most slot_count frames ahead */
+    mlv_writer_slot_t * slots;
+    int slot_count;
+    uint32_t next_encode;
+    uint32_t next_write;
+    int video_class_patched;
+};
+
+static void * mlv_writer_thread(void * arg)
+{
+    mlvWriter_t * writer = (mlvWriter_t *)arg;
+    char error_message[256] = { 0 };
+
+    frame_encoder_t * encoder = init_frame_encoder(writer->video, writer->export_mode, 1, error_message);
+
+    pthread_mutex_lock(&writer->mutex);
+    while (!writer->stop)
+    {
+        if (writer->next_encode >= writer->frame_end
+            || writer->next_encode >= writer->next_write + writer->slot_count)
+        {
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+            continue;
+        }
+
+        uint32_t frame_index = writer->next_encode++;
+        mlv_writer_slot_t * slot = writer->slots + (frame_index % writer->slot_count);
+        slot->state = WRITER_SLOT_ENCODING;
+        slot->frame_index = frame_index;
+        pthread_mutex_unlock(&writer->mutex);
+
+        mlv_vidf_hdr_t vidf_hdr = { 0 };
+        uint8_t * block = NULL;
+        int uncompressed = 0;
+        if (!encoder)
+        {
+            /* error_message is set by init_frame_encoder */
+        }
+        else if (read_vidf_header(writer->video, frame_index, &vidf_hdr))
+        {
+            sprintf(error_message, "Could not read VIDF block header from:  %s", writer->video->path);
+        }
+        else
+        {
+            block = encode_vidf_block(writer->video, encoder, frame_index, &vidf_hdr, &uncompressed, error_message);
+        }
+
+        pthread_mutex_lock(&writer->mutex);
+        slot->block = block;
+        slot->block_size = vidf_hdr.blockSize;
+        slot->timestamp = vidf_hdr.timestamp;
+        slot->uncompressed = uncompressed;
+        if (!block) strcpy(slot->error_message, error_message);
+        slot->state = block ? WRITER_SLOT_READY : WRITER_SLOT_FAILED;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+
+    free_frame_encoder(encoder);
+    return NULL;
+}
+
+mlvWriter_t * initMlvWriter(mlvObject_t * video, FILE * output_mlv, int export_audio, int export_mode, uint32_t frame_start, uint32_t frame_end, int threads)
+{
+    if (!is_encoded_export(video, export_mode)) return NULL;
+    if (threads < 1) threads = 1;
+
+    mlvWriter_t * writer = calloc(1, sizeof(mlvWriter_t));
+    if (!writer) return NULL;
+
+    writer->video = video;
+    writer->output_mlv = output_mlv;
+    writer->export_audio = export_audio;
+    writer->export_mode = export_mode;
+    writer->frame_start = frame_start;
+    writer->frame_end = frame_end;
+    writer->next_encode = frame_start - 1;
+    writer->next_write = frame_start - 1;
+    writer->slot_count = threads * 2;
+    writer->slots = calloc(writer->slot_count, sizeof(mlv_writer_slot_t));
+    writer->threads = calloc(threads, sizeof(pthread_t));
+    if (!writer->slots || !writer->threads)
+    {
+        free(writer->slots);
+        free(writer->threads);
+        free(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(writer->threads + i, NULL, mlv_writer_thread, writer)) break;
+        writer->thread_count++;
+    }
+    if (!writer->thread_count)
+    {
+        freeMlvWriter(writer);
+        return NULL;
+    }
+
+    DEBUG( printf("MLV writer: %d threads, %d frames ahead\n", writer->thread_count, writer->slot_count); )
+    return writer;
+}
+
+int mlvWriterWriteFrame(mlvWriter_t * writer, uint32_t frame_index, char * error_message)
+{
+    if (frame_index != writer->next_write)
+    {
+        sprintf(error_message, "MLV writer: frame #%u requested, #%u is next", frame_index, writer->next_write);
+        return 1;
+    }
+
+    /* Wait for the frame, then give its slot back to the workers */
+    mlv_writer_slot_t * slot = writer->slots + (frame_index % writer->slot_count);
+    pthread_mutex_lock(&writer->mutex);
+    while (slot->frame_index != frame_index
+           || slot->state == WRITER_SLOT_FREE
+           || slot->state == WRITER_SLOT_ENCODING)
+    {
+        pthread_cond_wait(&writer->cond, &writer->mutex);
+    }
+    mlv_writer_slot_t frame = *slot;
+    slot->block = NULL;
+    slot->state = WRITER_SLOT_FREE;
+    writer->next_write++;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+
+    if (frame.state == WRITER_SLOT_FAILED)
+    {
+        strcpy(error_message, frame.error_message);
+        DEBUG( printf("\n%s\n", error_message); )
+        return 1;
+    }
+
+    /* if audio export is enabled */
+    if (frame_index == writer->frame_start - 1 && writer->export_audio)
+    {
+        if (write_audf_block(writer->video, writer->output_mlv, writer->frame_start, writer->frame_end, frame.timestamp, error_message))
+        {
+            free(frame.block);
+            return 1;
+        }
+    }
+
+    /* patch MLVI header and set back videoClass to 1 (uncompressed) */
+    if (frame.uncompressed && !writer->video_class_patched)
+    {
+        patch_output_video_class(writer->output_mlv, 0x1);
+        writer->video_class_patched = 1;
+    }
+
+    int ret = fwrite(frame.block, frame.block_size, 1, writer->output_mlv) != 1;
+    if (ret)
+    {
+        sprintf(error_message, "Could not write video frame #%u", frame_index);
+        DEBUG( printf("\n%s\n", error_message); )
+    }
+    free(frame.block);
+    return ret;
+}
+
+void freeMlvWriter(mlvWriter_t * writer)
+{
+    if (!writer) return;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+
+    for (int i = 0; i < writer->thread_count; i++)
+    {
+        pthread_join(writer->threads[i], NULL);
+    }
+
+    /* Frames encoded ahead which were not written (abort or error) */
+    for (int i = 0; i < writer->slot_count; i++)
+    {
+        free(writer->slots[i].block);
+    }
+
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->cond);
+    free(writer->threads);
+    free(writer->slots);
+    free(writer);
+}
+
 /* Reads a mcraw file in to a mlv object(mlvObject_t struct)
  * only puts metadata in to the mlvObject_t, no debayering or bit unpacking
  */
@@ -2789,7 +3354,7 @@ void findMlvWhiteBalance(mlvObject_t *video, uint64_t frameIndex, int posX, int
     int rgb_frame_size = height * width * 3;
 
     /* Unprocessed debayered frame (RGB) */
-    uint16_t * unprocessed_frame = malloc( rgb_frame_size * sizeof(uint16_t) );
+    uint16_t * unprocessed_frame = bufferPoolAlloc( rgb_frame_size * sizeof(uint16_t) );
 
     /* Get the raw data in B&W */
     getMlvRawFrameDebayered(video, frameIndex, unprocessed_frame);
@@ -2801,5 +3366,5 @@ void findMlvWhiteBalance(mlvObject_t *video, uint64_t frameIndex, int posX, int
                                 posX, posY,
                                 wbTemp, wbTint, mode);
 
-    free(unprocessed_frame);
+    bufferPoolFree(unprocessed_frame);
 }
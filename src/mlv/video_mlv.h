@@ -34,6 +34,14 @@ enum open_mode { MLV_OPEN_FULL, MLV_OPEN_MAPP, MLV_OPEN_PREVIEW };
 /* Functions for saving cut or averaged MLV */
 int saveMlvHeaders(mlvObject_t * video, FILE * output_mlv, int export_audio, int export_mode, uint32_t frame_start, uint32_t frame_end, const char * version, char * error_message);
 int saveMlvAVFrame(mlvObject_t * video, FILE * output_mlv, int export_audio, int export_mode, uint32_t frame_start, uint32_t frame_end, uint32_t frame_index, uint64_t * avg_buf, char * error_message);
+/* Exports the CineForm, JPEG2000 and LJ92 modes on many threads: frames are encoded ahead with one
+ * encoder per thread and written in frame order. Returns NULL for modes saveMlvAVFrame does alone.
+ * Call mlvWriterWriteFrame for every frame from frame_start - 1 to frame_end - 1 instead of saveMlvAVFrame */
+typedef struct mlvWriter_s mlvWriter_t;
+mlvWriter_t * initMlvWriter(mlvObject_t * video, FILE * output_mlv, int export_audio, int export_mode, uint32_t frame_start, uint32_t frame_end, int threads);
+int mlvWriterWriteFrame(mlvWriter_t * writer, uint32_t frame_index, char * error_message);
+/* Stops the threads, frames not written yet are dropped */
+void freeMlvWriter(mlvWriter_t * writer);
 enum export_mode { MLV_FAST_PASS, MLV_LJ92, MLV_DECOMPRESS, MLV_AVERAGED_FRAME, MLV_DF_INT, MLV_CINEFORM, MLV_JP2K_LOW, MLV_JP2K_MED, MLV_JP2K_HIGH, MLV_JP2K_VERYHIGH, MLV_JP2K_VISULOSSLESS };
 /* from darkframe.c */
 extern int df_init(mlvObject_t * video);
@@ -61,11 +69,16 @@ void findMlvWhiteBalance(mlvObject_t * video, uint64_t frameIndex, int posX, int
  * as it may have minor artifacts (though I haven't found them yet) */
 void getMlvProcessedFrame8(mlvObject_t * video, uint64_t frameIndex, uint8_t * outputFrame, int threads);
 void getMlvProcessedFrame16(mlvObject_t * video, uint64_t frameIndex, uint16_t * outputFrame, int threads);
+/* Faster frame for playback of compressed clips, decoded and processed at half resolution, then
+ * scaled up, output sized like getMlvProcessedFrame8. Use the full frame functions for pause and export */
+void getMlvPreviewFrame8(mlvObject_t * video, uint64_t frameIndex, uint8_t * outputFrame, int threads);
 
 /* Unpacks the bits of a frame to get a bayer B&W image (without black level correction)
  * Needs memory to return to, sized: sizeof(float) * getMlvHeight(urvid) * getMlvWidth(urvid)
  * Output values will be in range 0-65535 (16 bit), float is only because AMAzE uses it */
 int getMlvRawFrameUint16(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame);
+/* Same at 1/2^reduction width and height (bayer pattern kept), outWidth/outHeight get the size */
+int getMlvRawFrameUint16Reduced(mlvObject_t * video, uint64_t frameIndex, uint16_t * unpackedFrame, int reduction, int * outWidth, int * outHeight);
 void getMlvRawFrameFloat(mlvObject_t * video, uint64_t frameIndex, float * outputFrame);
 
 /* Gets a debayered 16 bit frame */
@@ -108,11 +121,14 @@ void get_mlv_raw_frame_debayered(mlvObject_t * video,
                                   uint64_t frame_index,
                                   float * temp_memory,
                                   uint16_t * output_frame,
-                                  int debayer_type ); /* Debayer type: 0=bilinear 1=amaze */
+                                  int debayer_type ); /* Debayer type: 0=bilinear 1=amaze ... 9=realtime rcd */
 
 /* Thumbnail Creation with a downscaled raw image sub-sampling algorithm is used. */
 int create_thumbnail(mlvObject_t * video, uint8_t * thumbnail_img, int downscaled_factor, int width, int height, int threads);
 
+/* Full debayer, area average downscale, no processing (linear 16 bit RGB). Returns 0 on success */
+int get_area_average_downscale_raw(mlvObject_t *video, int frame_index, int downscale_factor, uint16_t *out_buffer);
+
 /* Thumbnail Creation with full debayer, but downscaled image processing */
 void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, int downscale_factor, int cpu_cores, unsigned char *out_buffer);
 
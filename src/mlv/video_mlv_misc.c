@@ -5,6 +5,7 @@
 #include "../debayer/debayer.h"
 #include "mlv_object.h"
 #include "video_mlv.h"
+#include "../buffer_pool/buffer_pool.h"
 
 int create_thumbnail(mlvObject_t * video, uint8_t * thumbnail_img, int downscaled_factor, int width, int height, int threads)
 {
@@ -12,20 +13,20 @@ int create_thumbnail(mlvObject_t * video, uint8_t * thumbnail_img, int downscale
     int raw_h = video->RAWI.yRes;
     int i, j;
 
-    uint16_t *raw_frame = (uint16_t *)(malloc(raw_w * raw_h * sizeof(uint16_t)));
-    if (getMlvRawFrameUint16(video, 0, raw_frame))
+    uint16_t *raw_frame = (uint16_t *)(bufferPoolAlloc(raw_w * raw_h * sizeof(uint16_t)));
+    if (!raw_frame || getMlvRawFrameUint16(video, 0, raw_frame))
     {
-        free(raw_frame);
+        bufferPoolFree(raw_frame);
         return 1;
     }
 
     int pixel_count = (width) * (height);
 
-    uint16_t *downscaled_frame = (uint16_t *)(malloc(pixel_count * sizeof(uint16_t)));
+    uint16_t *downscaled_frame = (uint16_t *)(bufferPoolAlloc(pixel_count * sizeof(uint16_t)));
 
     if (!downscaled_frame)
     {
-        free(raw_frame);
+        bufferPoolFree(raw_frame);
         return 1;
     }
 
@@ -35,63 +36,66 @@ int create_thumbnail(mlvObject_t * video, uint8_t * thumbnail_img, int downscale
 
     int shift_val = (llrpHQDualIso(video)) ? 0 : (16 - video->RAWI.raw_info.bits_per_pixel);
 
-    float *float_thumb = (float *)(malloc(pixel_count * sizeof(float)));
+    float *float_thumb = (float *)(bufferPoolAlloc(pixel_count * sizeof(float)));
 
     if (!float_thumb)
     {
-        free(raw_frame);
-        free(downscaled_frame);
+        bufferPoolFree(raw_frame);
+        bufferPoolFree(downscaled_frame);
         return 1;
     }
 
     for (i = 0; i < pixel_count; i++)
         float_thumb[i] = (float)(downscaled_frame[i] << shift_val);
 
-    uint16_t *debayered_frame = (uint16_t *)(malloc(pixel_count * 3 * sizeof(uint16_t)));
+    uint16_t *debayered_frame = (uint16_t *)(bufferPoolAlloc(pixel_count * 3 * sizeof(uint16_t)));
 
     if (!debayered_frame)
     {
-        free(raw_frame);
-        free(downscaled_frame);
-        free(float_thumb);
+        bufferPoolFree(raw_frame);
+        bufferPoolFree(downscaled_frame);
+        bufferPoolFree(float_thumb);
         return 1;
     }
 
     debayerBasic(debayered_frame, float_thumb, width, height, 1);
 
-    uint16_t *processed_frame = (uint16_t *)(malloc(pixel_count * 3 * sizeof(uint16_t)));
+    uint16_t *processed_frame = (uint16_t *)(bufferPoolAlloc(pixel_count * 3 * sizeof(uint16_t)));
 
     if (!processed_frame)
     {
-        free(raw_frame);
-        free(downscaled_frame);
-        free(debayered_frame);
-        free(float_thumb);
+        bufferPoolFree(raw_frame);
+        bufferPoolFree(downscaled_frame);
+        bufferPoolFree(debayered_frame);
+        bufferPoolFree(float_thumb);
         return 1;
     }
 
-    applyProcessingObject(video->processing,
-                          width, height,
-                          debayered_frame,
-                          processed_frame,
-                          threads, 1, 0);
+    /* vignette and gradient masks are made for full resolution */
+    applyProcessingObjectWithoutMasks(video->processing,
+                                      width, height,
+                                      debayered_frame,
+                                      processed_frame,
+                                      threads, 1, 0);
 
     for (i = 0; i < pixel_count * 3; i++)
         thumbnail_img[i] = (uint8_t)(processed_frame[i] >> 8);
 
-    free(raw_frame);
-    free(downscaled_frame);
-    free(debayered_frame);
-    free(float_thumb);
-    free(processed_frame);
+    bufferPoolFree(raw_frame);
+    bufferPoolFree(downscaled_frame);
+    bufferPoolFree(debayered_frame);
+    bufferPoolFree(float_thumb);
+    bufferPoolFree(processed_frame);
 
     return 0;
 }
 
-void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, int downscale_factor, int cpu_cores, unsigned char *out_buffer)
+/* Area average downscale of the debayered frame, no image processing applied.
+ * out_buffer needs (xRes / downscale_factor) * (yRes / downscale_factor) * 3 uint16 */
+int get_area_average_downscale_raw(mlvObject_t *video, int frame_index, int downscale_factor, uint16_t *out_buffer)
 {
-    if (!video || !out_buffer) {
-        return;
+    if (!video || !out_buffer || downscale_factor < 1) {
+        return 1;
     }
 
     /* Get RAW frame info */
@@ -99,23 +103,23 @@ void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, in
     int raw_h = video->RAWI.yRes;
 
     if (raw_w <= 0 || raw_h <= 0) {
-        return;
+        return 1;
     }
 
     /* Allocate memory for the full raw frame */
-    float *raw_frame = (float *) malloc(raw_w * raw_h * sizeof(float));
+    float *raw_frame = (float *) bufferPoolAlloc(raw_w * raw_h * sizeof(float));
     if (!raw_frame) {
-        return;
+        return 1;
     }
 
     /* Get the float B&W raw bayer data */
     getMlvRawFrameFloat(video, frame_index, raw_frame);
 
-    uint16_t *debayered_raw_frame = (uint16_t *) malloc(
+    uint16_t *debayered_raw_frame = (uint16_t *) bufferPoolAlloc(
         (size_t) (raw_w * raw_h * 3) * sizeof(uint16_t));
     if (!debayered_raw_frame) {
-        free(raw_frame);
-        return;
+        bufferPoolFree(raw_frame);
+        return 1;
     }
 
     /* get debayered image */
@@ -124,14 +128,6 @@ void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, in
     const int thumbW = raw_w / downscale_factor;
     const int thumbH = raw_h / downscale_factor;
 
-    uint16_t *downscaled_image = (uint16_t *) malloc(
-        (size_t) (thumbW * thumbH * 3) * sizeof(uint16_t));
-    if (!downscaled_image) {
-        free(raw_frame);
-        free(debayered_raw_frame);
-        return;
-    }
-
     /* Downscale */
     for (int outY = 0; outY < thumbH; ++outY) {
         for (int outX = 0; outX < thumbW; ++outX) {
@@ -152,29 +148,64 @@ void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, in
             }
 
             size_t out_pixel_index = ((size_t) outY * thumbW + outX) * 3;
-            downscaled_image[out_pixel_index + 0] = (uint16_t) (sum_r / (downscale_factor *
-                                                                         downscale_factor));
-            downscaled_image[out_pixel_index + 1] = (uint16_t) (sum_g / (downscale_factor *
-                                                                         downscale_factor));
-            downscaled_image[out_pixel_index + 2] = (uint16_t) (sum_b / (downscale_factor *
-                                                                         downscale_factor));
+            out_buffer[out_pixel_index + 0] = (uint16_t) (sum_r / (downscale_factor *
+                                                                   downscale_factor));
+            out_buffer[out_pixel_index + 1] = (uint16_t) (sum_g / (downscale_factor *
+                                                                   downscale_factor));
+            out_buffer[out_pixel_index + 2] = (uint16_t) (sum_b / (downscale_factor *
+                                                                   downscale_factor));
         }
     }
 
-    uint16_t *downscaled_processed_image = (uint16_t *) malloc(
+    /* Cleanup */
+    bufferPoolFree(debayered_raw_frame);
+    bufferPoolFree(raw_frame);
+
+    return 0;
+}
+
+void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, int downscale_factor, int cpu_cores, unsigned char *out_buffer)
+{
+    if (!video || !out_buffer) {
+        return;
+    }
+
+    /* Get RAW frame info */
+    int raw_w = video->RAWI.xRes;
+    int raw_h = video->RAWI.yRes;
+
+    if (raw_w <= 0 || raw_h <= 0) {
+        return;
+    }
+
+    const int thumbW = raw_w / downscale_factor;
+    const int thumbH = raw_h / downscale_factor;
+
+    uint16_t *downscaled_image = (uint16_t *) bufferPoolAlloc(
+        (size_t) (thumbW * thumbH * 3) * sizeof(uint16_t));
+    if (!downscaled_image) {
+        return;
+    }
+
+    /* Debayer and downscale */
+    if (get_area_average_downscale_raw(video, frame_index, downscale_factor, downscaled_image)) {
+        bufferPoolFree(downscaled_image);
+        return;
+    }
+
+    uint16_t *downscaled_processed_image = (uint16_t *) bufferPoolAlloc(
         (size_t) (thumbW * thumbH * 3) * sizeof(uint16_t));
     if (!downscaled_processed_image) {
-        free(raw_frame);
-        free(debayered_raw_frame);
-        free(downscaled_image);
+        bufferPoolFree(downscaled_image);
         return;
     }
 
-    applyProcessingObject(video->processing,
-                          thumbW, thumbH,
-                          downscaled_image,
-                          downscaled_processed_image,
-                          cpu_cores, 1, frame_index);
+    /* vignette and gradient masks are made for full resolution */
+    applyProcessingObjectWithoutMasks(video->processing,
+                                      thumbW, thumbH,
+                                      downscaled_image,
+                                      downscaled_processed_image,
+                                      cpu_cores, 1, frame_index);
 
     size_t size = thumbW * thumbH * 3;
     for (size_t i = 0; i < size; i++) {
@@ -182,8 +213,6 @@ void get_area_average_downscale_thumnail(mlvObject_t *video, int frame_index, in
     }
 
     /* Cleanup */
-    free(downscaled_processed_image);
-    free(downscaled_image);
-    free(debayered_raw_frame);
-    free(raw_frame);
+    bufferPoolFree(downscaled_processed_image);
+    bufferPoolFree(downscaled_image);
 }
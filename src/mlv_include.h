@@ -9,6 +9,7 @@ extern "C" {
 /* MLV reading part */
 #include "mlv/video_mlv.h"
 #include "mlv/audio_mlv.h"
+#include "mlv/mlv_proxy.h"
 
 /* RAW processing part */
 #include "processing/raw_processing.h"
@@ -16,6 +17,9 @@ extern "C" {
 #include "mlv/llrawproc/llrawproc.h"
 #include "dng/dng.h"
 
+/* Frame sized scratch buffers */
+#include "buffer_pool/buffer_pool.h"
+
 #ifdef __cplusplus
 }
 #endif
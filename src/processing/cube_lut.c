@@ -6,47 +6,106 @@
  */
 
 #include "cube_lut.h"
+#include "lut3d.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 #define LIMIT16(X) MAX(MIN(X, 65535), 0)
 
-//Switch here between trilinear and tetrahedral interpolation
-//#define USE_TRILIN_INT
-
-#define LUT3D_INDEX(r, g, b, dim, dim2) (((r) + (g)*(dim) + (b)*(dim2)) * 3)
+//Position of a value in a domain, for a table of dim entries (0..dim-1)
+static double lut_position( double value, float min, float max, int dim )
+{
+    double x = ( value - min ) / ( max - min ) * ( dim - 1 );
+    if( !( x > 0.0 ) ) return 0.0;
+    if( x > dim - 1 ) return dim - 1;
+    return x;
+}
 
-// //////////////
-//Interpolation functions
-#if QT_NO_DEBUG
-inline float lerp(float x, float x1, float x2, float q00, float q01) {
-#else
-float lerp(float x, float x1, float x2, float q00, float q01) {
-#endif
-    if( ( x2 - x1 ) == 0 ) return q00;
-    else return ( ( ( x2 - x ) / ( x2 - x1 ) ) * q00 ) + ( ( ( x - x1 ) / ( x2 - x1 ) ) * q01 );
+//Linear interpolation in one channel of a 1D table with 3 channels
+static double lut_1d_value( const float *table, int dim, int channel, double x )
+{
+    int x0 = (int)x;
+    int x1 = MIN( x0 + 1, dim - 1 );
+    double f = x - x0;
+    return table[x0 * 3 + channel] * ( 1.0 - f ) + table[x1 * 3 + channel] * f;
 }
 
-inline float biLerp(float x, float y, float q11, float q12, float q21, float q22, float x1, float x2, float y1, float y2) {
-  float r1 = lerp(x, x1, x2, q11, q21);
-  float r2 = lerp(x, x1, x2, q12, q22);
+//Repack the loaded LUT for apply_lut, returns 0 on success. The tables are built
+//completely before they are set, apply_lut never sees them half filled
+static int lut_prepare( lut_t *lut )
+{
+    const int dim = lut->dimension;
+    if( dim <= 1 ) return 0;
 
-  return lerp(y, y1, y2, r1, r2);
-}
+    uint16_t *table;
+    uint32_t *coordinate = NULL;
+
+    if( lut->is3d == 0 )
+    {
+        //Resample to full 16 bit resolution, so applying is one lookup per channel
+        table = malloc( 3 * 65536 * sizeof( uint16_t ) );
+        if( !table ) return -1;
+        for( int c = 0; c < 3; c++ )
+        {
+            for( int v = 0; v < 65536; v++ )
+            {
+                double x = lut_position( v / 65535.0, lut->domain_min[c], lut->domain_max[c], dim );
+                table[c * 65536 + v] = LIMIT16( lut_1d_value( lut->cube, dim, c, x ) * 65535.0 + 0.5 );
+            }
+        }
+    }
+    else
+    {
+        //Nodes as 16 bit RGBX, so each node is one 8 byte load
+        table = malloc( (size_t)dim * dim * dim * 4 * sizeof( uint16_t ) );
+        coordinate = malloc( 3 * 65536 * sizeof( uint32_t ) );
+        if( !table || !coordinate )
+        {
+            free( table );
+            free( coordinate );
+            return -1;
+        }
+        uint16_t *node = table;
+        for( int r = 0; r < dim; r++ )
+        {
+            for( int g = 0; g < dim; g++ )
+            {
+                for( int b = 0; b < dim; b++ )
+                {
+                    float *in = lut->cube + ( r + g * dim + b * dim * dim ) * 3;
+                    node[0] = LIMIT16( in[0] * 65535.0 + 0.5 );
+                    node[1] = LIMIT16( in[1] * 65535.0 + 0.5 );
+                    node[2] = LIMIT16( in[2] * 65535.0 + 0.5 );
+                    node[3] = 0;
+                    node += 4;
+                }
+            }
+        }
 
-inline float triLerp(float x, float y, float z, float q000, float q001, float q010, float q011, float q100, float q101, float q110, float q111, float x1, float x2, float y1, float y2, float z1, float z2) {
-  float x00 = lerp(x, x1, x2, q000, q100);
-  float x10 = lerp(x, x1, x2, q010, q110);
-  float x01 = lerp(x, x1, x2, q001, q101);
-  float x11 = lerp(x, x1, x2, q011, q111);
-  float r0 = lerp(y, y1, y2, x00, x10);
-  float r1 = lerp(y, y1, y2, x01, x11);
+        //Shaper and domain, from input value to node coordinate with 16 bit fraction
+        for( int c = 0; c < 3; c++ )
+        {
+            for( int v = 0; v < 65536; v++ )
+            {
+                double x = v / 65535.0;
+                if( lut->shaper )
+                {
+                    x = lut_1d_value( lut->shaper, lut->shaper_dimension, c,
+                                      lut_position( x, lut->shaper_range[0], lut->shaper_range[1], lut->shaper_dimension ) );
+                }
+                x = lut_position( x, lut->domain_min[c], lut->domain_max[c], dim );
+                coordinate[c * 65536 + v] = (uint32_t)( x * 65536.0 + 0.5 );
+            }
+        }
+    }
 
-  return lerp(z, z1, z2, r0, r1);
+    lut->coordinate = coordinate;
+    lut->table = table;
+    return 0;
 }
-// //////////////
 
 //Initialize LUT object
 lut_t * init_lut( void )
@@ -72,9 +131,14 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
     unsigned int i = 0;
     char line[250];
     uint32_t lut_size = 0;
+    uint32_t shaper_size = 0;
+    uint16_t size_1d = 0, size_3d = 0;
     float r, g, b;
     float inMin, inMax;
 
+    //Loading again replaces the last LUT
+    unload_lut( lut );
+
     FILE *fp;
     fp = fopen( filename, "r" );
 
@@ -84,6 +148,8 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
         lut->domain_min[i] = 0.0;
         lut->domain_max[i] = 1.0;
     }
+    lut->shaper_range[0] = 0.0;
+    lut->shaper_range[1] = 1.0;
 
     while( fgets (line, 250, fp) != NULL ) //No more than 250 characters on the line, cube specification
     {
@@ -101,28 +167,41 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
 #endif
             continue;
         }
-        else if( sscanf(line, "LUT_1D_SIZE%*[ \t]%hu%*[^\n]", &lut->dimension) == 1) //LUT is 1D
+        else if( sscanf(line, "LUT_1D_SIZE%*[ \t]%hu%*[^\n]", &size_1d) == 1) //LUT is 1D, or shaper if 3D size follows
         {
 #ifndef STDOUT_SILENT
-            printf("LUT_1D_SIZE %u\n", lut->dimension);
+            printf("LUT_1D_SIZE %u\n", size_1d);
 #endif
-            lut_size = lut->dimension * 3;
-            lut->is3d = 0;
-            lut->cube = malloc( lut_size * sizeof( float ) );
             continue;
         }
-        else if( sscanf(line, "LUT_3D_SIZE%*[ \t]%hu%*[^\n]", &lut->dimension) == 1) //LUT is 3D
+        else if( sscanf(line, "LUT_3D_SIZE%*[ \t]%hu%*[^\n]", &size_3d) == 1) //LUT is 3D
         {
 #ifndef STDOUT_SILENT
-            printf("LUT_3D_SIZE %u\n", lut->dimension);
+            printf("LUT_3D_SIZE %u\n", size_3d);
 #endif
-            lut_size = (uint32_t)lut->dimension * (uint32_t)lut->dimension * (uint32_t)lut->dimension * 3;
-            lut->is3d = 1;
-            lut->cube = malloc( lut_size * sizeof( float ) );
             continue;
         }
         else if( sscanf(line, "%f%*[ \t]%f%*[ \t]%f%*[^\n]", &r, &g, &b ) == 3) //Read data
         {
+            if( !lut_size ) //First data line: shaper data (if any) comes first, then the LUT
+            {
+                if( size_3d )
+                {
+                    lut->dimension = size_3d;
+                    lut->is3d = 1;
+                    lut->shaper_dimension = size_1d;
+                    shaper_size = size_1d * 3;
+                    if( shaper_size ) lut->shaper = malloc( shaper_size * sizeof( float ) );
+                }
+                else
+                {
+                    lut->dimension = size_1d;
+                    lut->is3d = 0;
+                }
+                lut_size = lut->is3d ? (uint32_t)size_3d * (uint32_t)size_3d * (uint32_t)size_3d * 3 : (uint32_t)size_1d * 3;
+                lut_size += shaper_size;
+                if( lut_size ) lut->cube = malloc( ( lut_size - shaper_size ) * sizeof( float ) );
+            }
             if(!lut_size || i >= lut_size) //File with invalid header or file is too long
             {
                 sprintf(error_message, "File with invalid header or file is too long.");
@@ -136,9 +215,10 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
 #ifndef STDOUT_SILENT
             printf("Data line #%d values: r = %f, g = %f, b = %f\n", i/3, r, g, b);
 #endif
-            lut->cube[i+0] = r;
-            lut->cube[i+1] = g;
-            lut->cube[i+2] = b;
+            float *data = ( i < shaper_size ) ? lut->shaper + i : lut->cube + i - shaper_size;
+            data[0] = r;
+            data[1] = g;
+            data[2] = b;
             i+=3;
         }
         else if( sscanf(line, "DOMAIN_MIN%*[ \t]%f%*[ \t]%f%*[ \t]%f%*[^\n]", &lut->domain_min[0], &lut->domain_min[1], &lut->domain_min[2]) == 3) //Read domain min values
@@ -155,10 +235,10 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
 #endif
             continue;
         }
-        else if( sscanf(line, "LUT_1D_INPUT_RANGE%*[ \t]%f%*[ \t]%f%*[^\n]", &inMin, &inMax) == 2) //Read input range values (Resolve created), do nothing with it, because it is not in the specs
+        else if( sscanf(line, "LUT_1D_INPUT_RANGE%*[ \t]%f%*[ \t]%f%*[^\n]", &lut->shaper_range[0], &lut->shaper_range[1]) == 2) //Read input range values (Resolve created), only used for a shaper, because it is not in the specs
         {
 #ifndef STDOUT_SILENT
-            printf("LUT_1D_INPUT_RANGE %f %f\n", &inMin, &inMax);
+            printf("LUT_1D_INPUT_RANGE %f %f\n", lut->shaper_range[0], lut->shaper_range[1]);
 #endif
             continue;
         }
@@ -193,6 +273,18 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
     }
 
     fclose( fp );
+
+    if( lut_prepare( lut ) )
+    {
+        sprintf(error_message, "Not enough memory.");
+#ifndef STDOUT_SILENT
+        printf("%s\n", error_message);
+#endif
+        unload_lut( lut );
+        return -4;
+    }
+
+    lut->version++;
     return 0;
 }
 
@@ -200,143 +292,92 @@ int load_lut( lut_t *lut, char *filename, char *error_message )
 void unload_lut( lut_t *lut )
 {
     if( !lut ) return;
+    free( lut->cube );
+    free( lut->shaper );
+    free( lut->table );
+    free( lut->coordinate );
+    lut->cube = NULL;
+    lut->shaper = NULL;
+    lut->table = NULL;
+    lut->coordinate = NULL;
+    lut->shaper_dimension = 0;
     if( lut->dimension == 0 ) return;
-    if( lut->cube ) free( lut->cube );
     lut->dimension = 0;
+    lut->version++;
 }
 
-//Apply LUT on picture
+//Copy the repacked tables of a loaded LUT, enough for apply_lut. Returns 0 on success
+int copy_lut( lut_t *dst, lut_t *src )
+{
+    unload_lut( dst );
+    memcpy( dst->title, src->title, sizeof( dst->title ) );
+    memcpy( dst->domain_min, src->domain_min, sizeof( dst->domain_min ) );
+    memcpy( dst->domain_max, src->domain_max, sizeof( dst->domain_max ) );
+    dst->is3d = src->is3d;
+    dst->intensity = src->intensity;
+
+    if( src->dimension > 1 && src->table )
+    {
+        const size_t dim = src->dimension;
+        size_t tableSize = src->is3d ? dim * dim * dim * 4 : 3 * 65536;
+        dst->table = malloc( tableSize * sizeof( uint16_t ) );
+        if( src->is3d ) dst->coordinate = malloc( 3 * 65536 * sizeof( uint32_t ) );
+        if( !dst->table || ( src->is3d && !dst->coordinate ) )
+        {
+            unload_lut( dst );
+            return -1;
+        }
+        memcpy( dst->table, src->table, tableSize * sizeof( uint16_t ) );
+        if( src->is3d ) memcpy( dst->coordinate, src->coordinate, 3 * 65536 * sizeof( uint32_t ) );
+        dst->dimension = src->dimension;
+    }
+
+    dst->version = src->version;
+    return 0;
+}
+
+//Apply LUT on picture, runs on many threads already (one per image part)
 void apply_lut(lut_t *lut, int width, int height, uint16_t *image)
 {
-    if( lut->dimension <= 1 || !lut->cube ) return;
+    if( lut->dimension <= 1 || !lut->table ) return;
+    if( lut->is3d && !lut->coordinate ) return;
     if( lut->intensity > 100 ) lut->intensity = 100;
 
     uint16_t * end = image + (width * height * 3);
-    float factor1 = (float)lut->intensity / 100.0f;
-    float factor2 = 1.0 - factor1;
+    //Intensity as 16 bit fraction
+    const uint32_t factor1 = lut->intensity * 65536 / 100;
+    const uint32_t factor2 = 65536 - factor1;
 
-    const uint32_t dim = lut->dimension;
-    const uint32_t dim2 = dim * dim;
-    float *cube = lut->cube;
-    float factorA = ( lut->dimension - 1 ) / 65536.0 / ( lut->domain_max[0] - lut->domain_min[0] );
-    float factorB = ( lut->dimension - 1 ) / 65536.0 / ( lut->domain_max[1] - lut->domain_min[1] );
-    float factorC = ( lut->dimension - 1 ) / 65536.0 / ( lut->domain_max[2] - lut->domain_min[2] );
+    const int dim = lut->dimension;
+    const uint16_t *table = lut->table;
+    const uint32_t *coordinate = lut->coordinate;
 
     for (uint16_t * pix = image; pix < end; pix += 3)
     {
-        //x
-        float red   = ( pix[0] * factorA ) - lut->domain_min[0];
-        float green = ( pix[1] * factorB ) - lut->domain_min[1];
-        float blue  = ( pix[2] * factorC ) - lut->domain_min[2];
-
-        //x0
-        uint16_t r0 = (uint16_t)red;
-        uint16_t g0 = (uint16_t)green;
-        uint16_t b0 = (uint16_t)blue;
-        //x1
-        uint16_t r1 = r0 + 1;
-        uint16_t g1 = g0 + 1;
-        uint16_t b1 = b0 + 1;
-
-        //Limit
-        if( r0 >= lut->dimension ) r0 = lut->dimension - 1;
-        if( g0 >= lut->dimension ) g0 = lut->dimension - 1;
-        if( b0 >= lut->dimension ) b0 = lut->dimension - 1;
-        if( r1 >= lut->dimension ) r1 = lut->dimension - 1;
-        if( g1 >= lut->dimension ) g1 = lut->dimension - 1;
-        if( b1 >= lut->dimension ) b1 = lut->dimension - 1;
-
+        uint16_t out[3];
         if( lut->is3d == 0 )
         {
-            //Linear Interpolation
-            //y0 & //y1
-            float pix00 = cube[r0 * 3 + 0];
-            float pix01 = cube[r1 * 3 + 0];
-            float pix10 = cube[g0 * 3 + 1];
-            float pix11 = cube[g1 * 3 + 1];
-            float pix20 = cube[b0 * 3 + 2];
-            float pix21 = cube[b1 * 3 + 2];
-            //3x Linear Interpolation
-            float a = lerp( red,   r0, r1, pix00, pix01 );
-            float b = lerp( green, g0, g1, pix10, pix11 );
-            float c = lerp( blue,  b0, b1, pix20, pix21 );
-            //Output
-            pix[0] = pix[0] * factor2 + LIMIT16( a * 65535.0 ) * factor1;
-            pix[1] = pix[1] * factor2 + LIMIT16( b * 65535.0 ) * factor1;
-            pix[2] = pix[2] * factor2 + LIMIT16( c * 65535.0 ) * factor1;
+            out[0] = table[pix[0]];
+            out[1] = table[65536 + pix[1]];
+            out[2] = table[131072 + pix[2]];
         }
         else
         {
-#ifdef USE_TRILIN_INT
-            //Trilinear Interpolation
-            for( int i = 0; i < 3; i++ )
-            {
-                float q000 = cube[LUT3D_INDEX(r0, g0, b0, dim, dim2) + i];
-                float q001 = cube[LUT3D_INDEX(r0, g0, b1, dim, dim2) + i];
-                float q010 = cube[LUT3D_INDEX(r0, g1, b0, dim, dim2) + i];
-                float q011 = cube[LUT3D_INDEX(r0, g1, b1, dim, dim2) + i];
-                float q100 = cube[LUT3D_INDEX(r1, g0, b0, dim, dim2) + i];
-                float q101 = cube[LUT3D_INDEX(r1, g0, b1, dim, dim2) + i];
-                float q110 = cube[LUT3D_INDEX(r1, g1, b0, dim, dim2) + i];
-                float q111 = cube[LUT3D_INDEX(r1, g1, b1, dim, dim2) + i];
-
-                float out = triLerp(red, green, blue, q000, q001, q010, q011, q100, q101, q110, q111, r0, r1, g0, g1, b0, b1);
-
-                //Output
-                pix[i] = LIMIT16( out * 65535.0 );
-            }
-#else
-            //Tetrahedral Interpolation
-            red = red - r0;
-            blue = blue - b0;
-            green = green - g0;
-
-            for( uint8_t i = 0; i < 3; i++ )
-            {
-                float q000 = cube[LUT3D_INDEX(r0, g0, b0, dim, dim2) + i];
-                float q001 = cube[LUT3D_INDEX(r0, g0, b1, dim, dim2) + i];
-                float q010 = cube[LUT3D_INDEX(r0, g1, b0, dim, dim2) + i];
-                float q011 = cube[LUT3D_INDEX(r0, g1, b1, dim, dim2) + i];
-                float q100 = cube[LUT3D_INDEX(r1, g0, b0, dim, dim2) + i];
-                float q101 = cube[LUT3D_INDEX(r1, g0, b1, dim, dim2) + i];
-                float q110 = cube[LUT3D_INDEX(r1, g1, b0, dim, dim2) + i];
-                float q111 = cube[LUT3D_INDEX(r1, g1, b1, dim, dim2) + i];
+            lut3d_interpolate_rgbx( table, dim, coordinate[pix[0]], coordinate[65536 + pix[1]], coordinate[131072 + pix[2]], out );
+        }
 
-                float out;
-                if( green >= blue && blue >= red ) //T1
-                {
-                    out = ( (1.0 - green) * q000 ) + ( ( green - blue ) * q010 )
-                                + ( ( blue - red ) * q011 ) + ( red * q111 );
-                }
-                else if( blue > red && red > green ) //T2
-                {
-                    out = ( (1.0 - blue) * q000 ) + ( ( blue - red ) * q001 )
-                                + ( ( red - green ) * q101 ) + ( green * q111 );
-                }
-                else if( blue > green && green >= red ) //T3
-                {
-                    out = ( (1.0 - blue) * q000 ) + ( ( blue - green ) * q001 )
-                                + ( ( green - red ) * q011 ) + ( red * q111 );
-                }
-                else if( red >= green && green > blue ) //T4
-                {
-                    out = ( (1.0 - red) * q000 ) + ( ( red - green ) * q100 )
-                                + ( ( green - blue ) * q110 ) + ( blue * q111 );
-                }
-                else if( green > red && red >= blue ) //T5
-                {
-                    out = ( (1.0 - green) * q000 ) + ( ( green - red ) * q010 )
-                                + ( ( red - blue ) * q110 ) + ( blue * q111 );
-                }
-                else //T6
-                {
-                    out = ( (1.0 - red) * q000 ) + ( ( red - blue ) * q100 )
-                                + ( ( blue - green ) * q101 ) + ( green * q111 );
-                }
-                //Output
-                pix[i] = pix[i] * factor2 + LIMIT16( out * 65535.0 ) * factor1;
-            }
-#endif
+        //Output
+        if( factor2 == 0 )
+        {
+            pix[0] = out[0];
+            pix[1] = out[1];
+            pix[2] = out[2];
+        }
+        else
+        {
+            pix[0] = ( pix[0] * factor2 + out[0] * factor1 + 32768 ) >> 16;
+            pix[1] = ( pix[1] * factor2 + out[1] * factor1 + 32768 ) >> 16;
+            pix[2] = ( pix[2] * factor2 + out[2] * factor1 + 32768 ) >> 16;
         }
     }
 }
@@ -18,12 +18,22 @@ typedef struct {
     float *cube;
     int is3d;
     uint8_t intensity;
+    uint32_t version; /* Changes on each load/unload */
+    /* 1D shaper in front of a 3D LUT (Resolve style .cube), input range 0..1 if not given */
+    uint16_t shaper_dimension;
+    float shaper_range[2];
+    float *shaper;
+    /* Repacked when loaded: 1D as 3 curves of 65536 values, 3D as 16 bit RGBX nodes (red slowest)
+     * with node coordinates for each 16 bit input value and channel */
+    uint16_t *table;
+    uint32_t *coordinate;
 } lut_t;
 
 lut_t * init_lut( void );
 void free_lut( lut_t *lut );
 int load_lut(lut_t *lut, char *filename, char *error_message);
 void unload_lut( lut_t *lut );
+int copy_lut( lut_t *dst, lut_t *src );
 void apply_lut( lut_t *lut, int width, int height, uint16_t * image );
 
 #endif // CUBE_LUT_H
@@ -8,43 +8,184 @@
 #include <stdlib.h>
 #include <string.h>
 #include "denoiser_2d_median.h"
+#include "../../buffer_pool/buffer_pool.h"
 
-void swap(int *a, int *b)
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+//Pixels of a row which go through a sorting network together
+#define MEDIAN_BLOCK 64
+
+//Sort two values of the window for all pixels of the block, branchless so it vectorizes
+#define PIX_SORT(a,b) for( int j = 0; j < MEDIAN_BLOCK; j++ ) \
+    { uint16_t lo = MIN( p[a][j], p[b][j] ); p[b][j] = MAX( p[a][j], p[b][j] ); p[a][j] = lo; }
+
+//Median of 9 by sorting network (N. Devillard, "Fast median search")
+static void median_network_9( uint16_t p[9][MEDIAN_BLOCK] )
+{
+    PIX_SORT(1, 2); PIX_SORT(4, 5); PIX_SORT(7, 8);
+    PIX_SORT(0, 1); PIX_SORT(3, 4); PIX_SORT(6, 7);
+    PIX_SORT(1, 2); PIX_SORT(4, 5); PIX_SORT(7, 8);
+    PIX_SORT(0, 3); PIX_SORT(5, 8); PIX_SORT(4, 7);
+    PIX_SORT(3, 6); PIX_SORT(1, 4); PIX_SORT(2, 5);
+    PIX_SORT(4, 7); PIX_SORT(4, 2); PIX_SORT(6, 4);
+    PIX_SORT(4, 2);
+    //Median is in p[4]
+}
+
+//Median of 25 by sorting network (N. Devillard, "Fast median search")
+static void median_network_25( uint16_t p[25][MEDIAN_BLOCK] )
+{
+    PIX_SORT(0, 1);   PIX_SORT(3, 4);   PIX_SORT(2, 4);
+    PIX_SORT(2, 3);   PIX_SORT(6, 7);   PIX_SORT(5, 7);
+    PIX_SORT(5, 6);   PIX_SORT(9, 10);  PIX_SORT(8, 10);
+    PIX_SORT(8, 9);   PIX_SORT(12, 13); PIX_SORT(11, 13);
+    PIX_SORT(11, 12); PIX_SORT(15, 16); PIX_SORT(14, 16);
+    PIX_SORT(14, 15); PIX_SORT(18, 19); PIX_SORT(17, 19);
+    PIX_SORT(17, 18); PIX_SORT(21, 22); PIX_SORT(20, 22);
+    PIX_SORT(20, 21); PIX_SORT(23, 24); PIX_SORT(2, 5);
+    PIX_SORT(3, 6);   PIX_SORT(0, 6);   PIX_SORT(0, 3);
+    PIX_SORT(4, 7);   PIX_SORT(1, 7);   PIX_SORT(1, 4);
+    PIX_SORT(11, 14); PIX_SORT(8, 14);  PIX_SORT(8, 11);
+    PIX_SORT(12, 15); PIX_SORT(9, 15);  PIX_SORT(9, 12);
+    PIX_SORT(13, 16); PIX_SORT(10, 16); PIX_SORT(10, 13);
+    PIX_SORT(20, 23); PIX_SORT(17, 23); PIX_SORT(17, 20);
+    PIX_SORT(21, 24); PIX_SORT(18, 24); PIX_SORT(18, 21);
+    PIX_SORT(19, 22); PIX_SORT(8, 17);  PIX_SORT(9, 18);
+    PIX_SORT(0, 18);  PIX_SORT(0, 9);   PIX_SORT(10, 19);
+    PIX_SORT(1, 19);  PIX_SORT(1, 10);  PIX_SORT(11, 20);
+    PIX_SORT(2, 20);  PIX_SORT(2, 11);  PIX_SORT(12, 21);
+    PIX_SORT(3, 21);  PIX_SORT(3, 12);  PIX_SORT(13, 22);
+    PIX_SORT(4, 22);  PIX_SORT(4, 13);  PIX_SORT(14, 23);
+    PIX_SORT(5, 23);  PIX_SORT(5, 14);  PIX_SORT(15, 24);
+    PIX_SORT(6, 24);  PIX_SORT(6, 15);  PIX_SORT(7, 16);
+    PIX_SORT(7, 19);  PIX_SORT(13, 21); PIX_SORT(15, 23);
+    PIX_SORT(7, 13);  PIX_SORT(7, 15);  PIX_SORT(1, 9);
+    PIX_SORT(3, 11);  PIX_SORT(5, 17);  PIX_SORT(11, 17);
+    PIX_SORT(9, 17);  PIX_SORT(4, 10);  PIX_SORT(6, 12);
+    PIX_SORT(7, 14);  PIX_SORT(4, 6);   PIX_SORT(4, 7);
+    PIX_SORT(12, 14); PIX_SORT(10, 14); PIX_SORT(6, 7);
+    PIX_SORT(10, 12); PIX_SORT(6, 10);  PIX_SORT(6, 17);
+    PIX_SORT(12, 17); PIX_SORT(7, 17);  PIX_SORT(7, 10);
+    PIX_SORT(12, 18); PIX_SORT(7, 12);  PIX_SORT(10, 18);
+    PIX_SORT(12, 20); PIX_SORT(10, 20); PIX_SORT(10, 12);
+    //Median is in p[12]
+}
+
+//Medians of one row for window 3 and 5: blocks of pixels through a sorting network
+static void median_row_network( const uint16_t *noisy, uint16_t *median, int width, int y, int window )
 {
-    int temp;
-    temp=*a;
-    *a=*b;
-    *b=temp;
+    uint16_t p[25][MEDIAN_BLOCK];
+    const int edge = window / 2;
+    const int middle = window * window / 2;
+
+    for( int c = 0; c < 3; c++ )
+    {
+        for( int x0 = edge; x0 < width - edge; x0 += MEDIAN_BLOCK )
+        {
+            int count = MIN( MEDIAN_BLOCK, width - edge - x0 );
+
+            //Fill window, the last block is padded with its last pixel
+            for( int j = 0; j < MEDIAN_BLOCK; j++ )
+            {
+                int x = x0 + MIN( j, count - 1 );
+                int i = 0;
+                for( int fy = 0; fy < window; fy++ )
+                {
+                    const uint16_t *line = noisy + ( ( y + fy - edge ) * width + x - edge ) * 3 + c;
+                    for( int fx = 0; fx < window; fx++ )
+                    {
+                        p[i++][j] = line[fx * 3];
+                    }
+                }
+            }
+
+            if( window == 3 ) median_network_9( p );
+            else median_network_25( p );
+
+            for( int j = 0; j < count; j++ ) median[( x0 + j ) * 3 + c] = p[middle][j];
+        }
+    }
 }
 
-/* the aim of the partition is to return the subscript of the exact */
-/* position of the pivot when it is sorted */
-// the low variable is used to point to the position of the next lowest element
-int partition(int arr[], int first, int last)
+//Comparators of Batcher's odd-even merge sort for n values, reduced to the ones the median depends on.
+//Returns the count of comparators, pairs are stored in network (needs n*n*2 entries).
+static int median_network_build( int n, uint8_t *network )
 {
-    int pivot = arr[last]; // changed the pivot
-    int low = first;
-    int i = first; // changed
-    while(i <= last-1 ){// or you can do for(i=first;i<last;i++)
-        if(arr[i] < pivot){
-            swap(&arr[i], &arr[low]);
-            low++;
+    int count = 0;
+    for( int p = 1; p < n; p *= 2 )
+    {
+        for( int k = p; k >= 1; k /= 2 )
+        {
+            for( int j = k % p; j <= n - 1 - k; j += 2 * k )
+            {
+                for( int i = 0; i <= MIN( k - 1, n - j - k - 1 ); i++ )
+                {
+                    if( ( i + j ) / ( 2 * p ) == ( i + j + k ) / ( 2 * p ) )
+                    {
+                        network[count * 2 + 0] = i + j;
+                        network[count * 2 + 1] = i + j + k;
+                        count++;
+                    }
+                }
+            }
+        }
+    }
+
+    //Walk backwards from the median, keep comparators which touch values it depends on
+    uint8_t needed[256] = { 0 };
+    needed[n / 2] = 1;
+    int kept = count;
+    for( int c = count - 1; c >= 0; c-- )
+    {
+        uint8_t a = network[c * 2 + 0], b = network[c * 2 + 1];
+        if( needed[a] || needed[b] )
+        {
+            needed[a] = needed[b] = 1;
+            kept--;
+            network[kept * 2 + 0] = a;
+            network[kept * 2 + 1] = b;
         }
-        i++;
     }
-    swap(&arr[last], &arr[low]);
-    // after finishing putting all the lower element than the pivot
-    // It's time to put the pivot into its place and return its position
-    return low;
+    memmove( network, network + kept * 2, ( count - kept ) * 2 );
+    return count - kept;
 }
 
-void quick_sort(int arr[], int first, int last)
+//Medians of one row for any window, same as above with a generated network
+static void median_row_generic( const uint16_t *noisy, uint16_t *median, int width, int y, int window,
+                                const uint8_t *network, int comparators )
 {
-    int pivot_pos;
-    if(first < last){
-        pivot_pos = partition(arr, first, last);
-        quick_sort(arr, first, pivot_pos-1);
-        quick_sort(arr, pivot_pos+1, last);
+    uint16_t p[225][MEDIAN_BLOCK];
+    const int edge = window / 2;
+    const int middle = window * window / 2;
+
+    for( int c = 0; c < 3; c++ )
+    {
+        for( int x0 = edge; x0 < width - edge; x0 += MEDIAN_BLOCK )
+        {
+            int count = MIN( MEDIAN_BLOCK, width - edge - x0 );
+
+            for( int j = 0; j < MEDIAN_BLOCK; j++ )
+            {
+                int x = x0 + MIN( j, count - 1 );
+                int i = 0;
+                for( int fy = 0; fy < window; fy++ )
+                {
+                    const uint16_t *line = noisy + ( ( y + fy - edge ) * width + x - edge ) * 3 + c;
+                    for( int fx = 0; fx < window; fx++ )
+                    {
+                        p[i++][j] = line[fx * 3];
+                    }
+                }
+            }
+
+            for( int k = 0; k < comparators; k++ )
+            {
+                PIX_SORT( network[k * 2 + 0], network[k * 2 + 1] );
+            }
+
+            for( int j = 0; j < count; j++ ) median[( x0 + j ) * 3 + c] = p[middle][j];
+        }
     }
 }
 
@@ -53,62 +194,51 @@ void denoise_2D_median(uint16_t *data, int width, int height, uint8_t window, ui
 {
     //Parameter limitation and conversion
     if( strength > 100 ) strength = 100;
+    if( window < 2 || window > 15 ) return;
     float strengthF = strength / 100.0;
     float antiStrengthF = 1 - strengthF;
 
     uint32_t imageSize = width*height*3;
 
     //Make a copy
-    uint16_t * noisy = malloc( imageSize * sizeof( uint16_t ) );
+    uint16_t * noisy = bufferPoolAlloc( imageSize * sizeof( uint16_t ) );
     memcpy( noisy, data, imageSize * sizeof( uint16_t ) );
 
-    //Allocate window
-    uint16_t winSize = window * window;
     uint16_t edgeX = window / 2;
     uint16_t edgeY = window / 2;
-    uint8_t middle = window * window / 2;
 
-#pragma omp parallel for// collapse(2) //collapse did not work here in test on Windows
-    for( uint16_t x = edgeX; x < width-edgeX; x++ )
+    //Other windows than 3x3 and 5x5 get a generated network
+    uint8_t * network = NULL;
+    int comparators = 0;
+    if( window != 3 && window != 5 )
     {
-        for( uint16_t y = edgeY; y < height-edgeY; y++ )
+        network = malloc( window * window * window * window * 2 );
+        comparators = median_network_build( window * window, network );
+    }
+
+    //Row by row, each thread has its own median row
+#pragma omp parallel
+    {
+        uint16_t * median = malloc( width * 3 * sizeof( uint16_t ) );
+
+#pragma omp for
+        for( int y = edgeY; y < height-edgeY; y++ )
         {
-            //Allocate window
-            int * windowR = malloc( winSize * sizeof( int ) );
-            int * windowB = malloc( winSize * sizeof( int ) );
-            int * windowG = malloc( winSize * sizeof( int ) );
-
-            //Fill window
-            uint32_t i = 0;
-            for( uint16_t fx = 0; fx < window; fx++ )
-            {
-                for( uint16_t fy = 0; fy < window; fy++ )
-                {
-                    uint16_t w = x + fx - edgeX;
-                    uint16_t h = y + fy - edgeY;
-                    windowR[i] = noisy[(h*width+w)*3+0];
-                    windowG[i] = noisy[(h*width+w)*3+1];
-                    windowB[i] = noisy[(h*width+w)*3+2];
-                    i++;
-                }
-            }
-            //sort window values
-            quick_sort( windowR, 0, winSize-1 );
-            quick_sort( windowG, 0, winSize-1 );
-            quick_sort( windowB, 0, winSize-1 );
+            if( window == 3 || window == 5 ) median_row_network( noisy, median, width, y, window );
+            else median_row_generic( noisy, median, width, y, window, network, comparators );
 
             //write output
-            data[(y*width+x)*3+0] = strengthF*windowR[middle] + antiStrengthF*data[(y*width+x)*3+0];
-            data[(y*width+x)*3+1] = strengthF*windowG[middle] + antiStrengthF*data[(y*width+x)*3+1];
-            data[(y*width+x)*3+2] = strengthF*windowB[middle] + antiStrengthF*data[(y*width+x)*3+2];
-
-            //Cleanup window
-            free( windowR );
-            free( windowG );
-            free( windowB );
+            uint16_t * out = data + y * width * 3;
+            for( int i = edgeX * 3; i < ( width - edgeX ) * 3; i++ )
+            {
+                out[i] = strengthF*median[i] + antiStrengthF*out[i];
+            }
         }
+
+        free( median );
     }
 
     //Cleanup
-    free( noisy );
+    free( network );
+    bufferPoolFree( noisy );
 }
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "filter.h"
+#include "../lut3d.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -60,52 +61,81 @@ filterObject_t * initFilterObject()
 
     filterObjectSetFilterStrength(filter, 1.0);
 
+    for (int i = 0; i < FILTER_COUNT; ++i) filter->lut[i] = NULL;
+    filterObjectSetFilter(filter, FILTER_FILM_FJ);
+
     return filter;
 }
 
+static genann * filter_network(filterObject_t * filter, int filterID)
+{
+    if (filterID == FILTER_FILM_FJ) return filter->net_fj;
+    else if (filterID == FILTER_FILM_VIS3) return filter->net_vis3;
+    else if (filterID == FILTER_FILM_P400) return filter->net_p400;
+    else if (filterID == FILTER_FILM_E100) return filter->net_kodak_ektar;
+    else if (filterID == FILTER_TOYC) return filter->net_toyc;
+    else if (filterID == FILTER_SEPIA) return filter->net_sepia;
+    else if (filterID == FILTER_CINE1) return filter->net_cine1;
+    else if (filterID == FILTER_CINE2) return filter->net_cine2;
+    else return filter->net_cine3;
+}
+
+/* The networks are a fixed function of RGB, so they are run once for each node
+ * of a 3D LUT instead of once for each pixel */
+static uint16_t * filter_make_lut(genann * net)
+{
+    const int size = FILTER_LUT_SIZE;
+    uint16_t * lut = malloc(size * size * size * 3 * sizeof(uint16_t));
+    if (!lut) return NULL;
+
+    double pixel[3];
+    uint16_t * node = lut;
+    for (int r = 0; r < size; ++r)
+    {
+        for (int g = 0; g < size; ++g)
+        {
+            for (int b = 0; b < size; ++b)
+            {
+                pixel[0] = r / (double)(size - 1);
+                pixel[1] = g / (double)(size - 1);
+                pixel[2] = b / (double)(size - 1);
+                const double * filtered = genann_run(net, pixel);
+                node[0] = LIMIT16(filtered[0]*65535.0);
+                node[1] = LIMIT16(filtered[1]*65535.0);
+                node[2] = LIMIT16(filtered[2]*65535.0);
+                node += 3;
+            }
+        }
+    }
+
+    return lut;
+}
+
 void applyFilterObject( filterObject_t * filter,
                         int width, int height,
                         uint16_t * image )
 {
     if (filter->strength < 0.01) return;
 
-    double pixel[3];
-
     uint16_t * end = image + (width * height * 3);
 
-    /* We need a copy or it gets messed up on many threads */
-    genann * net;
-    if (filter->filter_option == FILTER_FILM_FJ)
-        net = genann_copy(filter->net_fj);
-    else if (filter->filter_option == FILTER_FILM_VIS3)
-        net = genann_copy(filter->net_vis3);
-    else if (filter->filter_option == FILTER_FILM_P400)
-        net = genann_copy(filter->net_p400);
-    else if (filter->filter_option == FILTER_FILM_E100)
-        net = genann_copy(filter->net_kodak_ektar);
-    else if (filter->filter_option == FILTER_TOYC)
-        net = genann_copy(filter->net_toyc);
-    else if (filter->filter_option == FILTER_SEPIA)
-        net = genann_copy(filter->net_sepia);
-    else if (filter->filter_option == FILTER_CINE1)
-        net = genann_copy(filter->net_cine1);
-    else if (filter->filter_option == FILTER_CINE2)
-        net = genann_copy(filter->net_cine2);
-    else if (filter->filter_option == FILTER_CINE3)
-        net = genann_copy(filter->net_cine3);
+    /* Runs on many threads already (one per image part) */
+    uint16_t * lut = filter->lut[filter->filter_option];
+    if (!lut) return;
+    uint64_t scale = lut3d_scale(FILTER_LUT_SIZE);
 
     for (uint16_t * pix = image; pix < end; pix += 3)
     {
-        pixel[0] = ((double)pix[0])/65535.0;
-        pixel[1] = ((double)pix[1])/65535.0;
-        pixel[2] = ((double)pix[2])/65535.0;
-        const double * filtered = genann_run(net, pixel);
-        pix[0] = LIMIT16(filter->processed[(size_t)(filtered[0]*65535.0)] + filter->original[pix[0]]);
-        pix[1] = LIMIT16(filter->processed[(size_t)(filtered[1]*65535.0)] + filter->original[pix[1]]);
-        pix[2] = LIMIT16(filter->processed[(size_t)(filtered[2]*65535.0)] + filter->original[pix[2]]);
+        uint16_t filtered[3];
+        lut3d_interpolate( lut, FILTER_LUT_SIZE,
+                           lut3d_coordinate(pix[0], scale),
+                           lut3d_coordinate(pix[1], scale),
+                           lut3d_coordinate(pix[2], scale),
+                           filtered );
+        pix[0] = LIMIT16(filter->processed[filtered[0]] + filter->original[pix[0]]);
+        pix[1] = LIMIT16(filter->processed[filtered[1]] + filter->original[pix[1]]);
+        pix[2] = LIMIT16(filter->processed[filtered[2]] + filter->original[pix[2]]);
     }
-
-    genann_free(net);
 }
 
 /* Set effect strength, 0.0-1.0 */
@@ -123,10 +153,14 @@ void filterObjectSetFilterStrength(filterObject_t * filter, double strength)
 void freeFilterObject(filterObject_t * filter)
 {
     genann_free(filter->net_fj);
+    for (int i = 0; i < FILTER_COUNT; ++i) free(filter->lut[i]);
     free(filter);
 }
 
 void filterObjectSetFilter(filterObject_t * filter, int filterID)
 {
+    if (filterID < 0 || filterID >= FILTER_COUNT) return;
+    /* LUT is ready before the filter is used */
+    if (!filter->lut[filterID]) filter->lut[filterID] = filter_make_lut(filter_network(filter, filterID));
     filter->filter_option = filterID;
 }
@@ -4,6 +4,10 @@
 #include "stdint.h"
 #include "genann/genann.h"
 
+/* Count of filters and nodes per axis of their precompiled 3D LUTs */
+#define FILTER_COUNT 9
+#define FILTER_LUT_SIZE 33
+
 typedef struct {
     double strength;
     int filter_option;
@@ -19,6 +23,8 @@ typedef struct {
     /* Strength lut */
     int32_t processed[65536];
     int32_t original[65536];
+    /* Network output for each filter as 3D LUT, made when the filter gets selected first */
+    uint16_t * lut[FILTER_COUNT];
 } filterObject_t;
 
 filterObject_t * initFilterObject();
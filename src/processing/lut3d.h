@@ -0,0 +1,118 @@
+/*!
+ * \file lut3d.h
+ * \author masc4ii
+ * \copyright 2026
+ * \brief 16 bit 3D LUTs with tetrahedral interpolation
+ */
+
+#ifndef LUT3D_H
+#define LUT3D_H
+
+#include <stdint.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+/* Finds the tetrahedron around a point, in a cube of size^3 nodes with
+ * the given count of channels per node, red changes slowest.
+ * Returns offsets of its 4 corners and their weights, which sum up to 65536. */
+static inline void lut3d_tetrahedron( int size, int channels,
+                                      uint32_t r, uint32_t g, uint32_t b,
+                                      uint32_t * offset, uint32_t * weight )
+{
+    /* Strides in the LUT */
+    const uint32_t sr = size * size * channels, sg = size * channels, sb = channels;
+
+    uint32_t c[3] = { r >> 16, g >> 16, b >> 16 };
+    uint32_t f[3] = { r & 0xFFFF, g & 0xFFFF, b & 0xFFFF };
+    for( int j = 0; j < 3; j++ )
+    {
+        if( c[j] >= (uint32_t)( size - 1 ) )
+        {
+            c[j] = size - 2;
+            f[j] = 65536;
+        }
+    }
+    offset[0] = c[0] * sr + c[1] * sg + c[2] * sb;
+    offset[3] = offset[0] + sr + sg + sb;
+
+    /* Walk along the axes from the largest to the smallest fraction */
+    uint32_t w1, w2, w3;
+    if( f[0] >= f[1] )
+    {
+        if( f[1] >= f[2] )      { offset[1] = sr; offset[2] = sr + sg; w1 = f[0]; w2 = f[1]; w3 = f[2]; }
+        else if( f[0] >= f[2] ) { offset[1] = sr; offset[2] = sr + sb; w1 = f[0]; w2 = f[2]; w3 = f[1]; }
+        else                    { offset[1] = sb; offset[2] = sr + sb; w1 = f[2]; w2 = f[0]; w3 = f[1]; }
+    }
+    else
+    {
+        if( f[2] >= f[1] )      { offset[1] = sb; offset[2] = sg + sb; w1 = f[2]; w2 = f[1]; w3 = f[0]; }
+        else if( f[2] >= f[0] ) { offset[1] = sg; offset[2] = sg + sb; w1 = f[1]; w2 = f[2]; w3 = f[0]; }
+        else                    { offset[1] = sg; offset[2] = sr + sg; w1 = f[1]; w2 = f[0]; w3 = f[2]; }
+    }
+    offset[1] += offset[0];
+    offset[2] += offset[0];
+
+    weight[0] = 65536 - w1;
+    weight[1] = w1 - w2;
+    weight[2] = w2 - w3;
+    weight[3] = w3;
+}
+
+/* Tetrahedral interpolation in a LUT of RGB nodes.
+ * Coordinates are in nodes, with 16 bit fraction. */
+static inline void lut3d_interpolate( const uint16_t * lut, int size,
+                                      uint32_t r, uint32_t g, uint32_t b,
+                                      uint16_t * out )
+{
+    uint32_t o[4], w[4];
+    lut3d_tetrahedron( size, 3, r, g, b, o, w );
+
+    /* Weights sum up to 65536, so this fits 32 bit */
+    for( int j = 0; j < 3; j++ )
+    {
+        out[j] = ( w[0] * lut[o[0]+j] + w[1] * lut[o[1]+j] + w[2] * lut[o[2]+j] + w[3] * lut[o[3]+j] + 32768 ) >> 16;
+    }
+}
+
+/* Same for a LUT of RGBX nodes (8 bytes each), all channels of a node are loaded at once */
+static inline void lut3d_interpolate_rgbx( const uint16_t * lut, int size,
+                                           uint32_t r, uint32_t g, uint32_t b,
+                                           uint16_t * out )
+{
+    uint32_t o[4], w[4];
+    lut3d_tetrahedron( size, 4, r, g, b, o, w );
+
+#ifdef __SSE4_1__
+    __m128i sum = _mm_set1_epi32( 32768 );
+    for( int k = 0; k < 4; k++ )
+    {
+        __m128i node = _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i *)( lut + o[k] ) ) );
+        sum = _mm_add_epi32( sum, _mm_mullo_epi32( node, _mm_set1_epi32( w[k] ) ) );
+    }
+    uint16_t result[8];
+    _mm_storeu_si128( (__m128i *)result, _mm_packus_epi32( _mm_srli_epi32( sum, 16 ), _mm_setzero_si128() ) );
+    out[0] = result[0];
+    out[1] = result[1];
+    out[2] = result[2];
+#else
+    for( int j = 0; j < 3; j++ )
+    {
+        out[j] = ( w[0] * lut[o[0]+j] + w[1] * lut[o[1]+j] + w[2] * lut[o[2]+j] + w[3] * lut[o[3]+j] + 32768 ) >> 16;
+    }
+#endif
+}
+
+/* Factor for lut3d_coordinate, for evenly spaced nodes over 0..65535 */
+static inline uint64_t lut3d_scale( int size )
+{
+    return ( (uint64_t)( size - 1 ) << 32 ) / 65535;
+}
+
+/* Coordinate of a 16 bit value for lut3d_interpolate */
+static inline uint32_t lut3d_coordinate( uint16_t value, uint64_t scale )
+{
+    return ( value * scale ) >> 16;
+}
+
+#endif // LUT3D_H
@@ -4,11 +4,50 @@
 #include "image_profile.h"
 #include "filter/filter.h"
 #include "cube_lut.h"
+#include "rbfilter/rbf_wrapper.h"
 
 #include "tinyexpr/tinyexpr.h"
 
 enum transform { TR_NONE, TR_ROT180 };
 
+/* Lookup tables, setters only mark them dirty, they are rebuilt before the next frame */
+enum processing_tables {
+    TABLE_MATRICES                = 1 << 0,
+    TABLE_MATRICES_GRADIENT       = 1 << 1,
+    TABLE_GAMMA                   = 1 << 2,
+    TABLE_GAMMA_GRADIENT          = 1 << 3,
+    TABLE_CURVES                  = 1 << 4,
+    TABLE_SHADOW_HIGHLIGHT_CURVE  = 1 << 5,
+    TABLE_CONTRAST_CURVE          = 1 << 6,
+    TABLE_CONTRAST_CURVE_GRADIENT = 1 << 7,
+    TABLE_CLARITY_CURVE           = 1 << 8,
+    TABLE_SATURATION              = 1 << 9,  /* Calculated per pixel, only counts as change */
+    TABLE_VIBRANCE                = 1 << 10, /* Calculated per pixel, only counts as change */
+    TABLE_SHARPENING              = 1 << 11,
+    TABLE_LEVELS                  = 1 << 12,
+    TABLE_POST_GAMMA_CURVES       = 1 << 13,
+    TABLE_HUE_VS_CURVES           = 1 << 14  /* Built by the setter, only counts as change */
+};
+
+/* Nodes per axis of the baked 3D LUT */
+#define BAKED_LUT_SIZE 65
+
+/* Settings the baked 3D LUT depends on, which can change without a setter function */
+typedef struct {
+    uint32_t tables_version;
+    uint8_t  use_cam_matrix;
+    uint8_t  colour_gamut;
+    uint8_t  allow_creative_adjustments;
+    int      exr_mode;
+    int      AgX;
+    int      lut_on;
+    uint32_t lut_version;
+    uint8_t  lut_intensity;
+    int      filter_on;
+    int      filter_option;
+    double   filter_strength;
+} processing_baked_key_t;
+
 typedef struct {
     uint16_t width, height;
     uint16_t * image;
@@ -26,6 +65,16 @@ typedef struct {
     lut_t * lut;
     int lut_on;
 
+    /* Dirty lookup tables (enum processing_tables) */
+    volatile uint32_t dirty_tables;
+    uint32_t tables_version; /* Counts table rebuilds */
+
+    /* Whole colour pipeline in one 3D LUT, used if no module needs neighbour pixels */
+    uint16_t * baked_lut;
+    int baked_lut_valid;
+    processing_baked_key_t baked_key;
+    uint32_t baked_shaper[65536]; /* White balanced value to LUT coordinate, 16 bit fraction */
+
     /* If whitebalance find algorithm is on the run, we need it only for one single RGB -> faster */
     int wbFindActive;
     uint16_t wbR, wbG, wbB;
@@ -162,16 +211,13 @@ typedef struct {
     uint16_t   pre_calc_curve_r[65536];
     uint16_t   pre_calc_curve_g[65536];
     uint16_t   pre_calc_curve_b[65536];
+    uint16_t   post_gamma_curve[3][65536]; /* Toning, contrast curve and gradation curves in one (per channel) */
     uint16_t   pre_calc_levels[65536]; /* For black level and white level */
     uint16_t   pre_calc_gamma[65536];
     uint16_t   pre_calc_gamma_gradient[65536];
     uint32_t   pre_calc_sharp_a[65536];
     uint16_t   pre_calc_sharp_x[65536]; /* In horizontal dimension */
     uint16_t   pre_calc_sharp_y[65536]; /* In vertical dimension */
-    /* Precalculated values for saturation */
-    int32_t    pre_calc_sat[131072];
-    /* Precalculated values for vibrance */
-    int32_t    pre_calc_vibrance[131072];
 
     /* Transformation */
     uint8_t    transformation;
@@ -187,6 +233,8 @@ typedef struct {
     uint8_t    rbfDenoiserLuma;
     uint8_t    rbfDenoiserChroma;
     uint8_t    rbfDenoiserRange;
+    /* Filter memory, shared with shadows/highlights blur */
+    rbf_context_t * rbf;
 
     /* Grain Generator */
     uint8_t    grainStrength;
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 #include <pthread.h>
 #include <ctype.h>
 #include "blur_threaded.h"
@@ -25,6 +26,7 @@
 #include "rbfilter/rbf_wrapper.h"
 #include "sobel/sobel.h"
 #include "cafilter/ColorAberrationCorrection.h"
+#include "lut3d.h"
 
 /* Matrix functions which are useful */
 #include "../matrix/matrix.h"
@@ -35,6 +37,9 @@
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 #define LIMIT16(X) MAX(MIN(X, 65535), 0)
 
+/* Setters run on the GUI thread while processingUpdateTables clears the bits on the render thread */
+#define processing_mark_dirty(processing, tables) __atomic_fetch_or(&(processing)->dirty_tables, (tables), __ATOMIC_RELEASE)
+
 /* Thank you to https://gist.github.com/MrLixm/946c1b59cce8b74e948e75618583ce8d */
 double agx_compressed_matrix[9] = {
     0.84247906, 0.0784336, 0.07922375,
@@ -98,6 +103,8 @@ processingObject_t * initProcessingObject()
     processing->lut = init_lut();
     processing->lut_on = 0;
 
+    processing->rbf = init_rbf_context();
+
     /* For precalculated matrix values */
     for (int i = 0; i < 9; ++i)
     {
@@ -201,10 +208,7 @@ processingObject_t * initProcessingObject()
     processingUseCamMatrix(processing);
     processingSetImageProfile(processing, PROFILE_TONEMAPPED);
 
-    /* Just in case (should be done tho already) */
-    processing_update_matrices(processing);
-    //processing_update_matrices_gradient(processing);
-    processing_update_shadow_highlight_curve(processing);
+    /* Lookup tables get built with the first frame */
 
     processingSetToning(processing, 255, 192, 0, 0);
     processingSetCaDesaturate(processing, 0);
@@ -220,9 +224,6 @@ void processingSetGamut(processingObject_t * processing, int gamut)
     /* This will update everything necessary to enable tonemapping */
     processingSetWhiteBalance(processing, processingGetWhiteBalanceKelvin(processing), processingGetWhiteBalanceTint(processing));
     processingSetGamma(processing, processing->gamma_power);
-    processingSetGammaGradient(processing, processing->gamma_power);
-    processing_update_matrices(processing);
-    processing_update_matrices_gradient(processing);
 }
 
 int processingGetGamut(processingObject_t * processing)
@@ -235,9 +236,7 @@ void processingSetTonemappingFunction(processingObject_t * processing, int funct
     processing->tonemap_function = function;
     /* This will update everything necessary to enable tonemapping */
     processingSetGamma(processing, processing->gamma_power);
-    processingSetGammaGradient(processing, processing->gamma_power);
-    processing_update_matrices(processing);
-    processing_update_matrices_gradient(processing);
+    processing_mark_dirty(processing, TABLE_MATRICES | TABLE_MATRICES_GRADIENT);
 }
 
 int processingGetTonemappingFunction(processingObject_t * processing)
@@ -254,9 +253,6 @@ void processingSetImageProfile(processingObject_t * processing, int imageProfile
 
     /* This updates matrices, so new gamut will be put to use */
     processingSetWhiteBalance(processing, processingGetWhiteBalanceKelvin(processing), processingGetWhiteBalanceTint(processing));
-
-    processing_update_matrices(processing);
-    processing_update_matrices_gradient(processing);
 }
 
 /* Takes those matrices I learned about on the forum */
@@ -266,20 +262,17 @@ void processingSetCamMatrix(processingObject_t * processing, double * camMatrix,
     memcpy(processing->cam_matrix_A, camMatrixA, sizeof(double) * 9);
     /* TO update matrices really argh so much confusion :( */
     processingSetWhiteBalance(processing, processingGetWhiteBalanceKelvin(processing), processingGetWhiteBalanceTint(processing));
-    /* Calculates final main matrix */
-    processing_update_matrices(processing);
-    if( processing->gradient_enable != 0 ) processing_update_matrices_gradient(processing);
 }
 
 void processingSetHighlights(processingObject_t * processing, double value)
 {
     processing->shadows_highlights.highlights = value;
-    processing_update_shadow_highlight_curve(processing);
+    processing_mark_dirty(processing, TABLE_SHADOW_HIGHLIGHT_CURVE);
 }
 void processingSetShadows(processingObject_t * processing, double value)
 {
     processing->shadows_highlights.shadows = value;
-    processing_update_shadow_highlight_curve(processing);
+    processing_mark_dirty(processing, TABLE_SHADOW_HIGHLIGHT_CURVE);
 }
 
 void processing_update_shadow_highlight_curve(processingObject_t * processing)
@@ -309,13 +302,13 @@ void processing_update_shadow_highlight_curve(processingObject_t * processing)
 void processingSetSimpleContrast(processingObject_t * processing, double value)
 {
     processing->contrast = value * 0.65;
-    processing_update_contrast_curve(processing);
+    processing_mark_dirty(processing, TABLE_CONTRAST_CURVE);
 }
 
 void processingSetPivot(processingObject_t * processing, double value)
 {
     processing->pivot = value;
-    processing_update_contrast_curve(processing);
+    processing_mark_dirty(processing, TABLE_CONTRAST_CURVE);
 }
 
 void processing_update_contrast_curve(processingObject_t * processing)
@@ -345,7 +338,7 @@ void processing_update_contrast_curve(processingObject_t * processing)
 void processingSetSimpleContrastGradient(processingObject_t * processing, double value)
 {
     processing->gradient_contrast = value * 0.65;
-    processing_update_contrast_curve_gradient(processing);
+    processing_mark_dirty(processing, TABLE_CONTRAST_CURVE_GRADIENT);
 }
 
 void processing_update_contrast_curve_gradient(processingObject_t * processing)
@@ -376,7 +369,7 @@ void processingSetClarity(processingObject_t * processing, double value)
 {
     if( value < 0 ) value /= 2.0;
     processing->clarity = value;
-    processing_update_clarity_curve(processing);
+    processing_mark_dirty(processing, TABLE_CLARITY_CURVE);
 }
 
 void processing_update_clarity_curve(processingObject_t * processing)
@@ -412,16 +405,175 @@ void processing_object_thread(apply_processing_parameters_t * p)
                              p->outputImage,
                              p->blurImage,
                              p->gradientMask,
-                             p->vignetteMask );
+                             p->vignetteMask,
+                             0 );
 }
 
-/* Apply it with multiple threads */
-void applyProcessingObject( processingObject_t * processing, 
-                            int imageX, int imageY, 
-                            uint16_t * __restrict inputImage, 
-                            uint16_t * __restrict outputImage,
-                            int threads, int imageChanged, uint64_t frameIndex )
+/* True if every module works on the single pixel only, so the whole colour
+ * pipeline can be baked into a 3D LUT */
+static int processing_is_pointwise(processingObject_t * processing, int masks)
+{
+    /* Vignette and gradient depend on the pixel position, the bake has no masks */
+    if( masks && processing->vignette_strength != 0 ) return 0;
+    if( masks && processing->gradient_enable ) return 0;
+
+    /* Shadows/highlights and clarity need the blurred image, contrast is applied before
+     * white balanced values are clipped */
+    if( processing->allow_creative_adjustments
+     && ( ( processing->shadows_highlights.shadows    <= -0.01 || processing->shadows_highlights.shadows    >= 0.01 )
+       || ( processing->shadows_highlights.highlights <= -0.01 || processing->shadows_highlights.highlights >= 0.01 )
+       || ( processing->clarity                       <= -0.01 || processing->clarity                       >= 0.01 )
+       || ( processing->contrast                      <= -0.01 || processing->contrast                      >= 0.01 ) ) ) return 0;
+
+    return 1;
+}
+
+/* Makes sure the baked 3D LUT fits the actual settings, returns 0 if it is not worth it for this image */
+static int processing_bake_lut(processingObject_t * processing, int pixels)
+{
+    const int n = BAKED_LUT_SIZE;
+
+    processing_baked_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.tables_version = processing->tables_version;
+    key.use_cam_matrix = processing->use_cam_matrix;
+    key.colour_gamut = processing->colour_gamut;
+    key.allow_creative_adjustments = processing->allow_creative_adjustments;
+    key.exr_mode = processing->exr_mode;
+    key.AgX = processing->AgX;
+    key.lut_on = processing->lut_on;
+    key.lut_version = processing->lut->version;
+    key.lut_intensity = processing->lut->intensity;
+    key.filter_on = processing->filter_on;
+    key.filter_option = processing->filter->filter_option;
+    key.filter_strength = processing->filter->strength;
+
+    if (processing->baked_lut_valid && !memcmp(&key, &processing->baked_key, sizeof(key))) return 1;
+
+    /* Baking costs about the same as processing two LUT sized images */
+    if (pixels < 2 * n * n * n) return 0;
+
+    if (!processing->baked_lut)
+    {
+        processing->baked_lut = malloc(n * n * n * 3 * sizeof(uint16_t));
+        if (!processing->baked_lut) return 0;
+
+        /* Cube root spacing, so shadows get enough nodes before gamma */
+        for (int i = 0; i < 65536; ++i)
+        {
+            processing->baked_shaper[i] = (uint32_t)(cbrt(i / 65535.0) * (n - 1) * 65536.0 + 0.5);
+        }
+    }
+
+    uint16_t node_value[BAKED_LUT_SIZE];
+    for (int i = 0; i < n; ++i) node_value[i] = LIMIT16(pow(i / (double)(n - 1), 3.0) * 65535.0 + 0.5);
+
+    /* Run the white balanced node colours through the pipeline, one red slice per thread */
+    int failed = 0;
+    #pragma omp parallel for reduction(|:failed)
+    for (int r = 0; r < n; ++r)
+    {
+        uint16_t * nodes = malloc(n * n * 3 * sizeof(uint16_t));
+        if (!nodes)
+        {
+            failed = 1;
+            continue;
+        }
+        uint16_t * pix = nodes;
+        for (int g = 0; g < n; ++g)
+        {
+            for (int b = 0; b < n; ++b)
+            {
+                pix[0] = node_value[r];
+                pix[1] = node_value[g];
+                pix[2] = node_value[b];
+                pix += 3;
+            }
+        }
+        apply_processing_object(processing, n, n, nodes, processing->baked_lut + r * n * n * 3, NULL, NULL, NULL, 1);
+        free(nodes);
+    }
+
+    /* Incomplete LUT, process this frame the normal way */
+    if (failed)
+    {
+        processing->baked_lut_valid = 0;
+        return 0;
+    }
+
+    processing->baked_key = key;
+    processing->baked_lut_valid = 1;
+
+    return 1;
+}
+
+/* Levels, white balance and highlight reconstruction as in apply_processing_object,
+ * then the rest of the colour pipeline by tetrahedral interpolation of the baked LUT */
+static void apply_baked_lut(processingObject_t * processing,
+                            int imageX, int imageY,
+                            uint16_t * __restrict inputImage,
+                            uint16_t * __restrict outputImage)
+{
+    const int n = BAKED_LUT_SIZE;
+    int img_s = imageX * imageY * 3;
+
+    /* (for shorter code) */
+    int32_t ** pm = processing->pre_calc_matrix;
+    uint16_t * levels = processing->pre_calc_levels;
+    uint32_t * shaper = processing->baked_shaper;
+    uint16_t * lut = processing->baked_lut;
+
+    #pragma omp parallel for
+    for (int i = 0; i < img_s; i += 3)
+    {
+        uint16_t * in = inputImage + i;
+        uint16_t * out = outputImage + i;
+
+        /* white balance & exposure */
+        uint16_t pix[3];
+        pix[0] = LIMIT16(pm[0][levels[in[0]]]);
+        pix[1] = LIMIT16(pm[4][levels[in[1]]]);
+        pix[2] = LIMIT16(pm[8][levels[in[2]]]);
+        uint16_t tmp1 = pix[1];
+
+        /* Now highlight reconstruction */
+        if (processing->highlight_reconstruction)
+        {
+            if (*processing->dual_iso != 0)
+            {
+                if (tmp1 >= LIMIT16( processing->highest_green_diso - 5000 ) && tmp1 <= LIMIT16( processing->highest_green_diso + 5000 ))
+                {
+                    if( pix[1] < 1.1*pix[0] && pix[1] < pix[2] )
+                    {
+                        pix[1] = (pix[0] + pix[2]) / 2;
+                    }
+                }
+            }
+            else if (tmp1 == processing->highest_green)
+            {
+                pix[1] = (pix[0] + pix[2]) / 2;
+            }
+        }
+
+        /* Everything else */
+        lut3d_interpolate(lut, n, shaper[pix[0]], shaper[pix[1]], shaper[pix[2]], out);
+    }
+}
+
+/* Apply it with multiple threads, masks = 0 leaves out vignette and gradient */
+static void apply_processing( processingObject_t * processing,
+                              int imageX, int imageY,
+                              uint16_t * __restrict inputImage,
+                              uint16_t * __restrict outputImage,
+                              int threads, int imageChanged, uint64_t frameIndex,
+                              int masks )
 {
+    uint16_t * gradient_mask = masks ? processing->gradient_mask : NULL;
+    float * vignette_mask = masks ? processing->vignette_mask : NULL;
+
+    /* Settings changed since last frame */
+    processingUpdateTables(processing);
+
     /* Do transformation */
     get_frame_transformed(processing, inputImage, imageX, imageY);
 
@@ -454,10 +606,11 @@ void applyProcessingObject( processingObject_t * processing,
             if(0) blur_image_threaded( get_buffer(processing->shadows_highlights.blur_image), outputImage, imageX, imageY, blur_radius, threads );
             else
                 recursive_bf_wrap(
+                        processing->rbf,
                         inputImage,
                         get_buffer(processing->shadows_highlights.blur_image),
                         0.0005f, 0.075f+(((float)100.0-40.0f)/666.6f),
-                        imageX, imageY, 3);
+                        imageX, imageY, 3, NULL);
 
             /* Apply basic levels */
             int img_s = imageX * imageY * 3;
@@ -470,10 +623,15 @@ void applyProcessingObject( processingObject_t * processing,
     /* Analyse dual iso frame to find highest green for highlight reconstruction */
     analyse_frame_highest_green( processing, imageX, imageY, inputImage );
 
+    /* Colour adjustments only: one 3D LUT lookup per pixel */
+    if (processing_is_pointwise(processing, masks) && processing_bake_lut(processing, imageX * imageY))
+    {
+        apply_baked_lut(processing, imageX, imageY, inputImage, outputImage);
+    }
     /* If threads is 1, no threads are needed */
-    if (threads == 1)
+    else if (threads == 1)
     {
-        apply_processing_object(processing, imageX, imageY, inputImage, outputImage, get_buffer(processing->shadows_highlights.blur_image), processing->gradient_mask, processing->vignette_mask);
+        apply_processing_object(processing, imageX, imageY, inputImage, outputImage, get_buffer(processing->shadows_highlights.blur_image), gradient_mask, vignette_mask, 0);
     }
     else
     {
@@ -493,8 +651,8 @@ void applyProcessingObject( processingObject_t * processing,
             params[t].inputImage = inputImage + offset_chunk*t;
             params[t].outputImage = outputImage + offset_chunk*t;
             params[t].blurImage = get_buffer(processing->shadows_highlights.blur_image) + offset_chunk*t;
-            params[t].gradientMask = processing->gradient_mask + (imageX * chunk_size * t);
-            params[t].vignetteMask = processing->vignette_mask + (imageX * chunk_size * t);
+            params[t].gradientMask = gradient_mask ? gradient_mask + (imageX * chunk_size * t) : NULL;
+            params[t].vignetteMask = vignette_mask ? vignette_mask + (imageX * chunk_size * t) : NULL;
         }
 
         /* To make sure bottom is processed */
@@ -523,30 +681,31 @@ void applyProcessingObject( processingObject_t * processing,
     /* Recursive bilateral filtering (developed by Qingxiong Yang) must render on complete image, because of border problems */
     if( processing->rbfDenoiserLuma > 0 || processing->rbfDenoiserChroma > 0 )
     {
-        int img_s = imageX * imageY * 3;
-        memcpy( inputImage, outputImage, img_s * sizeof(uint16_t) );
+        /* Luma and chroma strengths are blended inside the filter: rgb + rgb_from_YCbCr * strengths * YCbCr_from_rgb * (filtered - rgb) */
+        static const double rgb_to_YCbCr[9] = {  0.299000,  0.587000,  0.114000,
+                                                -0.168736, -0.331264,  0.500000,
+                                                 0.500000, -0.418688, -0.081312 };
+        static const double YCbCr_to_rgb[9] = {  1.0,  0.000000,  1.402000,
+                                                 1.0, -0.344136, -0.714136,
+                                                 1.0,  1.772000,  0.000000 };
+        double strength[3] = { processing->rbfDenoiserLuma/100.0, processing->rbfDenoiserChroma/100.0, processing->rbfDenoiserChroma/100.0 };
+        float blend[9];
+        for( int i = 0; i < 3; i++ )
+        {
+            for( int j = 0; j < 3; j++ )
+            {
+                double sum = 0.0;
+                for( int k = 0; k < 3; k++ ) sum += YCbCr_to_rgb[i*3+k] * strength[k] * rgb_to_YCbCr[k*3+j];
+                blend[i*3+j] = sum;
+            }
+        }
+
         recursive_bf_wrap(
-                inputImage,
+                processing->rbf,
+                outputImage,
                 outputImage,
                 0.0025f, 0.075f+(((float)processing->rbfDenoiserRange-40.0f)/666.6f),
-                imageX, imageY, 3);
-
-        float outL = processing->rbfDenoiserLuma/100.0;
-        float inL = 1.0 - outL;
-        float outC = processing->rbfDenoiserChroma/100.0;
-        float inC = 1.0 - outC;
-
-        convert_rgb_to_YCbCr_omp(inputImage, img_s, processing->cs_zone.pre_calc_rgb_to_YCbCr);
-        convert_rgb_to_YCbCr_omp(outputImage, img_s, processing->cs_zone.pre_calc_rgb_to_YCbCr);
-        /* Linear blend strengths */
-#pragma omp parallel for
-        for( int i = 0; i < img_s; i+=3 )
-        {
-            outputImage[i+0] = outputImage[i+0]*outL + inputImage[i+0]*inL;
-            outputImage[i+1] = outputImage[i+1]*outC + inputImage[i+1]*inC;
-            outputImage[i+2] = outputImage[i+2]*outC + inputImage[i+2]*inC;
-        }
-        convert_YCbCr_to_rgb_omp(outputImage, img_s, processing->cs_zone.pre_calc_YCbCr_to_rgb);
+                imageX, imageY, 3, blend);
     }
     /* RGB CA&ColorMoiree Removal */
     if( processing->ca_desaturate > 0 )
@@ -585,13 +744,6 @@ void applyProcessingObject( processingObject_t * processing,
 
     if (processingGetSharpening(processing) > 0.005)
     {
-        /* Use sobel filter to create a edge mask */
-        uint16_t *gray,
-             *sobel_h_res,
-             *sobel_v_res,
-             *contour_img;
-        if( processing->sh_masking > 0 ) sobelFilter( inputImage, &gray, &sobel_h_res, &sobel_v_res, &contour_img, imageX, imageY );
-
         /* Avoid gaps in pixels if skipping pixels during sharpen */
         if (sharp_skip != 1) memcpy(outputImage, inputImage, img_s * sizeof(uint16_t));
 
@@ -606,76 +758,98 @@ void applyProcessingObject( processingObject_t * processing,
         /* Row length elements */
         uint32_t rl = imageX * 3;
 
-#pragma omp parallel for
-        for (uint32_t y = 0; y < y_max+1; ++y)
+        /* Edge mask by sobel filter, made row by row together with sharpening */
+        int masking = processing->sh_masking > 0;
+        /* more contrast & brightness for mask */
+        uint32_t maskIntensity = 15000;
+        uint32_t maskOffset = (100-(uint32_t)processing->sh_masking) * 150;
+
+#pragma omp parallel
         {
-            uint16_t * out_row = outputImage + (y * rl); /* current row ouptut */
-            uint16_t * row = inputImage + (y * rl); /* current row */
-            uint16_t * p_row;
-            if( y == 0 ) p_row = row;        /* minimize border artifact */
-            else p_row = inputImage + ((y-1) * rl); /* previous */
-
-            uint16_t * n_row;
-            if( y == y_max ) p_row = row;    /* minimize border artifact */
-            else n_row = inputImage + ((y+1) * rl); /* next */
-
-            uint16_t * cont_row;
-            if( processing->sh_masking > 0 )
+            /* Gray of previous, current and next row, and the mask of the current row */
+            uint16_t * gray_rows = masking ? malloc(imageX * 3 * sizeof(uint16_t)) : NULL;
+            uint16_t * gray[3] = { gray_rows, gray_rows + imageX, gray_rows + imageX * 2 };
+            uint16_t * cont_row = masking ? malloc(imageX * sizeof(uint16_t)) : NULL;
+            int64_t gray_y = -2; /* Row in gray[1] */
+
+#pragma omp for schedule(static)
+            for (uint32_t y = 0; y < y_max+1; ++y)
             {
-                cont_row = contour_img + (y * imageX);
-            }
+                uint16_t * out_row = outputImage + (y * rl); /* current row ouptut */
+                uint16_t * row = inputImage + (y * rl); /* current row */
+                uint16_t * p_row;
+                if( y == 0 ) p_row = row;        /* minimize border artifact */
+                else p_row = inputImage + ((y-1) * rl); /* previous */
 
-            for (uint32_t x = 3+sharp_start; x < x_max; x+=sharp_skip)
-            {
-                int32_t sharp = ka[row[x]]
-                              - ky[p_row[x]]
-                              - ky[n_row[x]]
-                              - kx[row[x-3]]
-                              - kx[row[x+3]];
-
-                /* use the edge mask for sharpening only edges */
-                if( processing->sh_masking > 0 )
+                uint16_t * n_row;
+                if( y == y_max ) n_row = row;    /* minimize border artifact */
+                else n_row = inputImage + ((y+1) * rl); /* next */
+
+                if( masking )
                 {
-                    uint32_t x1 = x / 3;
-                    /* more contrast & brightness for mask */
-                    uint32_t maskIntensity = 15000;
-                    uint32_t cont = cont_row[x1] + (100-(uint32_t)processing->sh_masking) * 150;
-                    if( cont > maskIntensity ) cont = maskIntensity;
-                    /* calc output in dependency to mask slider */
-                    out_row[x] = LIMIT16( ( cont / (float)maskIntensity) * LIMIT16(sharp)
-                                      + ( ( maskIntensity - cont ) / (float)maskIntensity ) * row[x] );
-                    /* Show mask */
-                    //out_row[x] = LIMIT16(cont/(float)maskIntensity*65535.0);
+                    /* Rolling gray rows, each thread gets a block of rows */
+                    if( gray_y == (int64_t)y - 1 )
+                    {
+                        uint16_t * oldest = gray[0];
+                        gray[0] = gray[1];
+                        gray[1] = gray[2];
+                        gray[2] = oldest;
+                        if( y < y_max ) rgbToGrayRow(n_row, gray[2], imageX);
+                    }
+                    else
+                    {
+                        if( y > 0 ) rgbToGrayRow(p_row, gray[0], imageX);
+                        rgbToGrayRow(row, gray[1], imageX);
+                        if( y < y_max ) rgbToGrayRow(n_row, gray[2], imageX);
+                    }
+                    gray_y = y;
+                    contourRow(y > 0 ? gray[0] : NULL, gray[1], y < y_max ? gray[2] : NULL, imageX, cont_row);
                 }
-                /* sharpen all */
-                else
+
+                for (uint32_t x = 3+sharp_start; x < x_max; x+=sharp_skip)
                 {
-                    out_row[x] = LIMIT16(sharp);
+                    int32_t sharp = ka[row[x]]
+                                  - ky[p_row[x]]
+                                  - ky[n_row[x]]
+                                  - kx[row[x-3]]
+                                  - kx[row[x+3]];
+
+                    /* use the edge mask for sharpening only edges */
+                    if( masking )
+                    {
+                        uint32_t cont = cont_row[x / 3] + maskOffset;
+                        if( cont > maskIntensity ) cont = maskIntensity;
+                        /* calc output in dependency to mask slider */
+                        out_row[x] = LIMIT16( ( cont / (float)maskIntensity) * LIMIT16(sharp)
+                                          + ( ( maskIntensity - cont ) / (float)maskIntensity ) * row[x] );
+                        /* Show mask */
+                        //out_row[x] = LIMIT16(cont/(float)maskIntensity*65535.0);
+                    }
+                    /* sharpen all */
+                    else
+                    {
+                        out_row[x] = LIMIT16(sharp);
+                    }
                 }
+
+                /* Edge pixels (basically don't do any changes to them) */
+                out_row[0] = row[0];
+                out_row[1] = row[1];
+                out_row[2] = row[2];
+                out_row += rl;
+                row += rl;
+                out_row[-3] = row[-3];
+                out_row[-2] = row[-2];
+                out_row[-1] = row[-1];
             }
 
-            /* Edge pixels (basically don't do any changes to them) */
-            out_row[0] = row[0];
-            out_row[1] = row[1];
-            out_row[2] = row[2];
-            out_row += rl;
-            row += rl;
-            out_row[-3] = row[-3];
-            out_row[-2] = row[-2];
-            out_row[-1] = row[-1];
+            free(gray_rows);
+            free(cont_row);
         }
 
         /* Copy top and bottom row */
         //memcpy(outputImage, inputImage, rl * sizeof(uint16_t));
         //memcpy(outputImage + (rl*(imageY-1)), inputImage + (rl*(imageY-1)), rl * sizeof(uint16_t));
-
-        if( processing->sh_masking > 0 )
-        {
-            if( gray ) free( gray );
-            if( sobel_h_res ) free( sobel_h_res );
-            if( sobel_v_res ) free( sobel_v_res );
-            if( contour_img ) free( contour_img );
-        }
     }
     else
     {
@@ -713,10 +887,195 @@ void applyProcessingObject( processingObject_t * processing,
     }
 }
 
+void applyProcessingObject( processingObject_t * processing, 
+                            int imageX, int imageY, 
+                            uint16_t * __restrict inputImage, 
+                            uint16_t * __restrict outputImage,
+                            int threads, int imageChanged, uint64_t frameIndex )
+{
+    apply_processing(processing, imageX, imageY, inputImage, outputImage, threads, imageChanged, frameIndex, 1);
+}
+
+void applyProcessingObjectWithoutMasks( processingObject_t * processing,
+                                        int imageX, int imageY,
+                                        uint16_t * __restrict inputImage,
+                                        uint16_t * __restrict outputImage,
+                                        int threads, int imageChanged, uint64_t frameIndex )
+{
+    apply_processing(processing, imageX, imageY, inputImage, outputImage, threads, imageChanged, frameIndex, 0);
+}
+
 /* Colour tonemap function for smooth gamut mapping */
 static float Reinhard_for_colour(float x) { return (x < 0.5f) ? x : (ReinhardTonemap_f((x-0.5f)/0.5f)*0.5f+0.5f); }
 static float Reinhard_for_blue(float x) { return (x < 0.7f) ? x : (ReinhardTonemap_f((x-0.7f)/0.3f)*0.3f+0.7f); }
 
+/* Pixels per tile of the colour stages, each channel in its own float row so the loops vectorize */
+#define COLOUR_TILE 64
+
+/* HueVs curves on a tile: RGB to HSV, curve lookups by hue and luma, back to RGB */
+static void apply_hue_vs_curves(processingObject_t * processing, uint16_t * img, int pixels)
+{
+    float r[COLOUR_TILE], g[COLOUR_TILE], b[COLOUR_TILE];
+    float h[COLOUR_TILE], s[COLOUR_TILE], v[COLOUR_TILE], sat[COLOUR_TILE];
+    float luma_factor[COLOUR_TILE], sat_factor[COLOUR_TILE], hue_shift[COLOUR_TILE];
+
+    for (int p0 = 0; p0 < pixels; p0 += COLOUR_TILE)
+    {
+        int n = MIN(COLOUR_TILE, pixels - p0);
+        uint16_t * pix = img + p0 * 3;
+
+        for (int i = 0; i < n; i++)
+        {
+            r[i] = pix[i*3+0] / 65535.0f;
+            g[i] = pix[i*3+1] / 65535.0f;
+            b[i] = pix[i*3+2] / 65535.0f;
+        }
+
+        /* RGB to HSV (hue in degrees) like fromRGBtoHSV, but without branches: gray gives hue 0
+         * anyway, because red is the max then. Only values are selected, so it vectorizes. */
+        for (int i = 0; i < n; i++)
+        {
+            float red = r[i], green = g[i], blue = b[i];
+            float max = MAX(red, MAX(green, blue));
+            float delta = max - MIN(red, MIN(green, blue));
+            int is_red = red >= max, is_green = green >= max;
+            float minuend = is_red ? green : (is_green ? blue : red);
+            float subtrahend = is_red ? blue : (is_green ? red : green);
+            float offset = is_red ? 0.0f : (is_green ? 2.0f : 4.0f);
+            float hue = offset + (minuend - subtrahend) / (delta + FLT_MIN);
+            hue += (hue < 0.0f) ? 6.0f : 0.0f;
+            float saturation = delta / (max + FLT_MIN);
+            h[i] = hue * 60.0f;
+            s[i] = saturation;
+            v[i] = max;
+            /* Some cheat factor to make the effect more visible */
+            sat[i] = 2.0f * saturation / ( saturation * saturation + 1.0f );
+        }
+
+        /* Curves by hue */
+        for (int i = 0; i < n; i++)
+        {
+            int hue = MIN((int)(h[i] * 100.0), 35999);
+            luma_factor[i] = processing->hue_vs_luma[hue];
+            sat_factor[i] = processing->hue_vs_saturation[hue];
+            hue_shift[i] = processing->hue_vs_hue[hue];
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            float value = v[i] * (1.0f + luma_factor[i] * sat[i] * 2.0f);
+            float saturation = s[i] * (1.0f + sat_factor[i] * 2.0f);
+            float hue = h[i] + 60.0f * hue_shift[i];
+            hue += (hue < 0.0f) ? 360.0f : 0.0f;
+            hue -= (hue >= 360.0f) ? 360.0f : 0.0f;
+            v[i] = MAX(value, 0.0f);
+            s[i] = MAX(saturation, 0.0f);
+            h[i] = hue;
+        }
+
+        /* Curve by luma */
+        for (int i = 0; i < n; i++)
+        {
+            int luma = MIN((int)(v[i] * 36000.0), 35999);
+            sat_factor[i] = processing->luma_vs_saturation[luma];
+        }
+
+        /* HSV to RGB: each channel is v - v*s*clamp(min(k, 4-k)) with k = (n + h/60) mod 6 */
+        for (int i = 0; i < n; i++)
+        {
+            float saturation = s[i] * (1.0f + sat_factor[i] * 2.0f);
+            float h6 = h[i] / 60.0f;
+            float vs = v[i] * MAX(saturation, 0.0f);
+            float kr = 5.0f + h6; kr -= (kr >= 6.0f) ? 6.0f : 0.0f;
+            float kg = 3.0f + h6; kg -= (kg >= 6.0f) ? 6.0f : 0.0f;
+            float kb = 1.0f + h6; kb -= (kb >= 6.0f) ? 6.0f : 0.0f;
+            r[i] = v[i] - vs * MAX(MIN(MIN(kr, 4.0f - kr), 1.0f), 0.0f);
+            g[i] = v[i] - vs * MAX(MIN(MIN(kg, 4.0f - kg), 1.0f), 0.0f);
+            b[i] = v[i] - vs * MAX(MIN(MIN(kb, 4.0f - kb), 1.0f), 0.0f);
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            pix[i*3+0] = LIMIT16(r[i] * 65535.0f + 0.5f);
+            pix[i*3+1] = LIMIT16(g[i] * 65535.0f + 0.5f);
+            pix[i*3+2] = LIMIT16(b[i] * 65535.0f + 0.5f);
+        }
+    }
+}
+
+/* Vibrance (before saturation, because it needs untouched colors) and saturation on a tile */
+static void apply_vibrance_saturation(processingObject_t * processing, uint16_t * img, int pixels)
+{
+    int32_t r[COLOUR_TILE], g[COLOUR_TILE], b[COLOUR_TILE];
+    int use_vibrance = processing->vibrance > 1.01 || processing->vibrance < 0.99;
+    int use_saturation = processing->saturation > 1.01 || processing->saturation < 0.99;
+    float vibrance = processing->vibrance;
+    /* Positive vibrance in dependency to raw saturation */
+    float positive = (vibrance > 1.0f) ? 1.0f : 0.0f;
+    float saturation = processing->saturation;
+
+    for (int p0 = 0; p0 < pixels; p0 += COLOUR_TILE)
+    {
+        int n = MIN(COLOUR_TILE, pixels - p0);
+        uint16_t * pix = img + p0 * 3;
+
+        for (int i = 0; i < n; i++)
+        {
+            r[i] = pix[i*3+0];
+            g[i] = pix[i*3+1];
+            b[i] = pix[i*3+2];
+        }
+
+        if (use_vibrance)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                /* Pixel brightness = 4/16 R, 11/16 G, 1/16 blue; Try swapping the channels, it will look worse */
+                int32_t Y = ((r[i] << 2) + (g[i] * 11) + b[i]) >> 4;
+
+                /* Increase difference between channels and the saturation midpoint */
+                float pix0 = (int32_t)((r[i] - Y) * vibrance) + Y;
+                float pix1 = (int32_t)((g[i] - Y) * vibrance) + Y;
+                float pix2 = (int32_t)((b[i] - Y) * vibrance) + Y;
+
+                /* Calculate saturation value of untouched pixel */
+                int32_t biggest = MAX(r[i], MAX(g[i], b[i]));
+                int32_t smallest = MIN(r[i], MIN(g[i], b[i]));
+                float sat = (float)(biggest - smallest) / ((float)biggest + FLT_MIN);
+                /* Some cheat factor to make the effect more visible, only for positive vibrance,
+                 * negative vibrance is the same as (un)saturation */
+                sat = positive * 2.0f * sat / ( sat * sat + 1.0f );
+                /* The less saturated the pixel was, the more saturation it gets */
+                float red = r[i] * sat + pix0 * ( 1.0f - sat );
+                float green = g[i] * sat + pix1 * ( 1.0f - sat );
+                float blue = b[i] * sat + pix2 * ( 1.0f - sat );
+                r[i] = LIMIT16(red);
+                g[i] = LIMIT16(green);
+                b[i] = LIMIT16(blue);
+            }
+        }
+
+        /* Saturation looks way better after gamma */
+        if (use_saturation)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                int32_t Y = ((r[i] << 2) + (g[i] * 11) + b[i]) >> 4;
+                r[i] = LIMIT16( (int32_t)((r[i] - Y) * saturation) + Y );
+                g[i] = LIMIT16( (int32_t)((g[i] - Y) * saturation) + Y );
+                b[i] = LIMIT16( (int32_t)((b[i] - Y) * saturation) + Y );
+            }
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            pix[i*3+0] = r[i];
+            pix[i*3+1] = g[i];
+            pix[i*3+2] = b[i];
+        }
+    }
+}
+
 /* A private part of the processing machine */
 void apply_processing_object( processingObject_t * processing,
                               int imageX, int imageY, 
@@ -724,7 +1083,8 @@ void apply_processing_object( processingObject_t * processing,
                               uint16_t * __restrict outputImage,
                               uint16_t * __restrict blurImage,
                               uint16_t * __restrict gradientMask,
-                              float * __restrict vignetteMask )
+                              float * __restrict vignetteMask,
+                              int white_balanced )
 {
     /* Number of elements */
     int img_s = imageX * imageY * 3;
@@ -737,6 +1097,10 @@ void apply_processing_object( processingObject_t * processing,
     uint16_t * gm = gradientMask;
     float * vm = vignetteMask;
     float * vmpix = vm;
+    /* Without a mask (baked LUT nodes) there is no gradient to blend */
+    int gradient = gm && processing->gradient_enable &&
+                 ( ( processing->gradient_exposure_stops < -0.01 || processing->gradient_exposure_stops > 0.01 )
+                || ( processing->gradient_contrast       < -0.01 || processing->gradient_contrast       > 0.01 ) );
 
     /* For Y calculation */
     float rgb_to_Y[3]; {
@@ -752,167 +1116,171 @@ void apply_processing_object( processingObject_t * processing,
     //double (* tone_mapping_function)(double) = tonemap_functions[processing->tonemap_function];
 
     /* Apply some precalcuolated settings */
-    for (int i = 0; i < img_s; ++i)
+    if (!white_balanced)
     {
         /* Black + white level */
-        img[i] = processing->pre_calc_levels[ img[i] ];
+        for (int i = 0; i < img_s; ++i) img[i] = processing->pre_calc_levels[ img[i] ];
     }
 
     /* white balance & exposure & highlights & gamma & highlight reconstruction */
     for (uint16_t * pix = img, * bpix = blurImage, *gmpix = gm; pix < img_end; pix += 3, bpix += 3, gmpix++)
     {
-        double expo_correction = 1.0;
-        double expo_correction_gradient = 1.0;
+        /* Gradient layer, stays in here until blended */
+        float pixg[3];
 
-        /* Vignette correction */
-        if( processing->vignette_strength != 0 )
+        /* Already done if the pixels come white balanced (baking the 3D LUT) */
+        if (!white_balanced)
         {
-            vmpix++;
-            if( vmpix < processing->vignette_end )  /* just safety - sometimes parameters may change faster than processing */
-            {
-                expo_correction *= pow( 1.0 + ( vmpix[0] * processing->vignette_strength / 128.0 ), 4 );
-            }
-        }
+            double expo_correction = 1.0;
+            double expo_correction_gradient = 1.0;
 
-        if (processing->allow_creative_adjustments)
-        {
-            /* shadows & highlights, clarity part 1 */
-            if( ( processing->shadows_highlights.shadows    <= -0.01 || processing->shadows_highlights.shadows    >= 0.01 )
-            || ( processing->shadows_highlights.highlights <= -0.01 || processing->shadows_highlights.highlights >= 0.01 )
-            || ( processing->clarity                       <= -0.01 || processing->clarity                       >= 0.01 ) )
+            /* Vignette correction */
+            if( vm && processing->vignette_strength != 0 )
             {
-                /* Blur pixLZ */
-                int32_t bval = ( ((pm[0][bpix[0]] /* + pm[1][bpix[1]] + pm[2][bpix[2]] */) << 2)
-                            + ((/* pm[3][bpix[0]] + */ pm[4][bpix[1]] /* + pm[5][bpix[2]] */) * 11)
-                            +  (/* pm[6][bpix[0]] + pm[7][bpix[1]] + */ pm[8][bpix[2]]) ) >> 4;
-
-                if( processing->clarity <= -0.01 || processing->clarity >= 0.01 )
+                vmpix++;
+                if( vmpix < processing->vignette_end )  /* just safety - sometimes parameters may change faster than processing */
                 {
-                    /* clarity part 1 */
-                    double factor = processing->clarity_curve[LIMIT16(bval)];
-                    expo_correction /= (factor * factor);
-                }
-                if( ( processing->shadows_highlights.shadows <= -0.01 || processing->shadows_highlights.shadows >= 0.01 )
-                || ( processing->shadows_highlights.highlights <= -0.01 || processing->shadows_highlights.highlights >= 0.01 ) )
-                {
-                    /* highlight exposure factor */
-                    expo_correction *= processing->shadows_highlights.shadow_highlight_curve[LIMIT16(bval)];
+                    expo_correction *= pow( 1.0 + ( vmpix[0] * processing->vignette_strength / 128.0 ), 4 );
                 }
             }
 
-            /* Contrast on untouched pixel */
-            if( ( processing->contrast          <= -0.01 || processing->contrast          >= 0.01 )
-            || ( processing->clarity           <= -0.01 || processing->clarity           >= 0.01 )
-            || ( processing->gradient_contrast <= -0.01 || processing->gradient_contrast >= 0.01 ) )
+            if (processing->allow_creative_adjustments)
             {
-                int32_t cval = ( ((pm[0][pix[0]] /* + pm[1][pix[1]] + pm[2][pix[2]] */) << 2)
-                             + ((/* pm[3][pix[0]] + */ pm[4][pix[1]] /* + pm[5][pix[2]] */) * 11)
-                             +  (/* pm[6][pix[0]] + pm[7][pix[1]] + */ pm[8][pix[2]]) ) >> 4;
-
-                if( processing->clarity <= -0.01 || processing->clarity >= 0.01 )
+                /* shadows & highlights, clarity part 1 */
+                if( ( processing->shadows_highlights.shadows    <= -0.01 || processing->shadows_highlights.shadows    >= 0.01 )
+                || ( processing->shadows_highlights.highlights <= -0.01 || processing->shadows_highlights.highlights >= 0.01 )
+                || ( processing->clarity                       <= -0.01 || processing->clarity                       >= 0.01 ) )
                 {
-                    /* clarity part 2 */
-                    double factor = processing->clarity_curve[LIMIT16(cval)];
-                    expo_correction *= factor * factor;
-                }
-                if( processing->contrast <= -0.01 || processing->contrast >= 0.01 )
-                {
-                    /* contrast factor */
-                    expo_correction *= processing->contrast_curve[LIMIT16(cval)];
+                    /* Blur pixLZ */
+                    int32_t bval = ( ((pm[0][bpix[0]] /* + pm[1][bpix[1]] + pm[2][bpix[2]] */) << 2)
+                                + ((/* pm[3][bpix[0]] + */ pm[4][bpix[1]] /* + pm[5][bpix[2]] */) * 11)
+                                +  (/* pm[6][bpix[0]] + pm[7][bpix[1]] + */ pm[8][bpix[2]]) ) >> 4;
+
+                    if( processing->clarity <= -0.01 || processing->clarity >= 0.01 )
+                    {
+                        /* clarity part 1 */
+                        double factor = processing->clarity_curve[LIMIT16(bval)];
+                        expo_correction /= (factor * factor);
+                    }
+                    if( ( processing->shadows_highlights.shadows <= -0.01 || processing->shadows_highlights.shadows >= 0.01 )
+                    || ( processing->shadows_highlights.highlights <= -0.01 || processing->shadows_highlights.highlights >= 0.01 ) )
+                    {
+                        /* highlight exposure factor */
+                        expo_correction *= processing->shadows_highlights.shadow_highlight_curve[LIMIT16(bval)];
+                    }
                 }
-                if( processing->gradient_contrast <= -0.01 || processing->gradient_contrast >= 0.01 )
+
+                /* Contrast on untouched pixel */
+                if( ( processing->contrast          <= -0.01 || processing->contrast          >= 0.01 )
+                || ( processing->clarity           <= -0.01 || processing->clarity           >= 0.01 )
+                || ( processing->gradient_contrast <= -0.01 || processing->gradient_contrast >= 0.01 ) )
                 {
-                    /* gradient contrast factor */
-                    expo_correction_gradient *= processing->gradient_contrast_curve[LIMIT16(cval)];
+                    int32_t cval = ( ((pm[0][pix[0]] /* + pm[1][pix[1]] + pm[2][pix[2]] */) << 2)
+                                 + ((/* pm[3][pix[0]] + */ pm[4][pix[1]] /* + pm[5][pix[2]] */) * 11)
+                                 +  (/* pm[6][pix[0]] + pm[7][pix[1]] + */ pm[8][pix[2]]) ) >> 4;
+
+                    if( processing->clarity <= -0.01 || processing->clarity >= 0.01 )
+                    {
+                        /* clarity part 2 */
+                        double factor = processing->clarity_curve[LIMIT16(cval)];
+                        expo_correction *= factor * factor;
+                    }
+                    if( processing->contrast <= -0.01 || processing->contrast >= 0.01 )
+                    {
+                        /* contrast factor */
+                        expo_correction *= processing->contrast_curve[LIMIT16(cval)];
+                    }
+                    if( processing->gradient_contrast <= -0.01 || processing->gradient_contrast >= 0.01 )
+                    {
+                        /* gradient contrast factor */
+                        expo_correction_gradient *= processing->gradient_contrast_curve[LIMIT16(cval)];
+                    }
                 }
             }
-        }
-
-        /* white balance & exposure */
-        float pix0 = (pm[0][pix[0]] /* + pm[1][pix[1]] + pm[2][pix[2]] */)*expo_correction;
-        float pix1 = (/* pm[3][pix[0]] + */ pm[4][pix[1]] /* + pm[5][pix[2]] */)*expo_correction;
-        float pix2 = (/* pm[6][pix[0]] + pm[7][pix[1]] + */ pm[8][pix[2]])*expo_correction;
-        float tmp1 = (/* pm[3][pix[0]] + */ pm[4][pix[1]] /* + pm[5][pix[2]] */);
 
-        /* Gradient variables and part 1 */
-        float pixg[3];
-        if( processing->gradient_enable && gmpix[0] != 0 &&
-          ( ( processing->gradient_exposure_stops < -0.01 || processing->gradient_exposure_stops > 0.01 )
-         || ( processing->gradient_contrast       < -0.01 || processing->gradient_contrast       > 0.01 ) ) )
-        {
-            /* do the same for gradient as for the pic itself, but before the values are overwritten */
             /* white balance & exposure */
-            float pix0g = (pmg[0][pix[0]] /* + pmg[1][pix[1]] + pmg[2][pix[2]] */) * expo_correction * expo_correction_gradient;
-            float pix1g = (/* pmg[3][pix[0]] + */ pmg[4][pix[1]] /* + pmg[5][pix[2]] */) * expo_correction * expo_correction_gradient;
-            float pix2g = (/* pmg[6][pix[0]] + pmg[7][pix[1]] */ + pmg[8][pix[2]]) * expo_correction * expo_correction_gradient;
-            float tmp1g = (/* pmg[3][pix[0]] + */ pmg[4][pix[1]] /* + pmg[5][pix[2]] */);
+            float pix0 = (pm[0][pix[0]] /* + pm[1][pix[1]] + pm[2][pix[2]] */)*expo_correction;
+            float pix1 = (/* pm[3][pix[0]] + */ pm[4][pix[1]] /* + pm[5][pix[2]] */)*expo_correction;
+            float pix2 = (/* pm[6][pix[0]] + pm[7][pix[1]] + */ pm[8][pix[2]])*expo_correction;
+            float tmp1 = (/* pm[3][pix[0]] + */ pm[4][pix[1]] /* + pm[5][pix[2]] */);
 
-            pixg[0] = LIMIT16(pix0g);
-            pixg[1] = LIMIT16(pix1g);
-            pixg[2] = LIMIT16(pix2g);
-            tmp1g   = LIMIT16(tmp1g);
-
-            /* Now highlight reconstruction for gradient layer*/
-            if (processing->highlight_reconstruction)
+            /* Gradient variables and part 1 */
+            if( gradient && gmpix[0] != 0 )
             {
-                if(*processing->dual_iso != 0)
+                /* do the same for gradient as for the pic itself, but before the values are overwritten */
+                /* white balance & exposure */
+                float pix0g = (pmg[0][pix[0]] /* + pmg[1][pix[1]] + pmg[2][pix[2]] */) * expo_correction * expo_correction_gradient;
+                float pix1g = (/* pmg[3][pix[0]] + */ pmg[4][pix[1]] /* + pmg[5][pix[2]] */) * expo_correction * expo_correction_gradient;
+                float pix2g = (/* pmg[6][pix[0]] + pmg[7][pix[1]] */ + pmg[8][pix[2]]) * expo_correction * expo_correction_gradient;
+                float tmp1g = (/* pmg[3][pix[0]] + */ pmg[4][pix[1]] /* + pmg[5][pix[2]] */);
+
+                pixg[0] = LIMIT16(pix0g);
+                pixg[1] = LIMIT16(pix1g);
+                pixg[2] = LIMIT16(pix2g);
+                tmp1g   = LIMIT16(tmp1g);
+
+                /* Now highlight reconstruction for gradient layer*/
+                if (processing->highlight_reconstruction)
                 {
-                    /* Check if its the range of highest green value possible */
-                    /* the range makes it cleaner against pink noise */
-                    if (tmp1g >= LIMIT16( processing->highest_green_gradient_diso - 5000 ) && tmp1g <= LIMIT16( processing->highest_green_gradient_diso + 5000 ))
+                    if(*processing->dual_iso != 0)
                     {
-                        if( pixg[1] < 1.1*pixg[0] && pixg[1] < pixg[2] )
+                        /* Check if its the range of highest green value possible */
+                        /* the range makes it cleaner against pink noise */
+                        if (tmp1g >= LIMIT16( processing->highest_green_gradient_diso - 5000 ) && tmp1g <= LIMIT16( processing->highest_green_gradient_diso + 5000 ))
                         {
-                            pixg[1] = (pixg[0] + pixg[2]) / 2;
+                            if( pixg[1] < 1.1*pixg[0] && pixg[1] < pixg[2] )
+                            {
+                                pixg[1] = (pixg[0] + pixg[2]) / 2;
+                            }
                         }
                     }
-                }
-                else
-                {
-                    /* Check if its the highest green value possible */
-                    if (tmp1g == processing->highest_green_gradient)
+                    else
                     {
-                        pixg[1] = (pixg[0] + pixg[2]) / 2;
+                        /* Check if its the highest green value possible */
+                        if (tmp1g == processing->highest_green_gradient)
+                        {
+                            pixg[1] = (pixg[0] + pixg[2]) / 2;
+                        }
                     }
                 }
             }
-        }
 
-        pix[0] = LIMIT16(pix0);
-        pix[1] = LIMIT16(pix1);
-        pix[2] = LIMIT16(pix2);
-        tmp1   = LIMIT16(tmp1);
+            pix[0] = LIMIT16(pix0);
+            pix[1] = LIMIT16(pix1);
+            pix[2] = LIMIT16(pix2);
+            tmp1   = LIMIT16(tmp1);
 
-        /* Now highlight reconstruction */
-        if (processing->highlight_reconstruction)
-        {
-            if(*processing->dual_iso != 0)
+            /* Now highlight reconstruction */
+            if (processing->highlight_reconstruction)
             {
-                /* Check if its the range of highest green value possible */
-                /* the range makes it cleaner against pink noise */
-                if (tmp1 >= LIMIT16( processing->highest_green_diso - 5000 ) && tmp1 <= LIMIT16( processing->highest_green_diso + 5000 ))
+                if(*processing->dual_iso != 0)
                 {
-                    if( pix[1] < 1.1*pix[0] && pix[1] < pix[2] )
+                    /* Check if its the range of highest green value possible */
+                    /* the range makes it cleaner against pink noise */
+                    if (tmp1 >= LIMIT16( processing->highest_green_diso - 5000 ) && tmp1 <= LIMIT16( processing->highest_green_diso + 5000 ))
                     {
-                        pix[1] = (pix[0] + pix[2]) / 2;
+                        if( pix[1] < 1.1*pix[0] && pix[1] < pix[2] )
+                        {
+                            pix[1] = (pix[0] + pix[2]) / 2;
+                        }
                     }
                 }
-            }
-            else
-            {
-                /* Check if its the highest green value possible */
-                if (tmp1 == processing->highest_green)
-                {
-                    pix[1] = (pix[0] + pix[2]) / 2;
-                }
-                /* Aggressive mode */
-                /*if (tmp1b >= processing->highest_green - 15000 && tmp1b <= processing->highest_green)
+                else
                 {
-                    if( pix[1] < 1.1*pix[0] && pix[1] < pix[2] )
+                    /* Check if its the highest green value possible */
+                    if (tmp1 == processing->highest_green)
                     {
                         pix[1] = (pix[0] + pix[2]) / 2;
                     }
-                }*/
+                    /* Aggressive mode */
+                    /*if (tmp1b >= processing->highest_green - 15000 && tmp1b <= processing->highest_green)
+                    {
+                        if( pix[1] < 1.1*pix[0] && pix[1] < pix[2] )
+                        {
+                            pix[1] = (pix[0] + pix[2]) / 2;
+                        }
+                    }*/
+                }
             }
         }
 
@@ -1002,9 +1370,7 @@ void apply_processing_object( processingObject_t * processing,
         }
 
         /* Gradient part 2 & blending */
-        if( processing->gradient_enable && gmpix[0] != 0 &&
-          ( ( processing->gradient_exposure_stops < -0.01 || processing->gradient_exposure_stops > 0.01 )
-         || ( processing->gradient_contrast       < -0.01 || processing->gradient_contrast       > 0.01 ) ) )
+        if( gradient && gmpix[0] != 0 )
         {
             /* WB correction gradient layer*/
             if( processing->use_cam_matrix > 0 )
@@ -1072,172 +1438,35 @@ void apply_processing_object( processingObject_t * processing,
         }
     }
 
-    //Code for HueVs...
-    if( (processing->allow_creative_adjustments )
-     && ( processing->hue_vs_luma_used
-       || processing->hue_vs_saturation_used
-       || processing->hue_vs_hue_used
-       || processing->luma_vs_saturation_used ) )
-    {
-        for (uint16_t * pix = img; pix < img_end; pix += 3)
-        {
-            float hsl[3];
-            float rgb[3];
-            for( int i = 0; i < 3; i++ ) rgb[i] = pix[i] / 65535.0f;
-            fromRGBtoHSV( rgb, hsl );
-            //rgb_to_hsl( pix, hsl );
-
-            /* Calculate saturation value of untouched pixel (taken from vibrance, gives better results than from rgb_to_hsl) */
-            // ///////////////////////
-            double sat = 0;
-            if( !( pix[0] == 0 && pix[1] == 0 && pix[2] == 0 ) )
-            {
-                uint16_t biggest = 0;
-                uint16_t smallest = 65535;
-                for( int i = 0; i < 3; i++ )
-                {
-                    if( pix[i] > biggest ) biggest = pix[i];
-                    if( pix[i] < smallest ) smallest = pix[i];
-                }
-                sat = ((double)biggest - (double)smallest) / (double)biggest;
-            }
-            /* Some cheat factor to make the effect more visible */
-            sat = 2.0 * sat / ( sat * sat + 1 );
-            if( sat > 1.0 ) sat = 1.0;
-            // ///////////////////////
-
-            uint16_t hue = (uint16_t)(hsl[0] * 100.0);
-
-            hsl[2] *= 1.0 + (processing->hue_vs_luma[hue] * sat * 2);
-            if( hsl[2] < 0.0 ) hsl[2] = 0.0;
-            //if( hsl[2] > 1.0 ) hsl[2] = 1.0;
-
-            hsl[1] *= 1.0 + (processing->hue_vs_saturation[hue] * 2);
-            if( hsl[1] < 0.0 ) hsl[1] = 0.0;
-            //if( hsl[1] > 1.0 ) hsl[1] = 1.0;
-
-            hsl[0] += 60 * processing->hue_vs_hue[hue];
-            if( hsl[0] < 0 ) hsl[0] += 360;
-            else if( hsl[0] >= 360 ) hsl[0] -= 360;
-
-            uint16_t luma = (uint16_t)((hsl[2]) * 36000.0);
-            hsl[1] *= 1.0 + (processing->luma_vs_saturation[luma] * 2);
-            if( hsl[1] < 0.0 ) hsl[1] = 0.0;
-
-            //hsl_to_rgb( hsl, pix );
-            fromHSVtoRGB( hsl, rgb );
-            for( int i = 0; i < 3; i++ ) pix[i] = LIMIT16( rgb[i] * 65535.0f + 0.5f );
-        }
-    }
-
     if (processing->allow_creative_adjustments)
     {
-        if( processing->vibrance > 1.01 || processing->vibrance < 0.99 )
+        /* HueVs curves */
+        if( processing->hue_vs_luma_used
+         || processing->hue_vs_saturation_used
+         || processing->hue_vs_hue_used
+         || processing->luma_vs_saturation_used )
         {
-            /* Now vibrance, before saturation, because we need untouched colors (in terms of saturation) */
-            for (uint16_t * pix = img; pix < img_end; pix += 3)
-            {
-                /* Pixel brightness = 4/16 R, 11/16 G, 1/16 blue; Try swapping the channels, it will look worse */
-                int32_t Y1 = ((pix[0] << 2) + (pix[1] * 11) + pix[2]) >> 4;
-                int32_t Y2 = Y1 - 65536;
-
-                /* Increase difference between channels and the saturation midpoint */
-                int32_t pix0 = processing->pre_calc_vibrance[pix[0] - Y2] + Y1;
-                int32_t pix1 = processing->pre_calc_vibrance[pix[1] - Y2] + Y1;
-                int32_t pix2 = processing->pre_calc_vibrance[pix[2] - Y2] + Y1;
-
-                /* Positive vibrance in dependency to raw saturation */
-                if( processing->vibrance > 1.0 )
-                {
-                    /* Calculate saturation value of untouched pixel */
-                    double sat = 0;
-                    if( !( pix[0] == 0 && pix[1] == 0 && pix[2] == 0 ) )
-                    {
-                        uint16_t biggest = 0;
-                        uint16_t smallest = 65535;
-                        for( int i = 0; i < 3; i++ )
-                        {
-                            if( pix[i] > biggest ) biggest = pix[i];
-                            if( pix[i] < smallest ) smallest = pix[i];
-                        }
-                        sat = ((double)biggest - (double)smallest) / (double)biggest;
-                    }
-                    /* Some cheat factor to make the effect more visible */
-                    sat = 2.0 * sat / ( sat * sat + 1 );
-                    if( sat > 1.0 ) sat = 1.0;
-                    /* The less saturated the pixel was, the more saturation it gets */
-                    pix[0] = LIMIT16( pix[0] * sat + pix0 * ( 1.0 - sat ) );
-                    pix[1] = LIMIT16( pix[1] * sat + pix1 * ( 1.0 - sat ) );
-                    pix[2] = LIMIT16( pix[2] * sat + pix2 * ( 1.0 - sat ) );
-                }
-                /* Negative vibrance is the same as (un)saturation */
-                else
-                {
-                    pix[0] = LIMIT16(pix0);
-                    pix[1] = LIMIT16(pix1);
-                    pix[2] = LIMIT16(pix2);
-                }
-            }
+            apply_hue_vs_curves(processing, img, imageX * imageY);
         }
 
-        if( processing->saturation > 1.01 || processing->saturation < 0.99 )
+        if( processing->vibrance > 1.01 || processing->vibrance < 0.99
+         || processing->saturation > 1.01 || processing->saturation < 0.99 )
         {
-            /* Now saturation (looks way better after gamma) */
-            for (uint16_t * pix = img; pix < img_end; pix += 3)
-            {
-                /* Pixel brightness = 4/16 R, 11/16 G, 1/16 blue; Try swapping the channels, it will look worse */
-                int32_t Y1 = ((pix[0] << 2) + (pix[1] * 11) + pix[2]) >> 4;
-                int32_t Y2 = Y1 - 65536;
-
-                /* Increase difference between channels and the saturation midpoint */
-                int32_t pix0 = processing->pre_calc_sat[pix[0] - Y2] + Y1;
-                int32_t pix1 = processing->pre_calc_sat[pix[1] - Y2] + Y1;
-                int32_t pix2 = processing->pre_calc_sat[pix[2] - Y2] + Y1;
-
-                pix[0] = LIMIT16(pix0);
-                pix[1] = LIMIT16(pix1);
-                pix[2] = LIMIT16(pix2);
-            }
-        }
-    }
-
-    /* Toning */
-    if (processing->allow_creative_adjustments)
-    {
-        if( processing->toning_dry < 99.8 )
-        {
-            for (uint16_t * pix = img; pix < img_end; pix += 3)
-            {
-                for( int i = 0; i < 3; i++ )
-                {
-                    pix[i] = pix[i] * processing->toning_dry + pix[i] * processing->toning_wet[i];
-                }
-            }
+            apply_vibrance_saturation(processing, img, imageX * imageY);
         }
     }
 
     if (processing->allow_creative_adjustments)
     {
-        /* Contrast Curve (OMG putting this after gamma made it 999x better) */
+        /* Toning, contrast curve (OMG putting this after gamma made it 999x better) and gradation curve in one go */
+        uint16_t * curve_r = processing->post_gamma_curve[0];
+        uint16_t * curve_g = processing->post_gamma_curve[1];
+        uint16_t * curve_b = processing->post_gamma_curve[2];
         for (uint16_t * pix = img; pix < img_end; pix += 3)
         {
-            pix[0] = processing->pre_calc_curve_r[ pix[0] ];
-            pix[1] = processing->pre_calc_curve_r[ pix[1] ];
-            pix[2] = processing->pre_calc_curve_r[ pix[2] ];
-        }
-    }
-
-    if (processing->allow_creative_adjustments)
-    {
-        //Gradation curve
-        for (uint16_t * pix = img; pix < img_end; pix += 3)
-        {
-            pix[0] = processing->gcurve_y[ pix[0] ];
-            pix[1] = processing->gcurve_y[ pix[1] ];
-            pix[2] = processing->gcurve_y[ pix[2] ];
-            pix[0] = processing->gcurve_r[ pix[0] ];
-            pix[1] = processing->gcurve_g[ pix[1] ];
-            pix[2] = processing->gcurve_b[ pix[2] ];
+            pix[0] = curve_r[ pix[0] ];
+            pix[1] = curve_g[ pix[1] ];
+            pix[2] = curve_b[ pix[2] ];
         }
     }
 
@@ -1301,33 +1530,33 @@ void processingSetContrast( processingObject_t * processing,
     processing->dark_contrast_range = DCRange;
     processing->lighten = lighten;
 
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 
 void processingSetDCRange(processingObject_t * processing, double DCRange)
 {
     processing->dark_contrast_range = DCRange;
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 void processingSetDCFactor(processingObject_t * processing, double DCFactor)
 {
     processing->dark_contrast_factor = DCFactor;
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 void processingSetLCRange(processingObject_t * processing, double LCRange) 
 {
     processing->light_contrast_range = LCRange;
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 void processingSetLCFactor(processingObject_t * processing, double LCFactor)
 {
     processing->light_contrast_factor = LCFactor;
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 void processingSetLightening(processingObject_t * processing, double lighten)
 {
     processing->lighten = lighten;
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 
 /* Have a guess what this does */
@@ -1335,10 +1564,7 @@ void processingSetExposureStops(processingObject_t * processing, double exposure
 {
     processing->exposure_stops = exposureStops;
 
-    processingSetGamma(processing, processing->gamma_power);
-    if( processing->gradient_enable != 0 ) processingSetGammaGradient(processing, processing->gamma_power);
-    processing_update_matrices(processing);
-    if( processing->gradient_enable != 0 ) processing_update_matrices_gradient(processing);
+    processing_mark_dirty(processing, TABLE_GAMMA | TABLE_GAMMA_GRADIENT | TABLE_MATRICES | TABLE_MATRICES_GRADIENT);
 }
 
 /* Have a guess what this does */
@@ -1346,23 +1572,14 @@ void processingSetGradientExposure(processingObject_t * processing, double value
 {
     processing->gradient_exposure_stops = value;
 
-    processingSetGamma(processing, processing->gamma_power);
-    processingSetGammaGradient(processing, processing->gamma_power);
-    processing_update_matrices(processing);
-    processing_update_matrices_gradient(processing);
+    processing_mark_dirty(processing, TABLE_GAMMA_GRADIENT | TABLE_MATRICES_GRADIENT);
 }
 
 /* Sets and precalculaes saturation */
 void processingSetSaturation(processingObject_t * processing, double saturationFactor)
 {
     processing->saturation = saturationFactor;
-
-    /* Precaluclate for the algorithm */
-    for (int i = 0; i < 131072; ++i)
-    {
-        double value = (i - 65536) * saturationFactor;
-        processing->pre_calc_sat[i] = value;
-    }
+    processing_mark_dirty(processing, TABLE_SATURATION);
 }
 
 
@@ -1370,13 +1587,7 @@ void processingSetSaturation(processingObject_t * processing, double saturationF
 void processingSetVibrance(processingObject_t *processing, double vibranceFactor)
 {
     processing->vibrance = vibranceFactor;
-
-    /* Precaluclate for the algorithm */
-    for (int i = 0; i < 131072; ++i)
-    {
-        double value = (i - 65536) * vibranceFactor;
-        processing->pre_calc_vibrance[i] = value;
-    }
+    processing_mark_dirty(processing, TABLE_VIBRANCE);
 }
 
 
@@ -1384,17 +1595,20 @@ void processingSetVibrance(processingObject_t *processing, double vibranceFactor
 void processingSetSharpeningBias(processingObject_t * processing, double bias)
 {
     processing->sharpen_bias = bias;
-    /* Recalculates everythin */
-    processingSetSharpening(processing, processingGetSharpening(processing));
+    processing_mark_dirty(processing, TABLE_SHARPENING);
 }
 
 
 void processingSetSharpening(processingObject_t * processing, double sharpen)
 {
     processing->sharpen = sharpen;
+    processing_mark_dirty(processing, TABLE_SHARPENING);
+}
 
+static void processing_update_sharpening(processingObject_t * processing)
+{
     /* Anything more than ~0.5 just looks awful */
-    sharpen = pow(sharpen, 1.5) * 0.55;
+    double sharpen = pow(processing->sharpen, 1.5) * 0.55;
 
     double sharpen_x = sharpen * (1.0 - processing->sharpen_bias);
     double sharpen_y = sharpen * (1.0 + processing->sharpen_bias);
@@ -1473,11 +1687,6 @@ void processingSetWhiteBalance(processingObject_t * processing, double WBKelvin,
 
     for (int i = 0; i < 3; ++i) processing->wb_multipliers[i] /= lowest;
 
-    /* White balance is part of the matrix */
-    processing_update_matrices(processing);
-    if( processing->gradient_enable != 0 ) processing_update_matrices_gradient(processing);
-
-
     /****************************** Now generate the matrix for scientific White Balance ******************************/
 
     double proper_wb_matrix[9] = {1,0,0,0,1,0,0,0,1};
@@ -1563,6 +1772,9 @@ void processingSetWhiteBalance(processingObject_t * processing, double WBKelvin,
 
     /* Back to sRGB (maybe something wider in future) */
     multiplyMatrices(p_xyz_to_rgb, back_in_XYZ_matrix, processing->proper_wb_matrix);
+
+    /* White balance is part of the matrix, mark dirty once proper_wb_matrix is written */
+    processing_mark_dirty(processing, TABLE_MATRICES | TABLE_MATRICES_GRADIENT);
 }
 
 /* WB just by kelvin */
@@ -1583,7 +1795,11 @@ void processingSetWhiteBalanceTint(processingObject_t * processing, double WBTin
 void processingSetGamma(processingObject_t * processing, double gammaValue)
 {
     processing->gamma_power = gammaValue;
+    processing_mark_dirty(processing, TABLE_GAMMA | TABLE_GAMMA_GRADIENT);
+}
 
+static void processing_update_gamma(processingObject_t * processing)
+{
     /* Needs to be inverse */
     //double gamma = 1.0 / gammaValue;
 
@@ -1601,17 +1817,17 @@ void processingSetGamma(processingObject_t * processing, double gammaValue)
         pixel = LIMIT16(pixel);
         processing->pre_calc_gamma[i] = pixel;
     }
-
-    /* So highlight reconstruction works */
-    processing_update_highest_green(processing);
-    processingSetGammaGradient(processing, gammaValue); /* Cool */
 }
 
 /* Set gamma for gradient image part (Log-ing / tonemapping done here) */
 void processingSetGammaGradient(processingObject_t * processing, double gammaValue)
 {
     processing->gamma_power = gammaValue;
+    processing_mark_dirty(processing, TABLE_GAMMA_GRADIENT);
+}
 
+static void processing_update_gamma_gradient(processingObject_t * processing)
+{
     /* Needs to be inverse */
     //double gamma = 1.0 / gammaValue;
 
@@ -1627,9 +1843,6 @@ void processingSetGammaGradient(processingObject_t * processing, double gammaVal
         processing->x_value = pixel;
         processing->pre_calc_gamma_gradient[i] = (uint16_t)LIMIT16(65535.0 * te_eval(processing->transfer_function));
     }
-
-    /* So highlight reconstruction works */
-    processing_update_highest_green_gradient(processing);
 }
 
 /* Range of saturation and hue is 0.0-1.0 */
@@ -1645,7 +1858,7 @@ void processingSet3WayCorrection( processingObject_t * processing,
     processing->shadow_hue = shadowHue;
     processing->shadow_sat = shadowSaturation;
 
-    processing_update_curves(processing);
+    processing_mark_dirty(processing, TABLE_CURVES);
 }
 
 /* Set black and white level */
@@ -1666,6 +1879,11 @@ void processingSetBlackAndWhiteLevel(processingObject_t * processing,
         processing->white_level = (int)((double)(mlvWhiteLevel << bits_shift) * 0.993);
     }
 
+    processing_mark_dirty(processing, TABLE_LEVELS);
+}
+
+static void processing_update_levels(processingObject_t * processing)
+{
     /* How much it needs to be stretched */
     double stretch = 65535.0 / (double)(processing->white_level - processing->black_level);
 
@@ -1705,6 +1923,80 @@ void processingSetWhiteLevel(processingObject_t * processing, int mlvWhiteLevel,
                                      mlvBitDepth );
 }
 
+/* Toning, contrast curve and gradation curves are all per channel maps after
+ * gamma, so they are put together to one table per channel */
+static void processing_update_post_gamma_curves(processingObject_t * processing)
+{
+    uint16_t * gcurve[3] = { processing->gcurve_r, processing->gcurve_g, processing->gcurve_b };
+    #pragma omp parallel for collapse(2)
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int i = 0; i < 65536; ++i)
+        {
+            uint16_t value = i * processing->toning_dry + i * processing->toning_wet[c];
+            value = processing->pre_calc_curve_r[ value ];
+            value = processing->gcurve_y[ value ];
+            processing->post_gamma_curve[c][i] = gcurve[c][ value ];
+        }
+    }
+}
+
+/* Rebuilds the lookup tables the setters marked dirty. Many settings change
+ * at once when a clip or receipt is loaded, so each table is built only once
+ * here, independent tables side by side. Gradient tables wait until the
+ * gradient gets enabled. */
+void processingUpdateTables(processingObject_t * processing)
+{
+    /* Take the dirty bits in one atomic step, gradient bits stay set while it is off */
+    uint32_t keep = processing->gradient_enable ? 0 : (TABLE_MATRICES_GRADIENT | TABLE_GAMMA_GRADIENT);
+    uint32_t dirty = __atomic_fetch_and(&processing->dirty_tables, keep, __ATOMIC_ACQUIRE) & ~keep;
+    if (!dirty) return;
+    processing->tables_version++;
+
+    /* Only split up if more than one table is dirty, else the loops inside run parallel */
+    int multiple = (dirty & (dirty - 1)) != 0;
+
+    #pragma omp parallel sections if(multiple)
+    {
+        #pragma omp section
+        {
+            if (dirty & TABLE_MATRICES) processing_update_matrices(processing);
+            if (dirty & TABLE_MATRICES_GRADIENT) processing_update_matrices_gradient(processing);
+        }
+        #pragma omp section
+        {
+            /* Both evaluate the transfer function with the same x variable */
+            if (dirty & TABLE_GAMMA) processing_update_gamma(processing);
+            if (dirty & TABLE_GAMMA_GRADIENT) processing_update_gamma_gradient(processing);
+        }
+        #pragma omp section
+        {
+            if (dirty & TABLE_CURVES) processing_update_curves(processing);
+        }
+        #pragma omp section
+        {
+            if (dirty & TABLE_SHADOW_HIGHLIGHT_CURVE) processing_update_shadow_highlight_curve(processing);
+        }
+        #pragma omp section
+        {
+            if (dirty & TABLE_CONTRAST_CURVE) processing_update_contrast_curve(processing);
+            if (dirty & TABLE_CONTRAST_CURVE_GRADIENT) processing_update_contrast_curve_gradient(processing);
+        }
+        #pragma omp section
+        {
+            if (dirty & TABLE_CLARITY_CURVE) processing_update_clarity_curve(processing);
+        }
+        #pragma omp section
+        {
+            if (dirty & TABLE_SHARPENING) processing_update_sharpening(processing);
+            if (dirty & TABLE_LEVELS) processing_update_levels(processing);
+        }
+    }
+
+    /* Needs the contrast curve */
+    if (dirty & (TABLE_CURVES | TABLE_POST_GAMMA_CURVES)) processing_update_post_gamma_curves(processing);
+}
+
 /* Set transformation */
 void processingSetTransformation(processingObject_t * processing, int transformation)
 {
@@ -1718,14 +2010,85 @@ void freeProcessingObject(processingObject_t * processing)
     if(processing->vignette_mask) free(processing->vignette_mask);
     freeFilterObject(processing->filter);
     free_lut(processing->lut);
+    free_rbf_context(processing->rbf);
     for (int i = 8; i >= 0; --i) free(processing->pre_calc_matrix[i]);
     for (int i = 8; i >= 0; --i) free(processing->pre_calc_matrix_gradient[i]);
     for (int i = 6; i >= 0; --i) free(processing->cs_zone.pre_calc_rgb_to_YCbCr[i]);
     for (int i = 3; i >= 0; --i) free(processing->cs_zone.pre_calc_YCbCr_to_rgb[i]);
     free_image_buffer(processing->shadows_highlights.blur_image);
+    if (processing->baked_lut) free(processing->baked_lut);
     free(processing);
 }
 
+void processingCopySettings(processingObject_t * dst, processingObject_t * src)
+{
+    /* Everything dst allocated itself */
+    filterObject_t * filter = dst->filter;
+    lut_t * lut = dst->lut;
+    rbf_context_t * rbf = dst->rbf;
+    int32_t * pre_calc_matrix[9];
+    int32_t * pre_calc_matrix_gradient[9];
+    int32_t * pre_calc_rgb_to_YCbCr[7];
+    int32_t * pre_calc_YCbCr_to_rgb[5];
+    memcpy(pre_calc_matrix, dst->pre_calc_matrix, sizeof(pre_calc_matrix));
+    memcpy(pre_calc_matrix_gradient, dst->pre_calc_matrix_gradient, sizeof(pre_calc_matrix_gradient));
+    memcpy(pre_calc_rgb_to_YCbCr, dst->cs_zone.pre_calc_rgb_to_YCbCr, sizeof(pre_calc_rgb_to_YCbCr));
+    memcpy(pre_calc_YCbCr_to_rgb, dst->cs_zone.pre_calc_YCbCr_to_rgb, sizeof(pre_calc_YCbCr_to_rgb));
+    processing_buffer_t * blur_image = dst->shadows_highlights.blur_image;
+    uint16_t * baked_lut = dst->baked_lut;
+    uint16_t * gradient_mask = dst->gradient_mask;
+    float * vignette_mask = dst->vignette_mask;
+    float * vignette_end = dst->vignette_end;
+    int * dual_iso = dst->dual_iso;
+    image_profile_t * image_profile = dst->image_profile;
+    char * transfer_function_string = dst->transfer_function_string;
+    char * transfer_function_string_formatted = dst->transfer_function_string_formatted;
+    te_expr * transfer_function = dst->transfer_function;
+    te_variable x_variable = dst->x_variable;
+
+    memcpy(dst, src, sizeof(processingObject_t));
+
+    dst->filter = filter;
+    dst->lut = lut;
+    dst->rbf = rbf;
+    memcpy(dst->pre_calc_matrix, pre_calc_matrix, sizeof(pre_calc_matrix));
+    memcpy(dst->pre_calc_matrix_gradient, pre_calc_matrix_gradient, sizeof(pre_calc_matrix_gradient));
+    memcpy(dst->cs_zone.pre_calc_rgb_to_YCbCr, pre_calc_rgb_to_YCbCr, sizeof(pre_calc_rgb_to_YCbCr));
+    memcpy(dst->cs_zone.pre_calc_YCbCr_to_rgb, pre_calc_YCbCr_to_rgb, sizeof(pre_calc_YCbCr_to_rgb));
+    dst->shadows_highlights.blur_image = blur_image;
+    dst->baked_lut = baked_lut;
+    dst->gradient_mask = gradient_mask;
+    dst->vignette_mask = vignette_mask;
+    dst->vignette_end = vignette_end;
+    dst->dual_iso = dual_iso;
+    dst->image_profile = image_profile;
+    dst->transfer_function_string = transfer_function_string;
+    dst->transfer_function_string_formatted = transfer_function_string_formatted;
+    dst->transfer_function = transfer_function;
+    dst->x_variable = x_variable;
+
+    /* The expression is bound to x_value of its own object */
+    if (src->transfer_function_string && (!dst->transfer_function_string
+        || strcmp(src->transfer_function_string, dst->transfer_function_string)))
+    {
+        double gamma_power = dst->gamma_power;
+        processingSetTransferFunction(dst, src->transfer_function_string);
+        dst->gamma_power = gamma_power;
+    }
+
+    /* Filter network LUT is only made if the filter is used */
+    if (src->filter_on && dst->filter->filter_option != src->filter->filter_option)
+        filterObjectSetFilter(dst->filter, src->filter->filter_option);
+    if (dst->filter->strength != src->filter->strength)
+        filterObjectSetFilterStrength(dst->filter, src->filter->strength);
+
+    if (dst->lut->version != src->lut->version) copy_lut(dst->lut, src->lut);
+    dst->lut->intensity = src->lut->intensity;
+
+    dst->dirty_tables = ~(uint32_t)0;
+    dst->baked_lut_valid = 0;
+}
+
 /* Find correct white balance setting for one selected pixel */
 void processingFindWhiteBalance(processingObject_t *processing, int imageX, int imageY, uint16_t *inputImage, int posX, int posY, int *wbTemp, int *wbTint, int mode)
 {
@@ -1736,6 +2099,9 @@ void processingFindWhiteBalance(processingObject_t *processing, int imageX, int
     int32_t ** pm = processing->pre_calc_matrix;
     uint16_t * img = inputImage;
 
+    /* Levels and gamma must be up to date */
+    processingUpdateTables(processing);
+
     /* Apply some precalcuolated settings */
     for (int i = 0; i < img_s; ++i)
     {
@@ -1793,6 +2159,7 @@ void processingFindWhiteBalance(processingObject_t *processing, int imageX, int
         for( int tint = -100; tint <= 100; tint += 1 )
         {
             processingSetWhiteBalance( processing, temp, tint/10.0 );
+            processing_update_matrices( processing );
 
             /* --- maybe this can also be exchanged by apply_processing_object, but here it is simplified and hopefully faster --- */
             /* white balance & exposure */
@@ -2055,6 +2422,8 @@ void processingSetGCurve(processingObject_t *processing, int num, float *pXin, f
         {
             curve[i] = i;
         }
+        //Mark dirty after the curve is written, the render thread may rebuild any time
+        processing_mark_dirty(processing, TABLE_POST_GAMMA_CURVES);
         return;
     }
 
@@ -2086,6 +2455,8 @@ void processingSetGCurve(processingObject_t *processing, int num, float *pXin, f
 
     free( pXout );
     free( pYout );
+
+    processing_mark_dirty(processing, TABLE_POST_GAMMA_CURVES);
 }
 
 //Set the hue vs curves
@@ -2113,6 +2484,7 @@ void processingSetHueVsCurves(processingObject_t *processing, int num, float *pX
         curve = processing->luma_vs_saturation;
         used = &processing->luma_vs_saturation_used;
     }
+
     //Init
     if( num < 2 )
     {
@@ -2121,6 +2493,8 @@ void processingSetHueVsCurves(processingObject_t *processing, int num, float *pX
             curve[i] = 0.0;
             *used = 0;
         }
+        //Mark dirty after the curve is written, the render thread may rebuild any time
+        processing_mark_dirty(processing, TABLE_HUE_VS_CURVES);
         return;
     }
 
@@ -2154,6 +2528,8 @@ void processingSetHueVsCurves(processingObject_t *processing, int num, float *pX
 
     free( pXout );
     free( pYout );
+
+    processing_mark_dirty(processing, TABLE_HUE_VS_CURVES);
 }
 
 /* Toning */
@@ -2163,6 +2539,7 @@ void processingSetToning(processingObject_t *processing, uint8_t r, uint8_t g, u
     processing->toning_wet[0] = (strength / 3.0 / 100.0) * (float)r / 255.0;
     processing->toning_wet[1] = (strength / 3.0 / 100.0) * (float)g / 255.0;
     processing->toning_wet[2] = (strength / 3.0 / 100.0) * (float)b / 255.0;
+    processing_mark_dirty(processing, TABLE_POST_GAMMA_CURVES);
 }
 
 static char * compile_ternary(char * function)
@@ -11,6 +11,10 @@
 processingObject_t * initProcessingObject();
 /* Opposite of the first fucntion */
 void freeProcessingObject(processingObject_t * processing);
+/* Copies all settings to a second processing object, to process with the same look on another
+ * thread. dst keeps its own buffers and rebuilds all lookup tables with its next frame. Masks and
+ * the dual iso pointer are not copied, use dst with applyProcessingObjectWithoutMasks */
+void processingCopySettings(processingObject_t * dst, processingObject_t * src);
 
 
 /* Set processing gamut */
@@ -88,6 +92,14 @@ void applyProcessingObject( processingObject_t * processing,
                             uint16_t * __restrict outputImage,
                             int threads, int imageChanged, uint64_t frameIndex );
 
+/* applyProcessingObject without vignette and gradient, for downscaled images (proxy,
+ * thumbnails) which don't fit the full resolution masks. Leaves the settings untouched */
+void applyProcessingObjectWithoutMasks( processingObject_t * processing,
+                                        int imageX, int imageY,
+                                        uint16_t * __restrict inputImage,
+                                        uint16_t * __restrict outputImage,
+                                        int threads, int imageChanged, uint64_t frameIndex );
+
 /* This is for EXR output, works exactly the same as applyprocessing object,
  * except output is float and ready for EXR export. */
 void processingGetFloatOutputForEXR( processingObject_t * processing, 
@@ -311,7 +323,8 @@ void apply_processing_object(processingObject_t * processing,
                               uint16_t * __restrict outputImage,
                               uint16_t * __restrict blurImage,
                               uint16_t * __restrict gradientMask,
-                              float *vignetteMask);
+                              float *vignetteMask,
+                              int white_balanced);
 
 /* Pass frame buffer and do the transform on it */
 void get_frame_transformed(processingObject_t * processing, uint16_t * frame_buf , uint16_t imageX, uint16_t imageY);
@@ -364,6 +377,9 @@ void processing_update_highest_green_gradient(processingObject_t * processing);
 /* Precalculates curve with contrast and colour correction */
 void processing_update_curves(processingObject_t * processing);
 
+/* Rebuilds all lookup tables marked dirty by the setters, done before each frame */
+void processingUpdateTables(processingObject_t * processing);
+
 /* Analyse dual iso frame to find highest green for highlight reconstruction */
 void analyse_frame_highest_green(processingObject_t * processing,
                                   int imageX, int imageY,
@@ -23,6 +23,7 @@ SOFTWARE.
 
 Fixed bugs and adapted to RGB64 by masc4ii (c) 2019
 Added dual threading by masc4ii (c) 2021
+Rows and column blocks on all threads, kept buffers, fused blending by masc4ii (c) 2026
 */
 
 #include "RBFilterPlain.h"
@@ -33,6 +34,9 @@ using namespace std;
 
 #define QX_DEF_U16_MAX 65535
 
+// pixels per column block of the vertical pass
+#define RBF_BLOCK 128
+
 
 CRBFilterPlain::CRBFilterPlain()
 {
@@ -52,6 +56,10 @@ void CRBFilterPlain::reserveMemory(int max_width, int max_height, int channels)
     if(!(max_height >= 10 && max_height < 10000))return;
     if(!(channels >= 1 && channels <= 4))return;
 
+    // big enough from last time
+    if( m_range_table && channels == m_reserve_channels
+     && max_width * max_height <= m_reserve_width * m_reserve_height ) return;
+
 	releaseMemory();
 
 	m_reserve_width = max_width;
@@ -61,34 +69,13 @@ void CRBFilterPlain::reserveMemory(int max_width, int max_height, int channels)
 	int width_height = m_reserve_width * m_reserve_height;
 	int width_height_channel = width_height * m_reserve_channels;
 
-	m_left_pass_color = new float[width_height_channel];
-	m_left_pass_factor = new float[width_height];
-
-	m_right_pass_color = new float[width_height_channel];
-	m_right_pass_factor = new float[width_height];
-
+	// all passes write every pixel, no need to clear
+	m_hor_pass_color = new float[width_height_channel];
+	m_pass_factor = new float[width_height];
 	m_down_pass_color = new float[width_height_channel];
-	m_down_pass_factor = new float[width_height];
-
-	m_up_pass_color = new float[width_height_channel];
-	m_up_pass_factor = new float[width_height];
-
-#pragma omp parallel for
-    for( int i = 0; i < width_height_channel; i++ )
-    {
-        m_left_pass_color[i] = 0;
-        m_right_pass_color[i] = 0;
-        m_down_pass_color[i] = 0;
-        m_up_pass_color[i] = 0;
-    }
-#pragma omp parallel for
-    for( int i = 0; i < width_height; i++ )
-    {
-        m_left_pass_factor[i] = 0;
-        m_right_pass_factor[i] = 0;
-        m_down_pass_factor[i] = 0;
-        m_up_pass_factor[i] = 0;
-    }
+	m_range_table = new float[QX_DEF_U16_MAX + 1];
+	m_range_sigma_spatial = 0.f;
+	m_range_sigma_range = 0.f;
 }
 
 void CRBFilterPlain::releaseMemory()
@@ -97,28 +84,16 @@ void CRBFilterPlain::releaseMemory()
 	m_reserve_height = 0;
 	m_reserve_channels = 0;
 
-	if (m_left_pass_color)
+	if (m_hor_pass_color)
 	{
-		delete[] m_left_pass_color;
-		m_left_pass_color = nullptr;
+		delete[] m_hor_pass_color;
+		m_hor_pass_color = nullptr;
 	}
 
-	if (m_left_pass_factor)
+	if (m_pass_factor)
 	{
-		delete[] m_left_pass_factor;
-		m_left_pass_factor = nullptr;
-	}
-
-	if (m_right_pass_color)
-	{
-		delete[] m_right_pass_color;
-		m_right_pass_color = nullptr;
-	}
-
-	if (m_right_pass_factor)
-	{
-		delete[] m_right_pass_factor;
-		m_right_pass_factor = nullptr;
+		delete[] m_pass_factor;
+		m_pass_factor = nullptr;
 	}
 
 	if (m_down_pass_color)
@@ -127,22 +102,10 @@ void CRBFilterPlain::releaseMemory()
 		m_down_pass_color = nullptr;
 	}
 
-	if (m_down_pass_factor)
-	{
-		delete[] m_down_pass_factor;
-		m_down_pass_factor = nullptr;
-	}
-
-	if (m_up_pass_color)
-	{
-		delete[] m_up_pass_color;
-		m_up_pass_color = nullptr;
-	}
-
-	if (m_up_pass_factor)
+	if (m_range_table)
 	{
-		delete[] m_up_pass_factor;
-		m_up_pass_factor = nullptr;
+		delete[] m_range_table;
+		m_range_table = nullptr;
 	}
 }
 
@@ -188,262 +151,180 @@ int CRBFilterPlain::getDiffFactor(const uint16_t *color1, const uint16_t *color2
 }
 
 // memory must be reserved before calling image filter
-// this implementation of filter uses plain C++, single threaded
 // channel count must be 3 or 4 (alpha not used)
 void CRBFilterPlain::filter(uint16_t* img_src, uint16_t* img_dst,
 	float sigma_spatial, float sigma_range,
-	int width, int height, int channel)
+	int width, int height, int channel,
+	const float* blend)
 {
     if(!img_src) return;
     if(!img_dst) return;
     if(!(m_reserve_channels == channel)) return;
-    if(!(m_reserve_width >= width)) return;
-    if(!(m_reserve_height >= height)) return;
+    if(!(m_reserve_width * m_reserve_height >= width * height)) return;
+    if(blend && channel != 3) return;
 
     // compute a lookup table
     float alpha_f = static_cast<float>(exp(-sqrt(2.0) / (sigma_spatial * QX_DEF_U16_MAX)));
     float inv_alpha_f = 1.f - alpha_f;
 
-
-    float range_table_f[QX_DEF_U16_MAX + 1];
-    float inv_sigma_range = 1.0f / (sigma_range * QX_DEF_U16_MAX);
+    float* range_table_f = m_range_table;
+    if( sigma_spatial != m_range_sigma_spatial || sigma_range != m_range_sigma_range )
     {
-        float ii = 0.f;
+        float inv_sigma_range = 1.0f / (sigma_range * QX_DEF_U16_MAX);
 #pragma omp parallel for
         for (int i = 0; i <= QX_DEF_U16_MAX; i++)
         {
-            ii = -i;
+            float ii = -i;
             range_table_f[i] = alpha_f * exp(ii * inv_sigma_range);
         }
+        m_range_sigma_spatial = sigma_spatial;
+        m_range_sigma_range = sigma_range;
     }
 
+    ///////////////
+    // Horizontal pass, each row on its own: left pass is stored, right pass is averaged in on the way back
 #pragma omp parallel for
-    for( int par = 0; par < 2; par++ )
+    for (int y = 0; y < height; y++)
     {
-        ///////////////
-        // Left pass
-        if( !par )
-        {
-            const uint16_t* src_color = img_src;
-            float* left_pass_color = m_left_pass_color;
-            float* left_pass_factor = m_left_pass_factor;
-
-            for (int y = 0; y < height-1; y++)
-            {
-                const uint16_t* src_prev = src_color;
-                const float* prev_factor = left_pass_factor;
-                const float* prev_color = left_pass_color;
+        const uint16_t* src_color = img_src + y * width * channel;
+        float* hor_color = m_hor_pass_color + y * width * channel;
+        float* left_factor = m_pass_factor + y * width;
 
-                // process 1st pixel separately since it has no previous
-                *left_pass_factor++ = 1.f;
-                for (int c = 0; c < channel; c++)
-                {
-                    *left_pass_color++ = *src_color++;
-                }
-
-                // handle other pixels
-                for (int x = 1; x < width; x++)
-                {
-                    // determine difference in pixel color between current and previous
-                    // calculation is different depending on number of channels
-                    int diff = getDiffFactor(src_color, src_prev);
-                    src_prev = src_color;
-
-                    float alpha_f = range_table_f[diff];
+        // process 1st pixel separately since it has no previous
+        left_factor[0] = 1.f;
+        for (int c = 0; c < channel; c++)
+        {
+            hor_color[c] = src_color[c];
+        }
 
-                    *left_pass_factor++ = inv_alpha_f + alpha_f * (*prev_factor++);
+        // left pass
+        for (int x = 1; x < width; x++)
+        {
+            const uint16_t* pix = src_color + x * channel;
+            float alpha_f = range_table_f[getDiffFactor(pix, pix - channel)];
 
-                    for (int c = 0; c < channel; c++)
-                    {
-                        *left_pass_color++ = inv_alpha_f * (*src_color++) + alpha_f * (*prev_color++);
-                    }
-                }
+            left_factor[x] = inv_alpha_f + alpha_f * left_factor[x - 1];
+            for (int c = 0; c < channel; c++)
+            {
+                hor_color[x * channel + c] = inv_alpha_f * pix[c] + alpha_f * hor_color[(x - 1) * channel + c];
             }
         }
-        else
-        ///////////////
-        // Right pass
-        {
-            // start from end and then go up to begining
-            int last_index = width * height * channel - 1;
-            const uint16_t* src_color = img_src + last_index;
-            float* right_pass_color = m_right_pass_color + last_index;
-            float* right_pass_factor = m_right_pass_factor + width * height - 1;
 
-            for (int y = 0; y < height-1; y++)
+        // right pass, average color divided by average factor
+        float right_factor = 1.f;
+        float right_color[4];
+        for (int x = width - 1; x >= 0; x--)
+        {
+            const uint16_t* pix = src_color + x * channel;
+            if (x == width - 1)
+            {
+                for (int c = 0; c < channel; c++) right_color[c] = pix[c];
+            }
+            else
             {
-                //const uint16_t* src_prev = src_color;
-                const float* prev_factor = right_pass_factor;
-                const float* prev_color = right_pass_color;
+                float alpha_f = range_table_f[getDiffFactor(pix, pix + channel)];
 
-                // process 1st pixel separately since it has no previous
-                *right_pass_factor-- = 1.f;
+                right_factor = inv_alpha_f + alpha_f * right_factor;
                 for (int c = 0; c < channel; c++)
                 {
-                    *right_pass_color-- = *src_color--;
+                    right_color[c] = inv_alpha_f * pix[c] + alpha_f * right_color[c];
                 }
+            }
 
-                // handle other pixels
-                for (int x = 1; x < width; x++)
-                {
-                    // determine difference in pixel color between current and previous
-                    // calculation is different depending on number of channels
-                    int diff = getDiffFactor(src_color, src_color - 3);
-                    //	src_prev = src_color;
-
-                    float alpha_f = range_table_f[diff];
-
-                    *right_pass_factor-- = inv_alpha_f + alpha_f * (*prev_factor--);
-
-                    for (int c = 0; c < channel; c++)
-                    {
-                        *right_pass_color-- = inv_alpha_f * (*src_color--) + alpha_f * (*prev_color--);
-                    }
-                }
+            float factor = 1.f / (left_factor[x] + right_factor);
+            for (int c = 0; c < channel; c++)
+            {
+                hor_color[x * channel + c] = factor * (hor_color[x * channel + c] + right_color[c]);
             }
         }
     }
 
-    // vertical pass will be applied on top on horizontal pass, while using pixel differences from original image
-    // result color stored in 'm_left_pass_color' and vertical pass will use it as source color
+    ///////////////
+    // Vertical pass on top of horizontal pass, while using pixel differences from original image.
+    // Each block of columns on its own: down pass is stored, up pass is averaged in and written to output.
+    int blocks = (width + RBF_BLOCK - 1) / RBF_BLOCK;
+#pragma omp parallel for
+    for (int b = 0; b < blocks; b++)
     {
-        float* img_out = m_left_pass_color; // use as temporary buffer
-        const float* left_pass_color = m_left_pass_color;
-        const float* left_pass_factor = m_left_pass_factor;
-        const float* right_pass_color = m_right_pass_color;
-        const float* right_pass_factor = m_right_pass_factor;
+        int x0 = b * RBF_BLOCK;
+        int x1 = min(x0 + RBF_BLOCK, width);
 
-        int width_height = width * height;
-#pragma omp parallel for
-        for (int i = 0; i < width_height; i++)
+        // down pass, 1st line done separately because no previous line
+        for (int x = x0; x < x1; x++)
         {
-            // average color divided by average factor
-            float factor = 1.f / ((left_pass_factor[i]) + (right_pass_factor[i]));
+            m_pass_factor[x] = 1.f;
             for (int c = 0; c < channel; c++)
             {
-                int idx = i + i + i + c;
-                img_out[idx] = (factor * ((left_pass_color[idx]) + (right_pass_color[idx])));
+                m_down_pass_color[x * channel + c] = m_hor_pass_color[x * channel + c];
             }
         }
-    }
-
-#pragma omp parallel for
-    for( int par = 0; par < 2; par++ )
-    {
-        ///////////////
-        // Down pass
-        if( !par )
+        for (int y = 1; y < height; y++)
         {
-            const float* src_color_hor = m_left_pass_color; // result of horizontal pass filter
-
-            const uint16_t* src_color = img_src;
-            float* down_pass_color = m_down_pass_color;
-            float* down_pass_factor = m_down_pass_factor;
-
-            const uint16_t* src_prev = src_color;
-            const float* prev_color = down_pass_color;
-            const float* prev_factor = down_pass_factor;
-
-            // 1st line done separately because no previous line
-            for (int x = 0; x < width; x++)
+            for (int x = x0; x < x1; x++)
             {
-                *down_pass_factor++ = 1.f;
+                int i = y * width + x;
+                float alpha_f = range_table_f[getDiffFactor(img_src + i * channel, img_src + (i - width) * channel)];
+
+                m_pass_factor[i] = inv_alpha_f + alpha_f * m_pass_factor[i - width];
                 for (int c = 0; c < channel; c++)
                 {
-                    *down_pass_color++ = *src_color_hor++;
+                    m_down_pass_color[i * channel + c] = inv_alpha_f * m_hor_pass_color[i * channel + c]
+                                                       + alpha_f * m_down_pass_color[(i - width) * channel + c];
                 }
-                src_color += channel;
             }
+        }
 
-            // handle other lines
-            for (int y = 1; y < height; y++)
+        // up pass, output may overwrite source, so the line below is kept
+        float up_factor[RBF_BLOCK];
+        float up_color[RBF_BLOCK * 4];
+        uint16_t below[RBF_BLOCK * 4];
+        for (int y = height - 1; y >= 0; y--)
+        {
+            for (int x = x0; x < x1; x++)
             {
-                for (int x = 0; x < width-1; x++)
+                int i = y * width + x;
+                int k = x - x0;
+                uint16_t* pix = img_src + i * channel;
+                if (y == height - 1)
                 {
-                    // determine difference in pixel color between current and previous
-                    // calculation is different depending on number of channels
-                    int diff = getDiffFactor(src_color, src_prev);
-                    src_prev += channel;
-                    src_color += channel;
-
-                    float alpha_f = range_table_f[diff];
-
-                    *down_pass_factor++ = inv_alpha_f + alpha_f * (*prev_factor++);
+                    up_factor[k] = 1.f;
+                    for (int c = 0; c < channel; c++) up_color[k * channel + c] = m_hor_pass_color[i * channel + c];
+                }
+                else
+                {
+                    float alpha_f = range_table_f[getDiffFactor(pix, below + k * channel)];
 
+                    up_factor[k] = inv_alpha_f + alpha_f * up_factor[k];
                     for (int c = 0; c < channel; c++)
                     {
-                        *down_pass_color++ = inv_alpha_f * (*src_color_hor++) + alpha_f * (*prev_color++);
+                        up_color[k * channel + c] = inv_alpha_f * m_hor_pass_color[i * channel + c]
+                                                  + alpha_f * up_color[k * channel + c];
                     }
                 }
-            }
-        }
-        else
-        ///////////////
-        // Up pass
-        {
-            // start from end and then go up to begining
-            int last_index = width * height * channel - 1;
-            const uint16_t* src_color = img_src + last_index;
-            const float* src_color_hor = m_left_pass_color + last_index; // result of horizontal pass filter
-            float* up_pass_color = m_up_pass_color + last_index;
-            float* up_pass_factor = m_up_pass_factor + (width * height - 1);
-
-            //	const uint16_t* src_prev = src_color;
-            const float* prev_color = up_pass_color;
-            const float* prev_factor = up_pass_factor;
-
-            // 1st line done separately because no previous line
-            for (int x = 0; x < width; x++)
-            {
-                *up_pass_factor-- = 1.f;
+
+                // average color divided by average factor
+                float factor = 1.f / (m_pass_factor[i] + up_factor[k]);
+                float result[4];
                 for (int c = 0; c < channel; c++)
                 {
-                    *up_pass_color-- = *src_color_hor--;
+                    result[c] = factor * (m_down_pass_color[i * channel + c] + up_color[k * channel + c]);
+                    below[k * channel + c] = pix[c];
                 }
-                src_color -= channel;
-            }
 
-            // handle other lines
-            for (int y = 1; y < height; y++)
-            {
-                for (int x = 0; x < width-1; x++)
+                uint16_t* out = img_dst + i * channel;
+                if (blend)
                 {
-                    // determine difference in pixel color between current and previous
-                    // calculation is different depending on number of channels
-                    src_color -= channel;
-                    int diff = getDiffFactor(src_color, src_color + width * channel);
-
-                    float alpha_f = range_table_f[diff];
-
-                    *up_pass_factor-- = inv_alpha_f + alpha_f * (*prev_factor--);
-
-                    for (int c = 0; c < channel; c++)
+                    float diff[3] = { result[0] - pix[0], result[1] - pix[1], result[2] - pix[2] };
+                    for (int c = 0; c < 3; c++)
                     {
-                        *up_pass_color-- = inv_alpha_f * (*src_color_hor--) + alpha_f * (*prev_color--);
+                        float value = pix[c] + blend[c * 3 + 0] * diff[0] + blend[c * 3 + 1] * diff[1] + blend[c * 3 + 2] * diff[2];
+                        out[c] = (uint16_t)max(0.f, min(value, (float)QX_DEF_U16_MAX));
                     }
                 }
-            }
-        }
-    }
-
-    ///////////////
-    // average result of vertical pass is written to output buffer
-    {
-        const float* down_pass_color = m_down_pass_color;
-        const float* down_pass_factor = m_down_pass_factor;
-        const float* up_pass_color = m_up_pass_color;
-        const float* up_pass_factor = m_up_pass_factor;
-
-        int width_height = width * height;
-#pragma omp parallel for
-        for (int i = 0; i < width_height; i++)
-        {
-            // average color divided by average factor
-            float factor = 1.f / ((up_pass_factor[i]) + (down_pass_factor[i]));
-            for (int c = 0; c < channel; c++)
-            {
-                int idx = i + i + i + c;
-                img_dst[idx] = (uint16_t)(factor * ((up_pass_color[idx]) + (down_pass_color[idx])));
+                else
+                {
+                    for (int c = 0; c < channel; c++) out[c] = (uint16_t)result[c];
+                }
             }
         }
     }
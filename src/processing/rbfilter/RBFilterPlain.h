@@ -39,17 +39,16 @@ class CRBFilterPlain
 	int			m_reserve_height = 0;
 	int			m_reserve_channels = 0;
 
-	float*		m_left_pass_color = nullptr;
-	float*		m_left_pass_factor = nullptr;
-
-	float*		m_right_pass_color = nullptr;
-	float*		m_right_pass_factor = nullptr;
-
+	// result of horizontal pass, then source of vertical pass
+	float*		m_hor_pass_color = nullptr;
+	// factors of left pass, then of down pass
+	float*		m_pass_factor = nullptr;
 	float*		m_down_pass_color = nullptr;
-	float*		m_down_pass_factor = nullptr;
 
-	float*		m_up_pass_color = nullptr;
-	float*		m_up_pass_factor = nullptr;
+	// range table is kept for the last sigmas
+	float*		m_range_table = nullptr;
+	float		m_range_sigma_spatial = 0.f;
+	float		m_range_sigma_range = 0.f;
 
     int getDiffFactor(const uint16_t* color1, const uint16_t* color2) const;
 
@@ -59,13 +58,17 @@ public:
 	~CRBFilterPlain();
 
 	// assumes 3/4 channel images, 1 byte per channel
+	// memory is kept if it is big enough already
 	void reserveMemory(int max_width, int max_height, int channels);
 	void releaseMemory();
 
 	// memory must be reserved before calling image filter
-	// this implementation of filter uses plain C++, single threaded
+	// rows and column blocks are filtered on all threads
 	// channel count must be 3 or 4 (alpha not used)
+	// blend (3x3, 3 channels only) mixes result and source: dst = src + blend * (filtered - src)
+	// img_src and img_dst may be the same image
     void filter(uint16_t* img_src, uint16_t* img_dst,
 		float sigma_spatial, float sigma_range,
-		int width, int height, int channel);
+		int width, int height, int channel,
+		const float* blend = nullptr);
 };
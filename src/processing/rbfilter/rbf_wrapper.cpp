@@ -7,15 +7,33 @@
 
 #include "rbf.h"
 #include "RBFilterPlain.h"
+#include "rbf_wrapper.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void recursive_bf_wrap(uint16_t * img_in,
+struct rbf_context_s
+{
+    CRBFilterPlain rbf;
+};
+
+rbf_context_t * init_rbf_context( void )
+{
+    return new rbf_context_t;
+}
+
+void free_rbf_context( rbf_context_t * rbf )
+{
+    delete rbf;
+}
+
+void recursive_bf_wrap(rbf_context_t * rbf,
+        uint16_t * img_in,
         uint16_t * img_out,
         float sigma_spatial, float sigma_range,
-        int width, int height, int channel)
+        int width, int height, int channel,
+        const float * blend)
 {
     if( 0 )
     {
@@ -30,10 +48,10 @@ void recursive_bf_wrap(uint16_t * img_in,
     else
     {
         //Ming version with better right boarder
-        CRBFilterPlain rbf;
-        rbf.reserveMemory( width, height, channel );
-        rbf.filter( img_in, img_out, sigma_spatial, sigma_range, width, height, channel );
-        rbf.releaseMemory();
+        rbf_context_t temp;
+        if( !rbf ) rbf = &temp;
+        rbf->rbf.reserveMemory( width, height, channel );
+        rbf->rbf.filter( img_in, img_out, sigma_spatial, sigma_range, width, height, channel, blend );
     }
 }
 
@@ -14,11 +14,21 @@ extern "C" {
 
 #include <stdint.h>
 
+/* Keeps filter memory from frame to frame */
+typedef struct rbf_context_s rbf_context_t;
+
+extern rbf_context_t * init_rbf_context( void );
+extern void free_rbf_context( rbf_context_t * rbf );
+
+/* blend: NULL, or 3x3 matrix for img_out = img_in + blend * (filtered - img_in).
+ * img_in and img_out may be the same image. rbf may be NULL (memory for one call only). */
 extern void recursive_bf_wrap(
+        rbf_context_t * rbf,
         uint16_t * img_in,
         uint16_t * img_out,
         float sigma_spatial, float sigma_range,
-        int width, int height, int channel);
+        int width, int height, int channel,
+        const float * blend);
 
 #ifdef __cplusplus
 }
@@ -153,3 +153,45 @@ int sobelFilter(uint16_t *rgb, uint16_t **gray, uint16_t **sobel_h_res, uint16_t
     return gray_size;
 }
 
+/*
+ * Gray representation of one row, same as rgbToGray
+ */
+
+void rgbToGrayRow(const uint16_t *rgb, uint16_t *gray, int width) {
+    for(int i=0; i<width; i++) {
+        gray[i] = 0.30*rgb[i*3+0] + 0.59*rgb[i*3+1] + 0.11*rgb[i*3+2];
+    }
+}
+
+/*
+ * Contour of one row from the gray rows around it, same result as sobelFilter
+ * (kernels flipped by the convolution, negative responses cut to 0).
+ * gray_prev/gray_next are NULL at the image borders (zero padding).
+ */
+
+void contourRow(const uint16_t *gray_prev, const uint16_t *gray, const uint16_t *gray_next, int width, uint16_t *contour_row) {
+    for(int i=0; i<width; i++) {
+        int l = i > 0;
+        int r = i < width-1;
+
+        int tl = gray_prev && l ? gray_prev[i-1] : 0;
+        int tm = gray_prev      ? gray_prev[i]   : 0;
+        int tr = gray_prev && r ? gray_prev[i+1] : 0;
+        int ml = l              ? gray[i-1]      : 0;
+        int mr = r              ? gray[i+1]      : 0;
+        int bl = gray_next && l ? gray_next[i-1] : 0;
+        int bm = gray_next      ? gray_next[i]   : 0;
+        int br = gray_next && r ? gray_next[i+1] : 0;
+
+        int h = (tl + 2*ml + bl) - (tr + 2*mr + br);
+        int v = (bl + 2*bm + br) - (tl + 2*tm + tr);
+        if( h < 0 ) h = 0;
+        if( h > 65535 ) h = 65535;
+        if( v < 0 ) v = 0;
+        if( v > 65535 ) v = 65535;
+
+        int res = sqrt((double)h*h + (double)v*v);
+        if( res > 65535 ) res = 65535;
+        contour_row[i] = (uint16_t) res;
+    }
+}
@@ -28,5 +28,9 @@ void itConv      (uint16_t *buffer, int buffer_size, int width, int *op, uint16_
 void contour     (uint16_t *sobel_h, uint16_t *sobel_v, int gray_size, uint16_t **contour_img);
 int  sobelFilter (uint16_t *rgb, uint16_t **gray, uint16_t **sobel_h_res, uint16_t **sobel_v_res, uint16_t **contour_img, int width, int height);
 
+/* Same filter for one row at a time, no image sized buffers */
+void rgbToGrayRow(const uint16_t *rgb, uint16_t *gray, int width);
+void contourRow  (const uint16_t *gray_prev, const uint16_t *gray, const uint16_t *gray_next, int width, uint16_t *contour_row);
+
 #endif
 